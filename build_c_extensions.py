@@ -16,9 +16,30 @@ extensions = [
         include_dirs=["csrc"],
         sources=["csrc/symbol.cpp", "csrc/stack/stack.cpp"],
     ),
+    Extension(
+        name="flight_profiler.ext.perf_C",
+        include_dirs=["csrc"],
+        sources=["csrc/symbol.cpp", "csrc/perf/perf.cpp"],
+    ),
+    Extension(
+        name="flight_profiler.ext.symbol_table_C",
+        include_dirs=["csrc"],
+        sources=["csrc/elf_symbol.cpp", "csrc/symbol/symbol_table.cpp"],
+    ),
     Extension(
         name="flight_profiler.ext.trace_profile_C",
-        sources=["csrc/trace/trace_profile.c"],
+        include_dirs=["csrc"],
+        sources=["csrc/clock_util.cpp", "csrc/trace/trace_profile.c"],
+    ),
+    Extension(
+        name="flight_profiler.ext.filter_C",
+        include_dirs=["csrc"],
+        sources=["csrc/filter/filter_expr.c", "csrc/filter/filter.c"],
+    ),
+    Extension(
+        name="flight_profiler.ext.aop_C",
+        include_dirs=["csrc"],
+        sources=["csrc/filter/filter_expr.c", "csrc/aop/aop.c"],
     ),
 ]
 
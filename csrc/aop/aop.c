@@ -0,0 +1,521 @@
+#include "filter/filter_expr.h"
+#include <Python.h>
+#include <frameobject.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#if PY_VERSION_HEX < 0x03090000
+#define PyObject_Vectorcall _PyObject_Vectorcall
+#define Py_TPFLAGS_HAVE_VECTORCALL _Py_TPFLAGS_HAVE_VECTORCALL
+#endif
+
+////////////////////////
+// Internal functions //
+////////////////////////
+
+// same clock as time.time() used by the python wrappers
+static double _realtime_s(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static PyCodeObject *_caller_code(void) {
+  // the current frame is the wrapped method running the trampoline
+  PyFrameObject *frame = PyEval_GetFrame();
+  if (frame == NULL) {
+    return NULL;
+  }
+#if PY_VERSION_HEX >= 0x03090000
+  PyFrameObject *back = PyFrame_GetBack(frame);
+  if (back == NULL) {
+    return NULL;
+  }
+  PyCodeObject *code = PyFrame_GetCode(back);
+  Py_DECREF(back);
+  return code;
+#else
+  if (frame->f_back == NULL) {
+    return NULL;
+  }
+  Py_INCREF(frame->f_back->f_code);
+  return frame->f_back->f_code;
+#endif
+}
+
+// build the args tuple and kwargs dict of a vectorcall
+static int _call_args(PyObject *const *args, Py_ssize_t nargs,
+                      PyObject *kwnames, PyObject **call_args,
+                      PyObject **kwargs) {
+  *call_args = PyTuple_New(nargs);
+  *kwargs = PyDict_New();
+  if (*call_args == NULL || *kwargs == NULL) {
+    goto error;
+  }
+  Py_ssize_t i;
+  for (i = 0; i < nargs; i++) {
+    Py_INCREF(args[i]);
+    PyTuple_SET_ITEM(*call_args, i, args[i]);
+  }
+  if (kwnames != NULL) {
+    for (i = 0; i < PyTuple_GET_SIZE(kwnames); i++) {
+      if (PyDict_SetItem(*kwargs, PyTuple_GET_ITEM(kwnames, i),
+                         args[nargs + i]) < 0) {
+        goto error;
+      }
+    }
+  }
+  return 0;
+error:
+  Py_CLEAR(*call_args);
+  Py_CLEAR(*kwargs);
+  return -1;
+}
+
+////////////////
+// AopWrapper //
+////////////////
+
+// enter/exit accounting, timing and filtering of a wrapped sync method, the
+// python callbacks only run for calls that pass the filter
+typedef struct {
+  PyObject_HEAD vectorcallfunc vectorcall; // called by tp_call
+  Py_ssize_t limit;          // calls to enter before the command finishes
+  Py_ssize_t count;          // entered calls
+  Py_ssize_t finished;       // entered calls returned
+  PyObject *filter;          // filter program, python callable or NULL
+  int native_filter;         // filter is a program for filter_expr_eval
+  int self_target;           // args[0] is the filter target of class methods
+  int keep_self;             // filter args still start with the target
+  int filter_before;         // filter before the call, return None and cost 0
+  PyObject *on_call;         // on_call(func, args, kwargs), makes the call
+  PyObject *on_return;       // on_return(start_ms, cost_ms, return_obj, ...)
+  PyObject *on_error;        // on_error(start_ms, cost_ms, exception, ...)
+                             // both end with args, kwargs, filter_failed
+  PyObject *on_finish;       // on_finish() once limit calls finished
+  PyCodeObject *last_caller; // caller code checked by the last call
+  int last_injected;         // whether last_caller is flight profiler code
+  Py_ssize_t sample_every;   // enter one in sample_every calls at random
+  Py_ssize_t rate;           // enter at most rate calls per second
+  long long rate_second;     // second rate_taken is counted in
+  Py_ssize_t rate_taken;     // calls entered in rate_second
+  uint64_t rng;              // xorshift state of sample_every
+  double cost_floor;         // calls not slower are not recorded until
+  double floor_until;        // floor_until, set by the slowest calls sampler
+} AopWrapper;
+
+// the callbacks are bound methods of the command holding the wrapper, the
+// cycle is only broken by the collector
+static int AopWrapper_Traverse(AopWrapper *self, visitproc visit, void *arg) {
+  Py_VISIT(self->filter);
+  Py_VISIT(self->on_call);
+  Py_VISIT(self->on_return);
+  Py_VISIT(self->on_error);
+  Py_VISIT(self->on_finish);
+  Py_VISIT(self->last_caller);
+  return 0;
+}
+
+static int AopWrapper_Clear(AopWrapper *self) {
+  Py_CLEAR(self->filter);
+  Py_CLEAR(self->on_call);
+  Py_CLEAR(self->on_return);
+  Py_CLEAR(self->on_error);
+  Py_CLEAR(self->on_finish);
+  Py_CLEAR(self->last_caller);
+  return 0;
+}
+
+static void AopWrapper_Dealloc(AopWrapper *self) {
+  PyObject_GC_UnTrack(self);
+  AopWrapper_Clear(self);
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *AopWrapper_Vectorcall(AopWrapper *self,
+                                       PyObject *const *args, size_t nargsf,
+                                       PyObject *kwnames);
+
+static PyObject *AopWrapper_New(PyTypeObject *type, PyObject *args,
+                                PyObject *kwds) {
+  static char *kwlist[] = {"limit",        "on_finish", "filter",
+                           "self_target",  "keep_self", "filter_before",
+                           "on_call",      "on_return", "on_error",
+                           "sample_every", "rate",      NULL};
+  Py_ssize_t limit;
+  PyObject *on_finish;
+  PyObject *filter = Py_None;
+  int self_target = 0;
+  int keep_self = 0;
+  int filter_before = 0;
+  PyObject *on_call = Py_None;
+  PyObject *on_return = Py_None;
+  PyObject *on_error = Py_None;
+  Py_ssize_t sample_every = 0;
+  Py_ssize_t rate = 0;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "nO|OpppOOOnn", kwlist, &limit,
+                                   &on_finish, &filter, &self_target,
+                                   &keep_self, &filter_before, &on_call,
+                                   &on_return, &on_error, &sample_every,
+                                   &rate)) {
+    return NULL;
+  }
+  if (filter_before && on_call == Py_None) {
+    PyErr_SetString(PyExc_ValueError, "filter_before requires on_call");
+    return NULL;
+  }
+  AopWrapper *self = PyObject_GC_New(AopWrapper, type);
+  if (self == NULL) {
+    return NULL;
+  }
+  // PyObject_GC_New leaves the fields after the header uninitialized
+  memset((char *)self + sizeof(PyObject), 0,
+         sizeof(AopWrapper) - sizeof(PyObject));
+  self->vectorcall = (vectorcallfunc)AopWrapper_Vectorcall;
+  self->limit = limit;
+  self->native_filter = PyTuple_Check(filter);
+  self->self_target = self_target;
+  self->keep_self = keep_self;
+  self->filter_before = filter_before;
+  self->sample_every = sample_every;
+  self->rate = rate;
+  self->rng = (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)self;
+  if (self->rng == 0) {
+    self->rng = 1;
+  }
+#define _KEEP(field, value)                                                    \
+  if ((value) != Py_None) {                                                    \
+    Py_INCREF(value);                                                          \
+    self->field = (value);                                                     \
+  }
+  _KEEP(filter, filter);
+  _KEEP(on_call, on_call);
+  _KEEP(on_return, on_return);
+  _KEEP(on_error, on_error);
+  _KEEP(on_finish, on_finish);
+#undef _KEEP
+  PyObject_GC_Track(self);
+  return (PyObject *)self;
+}
+
+// calls from flight profiler itself are not recorded, like
+// EnterExitCommand.enter
+static int AopWrapper_SelfInjected(AopWrapper *self) {
+  PyCodeObject *code = _caller_code();
+  if (code == NULL) {
+    return 1;
+  }
+  if (code != self->last_caller) {
+    const char *filename = PyUnicode_AsUTF8(code->co_filename);
+    if (filename == NULL) {
+      PyErr_Clear();
+      Py_DECREF(code);
+      return 1;
+    }
+    Py_XSETREF(self->last_caller, code);
+    self->last_injected = strstr(filename, "flight_profiler") != NULL &&
+                          strstr(filename, "test") == NULL;
+  } else {
+    Py_DECREF(code);
+  }
+  return self->last_injected;
+}
+
+// sampling is decided before counting, skipped calls do not reach the limit
+static int AopWrapper_Sampled(AopWrapper *self) {
+  if (self->sample_every > 1) {
+    self->rng ^= self->rng << 13;
+    self->rng ^= self->rng >> 7;
+    self->rng ^= self->rng << 17;
+    if (self->rng % (uint64_t)self->sample_every != 0) {
+      return 0;
+    }
+  }
+  if (self->rate > 0) {
+    long long second = (long long)_realtime_s();
+    if (second != self->rate_second) {
+      self->rate_second = second;
+      self->rate_taken = 0;
+    }
+    if (self->rate_taken >= self->rate) {
+      return 0;
+    }
+    self->rate_taken++;
+  }
+  return 1;
+}
+
+// return 1 when the call passes the filter and -1 when the filter raised,
+// such calls pass as well so that the python callbacks report the error
+static int AopWrapper_Filter(AopWrapper *self, PyObject *call_args,
+                             PyObject *kwargs, PyObject *return_obj,
+                             PyObject *cost) {
+  if (self->filter == NULL) {
+    return 1;
+  }
+  PyObject *target = Py_None;
+  PyObject *filter_args = call_args;
+  Py_ssize_t size = PyTuple_GET_SIZE(call_args);
+  if (self->self_target && size > 0) {
+    target = PyTuple_GET_ITEM(call_args, 0);
+  }
+  if (self->self_target && size > 0 && !self->keep_self) {
+    filter_args = PyTuple_GetSlice(call_args, 1, size);
+  } else {
+    Py_INCREF(filter_args);
+  }
+  if (filter_args == NULL) {
+    PyErr_Clear();
+    return -1;
+  }
+  int result;
+  if (self->native_filter) {
+    PyObject *roots[FILTER_ROOT_COUNT] = {target, return_obj, cost,
+                                          filter_args, kwargs};
+    result = filter_expr_eval(self->filter, roots);
+  } else {
+    // filter(target, return_obj, cost, *args, **kwargs)
+    PyObject *head = PyTuple_Pack(3, target, return_obj, cost);
+    PyObject *all_args = head == NULL ? NULL : PySequence_Concat(head,
+                                                                 filter_args);
+    PyObject *ok = all_args == NULL
+                       ? NULL
+                       : PyObject_Call(self->filter, all_args, kwargs);
+    result = ok == NULL ? -1 : PyObject_IsTrue(ok);
+    Py_XDECREF(head);
+    Py_XDECREF(all_args);
+    Py_XDECREF(ok);
+  }
+  Py_DECREF(filter_args);
+  if (result < 0) {
+    PyErr_Clear();
+    return -1;
+  }
+  return result;
+}
+
+// pass is the result of AopWrapper_Filter, the filter is only evaluated
+// again by callbacks told that it raised
+static void AopWrapper_Callback(PyObject *callback, double start,
+                                double cost_ms, PyObject *value,
+                                PyObject *call_args, PyObject *kwargs,
+                                int pass) {
+  PyObject *result = PyObject_CallFunction(
+      callback, "LdOOOO", (long long)(start * 1000), cost_ms, value, call_args,
+      kwargs, pass < 0 ? Py_True : Py_False);
+  if (result == NULL) {
+    // callbacks log their own errors, never fail the wrapped method
+    PyErr_Clear();
+  }
+  Py_XDECREF(result);
+}
+
+static PyObject *AopWrapper_FilterBefore(AopWrapper *self, PyObject *func,
+                                         PyObject *const *args,
+                                         Py_ssize_t nargs, PyObject *kwnames,
+                                         PyObject *call_args,
+                                         PyObject *kwargs) {
+  PyObject *cost = PyLong_FromLong(0);
+  if (cost == NULL) {
+    return NULL;
+  }
+  int pass = AopWrapper_Filter(self, call_args, kwargs, Py_None, cost);
+  Py_DECREF(cost);
+  if (!pass) {
+    return PyObject_Vectorcall(func, args, nargs, kwnames);
+  }
+  return PyObject_CallFunctionObjArgs(self->on_call, func, call_args, kwargs,
+                                      NULL);
+}
+
+static PyObject *AopWrapper_Record(AopWrapper *self, PyObject *func,
+                                   PyObject *const *args, Py_ssize_t nargs,
+                                   PyObject *kwnames) {
+  PyObject *call_args;
+  PyObject *kwargs;
+  if (_call_args(args, nargs, kwnames, &call_args, &kwargs) < 0) {
+    return NULL;
+  }
+  if (self->filter_before) {
+    PyObject *result = AopWrapper_FilterBefore(self, func, args, nargs,
+                                               kwnames, call_args, kwargs);
+    Py_DECREF(call_args);
+    Py_DECREF(kwargs);
+    return result;
+  }
+
+  double start = _realtime_s();
+  PyObject *result = PyObject_Vectorcall(func, args, nargs, kwnames);
+  double cost_ms = (_realtime_s() - start) * 1000;
+  PyObject *cost = PyFloat_FromDouble(cost_ms);
+  if (cost == NULL) {
+    Py_XDECREF(result);
+    result = NULL;
+  } else if (cost_ms <= self->cost_floor && start < self->floor_until) {
+    // faster than the slowest calls kept by the sampler
+  } else if (result != NULL) {
+    int pass = self->on_return != NULL
+                   ? AopWrapper_Filter(self, call_args, kwargs, result, cost)
+                   : 0;
+    if (pass) {
+      AopWrapper_Callback(self->on_return, start, cost_ms, result, call_args,
+                          kwargs, pass);
+    }
+  } else if (self->on_error != NULL &&
+             PyErr_ExceptionMatches(PyExc_Exception)) {
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    PyErr_NormalizeException(&type, &value, &traceback);
+    if (traceback != NULL) {
+      PyException_SetTraceback(value, traceback);
+    }
+    int pass = AopWrapper_Filter(self, call_args, kwargs, Py_None, cost);
+    if (pass) {
+      AopWrapper_Callback(self->on_error, start, cost_ms, value, call_args,
+                          kwargs, pass);
+    }
+    PyErr_Restore(type, value, traceback);
+  }
+  Py_XDECREF(cost);
+  Py_DECREF(call_args);
+  Py_DECREF(kwargs);
+  return result;
+}
+
+static void AopWrapper_Finish(AopWrapper *self) {
+  if (self->on_finish == NULL) {
+    return;
+  }
+  PyObject *on_finish = self->on_finish;
+  self->on_finish = NULL;
+  // keep the exception raised by the wrapped method
+  PyObject *type, *value, *traceback;
+  PyErr_Fetch(&type, &value, &traceback);
+  PyObject *result = PyObject_CallObject(on_finish, NULL);
+  if (result == NULL) {
+    PyErr_WriteUnraisable(on_finish);
+  }
+  Py_XDECREF(result);
+  Py_DECREF(on_finish);
+  PyErr_Restore(type, value, traceback);
+}
+
+// called as wrapper(func, *args, **kwargs) by the trampoline of the method
+static PyObject *AopWrapper_Vectorcall(AopWrapper *self,
+                                       PyObject *const *args, size_t nargsf,
+                                       PyObject *kwnames) {
+  Py_ssize_t nargs = PyVectorcall_NARGS(nargsf);
+  if (nargs < 1) {
+    PyErr_SetString(PyExc_TypeError, "AopWrapper expects the wrapped func");
+    return NULL;
+  }
+  PyObject *func = args[0];
+  if (self->count >= self->limit || AopWrapper_SelfInjected(self) ||
+      !AopWrapper_Sampled(self)) {
+    return PyObject_Vectorcall(func, args + 1, nargs - 1, kwnames);
+  }
+  self->count++;
+  PyObject *result = AopWrapper_Record(self, func, args + 1, nargs - 1,
+                                       kwnames);
+  self->finished++;
+  if (self->finished >= self->limit) {
+    AopWrapper_Finish(self);
+  }
+  return result;
+}
+
+static PyObject *AopWrapper_GetCount(AopWrapper *self, void *closure) {
+  return PyLong_FromSsize_t(self->count);
+}
+
+static PyObject *AopWrapper_GetFinished(AopWrapper *self, void *closure) {
+  return PyLong_FromSsize_t(self->finished);
+}
+
+static PyObject *AopWrapper_SetCostFloor(AopWrapper *self, PyObject *args) {
+  if (!PyArg_ParseTuple(args, "dd", &self->cost_floor, &self->floor_until)) {
+    return NULL;
+  }
+  Py_RETURN_NONE;
+}
+
+static PyMethodDef AopWrapper_methods[] = {
+    {"set_cost_floor", (PyCFunction)AopWrapper_SetCostFloor, METH_VARARGS,
+     "skip calls not slower than cost_ms until the until_s timestamp"},
+    {NULL} /* Sentinel */
+};
+
+static PyGetSetDef AopWrapper_getset[] = {
+    {"count", (getter)AopWrapper_GetCount, NULL, "entered calls", NULL},
+    {"finished", (getter)AopWrapper_GetFinished, NULL, "returned calls",
+     NULL},
+    {NULL} /* Sentinel */
+};
+
+static PyTypeObject AopWrapper_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0) "pyflight.ext.AopWrapper", /* tp_name */
+    sizeof(AopWrapper),                           /* tp_basicsize */
+    0,                                            /* tp_itemsize */
+    (destructor)AopWrapper_Dealloc,               /* tp_dealloc */
+    offsetof(AopWrapper, vectorcall),             /* tp_vectorcall_offset */
+    0,                                            /* tp_getattr */
+    0,                                            /* tp_setattr */
+    0,                                            /* tp_reserved */
+    0,                                            /* tp_repr */
+    0,                                            /* tp_as_number */
+    0,                                            /* tp_as_sequence */
+    0,                                            /* tp_as_mapping */
+    0,                                            /* tp_hash */
+    PyVectorcall_Call,                            /* tp_call */
+    0,                                            /* tp_str */
+    0,                                            /* tp_getattro */
+    0,                                            /* tp_setattro */
+    0,                                            /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_VECTORCALL |
+        Py_TPFLAGS_HAVE_GC,                       /* tp_flags */
+    "native enter/exit wrapper of a watched method", /* tp_doc */
+    (traverseproc)AopWrapper_Traverse,            /* tp_traverse */
+    (inquiry)AopWrapper_Clear,                    /* tp_clear */
+    0,                                            /* tp_richcompare */
+    0,                                            /* tp_weaklistoffset */
+    0,                                            /* tp_iter */
+    0,                                            /* tp_iternext */
+    AopWrapper_methods,                           /* tp_methods */
+    0,                                            /* tp_members */
+    AopWrapper_getset,                            /* tp_getset */
+    0,                                            /* tp_base */
+    0,                                            /* tp_dict */
+    0,                                            /* tp_descr_get */
+    0,                                            /* tp_descr_set */
+    0,                                            /* tp_dictoffset */
+    0,                                            /* tp_init */
+    PyType_GenericAlloc,                          /* tp_alloc */
+    AopWrapper_New,                               /* tp_new */
+    PyObject_GC_Del,                              /* tp_free */
+};
+
+///////////////////////////
+// Module initialization //
+///////////////////////////
+
+PyMODINIT_FUNC PyInit_aop_C(void) {
+  static struct PyModuleDef moduledef = {
+      PyModuleDef_HEAD_INIT, "aop_C", "PyFlight aop wrapper supports.", -1,
+      NULL};
+  if (PyType_Ready(&AopWrapper_Type) < 0) {
+    return NULL;
+  }
+  PyObject *m = PyModule_Create(&moduledef);
+  if (m == NULL) {
+    return NULL;
+  }
+  Py_INCREF(&AopWrapper_Type);
+  if (PyModule_AddObject(m, "AopWrapper", (PyObject *)&AopWrapper_Type) < 0) {
+    Py_DECREF(&AopWrapper_Type);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
+}
@@ -0,0 +1,273 @@
+/**
+ * Microbenchmark for the per call cost of PyGilStat take_gil/drop_gil hooks.
+ *
+ * Every worker thread replays take_gil enter/leave and drop_gil enter/leave
+ * back to back, the reported value is the average cost of one hook call:
+ *   baseline : empty hook, cost of the benchmark loop itself
+ *   mutex    : former implementation, global mutex + unordered_map lookup
+ *   slots    : PyGilStat, thread local slot + seqlock
+ *   storm    : PyGilStat with zero thresholds, every drop_gil emits warnings
+ *              into the ring, which stays full since it is never reported
+ *   timeline : PyGilStat recording every gil cycle into the thread timeline
+ *
+ * usage: py_gil_stat_bench [threads] [iterations per thread] [clock]
+ */
+#include "Python.h"
+#include "py_gil_stat.h"
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unordered_map>
+
+typedef struct _legacy_gil_statistics {
+  struct timespec last_gil_take_start_time;
+  struct timespec last_gil_take_success_time;
+  struct timespec last_gil_drop_start_time;
+  unsigned long gil_take_total_cost;
+  unsigned long gil_take_count;
+  unsigned long gil_drop_total_cost;
+  unsigned long gil_drop_count;
+  unsigned long gil_hold_total;
+} legacy_gil_statistics;
+
+/**
+ * hook bodies of the mutex based implementation, warnings excluded
+ */
+class LegacyGilStat {
+public:
+  LegacyGilStat() { pthread_mutex_init(&stat_map_mutex, NULL); }
+
+  void on_take_gil_enter(pthread_t p) {
+    pthread_mutex_lock(&stat_map_mutex);
+    auto it = stat_map.find(p);
+    legacy_gil_statistics *gil_stat;
+    if (it != stat_map.end()) {
+      gil_stat = it->second;
+    } else {
+      gil_stat = (legacy_gil_statistics *)calloc(
+          1, sizeof(legacy_gil_statistics));
+      stat_map[p] = gil_stat;
+    }
+    timespec_get(&gil_stat->last_gil_take_start_time, TIME_UTC);
+    pthread_mutex_unlock(&stat_map_mutex);
+  }
+
+  void on_take_gil_leave(pthread_t p) {
+    pthread_mutex_lock(&stat_map_mutex);
+    auto it = stat_map.find(p);
+    if (it != stat_map.end()) {
+      legacy_gil_statistics *gil_stat = it->second;
+      timespec_get(&gil_stat->last_gil_take_success_time, TIME_UTC);
+      gil_stat->gil_take_count++;
+      gil_stat->gil_take_total_cost +=
+          diff_ns(&gil_stat->last_gil_take_start_time,
+                  &gil_stat->last_gil_take_success_time);
+    }
+    pthread_mutex_unlock(&stat_map_mutex);
+  }
+
+  void on_drop_gil_enter(pthread_t p) {
+    pthread_mutex_lock(&stat_map_mutex);
+    auto it = stat_map.find(p);
+    if (it != stat_map.end()) {
+      timespec_get(&it->second->last_gil_drop_start_time, TIME_UTC);
+    }
+    pthread_mutex_unlock(&stat_map_mutex);
+  }
+
+  void on_drop_gil_leave(pthread_t p) {
+    pthread_mutex_lock(&stat_map_mutex);
+    auto it = stat_map.find(p);
+    if (it != stat_map.end()) {
+      legacy_gil_statistics *gil_stat = it->second;
+      struct timespec now;
+      timespec_get(&now, TIME_UTC);
+      gil_stat->gil_drop_count++;
+      gil_stat->gil_drop_total_cost +=
+          diff_ns(&gil_stat->last_gil_drop_start_time, &now);
+      gil_stat->gil_hold_total +=
+          diff_ns(&gil_stat->last_gil_take_success_time, &now);
+    }
+    pthread_mutex_unlock(&stat_map_mutex);
+  }
+
+private:
+  static unsigned long diff_ns(struct timespec *start, struct timespec *end) {
+    return (end->tv_sec - start->tv_sec) * 1000000000ul + end->tv_nsec -
+           start->tv_nsec;
+  }
+
+  std::unordered_map<pthread_t, legacy_gil_statistics *> stat_map;
+  pthread_mutex_t stat_map_mutex;
+};
+
+enum BenchMode {
+  BENCH_BASELINE,
+  BENCH_MUTEX,
+  BENCH_SLOTS,
+  BENCH_STORM,
+  BENCH_TIMELINE
+};
+
+struct bench_args {
+  BenchMode mode;
+  long iterations;
+  LegacyGilStat *legacy;
+  PyGilStat *stat;
+  pthread_barrier_t *barrier;
+  unsigned long elapsed_ns;
+};
+
+static volatile unsigned long baseline_sink = 0;
+
+__attribute__((noinline)) static void baseline_hook(pthread_t p) {
+  baseline_sink = baseline_sink + 1;
+}
+
+static unsigned long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ul + ts.tv_nsec;
+}
+
+static void *bench_worker(void *raw) {
+  struct bench_args *args = (struct bench_args *)raw;
+  pthread_t p = pthread_self();
+  pthread_barrier_wait(args->barrier);
+  unsigned long start = now_ns();
+  for (long i = 0; i < args->iterations; i++) {
+    switch (args->mode) {
+    case BENCH_BASELINE:
+      baseline_hook(p);
+      baseline_hook(p);
+      baseline_hook(p);
+      baseline_hook(p);
+      break;
+    case BENCH_MUTEX:
+      args->legacy->on_take_gil_enter(p);
+      args->legacy->on_take_gil_leave(p);
+      args->legacy->on_drop_gil_enter(p);
+      args->legacy->on_drop_gil_leave(p);
+      break;
+    case BENCH_SLOTS:
+    case BENCH_STORM:
+    case BENCH_TIMELINE:
+      args->stat->on_take_gil_enter(p, 0);
+      args->stat->on_take_gil_leave(p);
+      args->stat->on_drop_gil_enter(p, NULL);
+      args->stat->on_drop_gil_leave(p);
+      break;
+    }
+  }
+  args->elapsed_ns = now_ns() - start;
+  return NULL;
+}
+
+static double run_bench(BenchMode mode, int nthreads, long iterations,
+                        LegacyGilStat *legacy, PyGilStat *stat) {
+  pthread_t threads[nthreads];
+  struct bench_args args[nthreads];
+  pthread_barrier_t barrier;
+  pthread_barrier_init(&barrier, NULL, nthreads);
+  for (int i = 0; i < nthreads; i++) {
+    args[i].mode = mode;
+    args[i].iterations = iterations;
+    args[i].legacy = legacy;
+    args[i].stat = stat;
+    args[i].barrier = &barrier;
+    args[i].elapsed_ns = 0;
+    pthread_create(&threads[i], NULL, bench_worker, &args[i]);
+  }
+  unsigned long total_ns = 0;
+  for (int i = 0; i < nthreads; i++) {
+    pthread_join(threads[i], NULL);
+    total_ns += args[i].elapsed_ns;
+  }
+  pthread_barrier_destroy(&barrier);
+  // average cost of one hook call
+  return (double)total_ns / ((double)nthreads * iterations * 4);
+}
+
+int main(int argc, char **argv) {
+  int nthreads = argc > 1 ? atoi(argv[1]) : 8;
+  long iterations = argc > 2 ? atol(argv[2]) : 200000;
+  if (nthreads <= 0 || iterations <= 0) {
+    fprintf(stderr, "usage: %s [threads] [iterations] [clock]\n", argv[0]);
+    return 1;
+  }
+
+  Py_Initialize();
+  PyRun_SimpleString("class BenchQueue:\n"
+                     "    def output_msgstr_nowait(self, is_end, msg):\n"
+                     "        pass\n"
+                     "bench_queue = BenchQueue()\n");
+  PyObject *main_module = PyImport_AddModule("__main__");
+  PyObject *queue = PyObject_GetAttrString(main_module, "bench_queue");
+
+  gil_monitor_config config;
+  // thresholds and interval high enough that no report is produced
+  config.gil_take_warning_threshold = 100000;
+  config.gil_hold_warning_threshold = 100000;
+  config.stat_interval_ms = 3600000;
+  config.gil_stat_max_threads = nthreads + 1;
+  config.clock = clock_source_init(argc > 3 ? argv[3] : NULL);
+  config.stream_path = NULL;
+  config.timeline_events = 0;
+  config.hold_frames = 0;
+
+  gil_monitor_config storm_config = config;
+  storm_config.gil_take_warning_threshold = 0;
+  storm_config.gil_hold_warning_threshold = 0;
+
+  gil_monitor_config timeline_config = config;
+  timeline_config.timeline_events = 1 << 16;
+
+  PyGilStat *stat = new PyGilStat();
+  PyGilStat *storm_stat = new PyGilStat();
+  PyGilStat *timeline_stat = new PyGilStat();
+  if (stat->start(&config) != 0 || storm_stat->start(&storm_config) != 0 ||
+      timeline_stat->start(&timeline_config) != 0) {
+    fprintf(stderr, "start gil stat failed\n");
+    return 1;
+  }
+  stat->set_out_queue(queue);
+  storm_stat->set_out_queue(queue);
+  timeline_stat->set_out_queue(queue);
+  Py_DECREF(queue);
+  // let gil stat thread run while benchmarking
+  PyThreadState *main_tstate = PyEval_SaveThread();
+
+  LegacyGilStat legacy;
+  double baseline = run_bench(BENCH_BASELINE, nthreads, iterations, NULL, NULL);
+  double mutex = run_bench(BENCH_MUTEX, nthreads, iterations, &legacy, NULL);
+  double slots = run_bench(BENCH_SLOTS, nthreads, iterations, NULL, stat);
+  double storm =
+      run_bench(BENCH_STORM, nthreads, iterations, NULL, storm_stat);
+  double timeline =
+      run_bench(BENCH_TIMELINE, nthreads, iterations, NULL, timeline_stat);
+
+  fprintf(stdout, "threads: %d, iterations per thread: %ld, clock: %s\n",
+          nthreads, iterations, clock_source_name(config.clock));
+  fprintf(stdout, "%-12s%-18s%-18s\n", "mode", "ns/hook", "overhead(ns)");
+  fprintf(stdout, "%-12s%-18.1f%-18.1f\n", "baseline", baseline, 0.0);
+  fprintf(stdout, "%-12s%-18.1f%-18.1f\n", "mutex", mutex, mutex - baseline);
+  fprintf(stdout, "%-12s%-18.1f%-18.1f\n", "slots", slots, slots - baseline);
+  fprintf(stdout, "%-12s%-18.1f%-18.1f\n", "storm", storm, storm - baseline);
+  fprintf(stdout, "%-12s%-18.1f%-18.1f\n", "timeline", timeline,
+          timeline - baseline);
+
+  PyEval_RestoreThread(main_tstate);
+  if (stat->stop() == 0) {
+    delete stat;
+  }
+  if (storm_stat->stop() == 0) {
+    delete storm_stat;
+  }
+  if (timeline_stat->stop() == 0) {
+    delete timeline_stat;
+  }
+  Py_Finalize();
+  return 0;
+}
@@ -0,0 +1,105 @@
+"""
+Benchmark of the trace profiler backends on a call heavy workload.
+
+Every round runs the workload untraced, traced by setprofile and traced by
+sys.monitoring (CPython 3.12+), the reported value is the best wall time of
+the rounds and the overhead against the untraced run:
+  baseline   : no tracing
+  setprofile : set_trace_profile, every Python and C call of the thread
+  monitoring : set_trace_monitoring, PEP 669 callbacks for every call, those
+               returning below the interval are dropped in the callback
+
+usage: python3 trace_backend_bench.py [calls] [rounds] [interval_ms] [depth]
+"""
+import sys
+import time
+
+from flight_profiler.ext.trace_profile_C import (
+    TraceSession,
+    init_clock_source,
+    init_trace_monitoring,
+    release_trace_monitoring,
+    remove_trace_profile,
+    set_trace_monitoring,
+    set_trace_profile,
+)
+
+
+def leaf(n):
+    return n * 2
+
+
+def branch(n):
+    total = 0
+    for i in range(n):
+        total += leaf(i)
+    return len(str(total))
+
+
+def workload(calls):
+    # branch, 7 leaf and 2 builtin calls
+    for i in range(calls // 10):
+        branch(7)
+
+
+def discard(out_q, records, session, base=0, late=b"", final=True):
+    session.take_descriptions()
+
+
+def timed(calls, set_function, interval_ns, depth, clock):
+    start = time.perf_counter()
+    if set_function is None:
+        workload(calls)
+    else:
+        profiler = set_function(
+            discard, None, interval_ns, False, depth, clock, TraceSession(), 65536
+        )
+        try:
+            workload(calls)
+        finally:
+            remove_trace_profile(profiler)
+    return time.perf_counter() - start
+
+
+def main():
+    calls = int(sys.argv[1]) if len(sys.argv) > 1 else 200000
+    rounds = int(sys.argv[2]) if len(sys.argv) > 2 else 5
+    interval_ns = int(float(sys.argv[3]) * 1000000) if len(sys.argv) > 3 else 100000
+    depth = int(sys.argv[4]) if len(sys.argv) > 4 else -1
+    clock = init_clock_source("auto")
+
+    monitoring = init_trace_monitoring()
+    backends = [("baseline", None), ("setprofile", set_trace_profile)]
+    if monitoring:
+        backends.append(("monitoring", set_trace_monitoring))
+    else:
+        print("sys.monitoring is not available, python %s" % sys.version.split()[0])
+    best = {}
+    try:
+        for _ in range(rounds):
+            for name, set_function in backends:
+                cost = timed(calls, set_function, interval_ns, depth, clock)
+                best[name] = min(best.get(name, cost), cost)
+    finally:
+        if monitoring:
+            release_trace_monitoring()
+
+    baseline = best["baseline"]
+    print(
+        "python %s, %d calls, interval %.3fms, depth %d"
+        % (sys.version.split()[0], calls, interval_ns / 1000000, depth)
+    )
+    for name, _ in backends:
+        print(
+            "%-12s %8.2fms  %6.2fx  %7.1fns per call"
+            % (
+                name,
+                best[name] * 1000,
+                best[name] / baseline,
+                (best[name] - baseline) * 1e9 / calls,
+            )
+        )
+
+
+if __name__ == "__main__":
+    main()
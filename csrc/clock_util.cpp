@@ -0,0 +1,137 @@
+#include "clock_util.h"
+#include <stdio.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+
+typedef struct _clock_calibration {
+  int calibrated;
+  // nanoseconds per tick
+  double ns_per_tick;
+  // ticks and realtime sampled at the same moment, used for wall time
+  unsigned long long base_ticks;
+  unsigned long long base_realtime_ns;
+} clock_calibration;
+
+static clock_calibration calibrations[CLOCK_SOURCE_COUNT];
+
+static const char *clock_source_names[CLOCK_SOURCE_COUNT] = {"raw", "coarse",
+                                                             "tsc"};
+
+static unsigned long long realtime_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int tsc_available() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int eax, ebx, ecx, edx;
+  // invariant tsc, runs at constant rate in all ACPI P/C/T states
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0) {
+    return 0;
+  }
+  return (edx & (1u << 8)) != 0;
+#elif defined(__aarch64__)
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+static double tsc_ns_per_tick() {
+#if defined(__aarch64__)
+  unsigned long long freq;
+  __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(freq));
+  return freq > 0 ? 1e9 / (double)freq : 0;
+#else
+  // measure tsc against CLOCK_MONOTONIC_RAW for 10ms
+  unsigned long long start_ns = clock_ticks(CLOCK_SOURCE_MONOTONIC_RAW);
+  unsigned long long start_ticks = clock_ticks(CLOCK_SOURCE_TSC);
+  struct timespec sleep_ts = {0, 10000000};
+  nanosleep(&sleep_ts, NULL);
+  unsigned long long end_ns = clock_ticks(CLOCK_SOURCE_MONOTONIC_RAW);
+  unsigned long long end_ticks = clock_ticks(CLOCK_SOURCE_TSC);
+  if (end_ticks <= start_ticks) {
+    return 0;
+  }
+  return (double)(end_ns - start_ns) / (double)(end_ticks - start_ticks);
+#endif
+}
+
+static int calibrate(clock_source source) {
+  clock_calibration *c = &calibrations[source];
+  if (c->calibrated) {
+    return 0;
+  }
+  if (source == CLOCK_SOURCE_TSC) {
+    if (!tsc_available()) {
+      return -1;
+    }
+    c->ns_per_tick = tsc_ns_per_tick();
+    if (c->ns_per_tick <= 0) {
+      return -1;
+    }
+  } else {
+    c->ns_per_tick = 1.0;
+  }
+  c->base_ticks = clock_ticks(source);
+  c->base_realtime_ns = realtime_ns();
+  c->calibrated = 1;
+  return 0;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+clock_source clock_source_init(const char *name) {
+  clock_source source = CLOCK_SOURCE_TSC;
+  if (name != NULL && strcmp(name, "auto") != 0) {
+    source = CLOCK_SOURCE_COUNT;
+    for (int i = 0; i < CLOCK_SOURCE_COUNT; i++) {
+      if (strcmp(name, clock_source_names[i]) == 0) {
+        source = (clock_source)i;
+      }
+    }
+    if (source == CLOCK_SOURCE_COUNT) {
+      fprintf(stderr, "[*] unknown clock source %s, use raw\n", name);
+      source = CLOCK_SOURCE_MONOTONIC_RAW;
+    }
+  }
+  if (calibrate(source) != 0) {
+    source = CLOCK_SOURCE_MONOTONIC_RAW;
+    calibrate(source);
+  }
+  return source;
+}
+
+const char *clock_source_name(clock_source source) {
+  return clock_source_names[source];
+}
+
+unsigned long long clock_ticks_to_ns(clock_source source,
+                                     unsigned long long ticks) {
+  return (unsigned long long)(ticks * calibrations[source].ns_per_tick);
+}
+
+unsigned long long clock_ns_to_ticks(clock_source source,
+                                     unsigned long long ns) {
+  return (unsigned long long)(ns / calibrations[source].ns_per_tick);
+}
+
+unsigned long long clock_ticks_to_realtime_ns(clock_source source,
+                                              unsigned long long ticks) {
+  clock_calibration *c = &calibrations[source];
+  if (ticks >= c->base_ticks) {
+    return c->base_realtime_ns +
+           clock_ticks_to_ns(source, ticks - c->base_ticks);
+  }
+  return c->base_realtime_ns - clock_ticks_to_ns(source, c->base_ticks - ticks);
+}
+
+#ifdef __cplusplus
+}
+#endif
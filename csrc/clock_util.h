@@ -0,0 +1,87 @@
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifndef __CLOCK_UTIL_H__
+#define __CLOCK_UTIL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef enum _clock_source {
+  // nanosecond ticks, not affected by NTP slew
+  CLOCK_SOURCE_MONOTONIC_RAW = 0,
+  // nanosecond ticks with jiffy resolution, cheapest vDSO read
+  CLOCK_SOURCE_MONOTONIC_COARSE = 1,
+  // invariant TSC on x86-64, virtual counter cntvct_el0 on aarch64
+  CLOCK_SOURCE_TSC = 2,
+  CLOCK_SOURCE_COUNT = 3
+} clock_source;
+
+/**
+ * resolve clock source by name: "auto"(or NULL), "raw", "coarse", "tsc".
+ * calibrate it on first use, fallback to raw when it is not available.
+ */
+clock_source clock_source_init(const char *name);
+
+const char *clock_source_name(clock_source source);
+
+// convert tick duration to nanoseconds
+unsigned long long clock_ticks_to_ns(clock_source source,
+                                     unsigned long long ticks);
+
+// convert nanosecond duration to ticks
+unsigned long long clock_ns_to_ticks(clock_source source,
+                                     unsigned long long ns);
+
+// convert tick timestamp to nanoseconds since epoch
+unsigned long long clock_ticks_to_realtime_ns(clock_source source,
+                                              unsigned long long ticks);
+
+/**
+ * read current ticks of the clock source, called on every hooked event so
+ * nothing but the raw counter read happens here
+ */
+static inline unsigned long long clock_ticks(clock_source source) {
+  struct timespec ts;
+  switch (source) {
+  case CLOCK_SOURCE_TSC:
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+  {
+    unsigned long long cnt;
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(cnt));
+    return cnt;
+  }
+#else
+    break;
+#endif
+  case CLOCK_SOURCE_MONOTONIC_COARSE:
+#if defined(CLOCK_MONOTONIC_COARSE)
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+#elif defined(CLOCK_MONOTONIC_RAW_APPROX)
+    clock_gettime(CLOCK_MONOTONIC_RAW_APPROX, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  default:
+    break;
+  }
+#if defined(CLOCK_MONOTONIC_RAW)
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -9,7 +9,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 static char filename[FILENAME_MAX] = "";
+// name=hex;... link time addresses the client resolved for the agent
+static char agent_symbols[1024] = "";
 static char take_gil_literal[9] = "take_gil";
 static int py_injected = 0;
 static int port;
@@ -39,6 +42,11 @@ static PyObject *exec_python_file(FILE *fp, char *file_path, int port) {
     return NULL;
   }
 
+  if (PyDict_SetItemString(globals, "__profile_agent_symbols__",
+                           PyUnicode_FromString(agent_symbols)) != 0) {
+    return NULL;
+  }
+
   // pythonrun.h , here locals same to globals
   PyObject *v = PyRun_File(fp, file_path,
                            // Py_file_input from compile.h
@@ -251,16 +259,22 @@ void inject_inner() {
 
   get_parent_directory(so_path_modify);
   char params_path[PATH_MAX]; // Make sure the buffer is large enough
-  snprintf(params_path, sizeof(params_path), "%s/inject_params.data",
-           so_path_modify);
+  // params of this process, so that many processes can be attached at once
+  snprintf(params_path, sizeof(params_path), "%s/inject_params_%d.data",
+           so_path_modify, (int)getpid());
 
   FILE *file;
   char py_code[PATH_MAX];
-  char line[PATH_MAX + 30];
+  char line[PATH_MAX + 30 + sizeof(agent_symbols)];
   int port;
   unsigned long base_addr;
 
   file = fopen(params_path, "r");
+  if (file == NULL) {
+    snprintf(params_path, sizeof(params_path), "%s/inject_params.data",
+             so_path_modify);
+    file = fopen(params_path, "r");
+  }
   if (file == NULL) {
     perror("Unable to open input_prams.data");
     return;
@@ -283,6 +297,13 @@ void inject_inner() {
 
     if (token != NULL) {
       base_addr = strtoul(token, NULL, 10);
+      token = strtok(NULL, ",");
+    }
+
+    // a truncated list could end inside an address, the agent resolves all
+    // of them itself then
+    if (token != NULL && strlen(token) < sizeof(agent_symbols)) {
+      strcpy(agent_symbols, token);
     }
   } else {
     fprintf(stderr, "Error reading input_params.data!\n");
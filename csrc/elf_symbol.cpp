@@ -0,0 +1,271 @@
+#include "elf_symbol.h"
+#include <string>
+#include <unordered_map>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+struct _elf_symbol_table {
+  std::unordered_map<std::string, unsigned long> symbols;
+  // base names of compiler clones, take_gil for take_gil.lto_priv.0
+  std::unordered_map<std::string, unsigned long> clones;
+};
+
+#ifdef __linux__
+// lzma_stream_buffer_decode of liblzma, declared here so that neither lzma.h
+// nor liblzma is needed to build
+typedef int (*lzma_stream_buffer_decode_func)(
+    uint64_t *memlimit, uint32_t flags, const void *allocator,
+    const uint8_t *in, size_t *in_pos, size_t in_size, uint8_t *out,
+    size_t *out_pos, size_t out_size);
+#define LZMA_RET_OK 0
+#define LZMA_RET_BUF_ERROR 10
+// minidebuginfo only keeps function symbols, a few megabytes at most
+#define MINIDEBUGINFO_MAX_SIZE (256ul << 20)
+
+#if __ELF_NATIVE_CLASS == 64
+#define ELF_NATIVE_CLASS ELFCLASS64
+#define ELF_NATIVE_ST_TYPE ELF64_ST_TYPE
+#else
+#define ELF_NATIVE_CLASS ELFCLASS32
+#define ELF_NATIVE_ST_TYPE ELF32_ST_TYPE
+#endif
+
+static bool elf_range_ok(size_t size, uint64_t offset, uint64_t len) {
+  return offset <= size && len <= size - offset;
+}
+
+/**
+ * true when suffix is a chain of .lto_priv.N, .constprop.N and .isra.N, the
+ * clones standing for the whole function. .cold and .part.N only hold a split
+ * off piece of it and must never be hooked in its place
+ */
+static bool is_clone_suffix(const char *suffix) {
+  static const char *tags[] = {".lto_priv.", ".constprop.", ".isra."};
+  while (*suffix != '\0') {
+    size_t len = 0;
+    for (size_t i = 0; i < sizeof(tags) / sizeof(tags[0]); i++) {
+      if (strncmp(suffix, tags[i], strlen(tags[i])) == 0) {
+        len = strlen(tags[i]);
+        break;
+      }
+    }
+    if (len == 0 || suffix[len] < '0' || suffix[len] > '9') {
+      return false;
+    }
+    suffix += len;
+    while (*suffix >= '0' && *suffix <= '9') {
+      suffix++;
+    }
+  }
+  return true;
+}
+
+static void add_symbol(elf_symbol_table *table, const char *name,
+                       unsigned long value) {
+  // emplace keeps the symbol of the table indexed first
+  table->symbols.emplace(name, value);
+  const char *dot = strchr(name, '.');
+  if (dot != NULL && dot != name && is_clone_suffix(dot)) {
+    table->clones.emplace(std::string(name, dot - name), value);
+  }
+}
+
+// index one SHT_SYMTAB or SHT_DYNSYM section with its string table
+static void index_symbols(elf_symbol_table *table, const char *image,
+                          size_t size, const ElfW(Shdr) * shdrs,
+                          unsigned int shnum, const ElfW(Shdr) * symtab) {
+  if (symtab->sh_link >= shnum || symtab->sh_entsize != sizeof(ElfW(Sym)) ||
+      !elf_range_ok(size, symtab->sh_offset, symtab->sh_size)) {
+    return;
+  }
+  const ElfW(Shdr) *strtab = &shdrs[symtab->sh_link];
+  if (strtab->sh_type != SHT_STRTAB ||
+      !elf_range_ok(size, strtab->sh_offset, strtab->sh_size)) {
+    return;
+  }
+  const ElfW(Sym) *syms = (const ElfW(Sym) *)(image + symtab->sh_offset);
+  const char *strs = image + strtab->sh_offset;
+  size_t count = symtab->sh_size / sizeof(ElfW(Sym));
+  for (size_t i = 0; i < count; i++) {
+    const ElfW(Sym) *sym = &syms[i];
+    int type = ELF_NATIVE_ST_TYPE(sym->st_info);
+    if (sym->st_shndx == SHN_UNDEF || sym->st_value == 0 ||
+        type == STT_SECTION || type == STT_FILE || sym->st_name == 0 ||
+        sym->st_name >= strtab->sh_size) {
+      continue;
+    }
+    const char *name = strs + sym->st_name;
+    // names must end inside the string table
+    if (memchr(name, 0, strtab->sh_size - sym->st_name) == NULL) {
+      continue;
+    }
+    add_symbol(table, name, sym->st_value);
+  }
+}
+
+static lzma_stream_buffer_decode_func load_lzma_decoder() {
+  static lzma_stream_buffer_decode_func decode = NULL;
+  static bool loaded = false;
+  if (!loaded) {
+    void *handle = dlopen("liblzma.so.5", RTLD_LAZY | RTLD_LOCAL);
+    if (handle != NULL) {
+      decode = (lzma_stream_buffer_decode_func)dlsym(
+          handle, "lzma_stream_buffer_decode");
+    }
+    loaded = true;
+  }
+  return decode;
+}
+
+/**
+ * decode the xz stream of .gnu_debugdata, the output buffer grows until the
+ * embedded ELF fits. caller frees the result
+ */
+static char *decode_minidebuginfo(const char *data, size_t size,
+                                  size_t *out_size) {
+  lzma_stream_buffer_decode_func decode = load_lzma_decoder();
+  if (decode == NULL) {
+    return NULL;
+  }
+  size_t capacity = size * 8;
+  while (capacity <= MINIDEBUGINFO_MAX_SIZE) {
+    char *out = (char *)malloc(capacity);
+    if (out == NULL) {
+      return NULL;
+    }
+    uint64_t memlimit = UINT64_MAX;
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+    int ret = decode(&memlimit, 0, NULL, (const uint8_t *)data, &in_pos, size,
+                     (uint8_t *)out, &out_pos, capacity);
+    if (ret == LZMA_RET_OK) {
+      *out_size = out_pos;
+      return out;
+    }
+    free(out);
+    if (ret != LZMA_RET_BUF_ERROR) {
+      return NULL;
+    }
+    capacity *= 2;
+  }
+  return NULL;
+}
+
+static bool index_image(elf_symbol_table *table, const char *image,
+                        size_t size, bool nested) {
+  if (size < sizeof(ElfW(Ehdr)) || memcmp(image, ELFMAG, SELFMAG) != 0 ||
+      image[EI_CLASS] != ELF_NATIVE_CLASS) {
+    return false;
+  }
+  const ElfW(Ehdr) *ehdr = (const ElfW(Ehdr) *)image;
+  unsigned int shnum = ehdr->e_shnum;
+  if (ehdr->e_shentsize != sizeof(ElfW(Shdr)) ||
+      !elf_range_ok(size, ehdr->e_shoff,
+                    (uint64_t)shnum * sizeof(ElfW(Shdr)))) {
+    return false;
+  }
+  const ElfW(Shdr) *shdrs = (const ElfW(Shdr) *)(image + ehdr->e_shoff);
+  const ElfW(Shdr) *names = NULL;
+  if (ehdr->e_shstrndx < shnum &&
+      elf_range_ok(size, shdrs[ehdr->e_shstrndx].sh_offset,
+                   shdrs[ehdr->e_shstrndx].sh_size)) {
+    names = &shdrs[ehdr->e_shstrndx];
+  }
+
+  // full symbol table first, it has the static functions like take_gil
+  for (unsigned int i = 0; i < shnum; i++) {
+    if (shdrs[i].sh_type == SHT_SYMTAB) {
+      index_symbols(table, image, size, shdrs, shnum, &shdrs[i]);
+    }
+  }
+  // distributions stripping .symtab may keep its function symbols there
+  for (unsigned int i = 0; !nested && names != NULL && i < shnum; i++) {
+    const ElfW(Shdr) *section = &shdrs[i];
+    if (section->sh_type != SHT_PROGBITS ||
+        section->sh_name >= names->sh_size ||
+        !elf_range_ok(size, section->sh_offset, section->sh_size) ||
+        strncmp(image + names->sh_offset + section->sh_name, ".gnu_debugdata",
+                names->sh_size - section->sh_name) != 0) {
+      continue;
+    }
+    size_t debug_size = 0;
+    char *debug_image = decode_minidebuginfo(image + section->sh_offset,
+                                             section->sh_size, &debug_size);
+    if (debug_image != NULL) {
+      index_image(table, debug_image, debug_size, true);
+      free(debug_image);
+    }
+  }
+  for (unsigned int i = 0; i < shnum; i++) {
+    if (shdrs[i].sh_type == SHT_DYNSYM) {
+      index_symbols(table, image, size, shdrs, shnum, &shdrs[i]);
+    }
+  }
+  return true;
+}
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+elf_symbol_table *elf_symbol_table_open(const char *path) {
+#ifdef __linux__
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return NULL;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+    close(fd);
+    return NULL;
+  }
+  size_t size = (size_t)st.st_size;
+  void *image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (image == MAP_FAILED) {
+    return NULL;
+  }
+  elf_symbol_table *table = new elf_symbol_table();
+  bool ok = index_image(table, (const char *)image, size, false);
+  munmap(image, size);
+  if (!ok) {
+    delete table;
+    return NULL;
+  }
+  return table;
+#else
+  // Mach-O images are resolved by nm
+  return NULL;
+#endif
+}
+
+void elf_symbol_table_close(elf_symbol_table *table) { delete table; }
+
+size_t elf_symbol_table_size(const elf_symbol_table *table) {
+  return table->symbols.size();
+}
+
+unsigned long elf_symbol_table_lookup(const elf_symbol_table *table,
+                                      const char *name) {
+  auto it = table->symbols.find(name);
+  if (it != table->symbols.end()) {
+    return it->second;
+  }
+  it = table->clones.find(name);
+  return it != table->clones.end() ? it->second : 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
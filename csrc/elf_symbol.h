@@ -0,0 +1,37 @@
+#include <stddef.h>
+
+#ifndef __ELF_SYMBOL_H__
+#define __ELF_SYMBOL_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct _elf_symbol_table elf_symbol_table;
+
+/**
+ * index the defined symbols of an ELF file of the native class: .symtab,
+ * the .symtab of the xz compressed .gnu_debugdata (minidebuginfo, decoded
+ * when liblzma can be loaded) and .dynsym, earlier ones win on duplicates.
+ * NULL when the file is not such an ELF file or on other platforms.
+ */
+elf_symbol_table *elf_symbol_table_open(const char *path);
+
+void elf_symbol_table_close(elf_symbol_table *table);
+
+size_t elf_symbol_table_size(const elf_symbol_table *table);
+
+/**
+ * link time value of the symbol, the address nm prints. compiler clones like
+ * take_gil.lto_priv.0, .constprop.N or .isra.N are found by their base name
+ * when no symbol has the exact name, .cold and .part.N pieces are not. 0 when
+ * not found
+ */
+unsigned long elf_symbol_table_lookup(const elf_symbol_table *table,
+                                      const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
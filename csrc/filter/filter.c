@@ -0,0 +1,43 @@
+#include "filter/filter_expr.h"
+
+//////////////////////
+// Public functions //
+//////////////////////
+
+static PyObject *evaluate(PyObject *m, PyObject *const *args,
+                          Py_ssize_t nargs) {
+  if (nargs != 6) {
+    PyErr_Format(PyExc_TypeError, "evaluate expected 6 arguments, got %zd",
+                 nargs);
+    return NULL;
+  }
+  if (!PyTuple_Check(args[4]) || !PyDict_Check(args[5])) {
+    PyErr_SetString(PyExc_TypeError, "args must be a tuple, kwargs a dict");
+    return NULL;
+  }
+  // program, target, return_obj, cost, args, kwargs
+  PyObject *roots[FILTER_ROOT_COUNT] = {args[1], args[2], args[3], args[4],
+                                       args[5]};
+  int result = filter_expr_eval(args[0], roots);
+  if (result < 0) {
+    return NULL;
+  }
+  return PyBool_FromLong(result);
+}
+
+///////////////////////////
+// Module initialization //
+///////////////////////////
+
+static PyMethodDef module_methods[] = {
+    {"evaluate", (PyCFunction)(void (*)(void))evaluate, METH_FASTCALL,
+     "evaluate a compiled filter program, return its truth"},
+    {NULL} /* Sentinel */
+};
+
+PyMODINIT_FUNC PyInit_filter_C(void) {
+  static struct PyModuleDef moduledef = {
+      PyModuleDef_HEAD_INIT, "filter_C", "PyFlight filter supports.", -1,
+      module_methods};
+  return PyModule_Create(&moduledef);
+}
@@ -0,0 +1,195 @@
+#include "filter/filter_expr.h"
+
+/////////////////////
+// Filter programs //
+/////////////////////
+
+// filter expressions of simple shapes are compiled by compile_filter_program
+// in expression_resolver.py into nested tuples, evaluated here without
+// creating a python frame:
+//   (NODE_CONST, value)
+//   (NODE_PATH, root, ((STEP_ATTR, name) | (STEP_ITEM, key), ...))
+//   (NODE_COMPARE, op, left value, right value)
+//   (NODE_AND | NODE_OR, (test, ...))
+//   (NODE_NOT, test)
+// a test is any node, values are tested by their truth
+
+// same values as in expression_resolver.py
+enum _filter_node {
+  NODE_CONST = 0,
+  NODE_PATH = 1,
+  NODE_COMPARE = 2,
+  NODE_AND = 3,
+  NODE_OR = 4,
+  NODE_NOT = 5,
+};
+
+enum _filter_step {
+  STEP_ATTR = 0,
+  STEP_ITEM = 1,
+};
+
+// Py_LT to Py_GE are rich comparisons, the others are membership and identity
+enum _filter_cmp {
+  CMP_IN = 6,
+  CMP_NOT_IN = 7,
+  CMP_IS = 8,
+  CMP_IS_NOT = 9,
+};
+
+static int _malformed(void) {
+  PyErr_SetString(PyExc_ValueError, "malformed filter program");
+  return -1;
+}
+
+static int _node_kind(PyObject *node, Py_ssize_t size) {
+  if (!PyTuple_CheckExact(node) || PyTuple_GET_SIZE(node) != size) {
+    return _malformed();
+  }
+  long kind = PyLong_AsLong(PyTuple_GET_ITEM(node, 0));
+  if (kind == -1 && PyErr_Occurred()) {
+    return -1;
+  }
+  return (int)kind;
+}
+
+static long _node_long(PyObject *node, Py_ssize_t index) {
+  return PyLong_AsLong(PyTuple_GET_ITEM(node, index));
+}
+
+// return a new reference to the value of a const or path node
+static PyObject *eval_value(PyObject *node, PyObject **roots) {
+  if (!PyTuple_CheckExact(node) || PyTuple_GET_SIZE(node) < 2) {
+    _malformed();
+    return NULL;
+  }
+  long kind = _node_long(node, 0);
+  if (kind == NODE_CONST && PyTuple_GET_SIZE(node) == 2) {
+    PyObject *value = PyTuple_GET_ITEM(node, 1);
+    Py_INCREF(value);
+    return value;
+  }
+  if (kind != NODE_PATH || PyTuple_GET_SIZE(node) != 3) {
+    _malformed();
+    return NULL;
+  }
+  long root = _node_long(node, 1);
+  PyObject *steps = PyTuple_GET_ITEM(node, 2);
+  if (root < 0 || root >= FILTER_ROOT_COUNT || !PyTuple_CheckExact(steps)) {
+    _malformed();
+    return NULL;
+  }
+  PyObject *value = roots[root];
+  Py_INCREF(value);
+  Py_ssize_t i;
+  for (i = 0; i < PyTuple_GET_SIZE(steps); i++) {
+    PyObject *step = PyTuple_GET_ITEM(steps, i);
+    if (!PyTuple_CheckExact(step) || PyTuple_GET_SIZE(step) != 2) {
+      Py_DECREF(value);
+      _malformed();
+      return NULL;
+    }
+    PyObject *key = PyTuple_GET_ITEM(step, 1);
+    PyObject *next;
+    if (_node_long(step, 0) == STEP_ATTR) {
+      next = PyObject_GetAttr(value, key);
+    } else {
+      next = PyObject_GetItem(value, key);
+    }
+    Py_DECREF(value);
+    if (next == NULL) {
+      return NULL;
+    }
+    value = next;
+  }
+  return value;
+}
+
+static int eval_compare(PyObject *node, PyObject **roots) {
+  long op = _node_long(node, 1);
+  PyObject *left = eval_value(PyTuple_GET_ITEM(node, 2), roots);
+  if (left == NULL) {
+    return -1;
+  }
+  PyObject *right = eval_value(PyTuple_GET_ITEM(node, 3), roots);
+  if (right == NULL) {
+    Py_DECREF(left);
+    return -1;
+  }
+  int result;
+  switch (op) {
+  case Py_LT:
+  case Py_LE:
+  case Py_EQ:
+  case Py_NE:
+  case Py_GT:
+  case Py_GE:
+    result = PyObject_RichCompareBool(left, right, (int)op);
+    break;
+  case CMP_IN:
+    result = PySequence_Contains(right, left);
+    break;
+  case CMP_NOT_IN:
+    result = PySequence_Contains(right, left);
+    result = result < 0 ? result : !result;
+    break;
+  case CMP_IS:
+    result = left == right;
+    break;
+  case CMP_IS_NOT:
+    result = left != right;
+    break;
+  default:
+    result = _malformed();
+  }
+  Py_DECREF(left);
+  Py_DECREF(right);
+  return result;
+}
+
+static int eval_test(PyObject *node, PyObject **roots) {
+  if (!PyTuple_CheckExact(node) || PyTuple_GET_SIZE(node) < 2) {
+    return _malformed();
+  }
+  long kind = _node_long(node, 0);
+  switch (kind) {
+  case NODE_COMPARE:
+    if (_node_kind(node, 4) < 0) {
+      return -1;
+    }
+    return eval_compare(node, roots);
+  case NODE_AND:
+  case NODE_OR: {
+    PyObject *tests = PyTuple_GET_ITEM(node, 1);
+    if (!PyTuple_CheckExact(tests)) {
+      return _malformed();
+    }
+    Py_ssize_t i;
+    for (i = 0; i < PyTuple_GET_SIZE(tests); i++) {
+      int result = eval_test(PyTuple_GET_ITEM(tests, i), roots);
+      // short circuit like python
+      if (result < 0 || result == (kind == NODE_OR)) {
+        return result;
+      }
+    }
+    return kind == NODE_AND;
+  }
+  case NODE_NOT: {
+    int result = eval_test(PyTuple_GET_ITEM(node, 1), roots);
+    return result < 0 ? result : !result;
+  }
+  default: {
+    PyObject *value = eval_value(node, roots);
+    if (value == NULL) {
+      return -1;
+    }
+    int result = PyObject_IsTrue(value);
+    Py_DECREF(value);
+    return result;
+  }
+  }
+}
+
+int filter_expr_eval(PyObject *program, PyObject **roots) {
+  return eval_test(program, roots);
+}
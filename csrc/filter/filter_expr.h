@@ -0,0 +1,32 @@
+#include <Python.h>
+
+#ifndef __FILTER_EXPR_H__
+#define __FILTER_EXPR_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// roots of filter programs, same values as FILTER_ROOTS in
+// expression_resolver.py
+typedef enum _filter_root {
+  ROOT_TARGET = 0,
+  ROOT_RETURN = 1,
+  ROOT_COST = 2,
+  ROOT_ARGS = 3,
+  ROOT_KWARGS = 4,
+  FILTER_ROOT_COUNT = 5,
+} filter_root;
+
+/**
+ * evaluate a program compiled by compile_filter_program, roots are indexed
+ * by filter_root, args must be a tuple and kwargs a dict.
+ * return 1 or 0 for the truth of the program, -1 with an exception set.
+ */
+int filter_expr_eval(PyObject *program, PyObject **roots);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,121 @@
+#include "gil_stat_stream.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// copy into the ring at byte position pos, wrapping at capacity
+static void ring_write(gil_stream *stream, uint64_t pos, const char *data,
+                       size_t size) {
+  uint64_t capacity = stream->header->capacity;
+  size_t offset = pos % capacity;
+  size_t first = capacity - offset < size ? capacity - offset : size;
+  memcpy(stream->ring + offset, data, first);
+  if (first < size) {
+    memcpy(stream->ring, data + first, size - first);
+  }
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+gil_stream *gil_stream_open(const char *path, size_t capacity) {
+  long page_size = sysconf(_SC_PAGESIZE);
+  capacity = (capacity + page_size - 1) / page_size * page_size;
+  size_t map_size = GIL_STREAM_HEADER_SIZE + capacity;
+
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd < 0) {
+    fprintf(stderr, "[*] gil_statistics open stream file %s failed\n", path);
+    return NULL;
+  }
+  if (ftruncate(fd, map_size) != 0) {
+    fprintf(stderr, "[*] gil_statistics resize stream file %s failed\n", path);
+    close(fd);
+    return NULL;
+  }
+  void *mem = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "[*] gil_statistics map stream file %s failed\n", path);
+    close(fd);
+    return NULL;
+  }
+  gil_stream *stream = (gil_stream *)calloc(1, sizeof(gil_stream));
+  char *pending = (char *)malloc(capacity);
+  if (stream == NULL || pending == NULL) {
+    free(stream);
+    free(pending);
+    munmap(mem, map_size);
+    close(fd);
+    return NULL;
+  }
+  stream->fd = fd;
+  stream->map_size = map_size;
+  stream->header = (gil_stream_header *)mem;
+  stream->ring = (char *)mem + GIL_STREAM_HEADER_SIZE;
+  stream->pending = pending;
+
+  gil_stream_header *header = stream->header;
+  header->version = GIL_STREAM_VERSION;
+  header->header_size = GIL_STREAM_HEADER_SIZE;
+  header->capacity = capacity;
+  header->writer_pid = getpid();
+  // magic goes last, a reader only trusts the header once it is present
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  memcpy(header->magic, GIL_STREAM_MAGIC, sizeof(GIL_STREAM_MAGIC));
+  return stream;
+}
+
+void gil_stream_close(gil_stream *stream) {
+  if (stream == NULL) {
+    return;
+  }
+  __atomic_store_n(&stream->header->closed, 1, __ATOMIC_RELEASE);
+  munmap(stream->header, stream->map_size);
+  close(stream->fd);
+  free(stream->pending);
+  free(stream);
+}
+
+void gil_stream_append(gil_stream *stream, uint16_t type, const void *body,
+                       uint32_t size) {
+  gil_stream_record_header record;
+  record.type = type;
+  record.reserved = 0;
+  record.size = sizeof(record) + size;
+  if (stream->pending_size + record.size > stream->header->capacity) {
+    stream->overflow = 1;
+    return;
+  }
+  memcpy(stream->pending + stream->pending_size, &record, sizeof(record));
+  memcpy(stream->pending + stream->pending_size + sizeof(record), body, size);
+  stream->pending_size += record.size;
+}
+
+int gil_stream_commit(gil_stream *stream) {
+  gil_stream_header *header = stream->header;
+  int ret = 0;
+  uint64_t write_pos = header->write_pos;
+  uint64_t read_pos = __atomic_load_n(&header->read_pos, __ATOMIC_ACQUIRE);
+  if (stream->overflow ||
+      header->capacity - (write_pos - read_pos) < stream->pending_size) {
+    __atomic_store_n(&header->dropped_reports, header->dropped_reports + 1,
+                     __ATOMIC_RELAXED);
+    ret = -1;
+  } else if (stream->pending_size > 0) {
+    ring_write(stream, write_pos, stream->pending, stream->pending_size);
+    // records become visible to the reader as a whole
+    __atomic_store_n(&header->write_pos, write_pos + stream->pending_size,
+                     __ATOMIC_RELEASE);
+  }
+  stream->pending_size = 0;
+  stream->overflow = 0;
+  return ret;
+}
+
+#ifdef __cplusplus
+}
+#endif
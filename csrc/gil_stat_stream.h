@@ -0,0 +1,142 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef __GIL_STAT_STREAM_H__
+#define __GIL_STAT_STREAM_H__
+
+/**
+ * Binary export of gil statistics through a memory mapped file.
+ *
+ * The file starts with gil_stream_header, followed by a ring of `capacity`
+ * bytes. The gil_stat thread is the only writer: it appends all records of one
+ * report and then publishes them by advancing write_pos. The reader, usually
+ * the flight_profiler client, advances read_pos after decoding. When the ring
+ * has no room for a whole report the report is dropped and counted, the writer
+ * never waits for the reader.
+ *
+ * Every record starts with gil_stream_record_header, size includes the header.
+ * All fields use host byte order, agent and reader run on the same host.
+ * Layout is mirrored by flight_profiler/plugins/gilstat/gilstat_stream.py.
+ */
+
+#define GIL_STREAM_MAGIC "FPGILST"
+#define GIL_STREAM_VERSION 1
+// data area starts at a page boundary
+#define GIL_STREAM_HEADER_SIZE 4096
+
+typedef struct _gil_stream_header {
+  char magic[8];
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t capacity;
+  // bytes ever written/read, position in ring is pos % capacity
+  uint64_t write_pos;
+  uint64_t read_pos;
+  // reports dropped because the reader fell behind
+  uint64_t dropped_reports;
+  uint32_t writer_pid;
+  // set when gilstat is turned off, nothing is written after it
+  uint32_t closed;
+} gil_stream_header;
+
+enum _gil_stream_record_type {
+  GIL_STREAM_REPORT = 1,
+  GIL_STREAM_THREAD = 2,
+  GIL_STREAM_PROCESS = 3,
+  GIL_STREAM_WARNING = 4
+};
+
+typedef struct _gil_stream_record_header {
+  uint16_t type;
+  uint16_t reserved;
+  uint32_t size;
+} gil_stream_record_header;
+
+// nano second, count is the number of samples
+typedef struct _gil_stream_percentiles {
+  uint64_t count;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+  uint64_t p999;
+  uint64_t max;
+} gil_stream_percentiles;
+
+// first record of every report
+typedef struct _gil_stream_report {
+  uint64_t time_ns;
+  uint64_t untracked_threads;
+  uint64_t dropped_warnings;
+} gil_stream_report;
+
+typedef struct _gil_stream_thread {
+  uint64_t thread_id;
+  char thread_name[32];
+  uint64_t take_count;
+  uint64_t take_total_ns;
+  uint64_t hold_total_ns;
+  uint64_t drop_count;
+  uint64_t drop_total_ns;
+  gil_stream_percentiles take;
+  gil_stream_percentiles hold;
+  gil_stream_percentiles drop;
+} gil_stream_thread;
+
+// process wide distribution, including exited threads
+typedef struct _gil_stream_process {
+  gil_stream_percentiles take;
+  gil_stream_percentiles hold;
+  gil_stream_percentiles drop;
+} gil_stream_process;
+
+typedef struct _gil_stream_warning {
+  uint64_t thread_id;
+  char thread_name[32];
+  // 0: take 1:hold
+  uint32_t type;
+  uint32_t reserved;
+  uint64_t cost_ns;
+  uint64_t threshold_ns;
+  uint64_t start_ns;
+  uint64_t end_ns;
+} gil_stream_warning;
+
+typedef struct _gil_stream {
+  int fd;
+  size_t map_size;
+  gil_stream_header *header;
+  char *ring;
+  // records of the report being built, published by gil_stream_commit
+  char *pending;
+  size_t pending_size;
+  // pending records did not fit into the ring
+  int overflow;
+} gil_stream;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * create or truncate the file at path and map it, capacity is rounded up to
+ * whole pages, return NULL on failure
+ */
+gil_stream *gil_stream_open(const char *path, size_t capacity);
+
+// mark the stream closed and unmap it, the file is kept for the reader
+void gil_stream_close(gil_stream *stream);
+
+void gil_stream_append(gil_stream *stream, uint16_t type, const void *body,
+                       uint32_t size);
+
+/**
+ * publish appended records as one report
+ * return 0 on success, -1 when the report is dropped
+ */
+int gil_stream_commit(gil_stream *stream);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -2,8 +2,11 @@
 #include "symbol.h"
 
 static int (*init_func)(PyObject *, unsigned long, unsigned long, int, int, int,
-                        int) = NULL;
+                        int, const char *, const char *, int, int,
+                        const unsigned long *) = NULL;
 static int (*deinit_func)() = NULL;
+static PyObject *(*dump_timeline_func)() = NULL;
+static PyObject *(*dump_hold_samples_func)() = NULL;
 
 static PyObject *init_gil_interceptor(PyObject *self, PyObject *args) {
   if (init_func == NULL) {
@@ -11,14 +14,24 @@ static PyObject *init_gil_interceptor(PyObject *self, PyObject *args) {
   }
   PyObject *queue_obj;
   unsigned long take_addr, drop_addr;
-  int take_threshold, hold_threshold, stat_interval, max_stat_threads;
-  if (!PyArg_ParseTuple(args, "OLLiiii", &queue_obj, &take_addr, &drop_addr,
-                        &take_threshold, &hold_threshold, &stat_interval,
-                        &max_stat_threads)) {
+  int take_threshold, hold_threshold, stat_interval_ms, max_stat_threads;
+  const char *clock = NULL;
+  const char *stream_path = NULL;
+  int timeline_events = 0;
+  int hold_frames = 0;
+  // critical section, critical section 2, stop and start the world
+  unsigned long pause_addrs[4] = {0, 0, 0, 0};
+  if (!PyArg_ParseTuple(args, "OLLiiii|zzii(kkkk)", &queue_obj, &take_addr,
+                        &drop_addr, &take_threshold, &hold_threshold,
+                        &stat_interval_ms, &max_stat_threads, &clock,
+                        &stream_path, &timeline_events, &hold_frames,
+                        &pause_addrs[0], &pause_addrs[1], &pause_addrs[2],
+                        &pause_addrs[3])) {
     return Py_BuildValue("i", -1);
   }
   int ret = init_func(queue_obj, take_addr, drop_addr, take_threshold,
-                      hold_threshold, stat_interval, max_stat_threads);
+                      hold_threshold, stat_interval_ms, max_stat_threads, clock,
+                      stream_path, timeline_events, hold_frames, pause_addrs);
   return Py_BuildValue("i", ret);
 }
 
@@ -30,11 +43,31 @@ static PyObject *deinit_gil_interceptor(PyObject *self, PyObject *args) {
   return Py_BuildValue("i", ret);
 }
 
+static PyObject *dump_gil_timeline(PyObject *self, PyObject *args) {
+  if (dump_timeline_func == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "gil timeline is not supported");
+    return NULL;
+  }
+  return dump_timeline_func();
+}
+
+static PyObject *dump_gil_hold_samples(PyObject *self, PyObject *args) {
+  if (dump_hold_samples_func == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "gil hold samples are not supported");
+    return NULL;
+  }
+  return dump_hold_samples_func();
+}
+
 static PyMethodDef gilstat_module_methods[] = {
     {"init_gil_interceptor", (PyCFunction)init_gil_interceptor, METH_VARARGS,
      "init gil interceptor"},
     {"deinit_gil_interceptor", (PyCFunction)deinit_gil_interceptor,
      METH_VARARGS, "deinit gil interceptor"},
+    {"dump_gil_timeline", (PyCFunction)dump_gil_timeline, METH_NOARGS,
+     "dump gil cycles recorded by gilstat record"},
+    {"dump_gil_hold_samples", (PyCFunction)dump_gil_hold_samples, METH_NOARGS,
+     "dump python frames of long gil holds taken by gilstat hogs"},
     {NULL, NULL, 0, NULL}};
 
 static struct PyModuleDef gilstat_module = {
@@ -49,9 +82,15 @@ static struct PyModuleDef gilstat_module = {
 
 // will be called when python module first loaded
 PyMODINIT_FUNC PyInit_gilstat_C(void) {
-  init_func = (int (*)(PyObject *, unsigned long, unsigned long, int, int, int,
-                       int))get_symbol_addr("init_py_gil_interceptor");
+  init_func =
+      (int (*)(PyObject *, unsigned long, unsigned long, int, int, int, int,
+               const char *, const char *, int, int, const unsigned long *))
+          get_symbol_addr("init_py_gil_interceptor");
   deinit_func = (int (*)())get_symbol_addr("deinit_py_gil_interceptor");
+  dump_timeline_func =
+      (PyObject * (*)()) get_symbol_addr("dump_py_gil_timeline");
+  dump_hold_samples_func =
+      (PyObject * (*)()) get_symbol_addr("dump_py_gil_hold_samples");
 
   return PyModule_Create(&gilstat_module);
 }
@@ -45,25 +45,23 @@ private:
   pid_t target_process_id_;
   std::string library_file_path_;
   ProcessTracer process_tracer_;
+  long long dlopen_nanos_; ///< Time the injected dlopen call took
 
   // Injection workflow methods
-  ExitCode initializeInjectionEnvironment(long &code_injection_address,
+  ExitCode initializeInjectionEnvironment(long code_injection_address,
                                           REG_TYPE *original_registers,
                                           REG_TYPE *working_registers);
-  ExitCode orchestrateInjectionSequence(long injection_address,
-                                        long malloc_function_address,
-                                        long free_function_address,
-                                        long dlopen_function_address,
-                                        int library_path_string_length,
-                                        REG_TYPE *initial_registers);
+  ExitCode
+  orchestrateInjectionSequence(long injection_address,
+                               const std::vector<char> &shellcode_payload,
+                               REG_TYPE *initial_registers);
   ExitCode confirmInjectionSuccess(long injection_memory_location,
                                    const std::vector<char> &backup_memory_data,
                                    size_t shellcode_byte_size,
                                    REG_TYPE *original_register_state);
 
   // Shellcode generation methods
-  std::vector<char> createShellcodePayload(size_t &payload_size,
-                                           intptr_t &return_instruction_offset);
+  std::vector<char> createShellcodePayload(long dlopen_function_address);
 
   // Path manipulation utilities
   void getParentDirectoryPath(std::string &file_path);
@@ -1,9 +1,17 @@
 #include "ProcessTracer.h"
+#include <elf.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <iostream>
 #include <sstream>
+#include <sys/time.h>
+#include <sys/uio.h>
 #include <time.h>
 
+// Injected code must reach its breakpoint within this time, otherwise it is
+// mostly blocked on a lock held by the target like the gil
+#define TRAP_TIMEOUT_MS 500
+
 /**
  * @brief Macro to check ptrace operation results and handle errors
  *
@@ -33,7 +41,8 @@
  * @param process_id PID of the process to trace
  */
 ProcessTracer::ProcessTracer(pid_t process_id, bool debug_mode)
-    : process_id_(process_id), is_attached_(false), debug_mode_(debug_mode) {}
+    : process_id_(process_id), is_attached_(false), debug_mode_(debug_mode),
+      pending_signal_(0), attach_nanos_(0), stopped_nanos_(0) {}
 
 /**
  * @brief Destructor for ProcessTracer
@@ -54,6 +63,7 @@ ProcessTracer::~ProcessTracer() {
  * @return true if attachment was successful, false otherwise
  */
 bool ProcessTracer::attach() {
+  attach_nanos_ = monotonicNanos();
   int result = ptrace(PTRACE_ATTACH, process_id_, NULL, NULL);
   CHECK_PTRACE_RESULT(result, PTRACE_ATTACH);
 
@@ -73,13 +83,16 @@ bool ProcessTracer::attach() {
 /**
  * @brief Detach from the target process
  *
- * Uses ptrace to detach from the target process.
+ * Uses ptrace to detach from the target process, delivering the signal it
+ * received while stopped for the injection.
  *
  * @return true if detachment was successful, false otherwise
  */
 bool ProcessTracer::detach() {
-  int result = ptrace(PTRACE_DETACH, process_id_, NULL, NULL);
+  int result = ptrace(PTRACE_DETACH, process_id_, NULL, pending_signal_);
   CHECK_PTRACE_RESULT(result, PTRACE_DETACH);
+  stopped_nanos_ = monotonicNanos() - attach_nanos_;
+  pending_signal_ = 0;
   is_attached_ = false;
   return true;
 }
@@ -114,13 +127,22 @@ void ProcessTracer::stop() {
  * @brief Get the current register state of the target process
  *
  * Uses ptrace to retrieve the current register state of the target process.
+ * aarch64 has no PTRACE_GETREGS, its general registers are the NT_PRSTATUS
+ * register set.
  *
  * @param registers Pointer to store the register state
  * @return true if registers were successfully retrieved, false otherwise
  */
 bool ProcessTracer::getRegisters(REG_TYPE *registers) {
+#if defined(__aarch64__)
+  struct iovec register_iov = {registers, sizeof(*registers)};
+  int result =
+      ptrace(PTRACE_GETREGSET, process_id_, (void *)NT_PRSTATUS, &register_iov);
+  CHECK_PTRACE_RESULT(result, PTRACE_GETREGSET);
+#else
   int result = ptrace(PTRACE_GETREGS, process_id_, NULL, registers);
   CHECK_PTRACE_RESULT(result, PTRACE_GETREGS);
+#endif
   return true;
 }
 
@@ -133,15 +155,23 @@ bool ProcessTracer::getRegisters(REG_TYPE *registers) {
  * @return true if registers were successfully set, false otherwise
  */
 bool ProcessTracer::setRegisters(REG_TYPE *registers) {
+#if defined(__aarch64__)
+  struct iovec register_iov = {registers, sizeof(*registers)};
+  int result =
+      ptrace(PTRACE_SETREGSET, process_id_, (void *)NT_PRSTATUS, &register_iov);
+  CHECK_PTRACE_RESULT(result, PTRACE_SETREGSET);
+#else
   int result = ptrace(PTRACE_SETREGS, process_id_, NULL, registers);
   CHECK_PTRACE_RESULT(result, PTRACE_SETREGS);
+#endif
   return true;
 }
 
 /**
  * @brief Read memory from the target process
  *
- * Uses ptrace to read memory from the target process in word-sized chunks.
+ * Uses process_vm_readv to read the whole range in one call, falling back to
+ * ptrace in word-sized chunks.
  *
  * @param address Address to read from
  * @param buffer Buffer to store the read data
@@ -150,16 +180,28 @@ bool ProcessTracer::setRegisters(REG_TYPE *registers) {
  */
 bool ProcessTracer::readMemory(unsigned long address, void *buffer,
                                int length) {
+  struct iovec local_iov = {buffer, (size_t)length};
+  struct iovec remote_iov = {(void *)address, (size_t)length};
+  if (process_vm_readv(process_id_, &local_iov, 1, &remote_iov, 1, 0) ==
+      length) {
+    return true;
+  }
+
   int bytes_read = 0;
-  int i = 0;
   long word = 0;
-  long *ptr = static_cast<long *>(buffer);
+  char *ptr = static_cast<char *>(buffer);
 
   while (bytes_read < length) {
+    errno = 0;
     word = ptrace(PTRACE_PEEKTEXT, process_id_, address + bytes_read, NULL);
-    CHECK_PTRACE_RESULT(word, PTRACE_PEEKTEXT);
-    bytes_read += sizeof(word);
-    ptr[i++] = word;
+    if (word == -1 && errno != 0) {
+      CHECK_PTRACE_RESULT(-1, PTRACE_PEEKTEXT);
+    }
+    int chunk = length - bytes_read < (int)sizeof(word)
+                    ? length - bytes_read
+                    : (int)sizeof(word);
+    memcpy(ptr + bytes_read, &word, chunk);
+    bytes_read += chunk;
   }
 
   return true;
@@ -168,7 +210,10 @@ bool ProcessTracer::readMemory(unsigned long address, void *buffer,
 /**
  * @brief Write memory to the target process
  *
- * Uses ptrace to write memory to the target process in word-sized chunks.
+ * Uses process_vm_writev to write the whole range in one call. It honours
+ * page protections, so read-only mappings like the text page holding the
+ * shellcode are written through /proc/[pid]/mem, and ptrace in word-sized
+ * chunks is the last resort.
  *
  * @param address Address to write to
  * @param buffer Buffer containing the data to write
@@ -177,77 +222,165 @@ bool ProcessTracer::readMemory(unsigned long address, void *buffer,
  */
 bool ProcessTracer::writeMemory(unsigned long address, const void *buffer,
                                 int length) {
+  struct iovec local_iov = {const_cast<void *>(buffer), (size_t)length};
+  struct iovec remote_iov = {(void *)address, (size_t)length};
+  if (process_vm_writev(process_id_, &local_iov, 1, &remote_iov, 1, 0) ==
+      length) {
+    return true;
+  }
+  if (writeProcMemory(address, buffer, length)) {
+    return true;
+  }
+
   int byte_count = 0;
   long word = 0;
 
   while (byte_count < length) {
-    memcpy(&word, static_cast<const char *>(buffer) + byte_count, sizeof(word));
+    int chunk = length - byte_count < (int)sizeof(word)
+                    ? length - byte_count
+                    : (int)sizeof(word);
+    if (chunk < (int)sizeof(word)) {
+      // keep the bytes after the end of the buffer
+      if (!readMemory(address + byte_count, &word, sizeof(word))) {
+        return false;
+      }
+    }
+    memcpy(&word, static_cast<const char *>(buffer) + byte_count, chunk);
     int result =
         ptrace(PTRACE_POKETEXT, process_id_, address + byte_count, word);
     CHECK_PTRACE_RESULT(result, PTRACE_POKETEXT);
-    byte_count += sizeof(word);
+    byte_count += chunk;
   }
 
   return true;
 }
 
 /**
- * @brief Get signal information for the target process
+ * @brief Write memory through /proc/[pid]/mem
  *
- * Retrieves signal information for the target process, with retry logic
- * to handle cases where the process may not have reached the expected
- * interruption point yet.
+ * The kernel lets a tracer write read-only mappings of a stopped tracee
+ * through this file, the same way PTRACE_POKETEXT does, but in one call.
  *
- * @return siginfo_t structure containing signal information
+ * @param address Address to write to
+ * @param buffer Buffer containing the data to write
+ * @param length Number of bytes to write
+ * @return true if memory was successfully written, false otherwise
  */
-siginfo_t ProcessTracer::getSignalInfo() {
-  sleepMs(5);
-
-  siginfo_t signal_info;
-  // When PTRACE_GETSIGINFO returns -1, tracee may not reach int3 point, so
-  // spin on it waiting at most 500ms
-  for (int i = 0; i < 100; i++) {
-    if (ptrace(PTRACE_GETSIGINFO, process_id_, NULL, &signal_info) != -1) {
-      return signal_info;
-    }
-    sleepMs(5);
+bool ProcessTracer::writeProcMemory(unsigned long address, const void *buffer,
+                                    int length) {
+  std::string filename = "/proc/" + std::to_string(process_id_) + "/mem";
+  int fd = open(filename.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
   }
+  ssize_t written = pwrite(fd, buffer, length, (off_t)address);
+  close(fd);
+  return written == length;
+}
+
+static void onStopTimeout(int signal_number) {
+  // only interrupts waitpid
+}
+
+/**
+ * @brief Wait for the next stop of the target process
+ *
+ * Blocks in waitpid until the target stops, so the stop is noticed as soon as
+ * it happens. An interval timer interrupts the wait when the target does not
+ * stop in time.
+ *
+ * @param timeout_ms Maximum time to wait in milliseconds
+ * @return Signal the process stopped with, or -1 on timeout or exit
+ */
+int ProcessTracer::waitForStopSignal(int timeout_ms) {
+  struct sigaction timeout_action, previous_action;
+  memset(&timeout_action, 0, sizeof(timeout_action));
+  timeout_action.sa_handler = onStopTimeout;
+  sigemptyset(&timeout_action.sa_mask);
+  // without SA_RESTART so that waitpid fails with EINTR
+  sigaction(SIGALRM, &timeout_action, &previous_action);
+
+  struct itimerval timer;
+  memset(&timer, 0, sizeof(timer));
+  timer.it_value.tv_sec = timeout_ms / 1000;
+  timer.it_value.tv_usec = (timeout_ms % 1000) * 1000;
+  setitimer(ITIMER_REAL, &timer, NULL);
+
+  int wait_status = 0;
+  pid_t result = waitpid(process_id_, &wait_status, __WALL);
+  int wait_errno = errno;
+
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_REAL, &timer, NULL);
+  sigaction(SIGALRM, &previous_action, NULL);
 
-  // this is mostly due to gil lock not released, so injected code cannot
-  // execute
-  signal_info.si_signo = -1;
-  return signal_info;
+  if (result != process_id_) {
+    if (debug_mode_) {
+      std::cerr << "waitpid(" << process_id_ << ") failed: "
+                << strerror(wait_errno) << std::endl;
+    }
+    return -1;
+  }
+  if (!WIFSTOPPED(wait_status)) {
+    // exited or killed, there is nothing left to restore
+    is_attached_ = false;
+    return -1;
+  }
+  return WSTOPSIG(wait_status);
 }
 
 /**
  * @brief Verify the signal status of the target process
  *
- * Checks that the target process stopped with the expected SIGTRAP signal.
- * If not, it prints an error message and stops the process for debugging.
+ * Waits until the target stops with the expected SIGTRAP signal. Signals
+ * arriving meanwhile are held back and delivered on detach, while faults mean
+ * the injected code crashed, so an error message is printed and the process
+ * is stopped for debugging.
  *
  * @return true if signal status is as expected, false otherwise
  */
 bool ProcessTracer::verifySignalStatus() {
-  // Check the signal that the child stopped with.
-  siginfo_t signal_info = getSignalInfo();
-  if (signal_info.si_signo == -1) {
-    return false;
-  }
+  long long deadline = monotonicNanos() + TRAP_TIMEOUT_MS * 1000000LL;
+  while (true) {
+    int remaining_ms = (int)((deadline - monotonicNanos()) / 1000000);
+    if (remaining_ms <= 0) {
+      return false;
+    }
+    // Check the signal that the child stopped with.
+    int signal_number = waitForStopSignal(remaining_ms);
+    if (signal_number == -1) {
+      // this is mostly due to gil lock not released, so injected code cannot
+      // execute
+      return false;
+    }
+    if (signal_number == SIGTRAP) {
+      return true;
+    }
+
+    if (signal_number != SIGSEGV && signal_number != SIGBUS &&
+        signal_number != SIGILL && signal_number != SIGFPE &&
+        signal_number != SIGABRT) {
+      // e.g. a profiling timer, not for the injected code. SIGSTOP is the
+      // one of PTRACE_ATTACH when another signal was reported first
+      if (signal_number != SIGSTOP) {
+        pending_signal_ = signal_number;
+      }
+      int result = ptrace(PTRACE_CONT, process_id_, NULL, NULL);
+      CHECK_PTRACE_RESULT(result, PTRACE_CONT);
+      continue;
+    }
 
-  // If it wasn't SIGTRAP, then something bad happened (most likely a segfault).
-  if (signal_info.si_signo != SIGTRAP) {
+    // Something bad happened (most likely a segfault).
     if (debug_mode_) {
       std::cerr << "instead of expected SIGTRAP, target stopped with signal "
-                << signal_info.si_signo << ": "
-                << strsignal(signal_info.si_signo) << std::endl;
+                << signal_number << ": " << strsignal(signal_number)
+                << std::endl;
       std::cerr << "sending process " << process_id_
                 << " a SIGSTOP signal for debugging purposes" << std::endl;
     }
     ptrace(PTRACE_CONT, process_id_, NULL, SIGSTOP);
     exit(1);
   }
-
-  return true;
 }
 
 /**
@@ -299,15 +432,12 @@ bool ProcessTracer::recoverInjection(long injection_address,
 }
 
 /**
- * @brief Sleep for a specified number of milliseconds
- *
- * Uses nanosleep to sleep for the specified number of milliseconds.
+ * @brief Read the monotonic clock
  *
- * @param milliseconds Number of milliseconds to sleep
+ * @return Current monotonic time in nanoseconds
  */
-void ProcessTracer::sleepMs(int milliseconds) {
-  struct timespec sleep_time;
-  sleep_time.tv_sec = 0;
-  sleep_time.tv_nsec = milliseconds * 1000000; // Convert to nanoseconds
-  nanosleep(&sleep_time, NULL);
+long long ProcessTracer::monotonicNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000LL + now.tv_nsec;
 }
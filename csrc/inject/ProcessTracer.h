@@ -10,10 +10,21 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
-#ifdef ARM
-#define REG_TYPE struct user_regs
-#else
+// glibc names user_pt_regs of aarch64 user_regs_struct as well
 #define REG_TYPE struct user_regs_struct
+
+#if defined(__aarch64__)
+#define REG_INSTRUCTION_POINTER(registers) ((registers).pc)
+#define REG_RETURN_VALUE(registers) ((registers).regs[0])
+// size of the svc instruction, the kernel moves back the pc by it to restart
+// an interrupted syscall
+#define SYSCALL_INSTRUCTION_SIZE 4
+#elif defined(__x86_64__)
+#define REG_INSTRUCTION_POINTER(registers) ((registers).rip)
+#define REG_RETURN_VALUE(registers) ((registers).rax)
+#define SYSCALL_INSTRUCTION_SIZE 2
+#else
+#error "ptrace injection supports x86_64 and aarch64 only"
 #endif
 
 /**
@@ -99,10 +110,11 @@ public:
 
   // Signal handling
   /**
-   * @brief Get signal information for the target process
-   * @return siginfo_t structure containing signal information
+   * @brief Wait for the next stop of the target process
+   * @param timeout_ms Maximum time to wait in milliseconds
+   * @return Signal the process stopped with, or -1 on timeout or exit
    */
-  siginfo_t getSignalInfo();
+  int waitForStopSignal(int timeout_ms);
 
   /**
    * @brief Verify the signal status of the target process
@@ -129,18 +141,37 @@ public:
    */
   bool isDebugMode() const { return debug_mode_; }
 
+  /**
+   * @brief Get the time the process stayed stopped by the last attach
+   * @return Nanoseconds from attach to detach
+   */
+  long long getStoppedNanos() const { return stopped_nanos_; }
+
+  /**
+   * @brief Read the monotonic clock
+   * @return Current monotonic time in nanoseconds
+   */
+  static long long monotonicNanos();
+
 private:
   pid_t process_id_; ///< PID of the process being traced
   bool is_attached_; ///< Flag indicating if we're currently attached to the
                      ///< process
   bool debug_mode_;  ///< Flag indicating if debug logging is enabled
+  int pending_signal_; ///< Signal received while stopped, delivered on detach
+  long long attach_nanos_;  ///< Monotonic time of the last attach
+  long long stopped_nanos_; ///< Time stopped by the last attach
 
   // Helper functions
   /**
-   * @brief Sleep for a specified number of milliseconds
-   * @param milliseconds Number of milliseconds to sleep
+   * @brief Write memory through /proc/[pid]/mem, which unlike
+   * process_vm_writev may write read-only mappings like text pages
+   * @param address Address to write to
+   * @param buffer Buffer containing the data to write
+   * @param length Number of bytes to write
+   * @return true if memory was successfully written, false otherwise
    */
-  void sleepMs(int milliseconds);
+  bool writeProcMemory(unsigned long address, const void *buffer, int length);
 };
 
 #endif // PROCESS_TRACER_H
@@ -164,21 +164,3 @@ long ProcessUtils::resolveFunctionAddress(const std::string &function_name) {
 
   return address;
 }
-
-/**
- * @brief Locate the return instruction in a function
- *
- * Searches backwards from the end address to find the return instruction
- * (0xc3).
- *
- * @param end_address End address of the function
- * @return Pointer to the return instruction
- */
-unsigned char *ProcessUtils::locateReturnInstruction(void *end_address) {
-  unsigned char *return_instruction_address =
-      static_cast<unsigned char *>(end_address);
-  while (*return_instruction_address != 0xc3) { // 0xc3 is the opcode for 'ret'
-    return_instruction_address--;
-  }
-  return return_instruction_address;
-}
@@ -7,11 +7,7 @@
 #include <string>
 #include <unistd.h>
 
-#ifdef ARM
-#define REG_TYPE struct user_regs
-#else
 #define REG_TYPE struct user_regs_struct
-#endif
 
 /**
  * @brief A utility class for process-related operations
@@ -53,14 +49,6 @@ public:
    * @return Address of the function, or 0 on failure
    */
   static long resolveFunctionAddress(const std::string &function_name);
-
-  // Instruction management
-  /**
-   * @brief Locate the return instruction in a function
-   * @param end_address End address of the function
-   * @return Pointer to the return instruction
-   */
-  static unsigned char *locateReturnInstruction(void *end_address);
 };
 
 #endif // PROCESS_UTILS_H
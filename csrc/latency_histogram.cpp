@@ -0,0 +1,66 @@
+#include "latency_histogram.h"
+
+// highest value that falls into bucket index
+static unsigned long bucket_high_value(unsigned int index) {
+  if (index < LATENCY_HISTOGRAM_SUB_COUNT) {
+    return index;
+  }
+  unsigned int shift = index / LATENCY_HISTOGRAM_SUB_COUNT - 1;
+  unsigned long sub = index % LATENCY_HISTOGRAM_SUB_COUNT;
+  return ((LATENCY_HISTOGRAM_SUB_COUNT + sub) << shift) + (1ul << shift) - 1;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void latency_histogram_snapshot(latency_histogram *dst,
+                                const latency_histogram *src) {
+  for (unsigned int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    dst->buckets[i] = __atomic_load_n(&src->buckets[i], __ATOMIC_RELAXED);
+  }
+  dst->max = __atomic_load_n(&src->max, __ATOMIC_RELAXED);
+  // buckets may be a few records ahead of count, count them directly
+  unsigned long count = 0;
+  for (unsigned int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    count += dst->buckets[i];
+  }
+  dst->count = count;
+}
+
+void latency_histogram_merge(latency_histogram *dst,
+                             const latency_histogram *src) {
+  for (unsigned int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    dst->buckets[i] += src->buckets[i];
+  }
+  dst->count += src->count;
+  if (src->max > dst->max) {
+    dst->max = src->max;
+  }
+}
+
+unsigned long latency_histogram_percentile(const latency_histogram *h,
+                                           double percentile) {
+  if (h->count == 0) {
+    return 0;
+  }
+  // rank of the percentile value, rounded up
+  double rank = h->count * percentile / 100.0;
+  unsigned long target = (unsigned long)rank;
+  if (target < rank || target == 0) {
+    target++;
+  }
+  unsigned long seen = 0;
+  for (unsigned int i = 0; i < LATENCY_HISTOGRAM_BUCKETS; i++) {
+    seen += h->buckets[i];
+    if (seen >= target) {
+      unsigned long value = bucket_high_value(i);
+      return value < h->max ? value : h->max;
+    }
+  }
+  return h->max;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,72 @@
+#ifndef __LATENCY_HISTOGRAM_H__
+#define __LATENCY_HISTOGRAM_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * log-linear histogram with fixed memory, every power of two range is split
+ * into 2^LATENCY_HISTOGRAM_SUB_BITS linear sub buckets, so relative error of a
+ * reported percentile is at most 1/2^LATENCY_HISTOGRAM_SUB_BITS
+ */
+#define LATENCY_HISTOGRAM_SUB_BITS 4
+#define LATENCY_HISTOGRAM_SUB_COUNT (1ul << LATENCY_HISTOGRAM_SUB_BITS)
+// values at or above 2^LATENCY_HISTOGRAM_MAX_BITS fall into the last bucket
+#define LATENCY_HISTOGRAM_MAX_BITS 40
+#define LATENCY_HISTOGRAM_BUCKETS                                              \
+  ((LATENCY_HISTOGRAM_MAX_BITS - LATENCY_HISTOGRAM_SUB_BITS + 1) *             \
+   LATENCY_HISTOGRAM_SUB_COUNT)
+
+typedef struct _latency_histogram {
+  unsigned long count;
+  unsigned long max;
+  unsigned long buckets[LATENCY_HISTOGRAM_BUCKETS];
+} latency_histogram;
+
+static inline unsigned int latency_histogram_index(unsigned long value) {
+  if (value < LATENCY_HISTOGRAM_SUB_COUNT) {
+    return (unsigned int)value;
+  }
+  unsigned int msb = 63 - __builtin_clzl(value);
+  if (msb >= LATENCY_HISTOGRAM_MAX_BITS) {
+    return LATENCY_HISTOGRAM_BUCKETS - 1;
+  }
+  unsigned int shift = msb - LATENCY_HISTOGRAM_SUB_BITS;
+  return (shift + 1) * LATENCY_HISTOGRAM_SUB_COUNT +
+         (unsigned int)((value >> shift) - LATENCY_HISTOGRAM_SUB_COUNT);
+}
+
+/**
+ * record one value, only the owner thread writes a histogram so no atomic
+ * read-modify-write is needed, other threads may read it at any time
+ */
+static inline void latency_histogram_record(latency_histogram *h,
+                                            unsigned long value) {
+  unsigned long *bucket = &h->buckets[latency_histogram_index(value)];
+  __atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+  if (value > h->max) {
+    __atomic_store_n(&h->max, value, __ATOMIC_RELAXED);
+  }
+}
+
+// copy a histogram written concurrently by its owner thread
+void latency_histogram_snapshot(latency_histogram *dst,
+                                const latency_histogram *src);
+
+void latency_histogram_merge(latency_histogram *dst,
+                             const latency_histogram *src);
+
+/**
+ * value at the given percentile(0-100), it is the highest value of the
+ * matched bucket, capped by the recorded max
+ */
+unsigned long latency_histogram_percentile(const latency_histogram *h,
+                                           double percentile);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,58 @@
+#include "Python.h"
+#include "symbol.h"
+
+static int (*start_func)(int, int) = NULL;
+static int (*stop_func)() = NULL;
+static long (*dump_func)(int) = NULL;
+
+static PyObject *start_sampler(PyObject *self, PyObject *args) {
+  int rate;
+  // 0: wall 1: cpu
+  int mode = 0;
+  if (start_func == NULL || !PyArg_ParseTuple(args, "i|i", &rate, &mode)) {
+    return Py_BuildValue("i", -1);
+  }
+  return Py_BuildValue("i", start_func(rate, mode));
+}
+
+static PyObject *stop_sampler(PyObject *self, PyObject *args) {
+  if (stop_func == NULL) {
+    return Py_BuildValue("i", -1);
+  }
+  return Py_BuildValue("i", stop_func());
+}
+
+static PyObject *dump_sampler(PyObject *self, PyObject *args) {
+  int fd;
+  if (dump_func == NULL || !PyArg_ParseTuple(args, "i", &fd)) {
+    return Py_BuildValue("l", -1l);
+  }
+  return Py_BuildValue("l", dump_func(fd));
+}
+
+static PyMethodDef perf_module_methods[] = {
+    {"start_sampler", (PyCFunction)start_sampler, METH_VARARGS,
+     "start sampling python stacks"},
+    {"stop_sampler", (PyCFunction)stop_sampler, METH_VARARGS,
+     "stop sampling python stacks"},
+    {"dump_sampler", (PyCFunction)dump_sampler, METH_VARARGS,
+     "dump collapsed stacks and reset samples"},
+    {NULL, NULL, 0, NULL}};
+
+static struct PyModuleDef perf_module = {
+    PyModuleDef_HEAD_INIT,
+    // name of module
+    "perf_C",
+    // module documentation
+    NULL,
+    // size of per-interpreter state of the module, or -1 if the module keeps
+    // state in global variables
+    -1, perf_module_methods};
+
+// will be called when python module first loaded
+PyMODINIT_FUNC PyInit_perf_C(void) {
+  start_func = (int (*)(int, int))get_symbol_addr("start_py_sampler");
+  stop_func = (int (*)())get_symbol_addr("stop_py_sampler");
+  dump_func = (long (*)(int))get_symbol_addr("dump_py_sampler");
+  return PyModule_Create(&perf_module);
+}
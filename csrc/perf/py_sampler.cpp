@@ -0,0 +1,756 @@
+#include "py_sampler.h"
+#include "frameobject.h"
+#include "py_gil_intercept.h"
+#include <cstdio>
+#include <limits.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
+
+#define SAMPLE_INDEX_INIT_CAPACITY 4096
+#define SAMPLE_INTERN_FAILED UINT_MAX
+
+// reserved frames have no code object and are never interned
+#define SAMPLE_FRAME_TRUNCATED 0
+#define SAMPLE_FRAME_DROPPED 1
+// frame of a state node, SAMPLE_STATE_WALL samples hang on the root directly
+#define SAMPLE_STATE_FRAME(state) (SAMPLE_FRAME_DROPPED + (state))
+#define SAMPLE_RESERVED_FRAMES SAMPLE_STATE_FRAME(SAMPLE_STATE_COUNT)
+
+static const char *reserved_frame_names[SAMPLE_RESERVED_FRAMES] = {
+    "<truncated>", "<dropped>", "[cpu]", "[gil]", "[syscall]"};
+
+struct bootstate {
+  PyInterpreterState *interp;
+  PySampler *sampler;
+};
+
+typedef unsigned long (*sample_hash_func)(const void *entries, unsigned int i);
+
+static unsigned long mix_hash(unsigned long a, unsigned long b) {
+  unsigned long h = a * 0x9E3779B97F4A7C15ul ^ b * 0xC2B2AE3D27D4EB4Ful;
+  return h ^ (h >> 29);
+}
+
+static unsigned long frame_hash_at(const void *entries, unsigned int i) {
+  const sample_frame *frame = (const sample_frame *)entries + i;
+  return mix_hash((unsigned long)frame->code, (unsigned long)frame->line);
+}
+
+static unsigned long node_hash_at(const void *entries, unsigned int i) {
+  const sample_node *node = (const sample_node *)entries + i;
+  return mix_hash(node->parent, node->frame);
+}
+
+static void index_clear(sample_index *index) {
+  if (index->buckets != NULL) {
+    memset(index->buckets, 0, sizeof(unsigned int) * index->capacity);
+  }
+  index->size = 0;
+}
+
+// rebuild buckets with the given power of two capacity
+static int index_resize(sample_index *index, unsigned int capacity,
+                        const void *entries, sample_hash_func hash) {
+  unsigned int *buckets =
+      (unsigned int *)calloc(capacity, sizeof(unsigned int));
+  if (buckets == NULL) {
+    return -1;
+  }
+  for (unsigned int i = 0; i < index->capacity; i++) {
+    unsigned int value = index->buckets[i];
+    if (value == 0) {
+      continue;
+    }
+    unsigned int pos = hash(entries, value - 1) & (capacity - 1);
+    while (buckets[pos] != 0) {
+      pos = (pos + 1) & (capacity - 1);
+    }
+    buckets[pos] = value;
+  }
+  free(index->buckets);
+  index->buckets = buckets;
+  index->capacity = capacity;
+  return 0;
+}
+
+// keep the load factor below 3/4
+static int index_reserve(sample_index *index, const void *entries,
+                         sample_hash_func hash) {
+  if ((index->size + 1) * 4 <= index->capacity * 3) {
+    return 0;
+  }
+  unsigned int capacity = index->capacity == 0 ? SAMPLE_INDEX_INIT_CAPACITY
+                                               : index->capacity * 2;
+  return index_resize(index, capacity, entries, hash);
+}
+
+static void *grow_array(void *array, unsigned int *capacity, size_t item_size) {
+  unsigned int new_capacity =
+      *capacity == 0 ? SAMPLE_INDEX_INIT_CAPACITY : *capacity * 2;
+  void *new_array = realloc(array, item_size * new_capacity);
+  if (new_array != NULL) {
+    *capacity = new_capacity;
+  }
+  return new_array;
+}
+
+// new reference
+static PyObject *frame_code(PyFrameObject *frame) {
+#if PY_VERSION_HEX >= 0x03090000
+  return (PyObject *)PyFrame_GetCode(frame);
+#else
+  Py_INCREF(frame->f_code);
+  return (PyObject *)frame->f_code;
+#endif
+}
+
+// new reference
+static PyFrameObject *frame_back(PyFrameObject *frame) {
+#if PY_VERSION_HEX >= 0x03090000
+  return PyFrame_GetBack(frame);
+#else
+  Py_XINCREF(frame->f_back);
+  return frame->f_back;
+#endif
+}
+
+// ';' separates frames and '\n' separates stacks in collapsed output
+static void sanitize_name(char *name) {
+  for (char *p = name; *p != '\0'; p++) {
+    if (*p == ';' || *p == '\n') {
+      *p = '_';
+    }
+  }
+}
+
+static unsigned long monotonic_ns() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ul + now.tv_nsec;
+}
+
+// cpu time consumed by a live thread, python thread ident is its pthread_t
+static int thread_cpu_ns(unsigned long ident, unsigned long *cpu_ns) {
+#if defined(__APPLE__)
+  mach_port_t port = pthread_mach_thread_np((pthread_t)ident);
+  thread_basic_info_data_t info;
+  mach_msg_type_number_t count = THREAD_BASIC_INFO_COUNT;
+  if (thread_info(port, THREAD_BASIC_INFO, (thread_info_t)&info, &count) !=
+      KERN_SUCCESS) {
+    return -1;
+  }
+  *cpu_ns = (info.user_time.seconds + info.system_time.seconds) *
+                1000000000ul +
+            (info.user_time.microseconds + info.system_time.microseconds) *
+                1000ul;
+#else
+  clockid_t clock_id;
+  struct timespec t;
+  if (pthread_getcpuclockid((pthread_t)ident, &clock_id) != 0 ||
+      clock_gettime(clock_id, &t) != 0) {
+    return -1;
+  }
+  *cpu_ns = t.tv_sec * 1000000000ul + t.tv_nsec;
+#endif
+  return 0;
+}
+
+static void sleep_until(const struct timespec *deadline) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long ns = (deadline->tv_sec - now.tv_sec) * 1000000000l +
+            (deadline->tv_nsec - now.tv_nsec);
+  if (ns <= 0) {
+    return;
+  }
+  struct timespec t;
+  t.tv_sec = ns / 1000000000l;
+  t.tv_nsec = ns % 1000000000l;
+  nanosleep(&t, NULL);
+}
+
+PySampler::PySampler() {
+  frames = NULL;
+  frames_size = 0;
+  frames_capacity = 0;
+  memset(&frame_index, 0, sizeof(frame_index));
+  nodes = NULL;
+  nodes_size = 0;
+  nodes_capacity = 0;
+  memset(&node_index, 0, sizeof(node_index));
+  memset(state_nodes, 0, sizeof(state_nodes));
+  memset(dropped_nodes, 0, sizeof(dropped_nodes));
+  samples = 0;
+  mode = SAMPLE_MODE_WALL;
+  tick = 0;
+  active_threads = NULL;
+  interval_ns = 0;
+  sample_thread_id = 0;
+  running_flag = false;
+  sample_thread_exited = true;
+}
+
+PySampler::~PySampler() {
+  free(frames);
+  free(frame_index.buckets);
+  free(nodes);
+  free(node_index.buckets);
+}
+
+int PySampler::start(int rate, int mode) {
+  if (this->running_flag) {
+    fprintf(stderr, "[*] py_sampler is already running\n");
+    return -1;
+  }
+  if (!__atomic_load_n(&this->sample_thread_exited, __ATOMIC_ACQUIRE)) {
+    fprintf(stderr, "[*] py_sampler former thread has not exited\n");
+    return -1;
+  }
+  if (rate <= 0) {
+    fprintf(stderr, "[*] py_sampler invalid rate %d\n", rate);
+    return -1;
+  }
+  if (mode != SAMPLE_MODE_WALL && mode != SAMPLE_MODE_CPU) {
+    fprintf(stderr, "[*] py_sampler invalid mode %d\n", mode);
+    return -1;
+  }
+  // samples of the former session are kept until dumped, counts and micro
+  // seconds can not be mixed in one tree though
+  if (this->nodes_size != 0 && this->mode != mode) {
+    this->reset();
+  }
+  if (this->nodes_size == 0 && this->init_tree() != 0) {
+    fprintf(stderr, "[*] py_sampler alloc call tree failed\n");
+    return -1;
+  }
+  this->mode = mode;
+  this->tick = 0;
+  this->thread_clocks.clear();
+  this->interval_ns = 1000000000l / rate;
+  this->running_flag = true;
+  this->sample_thread_exited = false;
+  this->start_python_sample_thread();
+  if (this->sample_thread_id == 0) {
+    this->running_flag = false;
+    this->sample_thread_exited = true;
+    return -1;
+  }
+  return 0;
+}
+
+int PySampler::stop() {
+  if (this->running_flag == false) {
+    return 0;
+  }
+  this->running_flag = false;
+
+  // sample thread is detached by PyThread_start_new_thread and can not be
+  // joined, wait until it no longer touches this instance
+  int waited_ms = 0;
+  // drop gil, sample thread takes gil before it exits
+  PyThreadState *tstate = PyEval_SaveThread();
+  while (!__atomic_load_n(&sample_thread_exited, __ATOMIC_ACQUIRE) &&
+         waited_ms < 5000) {
+    usleep(10000);
+    waited_ms += 10;
+  }
+  PyEval_RestoreThread(tstate);
+
+  if (!__atomic_load_n(&sample_thread_exited, __ATOMIC_ACQUIRE)) {
+    fprintf(stderr, "[*] py_sampler thread exit timeout\n");
+    return -1;
+  }
+  this->sample_thread_id = 0;
+  return 0;
+}
+
+long PySampler::dump(int fd) {
+  if (this->nodes_size == 0) {
+    return 0;
+  }
+  int dup_fd = dup(fd);
+  FILE *fp = dup_fd < 0 ? NULL : fdopen(dup_fd, "w");
+  if (fp == NULL) {
+    if (dup_fd >= 0) {
+      close(dup_fd);
+    }
+    fprintf(stderr, "[*] py_sampler open dump file failed\n");
+    return -1;
+  }
+  char **names = (char **)calloc(this->frames_size, sizeof(char *));
+  if (names == NULL) {
+    fclose(fp);
+    fprintf(stderr, "[*] py_sampler alloc frame names failed\n");
+    return -1;
+  }
+  for (unsigned int i = 0; i < this->frames_size; i++) {
+    names[i] = this->format_frame(i);
+  }
+
+  // one line per call path: outermost;...;innermost count. a path is the
+  // state node, <truncated> and at most PY_SAMPLER_MAX_DEPTH frames
+  unsigned int path[PY_SAMPLER_MAX_DEPTH + 2];
+  for (unsigned int i = 1; i < this->nodes_size; i++) {
+    if (this->nodes[i].self_count == 0) {
+      continue;
+    }
+    int depth = 0;
+    for (unsigned int n = i; n != 0 && depth < PY_SAMPLER_MAX_DEPTH + 2;
+         n = this->nodes[n].parent) {
+      path[depth++] = this->nodes[n].frame;
+    }
+    for (int d = depth - 1; d >= 0; d--) {
+      const char *name = names[path[d]];
+      fputs(name != NULL ? name : "<unknown>", fp);
+      fputc(d > 0 ? ';' : ' ', fp);
+    }
+    fprintf(fp, "%lu\n", this->nodes[i].self_count);
+  }
+  fclose(fp);
+
+  for (unsigned int i = 0; i < this->frames_size; i++) {
+    free(names[i]);
+  }
+  free(names);
+  long dumped = (long)this->samples;
+  this->reset();
+  return dumped;
+}
+
+int PySampler::init_tree() {
+  this->frames_size = 0;
+  this->nodes_size = 0;
+  this->samples = 0;
+  index_clear(&this->frame_index);
+  index_clear(&this->node_index);
+  if (this->frames_capacity < SAMPLE_RESERVED_FRAMES) {
+    sample_frame *array = (sample_frame *)grow_array(
+        this->frames, &this->frames_capacity, sizeof(sample_frame));
+    if (array == NULL) {
+      return -1;
+    }
+    this->frames = array;
+  }
+  if (this->nodes_capacity < SAMPLE_RESERVED_FRAMES) {
+    sample_node *array = (sample_node *)grow_array(
+        this->nodes, &this->nodes_capacity, sizeof(sample_node));
+    if (array == NULL) {
+      return -1;
+    }
+    this->nodes = array;
+  }
+  for (unsigned int i = 0; i < SAMPLE_RESERVED_FRAMES; i++) {
+    this->frames[i].code = NULL;
+    this->frames[i].line = 0;
+  }
+  this->frames_size = SAMPLE_RESERVED_FRAMES;
+
+  this->nodes[0].parent = 0;
+  this->nodes[0].frame = 0;
+  this->nodes[0].self_count = 0;
+  this->nodes_size = 1;
+  for (int state = 0; state < SAMPLE_STATE_COUNT; state++) {
+    unsigned int node =
+        state == SAMPLE_STATE_WALL
+            ? 0
+            : this->intern_node(0, SAMPLE_STATE_FRAME(state));
+    if (node == SAMPLE_INTERN_FAILED) {
+      return -1;
+    }
+    this->state_nodes[state] = node;
+    this->dropped_nodes[state] =
+        this->intern_node(node, SAMPLE_FRAME_DROPPED);
+    if (this->dropped_nodes[state] == SAMPLE_INTERN_FAILED) {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+void PySampler::reset() {
+  for (unsigned int i = 0; i < this->frames_size; i++) {
+    Py_XDECREF(this->frames[i].code);
+  }
+  // arrays are kept, only fails when they were never allocated
+  if (this->init_tree() != 0) {
+    this->nodes_size = 0;
+  }
+}
+
+unsigned int PySampler::intern_frame(PyObject *code, int line) {
+  if (index_reserve(&this->frame_index, this->frames, frame_hash_at) != 0) {
+    return SAMPLE_INTERN_FAILED;
+  }
+  unsigned int mask = this->frame_index.capacity - 1;
+  unsigned int pos = mix_hash((unsigned long)code, (unsigned long)line) & mask;
+  while (this->frame_index.buckets[pos] != 0) {
+    unsigned int i = this->frame_index.buckets[pos] - 1;
+    if (this->frames[i].code == code && this->frames[i].line == line) {
+      return i;
+    }
+    pos = (pos + 1) & mask;
+  }
+  if (this->frames_size == this->frames_capacity) {
+    sample_frame *array = (sample_frame *)grow_array(
+        this->frames, &this->frames_capacity, sizeof(sample_frame));
+    if (array == NULL) {
+      return SAMPLE_INTERN_FAILED;
+    }
+    this->frames = array;
+  }
+  unsigned int i = this->frames_size++;
+  // keep the code object alive, its address must not be reused for another
+  Py_INCREF(code);
+  this->frames[i].code = code;
+  this->frames[i].line = line;
+  this->frame_index.buckets[pos] = i + 1;
+  this->frame_index.size++;
+  return i;
+}
+
+unsigned int PySampler::intern_node(unsigned int parent, unsigned int frame) {
+  if (index_reserve(&this->node_index, this->nodes, node_hash_at) != 0) {
+    return SAMPLE_INTERN_FAILED;
+  }
+  unsigned int mask = this->node_index.capacity - 1;
+  unsigned int pos = mix_hash(parent, frame) & mask;
+  while (this->node_index.buckets[pos] != 0) {
+    unsigned int i = this->node_index.buckets[pos] - 1;
+    if (this->nodes[i].parent == parent && this->nodes[i].frame == frame) {
+      return i;
+    }
+    pos = (pos + 1) & mask;
+  }
+  if (this->nodes_size >= PY_SAMPLER_MAX_NODES) {
+    return SAMPLE_INTERN_FAILED;
+  }
+  if (this->nodes_size == this->nodes_capacity) {
+    sample_node *array = (sample_node *)grow_array(
+        this->nodes, &this->nodes_capacity, sizeof(sample_node));
+    if (array == NULL) {
+      return SAMPLE_INTERN_FAILED;
+    }
+    this->nodes = array;
+  }
+  unsigned int i = this->nodes_size++;
+  this->nodes[i].parent = parent;
+  this->nodes[i].frame = frame;
+  this->nodes[i].self_count = 0;
+  this->node_index.buckets[pos] = i + 1;
+  this->node_index.size++;
+  return i;
+}
+
+char *PySampler::format_frame(unsigned int frame) {
+  if (frame < SAMPLE_RESERVED_FRAMES) {
+    return strdup(reserved_frame_names[frame]);
+  }
+  PyObject *code = this->frames[frame].code;
+#if PY_VERSION_HEX >= 0x030B0000
+  PyObject *name = PyObject_GetAttrString(code, "co_qualname");
+#else
+  PyObject *name = PyObject_GetAttrString(code, "co_name");
+#endif
+  PyObject *filename = PyObject_GetAttrString(code, "co_filename");
+  const char *name_str = name != NULL ? PyUnicode_AsUTF8(name) : NULL;
+  const char *filename_str =
+      filename != NULL ? PyUnicode_AsUTF8(filename) : NULL;
+  PyErr_Clear();
+
+  char *buffer = NULL;
+  int size = snprintf(NULL, 0, "%s (%s:%d)", name_str ? name_str : "<unknown>",
+                      filename_str ? filename_str : "<unknown>",
+                      this->frames[frame].line);
+  if (size >= 0) {
+    buffer = (char *)malloc(size + 1);
+    if (buffer != NULL) {
+      snprintf(buffer, size + 1, "%s (%s:%d)",
+               name_str ? name_str : "<unknown>",
+               filename_str ? filename_str : "<unknown>",
+               this->frames[frame].line);
+      sanitize_name(buffer);
+    }
+  }
+  Py_XDECREF(name);
+  Py_XDECREF(filename);
+  return buffer;
+}
+
+bool PySampler::is_self_thread(PyObject *ident) {
+  if (this->active_threads == NULL) {
+    return false;
+  }
+  // threading._active, borrowed
+  PyObject *thread = PyDict_GetItem(this->active_threads, ident);
+  if (thread == NULL) {
+    return false;
+  }
+  bool self = false;
+  PyObject *name = PyObject_GetAttrString(thread, "name");
+  if (name != NULL) {
+    const char *name_str = PyUnicode_AsUTF8(name);
+    self = name_str != NULL &&
+           strncmp(name_str, PY_SAMPLER_SELF_THREAD_PREFIX,
+                   sizeof(PY_SAMPLER_SELF_THREAD_PREFIX) - 1) == 0;
+    Py_DECREF(name);
+  }
+  PyErr_Clear();
+  return self;
+}
+
+bool PySampler::thread_times(unsigned long ident, unsigned long wall_ns,
+                             unsigned long *weights) {
+  unsigned long cpu_ns;
+  if (thread_cpu_ns(ident, &cpu_ns) != 0) {
+    return false;
+  }
+  std::map<unsigned long, sample_thread_clock>::iterator it =
+      this->thread_clocks.find(ident);
+  if (it == this->thread_clocks.end()) {
+    sample_thread_clock clock = {cpu_ns, wall_ns, this->tick};
+    this->thread_clocks[ident] = clock;
+    return false;
+  }
+  sample_thread_clock *clock = &it->second;
+  unsigned long cpu_delta = cpu_ns > clock->cpu_ns ? cpu_ns - clock->cpu_ns : 0;
+  unsigned long wall_delta =
+      wall_ns > clock->wall_ns ? wall_ns - clock->wall_ns : 0;
+  unsigned long off_cpu = wall_delta > cpu_delta ? wall_delta - cpu_delta : 0;
+  clock->cpu_ns = cpu_ns;
+  clock->wall_ns = wall_ns;
+  clock->tick = this->tick;
+
+  // time off cpu is spent either waiting for the gil or blocked in the
+  // kernel, tell them apart by whether the thread is inside take_gil now
+  bool taking_gil = py_gil_thread_taking(ident) == 1;
+  weights[SAMPLE_STATE_CPU] = cpu_delta / 1000;
+  weights[SAMPLE_STATE_GIL] = taking_gil ? off_cpu / 1000 : 0;
+  weights[SAMPLE_STATE_SYSCALL] = taking_gil ? 0 : off_cpu / 1000;
+  return true;
+}
+
+void PySampler::add_sample(PyObject *frame_obj, const unsigned long *weights) {
+  PyObject *codes[PY_SAMPLER_MAX_DEPTH];
+  int lines[PY_SAMPLER_MAX_DEPTH];
+  int depth = 0;
+
+  // innermost first
+  PyFrameObject *frame = (PyFrameObject *)frame_obj;
+  Py_INCREF(frame);
+  while (frame != NULL && depth < PY_SAMPLER_MAX_DEPTH) {
+    codes[depth] = frame_code(frame);
+    lines[depth] = PyFrame_GetLineNumber(frame);
+    depth++;
+    PyFrameObject *back = frame_back(frame);
+    Py_DECREF(frame);
+    frame = back;
+  }
+  bool truncated = frame != NULL;
+  Py_XDECREF(frame);
+  if (depth == 0) {
+    return;
+  }
+
+  for (int state = 0; state < SAMPLE_STATE_COUNT; state++) {
+    if (weights[state] == 0) {
+      continue;
+    }
+    unsigned int node = this->state_nodes[state];
+    if (truncated) {
+      node = this->intern_node(node, SAMPLE_FRAME_TRUNCATED);
+    }
+    for (int d = depth - 1; d >= 0 && node != SAMPLE_INTERN_FAILED; d--) {
+      unsigned int f = this->intern_frame(codes[d], lines[d]);
+      node = f == SAMPLE_INTERN_FAILED ? f : this->intern_node(node, f);
+    }
+    if (node == SAMPLE_INTERN_FAILED) {
+      node = this->dropped_nodes[state];
+    }
+    this->nodes[node].self_count += weights[state];
+  }
+  for (int d = 0; d < depth; d++) {
+    Py_DECREF(codes[d]);
+  }
+  this->samples++;
+}
+
+void PySampler::sample_threads(PyObject *current_frames,
+                               unsigned long self_ident) {
+  unsigned long wall_ns = monotonic_ns();
+  this->tick++;
+  PyObject *ident, *frame;
+  Py_ssize_t pos = 0;
+  while (PyDict_Next(current_frames, &pos, &ident, &frame)) {
+    unsigned long thread_ident = PyLong_AsUnsignedLong(ident);
+    if (thread_ident == self_ident) {
+      continue;
+    }
+    if (this->is_self_thread(ident)) {
+      continue;
+    }
+    unsigned long weights[SAMPLE_STATE_COUNT] = {0};
+    if (this->mode == SAMPLE_MODE_WALL) {
+      weights[SAMPLE_STATE_WALL] = 1;
+    } else if (!this->thread_times(thread_ident, wall_ns, weights)) {
+      continue;
+    }
+    this->add_sample(frame, weights);
+  }
+  PyErr_Clear();
+
+  // forget threads that exited, their idents may be reused
+  std::map<unsigned long, sample_thread_clock>::iterator it =
+      this->thread_clocks.begin();
+  while (it != this->thread_clocks.end()) {
+    if (it->second.tick != this->tick) {
+      this->thread_clocks.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
+/**
+ * similar to PyGilStat::boot_entry, the thread takes the gil only while it
+ * walks the frames of other threads
+ */
+void PySampler::boot_entry(void *boot_raw) {
+  struct bootstate *boot = (struct bootstate *)boot_raw;
+  PySampler *sampler = boot->sampler;
+
+#if defined(__APPLE__)
+  pthread_setname_np("py_sampler");
+#else
+  pthread_setname_np(pthread_self(), "py_sampler");
+#endif
+  PyThreadState *tstate = PyThreadState_New(boot->interp);
+  PyMem_RawFree(boot_raw);
+  if (tstate == NULL) {
+    fprintf(stderr,
+            "pyFlightProfiler: Not enough memory to create thread state.\n");
+    __atomic_store_n(&sampler->sample_thread_exited, true, __ATOMIC_RELEASE);
+    return;
+  }
+
+  PyEval_AcquireThread(tstate);
+  unsigned long self_ident = PyThread_get_thread_ident();
+  // sys._current_frames walks thread states under the interpreter lock
+  PyObject *current_frames_func = PySys_GetObject("_current_frames");
+  Py_XINCREF(current_frames_func);
+  PyObject *threading = PyImport_ImportModule("threading");
+  PyObject *active_threads = NULL;
+  if (threading != NULL) {
+    active_threads = PyObject_GetAttrString(threading, "_active");
+    Py_DECREF(threading);
+  }
+  PyErr_Clear();
+  sampler->active_threads = active_threads;
+  PyEval_ReleaseThread(tstate);
+
+  struct timespec deadline;
+  clock_gettime(CLOCK_MONOTONIC, &deadline);
+  while (sampler->running_flag && current_frames_func != NULL) {
+    deadline.tv_nsec += sampler->interval_ns;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000l;
+    deadline.tv_nsec %= 1000000000l;
+    sleep_until(&deadline);
+    // skip ticks missed while waiting for the gil instead of bursting
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - deadline.tv_sec) * 1000000000l +
+            (now.tv_nsec - deadline.tv_nsec) >
+        sampler->interval_ns) {
+      deadline = now;
+    }
+    if (!sampler->running_flag) {
+      break;
+    }
+
+    PyEval_AcquireThread(tstate);
+    PyObject *frames = PyObject_CallObject(current_frames_func, NULL);
+    if (frames != NULL) {
+      sampler->sample_threads(frames, self_ident);
+      Py_DECREF(frames);
+    } else {
+      PyErr_Clear();
+    }
+    PyEval_ReleaseThread(tstate);
+  }
+
+  // ceval.h
+  // here take gil lock, and set current PyThreadState
+  PyEval_AcquireThread(tstate);
+  Py_XDECREF(current_frames_func);
+  Py_XDECREF(sampler->active_threads);
+  sampler->active_threads = NULL;
+  // sampler must not be accessed after this point
+  __atomic_store_n(&sampler->sample_thread_exited, true, __ATOMIC_RELEASE);
+  // clear tstat data
+  PyThreadState_Clear(tstate);
+  // here will reset current PyThreadState, release gil lock and delete
+  // PyThreadState mem
+  PyThreadState_DeleteCurrent();
+}
+
+void PySampler::start_python_sample_thread() {
+  struct bootstate *boot;
+  unsigned long ident;
+
+  boot = (struct bootstate *)PyMem_RawMalloc(sizeof(struct bootstate));
+  if (boot == NULL) {
+    fprintf(stderr,
+            "pyFlightProfiler: alloc memory for sampler bootstate failed\n");
+    return;
+  }
+
+  // init if not yet done
+  PyThread_init_thread();
+
+  PyGILState_STATE old_gil_state = PyGILState_Ensure();
+  boot->interp = PyThreadState_Get()->interp;
+  boot->sampler = this;
+  ident = PyThread_start_new_thread(PySampler::boot_entry, (void *)boot);
+  if (ident == PYTHREAD_INVALID_THREAD_ID) {
+    PyMem_RawFree(boot);
+  } else {
+    this->sample_thread_id = ident;
+  }
+  PyGILState_Release(old_gil_state);
+}
+
+static PySampler *sampler = NULL;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int start_py_sampler(int rate, int mode) {
+  if (sampler == NULL) {
+    sampler = new PySampler();
+  }
+  return sampler->start(rate, mode);
+}
+
+int stop_py_sampler() {
+  if (sampler == NULL) {
+    return 0;
+  }
+  return sampler->stop();
+}
+
+long dump_py_sampler(int fd) {
+  if (sampler == NULL) {
+    return 0;
+  }
+  return sampler->dump(fd);
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,135 @@
+#include "Python.h"
+#include <map>
+#ifndef __PY_SAMPLER_H__
+#define __PY_SAMPLER_H__
+
+// deepest frames kept per sample, outer frames are folded into <truncated>
+#define PY_SAMPLER_MAX_DEPTH 128
+// distinct call paths kept, samples of new paths are counted as <dropped>
+#define PY_SAMPLER_MAX_NODES (1u << 20)
+// threads whose python name starts with it belong to flight_profiler
+#define PY_SAMPLER_SELF_THREAD_PREFIX "flight-profiler-"
+
+enum _sample_mode {
+  // one sample per thread and tick
+  SAMPLE_MODE_WALL = 0,
+  // thread time between ticks split into on cpu, gil wait and syscall
+  SAMPLE_MODE_CPU = 1
+};
+
+// subtree a sample is added to, SAMPLE_STATE_WALL is the untagged root and
+// the others are states of a thread between two ticks in SAMPLE_MODE_CPU
+enum _sample_state {
+  SAMPLE_STATE_WALL = 0,
+  SAMPLE_STATE_CPU = 1,
+  SAMPLE_STATE_GIL = 2,
+  SAMPLE_STATE_SYSCALL = 3,
+  SAMPLE_STATE_COUNT = 4
+};
+
+// code object and line, the code object is referenced until reset
+typedef struct _sample_frame {
+  PyObject *code;
+  int line;
+} sample_frame;
+
+// one call path, parent and frame together identify a node
+typedef struct _sample_node {
+  unsigned int parent;
+  unsigned int frame;
+  // samples, or micro seconds in SAMPLE_MODE_CPU
+  unsigned long self_count;
+} sample_node;
+
+// clocks of a thread at its last tick, nano second
+typedef struct _sample_thread_clock {
+  unsigned long cpu_ns;
+  unsigned long wall_ns;
+  unsigned long tick;
+} sample_thread_clock;
+
+// open addressing table of 1-based indices, 0 is an empty bucket
+typedef struct _sample_index {
+  unsigned int *buckets;
+  unsigned int capacity;
+  unsigned int size;
+} sample_index;
+
+class PySampler {
+public:
+  PySampler();
+  ~PySampler();
+
+public:
+  // rate is ticks per second, mode is one of _sample_mode
+  int start(int rate, int mode);
+  int stop();
+  // write collapsed stacks to fd and reset the call tree, return samples
+  long dump(int fd);
+
+private:
+  void start_python_sample_thread();
+  // walk frames of all python threads once, gil is held
+  void sample_threads(PyObject *current_frames, unsigned long self_ident);
+  // split thread time since its last tick into micro seconds per state,
+  // return false on the first tick of a thread
+  bool thread_times(unsigned long ident, unsigned long wall_ns,
+                    unsigned long *weights);
+  // add weights[state] to the call path of frame below each state node
+  void add_sample(PyObject *frame, const unsigned long *weights);
+  bool is_self_thread(PyObject *ident);
+  unsigned int intern_frame(PyObject *code, int line);
+  unsigned int intern_node(unsigned int parent, unsigned int frame);
+  // name of a frame in collapsed stacks, caller frees it
+  char *format_frame(unsigned int frame);
+  // empty call tree with the reserved frames and state nodes
+  int init_tree();
+  // release code objects and empty the call tree, gil is held
+  void reset();
+
+private:
+  static void boot_entry(void *boot_raw);
+
+private:
+  sample_frame *frames;
+  unsigned int frames_size;
+  unsigned int frames_capacity;
+  sample_index frame_index;
+  // nodes[0] is the root
+  sample_node *nodes;
+  unsigned int nodes_size;
+  unsigned int nodes_capacity;
+  sample_index node_index;
+  // subtree root of each state, state_nodes[SAMPLE_STATE_WALL] is 0
+  unsigned int state_nodes[SAMPLE_STATE_COUNT];
+  // <dropped> below each state node
+  unsigned int dropped_nodes[SAMPLE_STATE_COUNT];
+  unsigned long samples;
+  // mode of the samples in the call tree
+  int mode;
+  unsigned long tick;
+  // python thread ident -> clocks at its last tick, gil is held
+  std::map<unsigned long, sample_thread_clock> thread_clocks;
+  // threading._active, owned by the sample thread
+  PyObject *active_threads;
+  long interval_ns;
+  unsigned long sample_thread_id;
+  bool running_flag;
+  bool sample_thread_exited;
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int start_py_sampler(int rate, int mode);
+
+int stop_py_sampler();
+
+long dump_py_sampler(int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,5 +1,7 @@
 #include "Python.h"
 #include "frida_profiler.h"
+#include "clock_util.h"
+#include "py_gil_intercept.h"
 #include "py_gil_stat.h"
 #include "symbol_util.h"
 
@@ -9,7 +11,19 @@ struct _PythonGilListener {
   guint num_calls;
 };
 
-enum _PythonGilHookId { PYTHON_GIL_HOOK_TAKE_GIL, PYTHON_GIL_HOOK_DROP_GIL };
+// pause hooks follow the order of pause_symbol_addrs
+enum _PythonGilHookId {
+  PYTHON_GIL_HOOK_TAKE_GIL,
+  PYTHON_GIL_HOOK_DROP_GIL,
+  PYTHON_GIL_HOOK_CRITICAL_SECTION,
+  PYTHON_GIL_HOOK_CRITICAL_SECTION2,
+  PYTHON_GIL_HOOK_STOP_THE_WORLD,
+  PYTHON_GIL_HOOK_START_THE_WORLD,
+  PYTHON_GIL_HOOK_COUNT
+};
+static_assert(PYTHON_GIL_HOOK_COUNT - PYTHON_GIL_HOOK_CRITICAL_SECTION ==
+                  GIL_PAUSE_SYMBOL_COUNT,
+              "a hook for every pause symbol");
 
 typedef struct _PythonGilListener PythonGilListener;
 typedef enum _PythonGilHookId PythonGilHookId;
@@ -31,6 +45,40 @@ static pthread_mutex_t mutex;
 static gil_monitor_config config;
 static int inited = 0;
 
+#if PY_VERSION_HEX >= 0x030C0000
+// every interpreter may own a gil since 3.12, take_gil(PyThreadState *tstate)
+static long take_gil_interp_id(GumInvocationContext *ic) {
+  PyThreadState *tstate =
+      (PyThreadState *)gum_invocation_context_get_nth_argument(ic, 0);
+  if (tstate == NULL || tstate->interp == NULL) {
+    return -1;
+  }
+  return (long)PyInterpreterState_GetID(tstate->interp);
+}
+#else
+// one gil is shared by all interpreters
+static long take_gil_interp_id(GumInvocationContext *ic) { return 0; }
+#endif
+
+// drop_gil receives the thread state releasing the gil, which may belong to
+// a subinterpreter, at an argument index that moved between versions:
+// 3.9-3.11 drop_gil(ceval, ceval2, tstate), otherwise drop_gil(x, tstate, ...)
+#if PY_VERSION_HEX >= 0x03090000 && PY_VERSION_HEX < 0x030C0000
+#define DROP_GIL_TSTATE_ARG 2
+#else
+#define DROP_GIL_TSTATE_ARG 1
+#endif
+
+static PyThreadState *drop_gil_tstate(GumInvocationContext *ic) {
+  PyThreadState *tstate = (PyThreadState *)
+      gum_invocation_context_get_nth_argument(ic, DROP_GIL_TSTATE_ARG);
+  // NULL during early interpreter init
+  if (tstate == NULL || tstate->thread_id != PyThread_get_thread_ident()) {
+    return NULL;
+  }
+  return tstate;
+}
+
 // so init
 __attribute__((constructor)) static void py_gil_intercept_init() {
   pthread_mutex_init(&mutex, NULL);
@@ -45,10 +93,19 @@ static void python_gil_listener_on_enter(GumInvocationListener *listener,
   pthread_t thread_id = pthread_self();
   switch (hook_id) {
   case PYTHON_GIL_HOOK_TAKE_GIL:
-    gilStat->on_take_gil_enter(thread_id);
+    gilStat->on_take_gil_enter(thread_id, take_gil_interp_id(ic));
     break;
   case PYTHON_GIL_HOOK_DROP_GIL:
-    gilStat->on_drop_gil_enter(thread_id);
+    gilStat->on_drop_gil_enter(thread_id, drop_gil_tstate(ic));
+    break;
+  case PYTHON_GIL_HOOK_CRITICAL_SECTION:
+  case PYTHON_GIL_HOOK_CRITICAL_SECTION2:
+    gilStat->on_pause_enter(thread_id, GIL_PAUSE_CRITICAL_SECTION);
+    break;
+  case PYTHON_GIL_HOOK_STOP_THE_WORLD:
+    gilStat->on_pause_enter(thread_id, GIL_PAUSE_STOP_THE_WORLD);
+    break;
+  default:
     break;
   }
 
@@ -69,6 +126,15 @@ static void python_gil_listener_on_leave(GumInvocationListener *listener,
   case PYTHON_GIL_HOOK_DROP_GIL:
     gilStat->on_drop_gil_leave(thread_id);
     break;
+  case PYTHON_GIL_HOOK_CRITICAL_SECTION:
+  case PYTHON_GIL_HOOK_CRITICAL_SECTION2:
+    gilStat->on_pause_leave(thread_id, GIL_PAUSE_CRITICAL_SECTION);
+    break;
+  case PYTHON_GIL_HOOK_START_THE_WORLD:
+    gilStat->on_pause_leave(thread_id, GIL_PAUSE_STOP_THE_WORLD);
+    break;
+  default:
+    break;
   }
 }
 
@@ -88,36 +154,56 @@ static void python_gil_listener_iface_init(gpointer g_iface,
 
 static void python_gil_listener_init(PythonGilListener *self) {}
 
-static int init_python_gil_interceptor_inner(GumAddress take_gil_address,
-                                             GumAddress drop_gil_address,
+// addresses are indexed by PythonGilHookId, 0 when the function is missing.
+// take_gil and drop_gil are hooked together, free-threaded builds running
+// without the gil only have pause hooks
+static int init_python_gil_interceptor_inner(const GumAddress *addresses,
                                              gil_monitor_config *config) {
   if (inited != 0) {
     fprintf(stderr, "[*] interceptor for take_gil & drop_dril already added\n");
     return 0;
   }
-  if (take_gil_address == 0) {
-    fprintf(stderr, "[*] take_gil symbol not found\n");
+  if ((addresses[PYTHON_GIL_HOOK_TAKE_GIL] == 0) !=
+      (addresses[PYTHON_GIL_HOOK_DROP_GIL] == 0)) {
+    fprintf(stderr, "[*] %s symbol not found\n",
+            addresses[PYTHON_GIL_HOOK_TAKE_GIL] == 0 ? "take_gil"
+                                                     : "drop_gil");
     return -1;
   }
-  if (drop_gil_address == 0) {
-    fprintf(stderr, "[*] drop_gil symbol not found\n");
+  int hooks = 0;
+  for (int i = 0; i < PYTHON_GIL_HOOK_COUNT; i++) {
+    hooks += addresses[i] != 0;
+  }
+  if (hooks == 0) {
+    fprintf(stderr, "[*] take_gil & drop_gil symbol not found\n");
     return -1;
   }
   interceptor = gum_interceptor_obtain();
   listener =
       (GumInvocationListener *)g_object_new(PYTHON_GIL_TYPE_LISTENER, NULL);
   gilStat = new PyGilStat();
-  gilStat->start(config);
+  if (gilStat->start(config) != 0) {
+    delete gilStat;
+    gilStat = NULL;
+    g_object_unref(listener);
+    g_object_unref(interceptor);
+    listener = NULL;
+    interceptor = NULL;
+    return -1;
+  }
 
   gum_interceptor_begin_transaction(interceptor);
-  gum_interceptor_attach(interceptor, GSIZE_TO_POINTER(take_gil_address),
-                         listener, GSIZE_TO_POINTER(PYTHON_GIL_HOOK_TAKE_GIL));
-  gum_interceptor_attach(interceptor, GSIZE_TO_POINTER(drop_gil_address),
-                         listener, GSIZE_TO_POINTER(PYTHON_GIL_HOOK_DROP_GIL));
+  for (int i = 0; i < PYTHON_GIL_HOOK_COUNT; i++) {
+    if (addresses[i] != 0) {
+      gum_interceptor_attach(interceptor, GSIZE_TO_POINTER(addresses[i]),
+                             listener, GSIZE_TO_POINTER(i));
+    }
+  }
   gum_interceptor_end_transaction(interceptor);
 
   inited = 1;
-  g_print("[*] add interceptor to take_gil & drop_dril successfully\n");
+  g_print("[*] add interceptor to %d gil & pause functions successfully\n",
+          hooks);
   return 0;
 }
 
@@ -132,8 +218,10 @@ static int deinit_python_gil_interceptor_inner() {
   g_object_unref(interceptor);
 
   if (gilStat != NULL) {
-    gilStat->stop();
-    delete gilStat;
+    // leak rather than free memory still used by a stuck stat thread
+    if (gilStat->stop() == 0) {
+      delete gilStat;
+    }
     gilStat = NULL;
   }
 
@@ -152,8 +240,11 @@ int init_py_gil_interceptor(PyObject *queue_obj,
                             unsigned long take_gil_symbol_addr,
                             unsigned long drop_gil_symbol_addr,
                             int take_cost_warning_threshold,
-                            int hold_cost_warning_threshold, int stat_interval,
-                            int max_stat_threads) {
+                            int hold_cost_warning_threshold,
+                            int stat_interval_ms, int max_stat_threads,
+                            const char *clock, const char *stream_path,
+                            int timeline_events, int hold_frames,
+                            const unsigned long *pause_symbol_addrs) {
 
   if (take_cost_warning_threshold > 0) {
     config.gil_take_warning_threshold = take_cost_warning_threshold;
@@ -165,10 +256,10 @@ int init_py_gil_interceptor(PyObject *queue_obj,
   } else {
     config.gil_hold_warning_threshold = 10;
   }
-  if (stat_interval > 1) {
-    config.stat_interval = stat_interval;
+  if (stat_interval_ms >= 100) {
+    config.stat_interval_ms = stat_interval_ms;
   } else {
-    config.stat_interval = stat_interval <= 0 ? 5 : 1;
+    config.stat_interval_ms = stat_interval_ms <= 0 ? 5000 : 100;
   }
   if (max_stat_threads > 0) {
     config.gil_stat_max_threads =
@@ -176,16 +267,56 @@ int init_py_gil_interceptor(PyObject *queue_obj,
   } else {
     config.gil_stat_max_threads = 500;
   }
+  // rounded up to a power of two
+  config.timeline_events = 0;
+  if (timeline_events > 0) {
+    config.timeline_events = 1;
+    while (config.timeline_events < (unsigned int)timeline_events &&
+           config.timeline_events < GIL_TIMELINE_MAX_EVENTS) {
+      config.timeline_events <<= 1;
+    }
+  }
+  config.hold_frames = hold_frames > 0 ? hold_frames : 0;
+  if (config.hold_frames > GIL_HOLD_MAX_FRAMES) {
+    config.hold_frames = GIL_HOLD_MAX_FRAMES;
+  }
   pthread_mutex_lock(&mutex);
-  int ret = init_python_gil_interceptor_inner(
-      (GumAddress)get_symbol_address_by_nm_offset(take_gil_symbol_addr),
-      (GumAddress)get_symbol_address_by_nm_offset(drop_gil_symbol_addr),
-      &config);
+  if (gilStat != NULL &&
+      (config.timeline_events > 0 || config.hold_frames > 0)) {
+    // a running stat has no timeline or hold sample ring to record into
+    pthread_mutex_unlock(&mutex);
+    fprintf(stderr, "[*] gil timeline and hold samples can not be recorded "
+                    "while gilstat is on\n");
+    return -1;
+  }
+  if (gilStat == NULL) {
+    // running stat keeps its clock, ticks of two sources can not be mixed
+    config.clock = clock_source_init(clock);
+  }
+  config.stream_path = stream_path;
+  unsigned long symbol_addrs[PYTHON_GIL_HOOK_COUNT] = {take_gil_symbol_addr,
+                                                       drop_gil_symbol_addr};
+  if (pause_symbol_addrs != NULL) {
+    memcpy(&symbol_addrs[PYTHON_GIL_HOOK_CRITICAL_SECTION], pause_symbol_addrs,
+           sizeof(unsigned long) * GIL_PAUSE_SYMBOL_COUNT);
+  }
+  GumAddress addresses[PYTHON_GIL_HOOK_COUNT];
+  for (int i = 0; i < PYTHON_GIL_HOOK_COUNT; i++) {
+    // nm addresses of missing symbols stay 0 instead of the load offset
+    addresses[i] =
+        symbol_addrs[i] == 0
+            ? 0
+            : (GumAddress)get_symbol_address_by_nm_offset(symbol_addrs[i]);
+  }
+  int ret = init_python_gil_interceptor_inner(addresses, &config);
+  // owned by the python caller, stream is already opened by start()
+  config.stream_path = NULL;
   if (ret != 0) {
     pthread_mutex_unlock(&mutex);
     return ret;
   }
-  gilStat->set_out_queue(queue_obj);
+  // reports of a recording are not sent anywhere
+  gilStat->set_out_queue(queue_obj == Py_None ? NULL : queue_obj);
   pthread_mutex_unlock(&mutex);
   return ret;
 }
@@ -197,6 +328,32 @@ int deinit_py_gil_interceptor() {
   return ret;
 }
 
+int py_gil_thread_taking(unsigned long thread_id) {
+  // mutex is not taken, deinit holds it while waiting for the gil
+  if (gilStat == NULL) {
+    return -1;
+  }
+  return gilStat->is_taking_gil((pthread_t)thread_id) ? 1 : 0;
+}
+
+PyObject *dump_py_gil_timeline() {
+  // mutex is not taken for the same reason as py_gil_thread_taking
+  if (gilStat == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "gilstat is off");
+    return NULL;
+  }
+  return gilStat->dump_timeline();
+}
+
+PyObject *dump_py_gil_hold_samples() {
+  // mutex is not taken for the same reason as py_gil_thread_taking
+  if (gilStat == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "gilstat is off");
+    return NULL;
+  }
+  return gilStat->dump_hold_samples();
+}
+
 #ifdef __cplusplus
 }
 #endif
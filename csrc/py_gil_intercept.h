@@ -8,13 +8,37 @@
 extern "C" {
 #endif
 
-int init_py_gil_interceptor(unsigned long take_gil_symbol_addr,
+// nm addresses of _PyCriticalSection_BeginSlow,
+// _PyCriticalSection2_BeginSlow, _PyEval_StopTheWorld and
+// _PyEval_StartTheWorld hooked on free-threaded builds, 0 when not hooked
+#define GIL_PAUSE_SYMBOL_COUNT 4
+
+// take_gil_symbol_addr and drop_gil_symbol_addr are both 0 when a
+// free-threaded build runs without the gil, pause_symbol_addrs may be NULL
+int init_py_gil_interceptor(PyObject *queue_obj,
+                            unsigned long take_gil_symbol_addr,
                             unsigned long drop_gil_symbol_addr,
                             int take_cost_warning_threshold,
-                            int hold_cost_warning_threshold, int stat_interval);
+                            int hold_cost_warning_threshold,
+                            int stat_interval_ms, int max_stat_threads,
+                            const char *clock, const char *stream_path,
+                            int timeline_events, int hold_frames,
+                            const unsigned long *pause_symbol_addrs);
 
 int deinit_py_gil_interceptor();
 
+// 1 when the thread waits for the gil, 0 when not, -1 when gilstat is off.
+// caller must hold the gil, which keeps gilstat from being deinited
+int py_gil_thread_taking(unsigned long thread_id);
+
+// cycles recorded by `gilstat record`, see PyGilStat::dump_timeline. caller
+// must hold the gil
+PyObject *dump_py_gil_timeline();
+
+// hold samples taken by `gilstat hogs`, see PyGilStat::dump_hold_samples.
+// caller must hold the gil
+PyObject *dump_py_gil_hold_samples();
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,16 +4,25 @@
 #include "time_util.h"
 #include <cstdio>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <sstream>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
 
 struct bootstate {
   PyInterpreterState *interp;
   PyGilStat *stat;
 };
 
+// slot cached by current thread, valid only while generation matches
+static __thread gil_thread_slot *tls_gil_slot = NULL;
+static __thread unsigned long tls_gil_generation = 0;
+static unsigned long gil_stat_generation = 0;
+
 static unsigned long pthread_t_to_ulong(pthread_t p) {
 #if SIZEOF_PTHREAD_T <= SIZEOF_LONG
   return (unsigned long)p;
@@ -22,20 +31,218 @@ static unsigned long pthread_t_to_ulong(pthread_t p) {
 #endif
 }
 
+/**
+ * seqlock writer side, only the owner thread of the slot writes counters
+ */
+static inline void seq_write_begin(gil_statistics *gil_stat) {
+  __atomic_store_n(&gil_stat->seq, gil_stat->seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seq_write_end(gil_statistics *gil_stat) {
+  __atomic_store_n(&gil_stat->seq, gil_stat->seq + 1, __ATOMIC_RELEASE);
+}
+
+#define GIL_COUNTER_ADD(gil_stat, field, value)                                \
+  __atomic_store_n(&(gil_stat)->counters.field,                                \
+                   (gil_stat)->counters.field + (value), __ATOMIC_RELAXED)
+
+/**
+ * seqlock reader side, retry until a consistent copy is read
+ */
+static void read_gil_counters(gil_statistics *gil_stat, gil_counters *out) {
+  unsigned long begin, end;
+  int spins = 0;
+  do {
+    if (++spins > 64) {
+      // owner thread is preempted inside a hook
+      sched_yield();
+    }
+    begin = __atomic_load_n(&gil_stat->seq, __ATOMIC_ACQUIRE);
+    out->gil_take_total_cost = __atomic_load_n(
+        &gil_stat->counters.gil_take_total_cost, __ATOMIC_RELAXED);
+    out->gil_take_count =
+        __atomic_load_n(&gil_stat->counters.gil_take_count, __ATOMIC_RELAXED);
+    out->gil_drop_total_cost = __atomic_load_n(
+        &gil_stat->counters.gil_drop_total_cost, __ATOMIC_RELAXED);
+    out->gil_drop_count =
+        __atomic_load_n(&gil_stat->counters.gil_drop_count, __ATOMIC_RELAXED);
+    out->gil_hold_total =
+        __atomic_load_n(&gil_stat->counters.gil_hold_total, __ATOMIC_RELAXED);
+    for (int k = 0; k < GIL_PAUSE_KINDS; k++) {
+      out->pause_count[k] = __atomic_load_n(
+          &gil_stat->counters.pause_count[k], __ATOMIC_RELAXED);
+      out->pause_total[k] = __atomic_load_n(
+          &gil_stat->counters.pause_total[k], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    end = __atomic_load_n(&gil_stat->seq, __ATOMIC_RELAXED);
+  } while ((begin & 1) != 0 || begin != end);
+}
+
+static const char *lookup_thread_name(
+    std::map<unsigned long, char *> *thread_name_map, pthread_t thread_id,
+    char *buffer, size_t len) {
+  if (thread_name_map != NULL) {
+    auto it = thread_name_map->find(pthread_t_to_ulong(thread_id));
+    if (it != thread_name_map->end()) {
+      return it->second;
+    }
+  }
+  // fails when the thread already exited
+  if (pthread_getname_np(thread_id, buffer, len) != 0) {
+    snprintf(buffer, len, "unknown");
+  }
+  return buffer;
+}
+
+static void free_thread_name_map(
+    std::map<unsigned long, char *> *thread_name_map) {
+  if (thread_name_map == NULL) {
+    return;
+  }
+  for (std::map<unsigned long, char *>::iterator it = thread_name_map->begin();
+       it != thread_name_map->end(); ++it) {
+    free(it->second);
+  }
+  delete thread_name_map;
+}
+
+static void snapshot_gil_histograms(gil_histograms *dst,
+                                    const gil_histograms *src) {
+  latency_histogram_snapshot(&dst->take, &src->take);
+  latency_histogram_snapshot(&dst->hold, &src->hold);
+  latency_histogram_snapshot(&dst->drop, &src->drop);
+  for (int k = 0; k < GIL_PAUSE_KINDS; k++) {
+    latency_histogram_snapshot(&dst->pause[k], &src->pause[k]);
+  }
+}
+
+static void merge_gil_histograms(gil_histograms *dst,
+                                 const gil_histograms *src) {
+  latency_histogram_merge(&dst->take, &src->take);
+  latency_histogram_merge(&dst->hold, &src->hold);
+  latency_histogram_merge(&dst->drop, &src->drop);
+  for (int k = 0; k < GIL_PAUSE_KINDS; k++) {
+    latency_histogram_merge(&dst->pause[k], &src->pause[k]);
+  }
+}
+
 PyGilStat::PyGilStat() {
-  stat_map = new std::unordered_map<pthread_t, gil_statistics *>();
-  warning_list = new std::list<gil_warning *>();
+  slots = NULL;
+  slot_capacity = 0;
+  slots_size = 0;
+  retired_histograms = NULL;
+  memset(retired_pause_total, 0, sizeof(retired_pause_total));
+  generation = __atomic_add_fetch(&gil_stat_generation, 1, __ATOMIC_RELAXED);
+  gil_take_warning_ticks = 0;
+  gil_hold_warning_ticks = 0;
+  untracked_threads = 0;
+  stream = NULL;
+  timeline = NULL;
+  timeline_size = 0;
+  hold_sample_ring = NULL;
+  hold_sample_head = 0;
+  hold_sample_tail = 0;
+  dropped_hold_samples = 0;
+  warning_ring = NULL;
+  warning_head = 0;
+  warning_tail = 0;
+  dropped_warnings = 0;
   config = nullptr;
   stat_thread_id = 0;
   running_flag = false;
+  stat_thread_exited = false;
   py_out_queue = NULL;
   pthread_mutex_init(&queue_mutex, NULL);
-  pthread_mutex_init(&stat_map_mutex, NULL);
-  pthread_mutex_init(&warning_list_mutex, NULL);
+}
+
+PyGilStat::~PyGilStat() {
+  clear_hold_samples();
+  free(hold_sample_ring);
+  free(warning_ring);
+  gil_stream_close(stream);
+  if (timeline != NULL) {
+    munmap(timeline, timeline_size);
+  }
+  if (slots != NULL) {
+    munmap(slots, slots_size);
+  }
+  free(retired_histograms);
+  pthread_mutex_destroy(&queue_mutex);
 }
 
 int PyGilStat::start(gil_monitor_config *config) {
   this->config = config;
+  this->gil_take_warning_ticks = clock_ns_to_ticks(
+      config->clock, config->gil_take_warning_threshold * 1000000ul);
+  this->gil_hold_warning_ticks = clock_ns_to_ticks(
+      config->clock, config->gil_hold_warning_threshold * 1000000ul);
+  // slots must be ready before take_gil/drop_gil hooks are attached, they
+  // are mapped so that pages of unused slots are never committed
+  size_t size = sizeof(gil_thread_slot) * config->gil_stat_max_threads;
+  void *mem = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    fprintf(stderr, "[*] gil_statistics alloc thread slots failed\n");
+    return -1;
+  }
+  this->retired_histograms =
+      (gil_histograms *)calloc(1, sizeof(gil_histograms));
+  if (this->retired_histograms == NULL) {
+    munmap(mem, size);
+    fprintf(stderr, "[*] gil_statistics alloc histograms failed\n");
+    return -1;
+  }
+  this->warning_ring = (gil_warning_cell *)malloc(
+      sizeof(gil_warning_cell) * GIL_WARNING_RING_CAPACITY);
+  if (this->warning_ring == NULL) {
+    munmap(mem, size);
+    fprintf(stderr, "[*] gil_statistics alloc warning ring failed\n");
+    return -1;
+  }
+  for (unsigned long i = 0; i < GIL_WARNING_RING_CAPACITY; i++) {
+    this->warning_ring[i].seq = i;
+  }
+  if (config->timeline_events > 0) {
+    // rings of threads cycling less than timeline_events times are only
+    // partly committed
+    size_t timeline_size = sizeof(gil_timeline_event) *
+                           config->timeline_events *
+                           config->gil_stat_max_threads;
+    void *timeline_mem =
+        mmap(NULL, timeline_size, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (timeline_mem == MAP_FAILED) {
+      munmap(mem, size);
+      fprintf(stderr, "[*] gil_statistics alloc timeline failed\n");
+      return -1;
+    }
+    this->timeline = (gil_timeline_event *)timeline_mem;
+    this->timeline_size = timeline_size;
+  }
+  if (config->hold_frames > 0) {
+    this->hold_sample_ring = (gil_hold_sample_cell *)malloc(
+        sizeof(gil_hold_sample_cell) * GIL_HOLD_SAMPLE_CAPACITY);
+    if (this->hold_sample_ring == NULL) {
+      munmap(mem, size);
+      fprintf(stderr, "[*] gil_statistics alloc hold samples failed\n");
+      return -1;
+    }
+    for (unsigned long i = 0; i < GIL_HOLD_SAMPLE_CAPACITY; i++) {
+      this->hold_sample_ring[i].seq = i;
+    }
+  }
+  if (config->stream_path != NULL) {
+    this->stream = gil_stream_open(config->stream_path, GIL_STREAM_CAPACITY);
+    if (this->stream == NULL) {
+      munmap(mem, size);
+      return -1;
+    }
+  }
+  this->slots = (gil_thread_slot *)mem;
+  this->slots_size = size;
+  this->slot_capacity = config->gil_stat_max_threads;
   this->running_flag = true;
   this->start_python_stat_thread();
   return 0;
@@ -48,20 +255,26 @@ int PyGilStat::stop() {
   send_end();
   set_out_queue(NULL);
   this->running_flag = false;
-  void *retval;
 
-  pthread_mutex_lock(&stat_map_mutex);
-  stat_map->clear();
-  pthread_mutex_unlock(&stat_map_mutex);
-
-  pthread_mutex_lock(&warning_list_mutex);
-  this->warning_list->clear();
-  pthread_mutex_unlock(&warning_list_mutex);
+  // stat thread is detached by PyThread_start_new_thread and can not be
+  // joined, wait until it no longer touches this instance
+  int waited_ms = 0;
+  // drop gil, stat thread takes gil before it exits
+  PyThreadState *tstate = PyEval_SaveThread();
+  while (!__atomic_load_n(&stat_thread_exited, __ATOMIC_ACQUIRE) &&
+         waited_ms < 5000) {
+    usleep(10000);
+    waited_ms += 10;
+  }
+  PyEval_RestoreThread(tstate);
 
-  if (pthread_join((pthread_t)stat_thread_id, &retval) != 0) {
-    fprintf(stderr, "[*] gil_statistics thread join failed\n");
+  if (!__atomic_load_n(&stat_thread_exited, __ATOMIC_ACQUIRE)) {
+    fprintf(stderr, "[*] gil_statistics thread exit timeout\n");
     return -1;
   }
+  // reader stops once the stream is closed
+  gil_stream_close(stream);
+  stream = NULL;
   return 0;
 }
 
@@ -88,10 +301,13 @@ void PyGilStat::send(const char *msg, PyThreadState *tstate) {
   // take gil and set current PyThreadState
   PyEval_AcquireThread(tstate);
 
-  PyObject *result =
-      PyObject_CallMethod(py_out_queue, "output_msgstr_nowait", "(is)", 0, msg);
-  if (result != NULL) {
-    Py_DECREF(result);
+  // queue is reset when gilstat is turned off
+  if (py_out_queue != NULL) {
+    PyObject *result = PyObject_CallMethod(py_out_queue, "output_msgstr_nowait",
+                                           "(is)", 0, msg);
+    if (result != NULL) {
+      Py_DECREF(result);
+    }
   }
 
   // drop gil and reset current PyThreadState
@@ -105,10 +321,13 @@ void PyGilStat::send_end() {
   // take gil
   PyGILState_STATE gstate = PyGILState_Ensure();
 
-  PyObject *result = PyObject_CallMethod(py_out_queue, "output_msgstr_nowait",
-                                         "(iO)", 1, Py_None);
-  if (result != NULL) {
-    Py_DECREF(result);
+  // recordings have no queue
+  if (py_out_queue != NULL) {
+    PyObject *result = PyObject_CallMethod(
+        py_out_queue, "output_msgstr_nowait", "(iO)", 1, Py_None);
+    if (result != NULL) {
+      Py_DECREF(result);
+    }
   }
 
   // drop gil
@@ -167,8 +386,8 @@ void PyGilStat::dump_gil_stat(
   PyGilStat *stat = boot->stat;
   int nthreads = 0;
 
-  gil_statistics *stats[stat->config->gil_stat_max_threads];
-  pthread_t thread_ids[stat->config->gil_stat_max_threads];
+  gil_counters stats[stat->slot_capacity];
+  pthread_t thread_ids[stat->slot_capacity];
   char thread_name_buffer[16];
 
   char time_buffer[24];
@@ -176,26 +395,19 @@ void PyGilStat::dump_gil_stat(
   timespec_get(&ts, TIME_UTC);
   strftime_with_millisec(&ts, time_buffer, 24);
 
-  pthread_mutex_lock(&stat->stat_map_mutex);
-  // stat map iteration should be fast
-  for (std::unordered_map<pthread_t, gil_statistics *>::iterator it =
-           stat->stat_map->begin();
-       it != stat->stat_map->end(); ++it) {
-    if (nthreads > stat->config->gil_stat_max_threads) {
-      break;
+  // read every slot without blocking the hooked threads
+  for (unsigned int i = 0; i < stat->slot_capacity; i++) {
+    gil_thread_slot *slot = &stat->slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != GIL_SLOT_ACTIVE) {
+      continue;
     }
-    gil_statistics *gil_stat = it->second;
-    if (gil_stat->gil_take_count > 0 && gil_stat->gil_drop_count > 0) {
-      gil_statistics *copy_gil_stat =
-          (gil_statistics *)malloc(sizeof(gil_statistics));
-      memcpy(copy_gil_stat, gil_stat, sizeof(gil_statistics));
-      stats[nthreads] = copy_gil_stat;
-      thread_ids[nthreads] = it->first;
-
+    read_gil_counters(&slot->stat, &stats[nthreads]);
+    if (stats[nthreads].gil_take_count > 0 &&
+        stats[nthreads].gil_drop_count > 0) {
+      thread_ids[nthreads] = slot->thread_id;
       nthreads++;
     }
   }
-  pthread_mutex_unlock(&stat->stat_map_mutex);
 
   // print with no lock
   if (nthreads > 0) {
@@ -212,21 +424,18 @@ void PyGilStat::dump_gil_stat(
     ss << str_buffer;
 
     for (int i = 0; i < nthreads; i++) {
-      gil_statistics *gil_stat = stats[i];
+      // convert ticks to nano second only when reporting
+      gil_counters *gil_stat = &stats[i];
+      gil_stat->gil_hold_total =
+          clock_ticks_to_ns(stat->config->clock, gil_stat->gil_hold_total);
+      gil_stat->gil_take_total_cost =
+          clock_ticks_to_ns(stat->config->clock, gil_stat->gil_take_total_cost);
+      gil_stat->gil_drop_total_cost =
+          clock_ticks_to_ns(stat->config->clock, gil_stat->gil_drop_total_cost);
       unsigned long pid = pthread_t_to_ulong(thread_ids[i]);
-
-      const char *name_ptr = NULL;
-      if (thread_name_map != NULL) {
-        auto it = thread_name_map->find(pid);
-        if (it != thread_name_map->end()) {
-          name_ptr = it->second;
-        }
-      }
-      if (name_ptr == NULL) {
-        pthread_getname_np(thread_ids[i], thread_name_buffer,
-                           sizeof(thread_name_buffer));
-        name_ptr = (const char *)&thread_name_buffer;
-      }
+      const char *name_ptr =
+          lookup_thread_name(thread_name_map, thread_ids[i], thread_name_buffer,
+                             sizeof(thread_name_buffer));
 
       sprintf(
           str_buffer,
@@ -239,30 +448,290 @@ void PyGilStat::dump_gil_stat(
           gil_stat->gil_drop_count, gil_stat->gil_drop_total_cost,
           gil_stat->gil_drop_total_cost / gil_stat->gil_drop_count);
       ss << str_buffer;
-      free(gil_stat);
     }
 
+    unsigned long untracked =
+        __atomic_load_n(&stat->untracked_threads, __ATOMIC_RELAXED);
+    if (untracked > 0) {
+      sprintf(str_buffer,
+              "%lu threads not tracked, all %u thread slots are in use\n",
+              untracked, stat->slot_capacity);
+      ss << str_buffer;
+    }
+
+    ss << "\n";
+    const std::string tmp = ss.str();
+    const char *cstr = tmp.c_str();
+    // send to server q, here will take gil lock then send then release gil lock
+    stat->send(cstr, tstate);
+  }
+}
+
+// one row per gil event with percentiles converted to nano second
+static void format_percentile_rows(std::stringstream &ss, clock_source clock,
+                                   const char *time_buffer,
+                                   const char *thread_id, const char *name,
+                                   gil_histograms *h) {
+  static const double percentiles[] = {50, 90, 99, 99.9};
+  const char *events[] = {"take_gil", "hold_gil", "drop_gil"};
+  latency_histogram *histograms[] = {&h->take, &h->hold, &h->drop};
+  char str_buffer[512];
+  for (int e = 0; e < 3; e++) {
+    latency_histogram *hist = histograms[e];
+    unsigned long values[5];
+    for (int p = 0; p < 4; p++) {
+      values[p] = clock_ticks_to_ns(
+          clock, latency_histogram_percentile(hist, percentiles[p]));
+    }
+    values[4] = clock_ticks_to_ns(clock, hist->max);
+    sprintf(str_buffer,
+            "%-26s%-18s%-24s%-12s%-12lu%-14lu%-14lu%-14lu%-14lu%-14lu\n",
+            time_buffer, thread_id, name, events[e], hist->count, values[0],
+            values[1], values[2], values[3], values[4]);
+    ss << str_buffer;
+  }
+}
+
+void PyGilStat::dump_gil_percentile(
+    void *boot_raw, PyThreadState *tstate,
+    std::map<unsigned long, char *> *thread_name_map) {
+  struct bootstate *boot = (struct bootstate *)boot_raw;
+  PyGilStat *stat = boot->stat;
+  clock_source clock = stat->config->clock;
+
+  // [0] snapshot of one thread, [1] process wide
+  gil_histograms *scratch =
+      (gil_histograms *)malloc(sizeof(gil_histograms) * 2);
+  if (scratch == NULL) {
+    return;
+  }
+  gil_histograms *process = &scratch[1];
+  memcpy(process, stat->retired_histograms, sizeof(gil_histograms));
+
+  char time_buffer[24];
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  strftime_with_millisec(&ts, time_buffer, 24);
+
+  std::stringstream ss;
+  char str_buffer[4096];
+  char thread_name_buffer[16];
+  char thread_id_buffer[24];
+  sprintf(str_buffer,
+          "\ngil percentile "
+          "report:\n%-26s%-18s%-24s%-12s%-12s%-14s%-14s%-14s%-14s%-14s\n",
+          "time", "thread_id", "thread_name", "event", "count", "p50(ns)",
+          "p90(ns)", "p99(ns)", "p999(ns)", "max(ns)");
+  ss << str_buffer;
+
+  // histograms are read without blocking the hooked threads
+  for (unsigned int i = 0; i < stat->slot_capacity; i++) {
+    gil_thread_slot *slot = &stat->slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != GIL_SLOT_ACTIVE) {
+      continue;
+    }
+    gil_histograms *h = &scratch[0];
+    snapshot_gil_histograms(h, &slot->stat.histograms);
+    if (h->take.count == 0 || h->hold.count == 0) {
+      continue;
+    }
+    merge_gil_histograms(process, h);
+    sprintf(thread_id_buffer, "%lx", pthread_t_to_ulong(slot->thread_id));
+    const char *name_ptr =
+        lookup_thread_name(thread_name_map, slot->thread_id,
+                           thread_name_buffer, sizeof(thread_name_buffer));
+    format_percentile_rows(ss, clock, time_buffer, thread_id_buffer, name_ptr,
+                           h);
+  }
+
+  if (process->take.count > 0) {
+    format_percentile_rows(ss, clock, time_buffer, "all", "process", process);
     ss << "\n";
     const std::string tmp = ss.str();
     const char *cstr = tmp.c_str();
     // send to server q, here will take gil lock then send then release gil lock
     stat->send(cstr, tstate);
   }
+  free(scratch);
+}
+
+void PyGilStat::dump_gil_interp(void *boot_raw, PyThreadState *tstate) {
+  struct bootstate *boot = (struct bootstate *)boot_raw;
+  PyGilStat *stat = boot->stat;
+  // counters of the threads of an interpreter summed up, threads are
+  // attributed to the interpreter whose gil they took last
+  std::map<long, gil_counters> interps;
+  std::map<long, int> interp_threads;
+
+  for (unsigned int i = 0; i < stat->slot_capacity; i++) {
+    gil_thread_slot *slot = &stat->slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != GIL_SLOT_ACTIVE) {
+      continue;
+    }
+    gil_counters counters;
+    read_gil_counters(&slot->stat, &counters);
+    if (counters.gil_take_count == 0 || counters.gil_drop_count == 0) {
+      continue;
+    }
+    long interp_id = __atomic_load_n(&slot->stat.interp_id, __ATOMIC_RELAXED);
+    gil_counters *sum = &interps[interp_id];
+    sum->gil_take_count += counters.gil_take_count;
+    sum->gil_take_total_cost += counters.gil_take_total_cost;
+    sum->gil_drop_count += counters.gil_drop_count;
+    sum->gil_drop_total_cost += counters.gil_drop_total_cost;
+    sum->gil_hold_total += counters.gil_hold_total;
+    interp_threads[interp_id]++;
+  }
+  // the statistics report already covers a single gil
+  if (interps.size() < 2) {
+    return;
+  }
+
+  char time_buffer[24];
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  strftime_with_millisec(&ts, time_buffer, 24);
+
+  std::stringstream ss;
+  char str_buffer[4096];
+  clock_source clock = stat->config->clock;
+  sprintf(str_buffer,
+          "\ngil interpreter "
+          "report:\n%-26s%-12s%-10s%-12s%-18s%-18s%-12s%-18s%-12s\n",
+          "time", "interp_id", "threads", "takecnt", "hold_all(ns)",
+          "take_all(ns)", "takeavg(ns)", "drop_all(ns)", "dropavg(ns)");
+  ss << str_buffer;
+  for (std::map<long, gil_counters>::iterator it = interps.begin();
+       it != interps.end(); ++it) {
+    gil_counters *sum = &it->second;
+    unsigned long take_all = clock_ticks_to_ns(clock, sum->gil_take_total_cost);
+    unsigned long drop_all = clock_ticks_to_ns(clock, sum->gil_drop_total_cost);
+    unsigned long hold_all = clock_ticks_to_ns(clock, sum->gil_hold_total);
+    sprintf(str_buffer,
+            "%-26s%-12ld%-10d%-12lu%-18lu%-18lu%-12lu%-18lu%-12lu\n",
+            time_buffer, it->first, interp_threads[it->first],
+            sum->gil_take_count, hold_all, take_all,
+            take_all / sum->gil_take_count, drop_all,
+            drop_all / sum->gil_drop_count);
+    ss << str_buffer;
+  }
+  ss << "\n";
+  const std::string tmp = ss.str();
+  stat->send(tmp.c_str(), tstate);
+}
+
+// one row per pause kind recorded by a thread or the process
+static void format_pause_rows(std::stringstream &ss, clock_source clock,
+                              const char *time_buffer, const char *thread_id,
+                              const char *name, const unsigned long *totals,
+                              gil_histograms *h) {
+  const char *events[] = {"critical_section", "stop_the_world"};
+  char str_buffer[512];
+  for (int k = 0; k < GIL_PAUSE_KINDS; k++) {
+    latency_histogram *hist = &h->pause[k];
+    if (hist->count == 0) {
+      continue;
+    }
+    unsigned long total = clock_ticks_to_ns(clock, totals[k]);
+    unsigned long p99 =
+        clock_ticks_to_ns(clock, latency_histogram_percentile(hist, 99));
+    unsigned long max = clock_ticks_to_ns(clock, hist->max);
+    sprintf(str_buffer,
+            "%-26s%-18s%-24s%-20s%-12lu%-18lu%-14lu%-14lu%-14lu\n",
+            time_buffer, thread_id, name, events[k], hist->count, total,
+            total / hist->count, p99, max);
+    ss << str_buffer;
+  }
+}
+
+void PyGilStat::dump_gil_pause(
+    void *boot_raw, PyThreadState *tstate,
+    std::map<unsigned long, char *> *thread_name_map) {
+  struct bootstate *boot = (struct bootstate *)boot_raw;
+  PyGilStat *stat = boot->stat;
+  clock_source clock = stat->config->clock;
+
+  // [0] snapshot of one thread, [1] process wide
+  gil_histograms *scratch =
+      (gil_histograms *)malloc(sizeof(gil_histograms) * 2);
+  if (scratch == NULL) {
+    return;
+  }
+  gil_histograms *process = &scratch[1];
+  memcpy(process, stat->retired_histograms, sizeof(gil_histograms));
+  unsigned long process_totals[GIL_PAUSE_KINDS];
+  memcpy(process_totals, stat->retired_pause_total, sizeof(process_totals));
+
+  char time_buffer[24];
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  strftime_with_millisec(&ts, time_buffer, 24);
+
+  std::stringstream ss;
+  char str_buffer[4096];
+  char thread_name_buffer[16];
+  char thread_id_buffer[24];
+  sprintf(str_buffer,
+          "\nfree-threading pause "
+          "report:\n%-26s%-18s%-24s%-20s%-12s%-18s%-14s%-14s%-14s\n",
+          "time", "thread_id", "thread_name", "event", "count", "total(ns)",
+          "avg(ns)", "p99(ns)", "max(ns)");
+  ss << str_buffer;
+
+  for (unsigned int i = 0; i < stat->slot_capacity; i++) {
+    gil_thread_slot *slot = &stat->slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != GIL_SLOT_ACTIVE) {
+      continue;
+    }
+    gil_histograms *h = &scratch[0];
+    snapshot_gil_histograms(h, &slot->stat.histograms);
+    if (h->pause[GIL_PAUSE_CRITICAL_SECTION].count == 0 &&
+        h->pause[GIL_PAUSE_STOP_THE_WORLD].count == 0) {
+      continue;
+    }
+    gil_counters counters;
+    read_gil_counters(&slot->stat, &counters);
+    // totals may lag the histograms by the record made in between
+    for (int k = 0; k < GIL_PAUSE_KINDS; k++) {
+      latency_histogram_merge(&process->pause[k], &h->pause[k]);
+      process_totals[k] += counters.pause_total[k];
+    }
+    sprintf(thread_id_buffer, "%lx", pthread_t_to_ulong(slot->thread_id));
+    const char *name_ptr =
+        lookup_thread_name(thread_name_map, slot->thread_id,
+                           thread_name_buffer, sizeof(thread_name_buffer));
+    format_pause_rows(ss, clock, time_buffer, thread_id_buffer, name_ptr,
+                      counters.pause_total, h);
+  }
+
+  if (process->pause[GIL_PAUSE_CRITICAL_SECTION].count > 0 ||
+      process->pause[GIL_PAUSE_STOP_THE_WORLD].count > 0) {
+    format_pause_rows(ss, clock, time_buffer, "all", "process",
+                      process_totals, process);
+    ss << "\n";
+    const std::string tmp = ss.str();
+    stat->send(tmp.c_str(), tstate);
+  }
+  free(scratch);
+}
 
-  // remove exited thread id from thread map
-  for (int i = 0; i < nthreads; i++) {
-    pthread_t p = thread_ids[i];
+void PyGilStat::release_exited_slots() {
+  // exited threads never touch their slots again
+  for (unsigned int i = 0; i < slot_capacity; i++) {
+    gil_thread_slot *slot = &slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != GIL_SLOT_ACTIVE) {
+      continue;
+    }
     // kill -0 test thread alive
-    int ret = pthread_kill(p, 0);
+    int ret = pthread_kill(slot->thread_id, 0);
     if (ret != 0 && ret != EBUSY) {
-      pthread_mutex_lock(&stat->stat_map_mutex);
-      auto it = stat->stat_map->find(p);
-      if (it != stat->stat_map->end()) {
-        gil_statistics *gil_stat = it->second;
-        stat->stat_map->erase(p);
-        free(gil_stat);
+      // keep its latency distribution in the process wide report
+      merge_gil_histograms(retired_histograms, &slot->stat.histograms);
+      for (int k = 0; k < GIL_PAUSE_KINDS; k++) {
+        retired_pause_total[k] += slot->stat.counters.pause_total[k];
       }
-      pthread_mutex_unlock(&stat->stat_map_mutex);
+      memset(&slot->stat, 0, sizeof(gil_statistics));
+      __atomic_store_n(&slot->state, GIL_SLOT_FREE, __ATOMIC_RELEASE);
     }
   }
 }
@@ -272,54 +741,212 @@ void PyGilStat::dump_gil_warning(
     std::map<unsigned long, char *> *thread_name_map) {
   struct bootstate *boot = (struct bootstate *)boot_raw;
   PyGilStat *stat = boot->stat;
+  clock_source clock = stat->config->clock;
 
-  pthread_mutex_lock(&stat->warning_list_mutex);
-  if (stat->warning_list->size() > 0) {
-    std::stringstream ss;
-    char str_buffer[4096];
+  unsigned long dropped =
+      __atomic_exchange_n(&stat->dropped_warnings, 0, __ATOMIC_RELAXED);
+  gil_warning w;
+  bool has_warning = stat->pop_warning(&w);
+  if (!has_warning && dropped == 0) {
+    return;
+  }
+
+  std::stringstream ss;
+  char str_buffer[4096];
+  char thread_name_buffer[16];
+  sprintf(str_buffer,
+          "\ngil warning report:\n%-26s%-18s%-24s%-12s%-18s%-18s%-30s%-30s\n",
+          "time", "thread_id", "thread_name", "event", "cost(ns)",
+          "threshold(ns)", "start(ns)", "end(ns)");
+  ss << str_buffer;
+
+  // at most one ring of records, later ones wait for the next report
+  unsigned long reported = 0;
+  while (has_warning) {
+    unsigned long pid = pthread_t_to_ulong(w.thread_id);
+    const char *name_ptr =
+        lookup_thread_name(thread_name_map, w.thread_id, thread_name_buffer,
+                           sizeof(thread_name_buffer));
+
+    // convert ticks to wall time only when reporting
+    unsigned long long start_ns =
+        clock_ticks_to_realtime_ns(clock, w.start_ticks);
+    unsigned long long end_ns = clock_ticks_to_realtime_ns(clock, w.end_ticks);
+    struct timespec start_ts;
+    start_ts.tv_sec = start_ns / 1000000000ull;
+    start_ts.tv_nsec = start_ns % 1000000000ull;
+    char time_buffer[24];
+    strftime_with_millisec(&start_ts, time_buffer, sizeof(time_buffer));
+
+    sprintf(str_buffer, "%-26s%-18lx%-24s%-12s%-18llu%-18lu%-30llu%-30llu\n",
+            time_buffer, pid, name_ptr, w.type == 0 ? "take_gil" : "hold_gil",
+            clock_ticks_to_ns(clock, w.cost),
+            (w.type == 0 ? stat->config->gil_take_warning_threshold
+                         : stat->config->gil_hold_warning_threshold) *
+                1000000ul,
+            start_ns, end_ns);
+    ss << str_buffer;
+    has_warning =
+        ++reported < GIL_WARNING_RING_CAPACITY && stat->pop_warning(&w);
+  }
+
+  if (dropped > 0) {
     sprintf(str_buffer,
-            "\ngil warning report:\n%-26s%-18s%-24s%-12s%-18s%-18s%-30s%-30s\n",
-            "time", "thread_id", "thread_name", "event", "cost(ns)",
-            "threshold(ns)", "start(ns)", "end(ns)");
+            "%lu warnings dropped since last report, at most %u are kept\n",
+            dropped, GIL_WARNING_RING_CAPACITY);
     ss << str_buffer;
+  }
 
-    while (stat->warning_list->size() > 0) {
-      gil_warning *w = stat->warning_list->front();
-      stat->warning_list->pop_front();
+  ss << "\n";
+  const std::string tmp = ss.str();
+  const char *cstr = tmp.c_str();
+  // send to server q, here will take gil lock then send then release gil lock
+  stat->send(cstr, tstate);
+}
 
-      unsigned long pid = pthread_t_to_ulong(w->thread_id);
-      const char *name_ptr = NULL;
-      if (thread_name_map != NULL) {
-        auto it = thread_name_map->find(pid);
-        if (it != thread_name_map->end()) {
-          name_ptr = it->second;
-        }
-      }
-      if (name_ptr == NULL) {
-        name_ptr = (const char *)&w->thread_name;
-      }
+bool PyGilStat::has_unnamed_thread(
+    std::map<unsigned long, char *> *thread_name_map) {
+  for (unsigned int i = 0; i < slot_capacity; i++) {
+    gil_thread_slot *slot = &slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != GIL_SLOT_ACTIVE) {
+      continue;
+    }
+    if (thread_name_map == NULL ||
+        thread_name_map->find(pthread_t_to_ulong(slot->thread_id)) ==
+            thread_name_map->end()) {
+      return true;
+    }
+  }
+  return false;
+}
 
-      sprintf(str_buffer, "%-26s%-18lx%-24s%-12s%-18lu%-18lu%-30lu%-30lu\n",
-              w->time, pid, name_ptr, w->type == 0 ? "take_gil" : "hold_gil",
-              w->cost,
-              w->type == 0 ? stat->config->gil_take_warning_threshold
-                           : stat->config->gil_hold_warning_threshold,
-              w->start_ns, w->end_ns);
-      free(w);
-      ss << str_buffer;
+std::map<unsigned long, char *> *PyGilStat::add_native_thread_names(
+    void *boot_raw, std::map<unsigned long, char *> *thread_name_map) {
+  struct bootstate *boot = (struct bootstate *)boot_raw;
+  PyGilStat *stat = boot->stat;
+  if (thread_name_map == NULL) {
+    thread_name_map = new std::map<unsigned long, char *>();
+  }
+  char thread_name_buffer[16];
+  for (unsigned int i = 0; i < stat->slot_capacity; i++) {
+    gil_thread_slot *slot = &stat->slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != GIL_SLOT_ACTIVE) {
+      continue;
     }
+    unsigned long pid = pthread_t_to_ulong(slot->thread_id);
+    if (thread_name_map->find(pid) == thread_name_map->end()) {
+      const char *name =
+          lookup_thread_name(NULL, slot->thread_id, thread_name_buffer,
+                             sizeof(thread_name_buffer));
+      thread_name_map->insert(
+          std::map<unsigned long, char *>::value_type(pid, strdup(name)));
+    }
+  }
+  return thread_name_map;
+}
 
-    pthread_mutex_unlock(&stat->warning_list_mutex);
+static void fill_stream_percentiles(gil_stream_percentiles *out,
+                                    latency_histogram *h,
+                                    clock_source clock) {
+  out->count = h->count;
+  out->p50 = clock_ticks_to_ns(clock, latency_histogram_percentile(h, 50));
+  out->p90 = clock_ticks_to_ns(clock, latency_histogram_percentile(h, 90));
+  out->p99 = clock_ticks_to_ns(clock, latency_histogram_percentile(h, 99));
+  out->p999 = clock_ticks_to_ns(clock, latency_histogram_percentile(h, 99.9));
+  out->max = clock_ticks_to_ns(clock, h->max);
+}
 
-    ss << "\n";
-    const std::string tmp = ss.str();
-    const char *cstr = tmp.c_str();
-    // send to server q, here will take gil lock then send then release gil lock
-    stat->send(cstr, tstate);
+void PyGilStat::dump_gil_stream(
+    void *boot_raw, std::map<unsigned long, char *> *thread_name_map) {
+  struct bootstate *boot = (struct bootstate *)boot_raw;
+  PyGilStat *stat = boot->stat;
+  gil_stream *stream = stat->stream;
+  clock_source clock = stat->config->clock;
+  char thread_name_buffer[16];
 
-  } else {
-    pthread_mutex_unlock(&stat->warning_list_mutex);
+  // [0] snapshot of one thread, [1] process wide
+  gil_histograms *scratch =
+      (gil_histograms *)malloc(sizeof(gil_histograms) * 2);
+  if (scratch == NULL) {
+    return;
+  }
+  gil_histograms *process = &scratch[1];
+  memcpy(process, stat->retired_histograms, sizeof(gil_histograms));
+
+  struct timespec ts;
+  timespec_get(&ts, TIME_UTC);
+  gil_stream_report report;
+  report.time_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+  report.untracked_threads =
+      __atomic_load_n(&stat->untracked_threads, __ATOMIC_RELAXED);
+  report.dropped_warnings =
+      __atomic_exchange_n(&stat->dropped_warnings, 0, __ATOMIC_RELAXED);
+  gil_stream_append(stream, GIL_STREAM_REPORT, &report, sizeof(report));
+
+  for (unsigned int i = 0; i < stat->slot_capacity; i++) {
+    gil_thread_slot *slot = &stat->slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != GIL_SLOT_ACTIVE) {
+      continue;
+    }
+    gil_counters counters;
+    read_gil_counters(&slot->stat, &counters);
+    if (counters.gil_take_count == 0 || counters.gil_drop_count == 0) {
+      continue;
+    }
+    gil_histograms *h = &scratch[0];
+    snapshot_gil_histograms(h, &slot->stat.histograms);
+    merge_gil_histograms(process, h);
+
+    gil_stream_thread record;
+    memset(&record, 0, sizeof(record));
+    record.thread_id = pthread_t_to_ulong(slot->thread_id);
+    strncpy(record.thread_name,
+            lookup_thread_name(thread_name_map, slot->thread_id,
+                               thread_name_buffer, sizeof(thread_name_buffer)),
+            sizeof(record.thread_name) - 1);
+    record.take_count = counters.gil_take_count;
+    record.take_total_ns =
+        clock_ticks_to_ns(clock, counters.gil_take_total_cost);
+    record.hold_total_ns = clock_ticks_to_ns(clock, counters.gil_hold_total);
+    record.drop_count = counters.gil_drop_count;
+    record.drop_total_ns =
+        clock_ticks_to_ns(clock, counters.gil_drop_total_cost);
+    fill_stream_percentiles(&record.take, &h->take, clock);
+    fill_stream_percentiles(&record.hold, &h->hold, clock);
+    fill_stream_percentiles(&record.drop, &h->drop, clock);
+    gil_stream_append(stream, GIL_STREAM_THREAD, &record, sizeof(record));
+  }
+
+  gil_stream_process process_record;
+  fill_stream_percentiles(&process_record.take, &process->take, clock);
+  fill_stream_percentiles(&process_record.hold, &process->hold, clock);
+  fill_stream_percentiles(&process_record.drop, &process->drop, clock);
+  gil_stream_append(stream, GIL_STREAM_PROCESS, &process_record,
+                    sizeof(process_record));
+  free(scratch);
+
+  gil_warning w;
+  for (unsigned long n = 0;
+       n < GIL_WARNING_RING_CAPACITY && stat->pop_warning(&w); n++) {
+    gil_stream_warning record;
+    memset(&record, 0, sizeof(record));
+    record.thread_id = pthread_t_to_ulong(w.thread_id);
+    strncpy(record.thread_name,
+            lookup_thread_name(thread_name_map, w.thread_id,
+                               thread_name_buffer, sizeof(thread_name_buffer)),
+            sizeof(record.thread_name) - 1);
+    record.type = w.type;
+    record.cost_ns = clock_ticks_to_ns(clock, w.cost);
+    record.threshold_ns = (w.type == 0
+                               ? stat->config->gil_take_warning_threshold
+                               : stat->config->gil_hold_warning_threshold) *
+                          1000000ul;
+    record.start_ns = clock_ticks_to_realtime_ns(clock, w.start_ticks);
+    record.end_ns = clock_ticks_to_realtime_ns(clock, w.end_ticks);
+    gil_stream_append(stream, GIL_STREAM_WARNING, &record, sizeof(record));
   }
+
+  gil_stream_commit(stream);
 }
 
 /**
@@ -346,8 +973,9 @@ void PyGilStat::boot_entry(void *boot_raw) {
 
   fprintf(stdout, "pyFlightProfiler: Gil Stat Thread start Executing.\n");
 
-  int stat_interval = stat->config->stat_interval * 1000;
-  int sleep_interval = 500;
+  int stat_interval = stat->config->stat_interval_ms;
+  int sleep_interval = stat_interval < 500 ? stat_interval : 500;
+  std::map<unsigned long, char *> *stream_name_map = NULL;
   struct timespec last_ts;
   timespec_get(&last_ts, TIME_UTC);
   while (stat->running_flag) {
@@ -356,21 +984,31 @@ void PyGilStat::boot_entry(void *boot_raw) {
     if ((ts.tv_sec - last_ts.tv_sec) * 1000 +
             (ts.tv_nsec - last_ts.tv_nsec) / 1000000 >=
         stat_interval) {
+      if (stat->stream != NULL) {
+        // names are kept between reports, gil is only taken when a new
+        // thread shows up
+        if (stat->has_unnamed_thread(stream_name_map)) {
+          free_thread_name_map(stream_name_map);
+          stream_name_map = PyGilStat::dump_thread_name(boot_raw, tstate);
+          stream_name_map = PyGilStat::add_native_thread_names(
+              boot_raw, stream_name_map);
+        }
+        PyGilStat::dump_gil_stream(boot_raw, stream_name_map);
+        stat->release_exited_slots();
+        timespec_get(&last_ts, TIME_UTC);
+        continue;
+      }
       // dump all thread id-name pair, because python Thread's name is not
       // setted to pthread
       std::map<unsigned long, char *> *thread_name_map =
           PyGilStat::dump_thread_name(boot_raw, tstate);
       PyGilStat::dump_gil_warning(boot_raw, tstate, thread_name_map);
       PyGilStat::dump_gil_stat(boot_raw, tstate, thread_name_map);
-      // release thread name map
-      if (thread_name_map != NULL) {
-        for (std::map<unsigned long, char *>::iterator it =
-                 thread_name_map->begin();
-             it != thread_name_map->end(); ++it) {
-          free(it->second);
-        }
-        delete thread_name_map;
-      }
+      PyGilStat::dump_gil_percentile(boot_raw, tstate, thread_name_map);
+      PyGilStat::dump_gil_interp(boot_raw, tstate);
+      PyGilStat::dump_gil_pause(boot_raw, tstate, thread_name_map);
+      stat->release_exited_slots();
+      free_thread_name_map(thread_name_map);
 
       timespec_get(&last_ts, TIME_UTC);
       continue;
@@ -382,7 +1020,10 @@ void PyGilStat::boot_entry(void *boot_raw) {
     select(0, (fd_set *)0, (fd_set *)0, (fd_set *)0, &t);
   }
 
+  free_thread_name_map(stream_name_map);
   fprintf(stdout, "pyFlightProfiler: Gil Stat Thread finished execution.\n");
+  // stat must not be accessed after this point
+  __atomic_store_n(&stat->stat_thread_exited, true, __ATOMIC_RELEASE);
 
   PyMem_RawFree(boot_raw);
 
@@ -435,160 +1076,411 @@ void PyGilStat::start_python_stat_thread() {
   PyGILState_Release(old_gil_state);
 }
 
-void PyGilStat::on_take_gil_enter(pthread_t p) {
-  pthread_mutex_lock(&stat_map_mutex);
-  auto it = this->stat_map->find(p);
-  gil_statistics *gil_stat;
-  if (it != this->stat_map->end()) {
-    gil_stat = it->second;
-  } else {
-    gil_stat = (gil_statistics *)malloc(sizeof(gil_statistics));
-    memset(gil_stat, 0, sizeof(gil_statistics));
-    this->stat_map->insert(
-        std::unordered_map<pthread_t, gil_statistics *>::value_type(p,
-                                                                    gil_stat));
+gil_thread_slot *PyGilStat::claim_slot(pthread_t p) {
+  for (unsigned int i = 0; i < slot_capacity; i++) {
+    gil_thread_slot *slot = &slots[i];
+    int expected = GIL_SLOT_FREE;
+    if (__atomic_load_n(&slot->state, __ATOMIC_RELAXED) == GIL_SLOT_FREE &&
+        __atomic_compare_exchange_n(&slot->state, &expected, GIL_SLOT_CLAIMING,
+                                    false, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+      slot->thread_id = p;
+#ifdef __linux__
+      slot->native_thread_id = syscall(SYS_gettid);
+#else
+      slot->native_thread_id = 0;
+#endif
+      // cycles of the former owner are dropped
+      __atomic_store_n(&slot->timeline_head, 0, __ATOMIC_RELAXED);
+      // stat thread reads thread_id only after slot becomes active
+      __atomic_store_n(&slot->state, GIL_SLOT_ACTIVE, __ATOMIC_RELEASE);
+      return slot;
+    }
   }
-  timespec_get(&gil_stat->last_gil_take_start_time, TIME_UTC);
-  pthread_mutex_unlock(&stat_map_mutex);
+  __atomic_add_fetch(&untracked_threads, 1, __ATOMIC_RELAXED);
+  return NULL;
 }
 
-void PyGilStat::on_take_gil_leave(pthread_t p) {
-  pthread_mutex_lock(&stat_map_mutex);
-  auto it = this->stat_map->find(p);
-  gil_statistics *gil_stat;
-  if (it != this->stat_map->end()) {
-    gil_stat = it->second;
-    if (gil_stat->last_gil_take_start_time.tv_sec <= 0) {
-      pthread_mutex_unlock(&stat_map_mutex);
-      fprintf(
-          stderr,
-          "[*] gil_statistics last take start not found when take_gil leave\n");
+gil_thread_slot *PyGilStat::current_slot(pthread_t p) {
+  if (tls_gil_generation == generation) {
+    // NULL is cached too, so untracked threads do not rescan slots
+    return tls_gil_slot;
+  }
+  tls_gil_slot = claim_slot(p);
+  tls_gil_generation = generation;
+  return tls_gil_slot;
+}
+
+void PyGilStat::record_timeline(gil_thread_slot *slot,
+                                unsigned long drop_end_ticks) {
+  gil_statistics *gil_stat = &slot->stat;
+  unsigned long capacity = config->timeline_events;
+  unsigned long head = slot->timeline_head;
+  gil_timeline_event *event =
+      &timeline[(slot - slots) * capacity + (head & (capacity - 1))];
+  // seqlock per cycle, dump_timeline skips cycles rewritten while copied
+  __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&event->take_start_ticks,
+                   gil_stat->last_gil_take_start_ticks, __ATOMIC_RELAXED);
+  __atomic_store_n(&event->take_end_ticks,
+                   gil_stat->last_gil_take_success_ticks, __ATOMIC_RELAXED);
+  __atomic_store_n(&event->drop_start_ticks,
+                   gil_stat->last_gil_drop_start_ticks, __ATOMIC_RELAXED);
+  __atomic_store_n(&event->drop_end_ticks, drop_end_ticks, __ATOMIC_RELAXED);
+  __atomic_store_n(&event->seq, head + 1, __ATOMIC_RELEASE);
+  __atomic_store_n(&slot->timeline_head, head + 1, __ATOMIC_RELEASE);
+}
+
+PyObject *PyGilStat::dump_timeline() {
+  if (timeline == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "gil timeline is not recorded");
+    return NULL;
+  }
+  clock_source clock = config->clock;
+  unsigned long capacity = config->timeline_events;
+  uint64_t *buffer = (uint64_t *)malloc(sizeof(uint64_t) * 4 * capacity);
+  if (buffer == NULL) {
+    return PyErr_NoMemory();
+  }
+  PyObject *result = PyList_New(0);
+  char thread_name_buffer[16];
+  for (unsigned int i = 0; result != NULL && i < slot_capacity; i++) {
+    gil_thread_slot *slot = &slots[i];
+    // exited threads keep their cycles until the slot is claimed again
+    unsigned long head =
+        __atomic_load_n(&slot->timeline_head, __ATOMIC_ACQUIRE);
+    if (head == 0) {
+      continue;
+    }
+    gil_timeline_event *ring = &timeline[(size_t)i * capacity];
+    unsigned long first = head > capacity ? head - capacity : 0;
+    unsigned long n = 0;
+    for (unsigned long index = first; index < head; index++) {
+      gil_timeline_event *event = &ring[index & (capacity - 1)];
+      unsigned long seq = __atomic_load_n(&event->seq, __ATOMIC_ACQUIRE);
+      unsigned long ticks[4];
+      ticks[0] = __atomic_load_n(&event->take_start_ticks, __ATOMIC_RELAXED);
+      ticks[1] = __atomic_load_n(&event->take_end_ticks, __ATOMIC_RELAXED);
+      ticks[2] = __atomic_load_n(&event->drop_start_ticks, __ATOMIC_RELAXED);
+      ticks[3] = __atomic_load_n(&event->drop_end_ticks, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (seq != index + 1 ||
+          __atomic_load_n(&event->seq, __ATOMIC_RELAXED) != seq) {
+        continue;
+      }
+      for (int t = 0; t < 4; t++) {
+        buffer[n * 4 + t] = clock_ticks_to_realtime_ns(clock, ticks[t]);
+      }
+      n++;
+    }
+    const char *name =
+        __atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == GIL_SLOT_ACTIVE
+            ? lookup_thread_name(NULL, slot->thread_id, thread_name_buffer,
+                                 sizeof(thread_name_buffer))
+            : "unknown";
+    PyObject *item = Py_BuildValue(
+        "(klskN)", pthread_t_to_ulong(slot->thread_id),
+        slot->native_thread_id, name, head - n,
+        PyBytes_FromStringAndSize((const char *)buffer,
+                                  n * 4 * sizeof(uint64_t)));
+    if (item == NULL || PyList_Append(result, item) != 0) {
+      Py_XDECREF(item);
+      Py_CLEAR(result);
+      break;
+    }
+    Py_DECREF(item);
+  }
+  free(buffer);
+  return result;
+}
+
+void PyGilStat::record_hold_sample(pthread_t p, PyThreadState *tstate,
+                                   unsigned long hold_ticks) {
+  // tstate still holds the gil of its interpreter, its frames do not change
+  // before the gil is released
+  unsigned long pos = __atomic_load_n(&hold_sample_head, __ATOMIC_RELAXED);
+  gil_hold_sample_cell *cell;
+  while (true) {
+    cell = &hold_sample_ring[pos & (GIL_HOLD_SAMPLE_CAPACITY - 1)];
+    unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    long diff = (long)seq - (long)pos;
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&hold_sample_head, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // ring is full, frames are not captured so nothing is referenced
+      __atomic_add_fetch(&dropped_hold_samples, 1, __ATOMIC_RELAXED);
       return;
+    } else {
+      pos = __atomic_load_n(&hold_sample_head, __ATOMIC_RELAXED);
     }
-    timespec_get(&gil_stat->last_gil_take_success_time, TIME_UTC);
-    gil_stat->gil_take_count++;
-    gil_stat->last_gil_take_cost =
-        (gil_stat->last_gil_take_success_time.tv_sec -
-         gil_stat->last_gil_take_start_time.tv_sec) *
-            1000000000ul +
-        gil_stat->last_gil_take_success_time.tv_nsec -
-        gil_stat->last_gil_take_start_time.tv_nsec;
-    gil_stat->gil_take_total_cost += gil_stat->last_gil_take_cost;
-    pthread_mutex_unlock(&stat_map_mutex);
-  } else {
-    pthread_mutex_unlock(&stat_map_mutex);
-    fprintf(stderr, "[*] gil_statistics not found when take_gil leave\n");
   }
+  cell->sample.thread_id = p;
+  cell->sample.hold_ticks = hold_ticks;
+  cell->sample.depth =
+      capture_py_frames(tstate, cell->sample.frames, (int)config->hold_frames);
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
 }
 
-void PyGilStat::on_drop_gil_enter(pthread_t p) {
-  pthread_mutex_lock(&stat_map_mutex);
-  auto it = this->stat_map->find(p);
-  gil_statistics *gil_stat;
-  if (it != this->stat_map->end()) {
-    gil_stat = it->second;
-    timespec_get(&gil_stat->last_gil_drop_start_time, TIME_UTC);
-    pthread_mutex_unlock(&stat_map_mutex);
-  } else {
-    pthread_mutex_unlock(&stat_map_mutex);
-    fprintf(stderr, "[*] gil_statistics not found when drop_gil enter\n");
+gil_hold_sample_cell *PyGilStat::peek_hold_sample() {
+  gil_hold_sample_cell *cell =
+      &hold_sample_ring[hold_sample_tail & (GIL_HOLD_SAMPLE_CAPACITY - 1)];
+  if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != hold_sample_tail + 1) {
+    return NULL;
   }
+  return cell;
 }
 
-void PyGilStat::on_drop_gil_leave(pthread_t p) {
-  pthread_mutex_lock(&stat_map_mutex);
-  auto it = this->stat_map->find(p);
-  gil_statistics *gil_stat;
-  if (it != this->stat_map->end()) {
-    gil_stat = it->second;
-
-    if (gil_stat->last_gil_take_start_time.tv_sec <= 0 ||
-        gil_stat->last_gil_take_success_time.tv_sec <= 0) {
-      pthread_mutex_unlock(&stat_map_mutex);
-      fprintf(stderr,
-              "[*] gil_statistics last take not found when drop_gil leave\n");
-      return;
+void PyGilStat::pop_hold_sample(gil_hold_sample_cell *cell) {
+  release_py_frames(cell->sample.frames, cell->sample.depth);
+  __atomic_store_n(&cell->seq, hold_sample_tail + GIL_HOLD_SAMPLE_CAPACITY,
+                   __ATOMIC_RELEASE);
+  hold_sample_tail++;
+}
+
+void PyGilStat::clear_hold_samples() {
+  if (hold_sample_ring == NULL) {
+    return;
+  }
+  gil_hold_sample_cell *cell;
+  while ((cell = peek_hold_sample()) != NULL) {
+    pop_hold_sample(cell);
+  }
+}
+
+PyObject *PyGilStat::dump_hold_samples() {
+  if (hold_sample_ring == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "gil hold samples are not taken");
+    return NULL;
+  }
+  PyObject *samples = PyList_New(0);
+  gil_hold_sample_cell *cell;
+  while (samples != NULL && (cell = peek_hold_sample()) != NULL) {
+    gil_hold_sample *sample = &cell->sample;
+    PyObject *frames = PyTuple_New(sample->depth);
+    for (int i = 0; frames != NULL && i < sample->depth; i++) {
+      PyObject *frame = Py_BuildValue("(Oi)", sample->frames[i].code,
+                                      py_raw_frame_line(&sample->frames[i]));
+      if (frame == NULL) {
+        Py_CLEAR(frames);
+        break;
+      }
+      PyTuple_SET_ITEM(frames, i, frame);
+    }
+    PyObject *item = NULL;
+    if (frames != NULL) {
+      item = Py_BuildValue(
+          "(kKN)", pthread_t_to_ulong(sample->thread_id),
+          clock_ticks_to_ns(config->clock, sample->hold_ticks), frames);
     }
+    pop_hold_sample(cell);
+    if (item == NULL || PyList_Append(samples, item) != 0) {
+      Py_XDECREF(item);
+      Py_CLEAR(samples);
+    } else {
+      Py_DECREF(item);
+    }
+  }
+  if (samples == NULL) {
+    return NULL;
+  }
+  unsigned long dropped =
+      __atomic_exchange_n(&dropped_hold_samples, 0, __ATOMIC_RELAXED);
+  return Py_BuildValue("(kN)", dropped, samples);
+}
 
-    if (gil_stat->last_gil_drop_start_time.tv_sec <= 0) {
-      pthread_mutex_unlock(&stat_map_mutex);
-      fprintf(
-          stderr,
-          "[*] gil_statistics last drop start not found when drop_gil leave\n");
+void PyGilStat::push_warning(const gil_warning *w) {
+  unsigned long pos = __atomic_load_n(&warning_head, __ATOMIC_RELAXED);
+  gil_warning_cell *cell;
+  while (true) {
+    cell = &warning_ring[pos & (GIL_WARNING_RING_CAPACITY - 1)];
+    unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+    long diff = (long)seq - (long)pos;
+    if (diff == 0) {
+      // cell is free, reserve it, pos is reloaded when another thread wins
+      if (__atomic_compare_exchange_n(&warning_head, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // ring is full, keep the older records
+      __atomic_add_fetch(&dropped_warnings, 1, __ATOMIC_RELAXED);
       return;
+    } else {
+      pos = __atomic_load_n(&warning_head, __ATOMIC_RELAXED);
     }
+  }
+  cell->warning = *w;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+}
 
-    unsigned long last_gil_drop_cost;
-    unsigned long last_gil_hold_time;
-    struct timespec last_gil_drop_success_time;
-    timespec_get(&last_gil_drop_success_time, TIME_UTC);
-    gil_stat->gil_drop_count++;
-    last_gil_drop_cost = (last_gil_drop_success_time.tv_sec -
-                          gil_stat->last_gil_drop_start_time.tv_sec) *
-                             1000000000ul +
-                         last_gil_drop_success_time.tv_nsec -
-                         gil_stat->last_gil_drop_start_time.tv_nsec;
-    gil_stat->gil_drop_total_cost += last_gil_drop_cost;
-    last_gil_hold_time = (last_gil_drop_success_time.tv_sec -
-                          gil_stat->last_gil_take_success_time.tv_sec) *
-                             1000000000ul +
-                         last_gil_drop_success_time.tv_nsec -
-                         gil_stat->last_gil_take_success_time.tv_nsec;
-    gil_stat->gil_hold_total += last_gil_hold_time;
-
-    pthread_mutex_unlock(&stat_map_mutex);
-
-    // thread take gil mutex cost time warning
-    if (gil_stat->last_gil_take_cost >
-        config->gil_take_warning_threshold * 1000000ul) {
-
-      gil_warning *w = (gil_warning *)malloc(sizeof(gil_warning));
-      strftime_with_millisec(&gil_stat->last_gil_take_success_time, w->time,
-                             sizeof(w->time));
-      w->thread_id = p;
-      pthread_getname_np(p, w->thread_name, sizeof(w->thread_name));
-      w->type = 0;
-      w->cost = gil_stat->last_gil_take_cost;
-      w->start_ns = gil_stat->last_gil_take_start_time.tv_sec * 1000000000ul +
-                    gil_stat->last_gil_take_start_time.tv_nsec;
-      w->end_ns = gil_stat->last_gil_take_success_time.tv_sec * 1000000000ul +
-                  gil_stat->last_gil_take_success_time.tv_nsec;
-
-      pthread_mutex_lock(&warning_list_mutex);
-      if (this->warning_list->size() > 50) {
-        gil_warning *deprecated = this->warning_list->front();
-        this->warning_list->pop_front();
-        free(deprecated);
-      }
-      this->warning_list->push_back(w);
-      pthread_mutex_unlock(&warning_list_mutex);
-    }
-
-    // thread hold gil mutex time warning
-    if (last_gil_hold_time > config->gil_hold_warning_threshold * 1000000ul) {
-      gil_warning *w = (gil_warning *)malloc(sizeof(gil_warning));
-      strftime_with_millisec(&gil_stat->last_gil_take_success_time, w->time,
-                             sizeof(w->time));
-
-      pthread_getname_np(p, w->thread_name, sizeof(w->thread_name));
-      w->type = 0;
-      w->cost = last_gil_hold_time;
-      w->start_ns = gil_stat->last_gil_take_success_time.tv_sec * 1000000000ul +
-                    gil_stat->last_gil_take_success_time.tv_nsec;
-      w->end_ns = last_gil_drop_success_time.tv_sec * 1000000000ul +
-                  last_gil_drop_success_time.tv_nsec;
-
-      pthread_mutex_lock(&warning_list_mutex);
-      if (this->warning_list->size() > 50) {
-        gil_warning *deprecated = this->warning_list->front();
-        this->warning_list->pop_front();
-        free(deprecated);
-      }
-      this->warning_list->push_back(w);
-      pthread_mutex_unlock(&warning_list_mutex);
+bool PyGilStat::pop_warning(gil_warning *w) {
+  gil_warning_cell *cell =
+      &warning_ring[warning_tail & (GIL_WARNING_RING_CAPACITY - 1)];
+  // not filled yet, or a producer is still writing it
+  if (__atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE) != warning_tail + 1) {
+    return false;
+  }
+  *w = cell->warning;
+  __atomic_store_n(&cell->seq, warning_tail + GIL_WARNING_RING_CAPACITY,
+                   __ATOMIC_RELEASE);
+  warning_tail++;
+  return true;
+}
+
+void PyGilStat::on_take_gil_enter(pthread_t p, long interp_id) {
+  gil_thread_slot *slot = current_slot(p);
+  if (slot == NULL) {
+    return;
+  }
+  slot->stat.last_gil_take_start_ticks = clock_ticks(config->clock);
+  __atomic_store_n(&slot->stat.interp_id, interp_id, __ATOMIC_RELAXED);
+}
+
+bool PyGilStat::is_taking_gil(pthread_t p) {
+  for (unsigned int i = 0; i < slot_capacity; i++) {
+    gil_thread_slot *slot = &slots[i];
+    if (__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) != GIL_SLOT_ACTIVE ||
+        !pthread_equal(slot->thread_id, p)) {
+      continue;
     }
-  } else {
-    pthread_mutex_unlock(&stat_map_mutex);
-    fprintf(stderr, "[*] gil_statistics not found when drop_gil leave\n");
+    // written by the owner thread only, a stale read misses one transition
+    unsigned long start = __atomic_load_n(
+        &slot->stat.last_gil_take_start_ticks, __ATOMIC_RELAXED);
+    unsigned long success = __atomic_load_n(
+        &slot->stat.last_gil_take_success_ticks, __ATOMIC_RELAXED);
+    return start > success;
+  }
+  return false;
+}
+
+void PyGilStat::on_take_gil_leave(pthread_t p) {
+  gil_thread_slot *slot = current_slot(p);
+  if (slot == NULL) {
+    return;
+  }
+  gil_statistics *gil_stat = &slot->stat;
+  if (gil_stat->last_gil_take_start_ticks == 0) {
+    fprintf(
+        stderr,
+        "[*] gil_statistics last take start not found when take_gil leave\n");
+    return;
+  }
+  gil_stat->last_gil_take_success_ticks = clock_ticks(config->clock);
+  gil_stat->last_gil_take_cost = gil_stat->last_gil_take_success_ticks -
+                                 gil_stat->last_gil_take_start_ticks;
+
+  seq_write_begin(gil_stat);
+  GIL_COUNTER_ADD(gil_stat, gil_take_count, 1);
+  GIL_COUNTER_ADD(gil_stat, gil_take_total_cost, gil_stat->last_gil_take_cost);
+  seq_write_end(gil_stat);
+  latency_histogram_record(&gil_stat->histograms.take,
+                           gil_stat->last_gil_take_cost);
+}
+
+void PyGilStat::on_drop_gil_enter(pthread_t p, PyThreadState *tstate) {
+  gil_thread_slot *slot = current_slot(p);
+  if (slot == NULL) {
+    return;
+  }
+  unsigned long now = clock_ticks(config->clock);
+  slot->stat.last_gil_drop_start_ticks = now;
+  unsigned long take_success = slot->stat.last_gil_take_success_ticks;
+  if (hold_sample_ring != NULL && tstate != NULL && take_success != 0 &&
+      now - take_success > gil_hold_warning_ticks) {
+    record_hold_sample(p, tstate, now - take_success);
+  }
+}
+
+void PyGilStat::on_drop_gil_leave(pthread_t p) {
+  gil_thread_slot *slot = current_slot(p);
+  if (slot == NULL) {
+    return;
+  }
+  gil_statistics *gil_stat = &slot->stat;
+
+  if (gil_stat->last_gil_take_start_ticks == 0 ||
+      gil_stat->last_gil_take_success_ticks == 0) {
+    fprintf(stderr,
+            "[*] gil_statistics last take not found when drop_gil leave\n");
+    return;
+  }
+
+  if (gil_stat->last_gil_drop_start_ticks == 0) {
+    fprintf(
+        stderr,
+        "[*] gil_statistics last drop start not found when drop_gil leave\n");
+    return;
+  }
+
+  unsigned long last_gil_drop_success_ticks = clock_ticks(config->clock);
+  unsigned long last_gil_drop_cost =
+      last_gil_drop_success_ticks - gil_stat->last_gil_drop_start_ticks;
+  unsigned long last_gil_hold_time =
+      last_gil_drop_success_ticks - gil_stat->last_gil_take_success_ticks;
+
+  seq_write_begin(gil_stat);
+  GIL_COUNTER_ADD(gil_stat, gil_drop_count, 1);
+  GIL_COUNTER_ADD(gil_stat, gil_drop_total_cost, last_gil_drop_cost);
+  GIL_COUNTER_ADD(gil_stat, gil_hold_total, last_gil_hold_time);
+  seq_write_end(gil_stat);
+  latency_histogram_record(&gil_stat->histograms.drop, last_gil_drop_cost);
+  latency_histogram_record(&gil_stat->histograms.hold, last_gil_hold_time);
+  if (timeline != NULL) {
+    record_timeline(slot, last_gil_drop_success_ticks);
+  }
+
+  // thread take gil mutex cost time warning
+  if (gil_stat->last_gil_take_cost > gil_take_warning_ticks) {
+    gil_warning w;
+    w.type = 0;
+    w.cost = gil_stat->last_gil_take_cost;
+    w.start_ticks = gil_stat->last_gil_take_start_ticks;
+    w.end_ticks = gil_stat->last_gil_take_success_ticks;
+    w.thread_id = p;
+    push_warning(&w);
+  }
+
+  // thread hold gil mutex time warning
+  if (last_gil_hold_time > gil_hold_warning_ticks) {
+    gil_warning w;
+    w.type = 1;
+    w.cost = last_gil_hold_time;
+    w.start_ticks = gil_stat->last_gil_take_success_ticks;
+    w.end_ticks = last_gil_drop_success_ticks;
+    w.thread_id = p;
+    push_warning(&w);
+  }
+}
+
+void PyGilStat::on_pause_enter(pthread_t p, int kind) {
+  gil_thread_slot *slot = current_slot(p);
+  if (slot == NULL) {
+    return;
+  }
+  slot->stat.pause_start_ticks[kind] = clock_ticks(config->clock);
+}
+
+void PyGilStat::on_pause_leave(pthread_t p, int kind) {
+  gil_thread_slot *slot = current_slot(p);
+  if (slot == NULL) {
+    return;
+  }
+  gil_statistics *gil_stat = &slot->stat;
+  // pause began before the hooks were attached
+  if (gil_stat->pause_start_ticks[kind] == 0) {
+    return;
   }
+  unsigned long cost =
+      clock_ticks(config->clock) - gil_stat->pause_start_ticks[kind];
+  gil_stat->pause_start_ticks[kind] = 0;
+
+  seq_write_begin(gil_stat);
+  GIL_COUNTER_ADD(gil_stat, pause_count[kind], 1);
+  GIL_COUNTER_ADD(gil_stat, pause_total[kind], cost);
+  seq_write_end(gil_stat);
+  latency_histogram_record(&gil_stat->histograms.pause[kind], cost);
 }
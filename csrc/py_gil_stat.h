@@ -1,68 +1,216 @@
 #include "Python.h"
-#include <list>
+#include "clock_util.h"
+#include "gil_stat_stream.h"
+#include "latency_histogram.h"
+#include "python_util.h"
 #include <map>
 #include <pthread.h>
-#include <unordered_map>
 #ifndef __PY_GIL_STAT_H__
 #define __PY_GIL_STAT_H__
 
-typedef struct _gil_statistics {
-  struct timespec last_gil_take_start_time;
-  struct timespec last_gil_take_success_time;
-  struct timespec last_gil_drop_start_time;
-  // nano second
-  unsigned long last_gil_take_cost;
-  // nano second
+// waits of free-threaded builds, which replace the contention of the gil
+enum _gil_pause_kind {
+  // blocked in the slow path of a critical section on a contended object
+  GIL_PAUSE_CRITICAL_SECTION = 0,
+  // world stopped by this thread, from stop the world enter to start the
+  // world leave, gc is the usual stopper
+  GIL_PAUSE_STOP_THE_WORLD = 1,
+  GIL_PAUSE_KINDS = 2
+};
+
+// counters published to the gil_stat thread, guarded by gil_statistics.seq
+typedef struct _gil_counters {
+  // clock ticks
   unsigned long gil_take_total_cost;
   unsigned long gil_take_count;
 
-  // nano second
+  // clock ticks
   unsigned long gil_drop_total_cost;
   unsigned long gil_drop_count;
 
-  // nano second
+  // clock ticks
   unsigned long gil_hold_total;
+
+  unsigned long pause_count[GIL_PAUSE_KINDS];
+  // clock ticks
+  unsigned long pause_total[GIL_PAUSE_KINDS];
+} gil_counters;
+
+// latency distribution in clock ticks, written by the owner thread only
+typedef struct _gil_histograms {
+  latency_histogram take;
+  latency_histogram hold;
+  latency_histogram drop;
+  latency_histogram pause[GIL_PAUSE_KINDS];
+} gil_histograms;
+
+typedef struct _gil_statistics {
+  // only touched by the owner thread inside take_gil/drop_gil hooks
+  // clock ticks, 0 means not recorded yet
+  unsigned long last_gil_take_start_ticks;
+  unsigned long last_gil_take_success_ticks;
+  unsigned long last_gil_drop_start_ticks;
+  // clock ticks
+  unsigned long last_gil_take_cost;
+  // clock ticks, 0 when the thread is not pausing
+  unsigned long pause_start_ticks[GIL_PAUSE_KINDS];
+  // interpreter whose gil the thread took last, 0 before 3.12 where all
+  // interpreters share one gil. owner written, read relaxed by reports
+  long interp_id;
+
+  // seqlock sequence, odd while the owner thread is updating counters
+  unsigned long seq;
+  gil_counters counters;
+  // not guarded by seq, a report may miss records made while it is read
+  gil_histograms histograms;
 } gil_statistics;
 
+// one take/hold/drop cycle of a thread in clock ticks, hold_gil spans from
+// take_end to drop_end and so contains drop_gil
+typedef struct _gil_timeline_event {
+  // index + 1 of the cycle once written, 0 while the owner rewrites it
+  unsigned long seq;
+  unsigned long take_start_ticks;
+  unsigned long take_end_ticks;
+  unsigned long drop_start_ticks;
+  unsigned long drop_end_ticks;
+} gil_timeline_event;
+
+enum _gil_slot_state {
+  GIL_SLOT_FREE = 0,
+  GIL_SLOT_CLAIMING = 1,
+  GIL_SLOT_ACTIVE = 2
+};
+
+// one slot per hooked thread, found through thread local storage, cache line
+// aligned so that threads never write to the same line
+typedef struct __attribute__((aligned(64))) _gil_thread_slot {
+  int state;
+  pthread_t thread_id;
+  // kernel thread id, 0 when unknown
+  long native_thread_id;
+  gil_statistics stat;
+  // cycles ever recorded into the timeline ring of the slot, owner written
+  unsigned long timeline_head;
+} gil_thread_slot;
+
+// raw warning record, symbolized and formatted by the gil_stat thread
 typedef struct _gil_warning {
   // 0: take 1:hold
   int8_t type;
-  // nano second
+  // clock ticks, converted to nano second when reporting
   unsigned long cost;
-  // nano second
-  unsigned long start_ns;
-  // nano second
-  unsigned long end_ns;
+  unsigned long start_ticks;
+  unsigned long end_ticks;
   pthread_t thread_id;
-  char time[24];
-  char thread_name[16];
 } gil_warning;
 
+// upper bound of gil_monitor_config.hold_frames
+#define GIL_HOLD_MAX_FRAMES 32
+
+// python frames of a thread that held the gil longer than the hold warning
+// threshold, captured when it starts dropping the gil
+typedef struct _gil_hold_sample {
+  pthread_t thread_id;
+  // clock ticks from take_gil leave to drop_gil enter
+  unsigned long hold_ticks;
+  int depth;
+  // innermost first
+  py_raw_frame frames[GIL_HOLD_MAX_FRAMES];
+} gil_hold_sample;
+
+// must be a power of two
+#define GIL_WARNING_RING_CAPACITY 512
+// hold samples buffered until dump_hold_samples, must be a power of two
+#define GIL_HOLD_SAMPLE_CAPACITY 1024
+// upper bound of gil_monitor_config.timeline_events
+#define GIL_TIMELINE_MAX_EVENTS (1u << 20)
+// bytes of binary records buffered for the reader
+#define GIL_STREAM_CAPACITY (4ul << 20)
+
+typedef struct _gil_warning_cell {
+  // equals ring position when free, position + 1 when filled
+  unsigned long seq;
+  gil_warning warning;
+} gil_warning_cell;
+
+typedef struct _gil_hold_sample_cell {
+  // same protocol as gil_warning_cell
+  unsigned long seq;
+  gil_hold_sample sample;
+} gil_hold_sample_cell;
+
 typedef struct _gil_monitor_config {
   // millisecond
   unsigned int gil_take_warning_threshold;
   // millisecond
   unsigned int gil_hold_warning_threshold;
-  // second
-  unsigned int stat_interval;
+  // millisecond
+  unsigned int stat_interval_ms;
   unsigned int gil_stat_max_threads;
+  clock_source clock;
+  // export binary records to this file instead of text reports when not
+  // NULL, only read by start()
+  const char *stream_path;
+  // cycles kept in the timeline ring of every thread, a power of two, 0 does
+  // not record the timeline
+  unsigned int timeline_events;
+  // innermost python frames kept by hold samples, at most
+  // GIL_HOLD_MAX_FRAMES, 0 does not sample
+  unsigned int hold_frames;
 } gil_monitor_config;
 
 class PyGilStat {
 public:
   PyGilStat();
+  ~PyGilStat();
 
 public:
   int start(gil_monitor_config *config);
   int stop();
   void set_out_queue(PyObject *out_queue);
-  void on_take_gil_enter(pthread_t p);
+  // interp_id of the interpreter owning the gil, see gil_statistics
+  void on_take_gil_enter(pthread_t p, long interp_id);
   void on_take_gil_leave(pthread_t p);
-  void on_drop_gil_enter(pthread_t p);
+  // tstate releasing the gil, NULL when it is unknown
+  void on_drop_gil_enter(pthread_t p, PyThreadState *tstate);
   void on_drop_gil_leave(pthread_t p);
+  void on_pause_enter(pthread_t p, int kind);
+  void on_pause_leave(pthread_t p, int kind);
+  // thread p is waiting inside take_gil, false when it is not tracked
+  bool is_taking_gil(pthread_t p);
+  // recorded cycles as a list of (thread_id, native_thread_id, thread_name,
+  // lost cycles, bytes of gil_timeline_event in realtime ns) by thread, NULL
+  // with an exception set when no timeline is recorded. caller holds the gil
+  PyObject *dump_timeline();
+  // (dropped samples, [(thread_id, hold_ns, ((code, line), ...)), ...]) of
+  // the hold samples taken since the last call, frames innermost first. NULL
+  // with an exception set when hold samples are not taken. caller holds the
+  // gil
+  PyObject *dump_hold_samples();
 
 private:
+  // lookup current thread slot, claim a free one on first use
+  gil_thread_slot *current_slot(pthread_t p);
+  gil_thread_slot *claim_slot(pthread_t p);
+  // append a cycle to the timeline ring of slot, overwriting the oldest one
+  void record_timeline(gil_thread_slot *slot, unsigned long drop_end_ticks);
+  // capture python frames of tstate, which still holds the gil of its
+  // interpreter, into the multi producer single consumer ring of hold samples
+  void record_hold_sample(pthread_t p, PyThreadState *tstate,
+                          unsigned long hold_ticks);
+  gil_hold_sample_cell *peek_hold_sample();
+  void pop_hold_sample(gil_hold_sample_cell *cell);
+  // release frames of samples never dumped, caller holds the gil
+  void clear_hold_samples();
+  // multi producer single consumer ring, never blocks the hooked threads
+  void push_warning(const gil_warning *w);
+  bool pop_warning(gil_warning *w);
   void start_python_stat_thread();
+  // free slots of exited threads, only called by the stat thread
+  void release_exited_slots();
+  // some tracked thread has no name in thread_name_map yet
+  bool has_unnamed_thread(std::map<unsigned long, char *> *thread_name_map);
   void send(const char *msg, PyThreadState *tstate);
   void send_end();
 
@@ -70,24 +218,75 @@ private:
   static void boot_entry(void *boot_raw);
   static std::map<unsigned long, char *> *
   dump_thread_name(void *boot_raw, PyThreadState *tstate);
+  // name tracked threads unknown to python by their pthread name
+  static std::map<unsigned long, char *> *
+  add_native_thread_names(void *boot_raw,
+                          std::map<unsigned long, char *> *thread_name_map);
   // dump gil statistic group by thread
   static void dump_gil_stat(void *boot_raw, PyThreadState *tstate,
                             std::map<unsigned long, char *> *thread_name_map);
+  // dump p50/p90/p99/p999/max of gil take/hold/drop by thread and process
+  static void
+  dump_gil_percentile(void *boot_raw, PyThreadState *tstate,
+                      std::map<unsigned long, char *> *thread_name_map);
+  // dump gil statistic group by interpreter, only when threads took the gils
+  // of more than one interpreter
+  static void dump_gil_interp(void *boot_raw, PyThreadState *tstate);
+  // dump count/total/p99/max of free-threading pauses by thread and process
+  static void
+  dump_gil_pause(void *boot_raw, PyThreadState *tstate,
+                 std::map<unsigned long, char *> *thread_name_map);
+  // write statistics, percentiles and warnings as one binary report
+  static void
+  dump_gil_stream(void *boot_raw,
+                  std::map<unsigned long, char *> *thread_name_map);
   // dump gil take or hold timeout records
   static void
   dump_gil_warning(void *boot_raw, PyThreadState *tstate,
                    std::map<unsigned long, char *> *thread_name_map);
 
 private:
-  std::unordered_map<pthread_t, gil_statistics *> *stat_map;
-  std::list<gil_warning *> *warning_list;
+  gil_thread_slot *slots;
+  unsigned int slot_capacity;
+  size_t slots_size;
+  // histograms of released slots, kept for the process wide report
+  gil_histograms *retired_histograms;
+  // pause clock ticks of released slots, kept for the process wide report
+  unsigned long retired_pause_total[GIL_PAUSE_KINDS];
+  // distinguish slots cached in thread local storage by former instances
+  unsigned long generation;
+  // warning thresholds converted to clock ticks
+  unsigned long gil_take_warning_ticks;
+  unsigned long gil_hold_warning_ticks;
+  // threads not tracked because all slots are in use
+  unsigned long untracked_threads;
+  // binary export, NULL when reporting text to py_out_queue
+  gil_stream *stream;
+  // timeline_events cycles per slot, NULL when the timeline is not recorded
+  gil_timeline_event *timeline;
+  size_t timeline_size;
+  // NULL when hold samples are not taken
+  gil_hold_sample_cell *hold_sample_ring;
+  // next position to fill, shared by threads dropping the gil of any
+  // interpreter
+  unsigned long hold_sample_head;
+  // next position to dump, only used with the main gil held
+  unsigned long hold_sample_tail;
+  // samples discarded because the ring is full, reset on dump
+  unsigned long dropped_hold_samples;
+  gil_warning_cell *warning_ring;
+  // next position to fill, shared by hooked threads
+  unsigned long warning_head;
+  // next position to report, only used by the stat thread
+  unsigned long warning_tail;
+  // warnings discarded because the ring is full, reset on report
+  unsigned long dropped_warnings;
   gil_monitor_config *config;
   unsigned long stat_thread_id;
   bool running_flag;
+  bool stat_thread_exited;
   PyObject *py_out_queue;
   pthread_mutex_t queue_mutex;
-  pthread_mutex_t stat_map_mutex;
-  pthread_mutex_t warning_list_mutex;
 };
 
 #endif
@@ -1,4 +1,91 @@
 #include "python_util.h"
+#include "frameobject.h"
+#include <stdint.h>
+
+#if PY_VERSION_HEX >= 0x030B0000
+// leading fields of _PyInterpreterFrame in internal/pycore_frame.h, which can
+// not be included from c++. code units are 16 bits, _Py_CODEUNIT is internal
+// since 3.13
+#if PY_VERSION_HEX >= 0x030E0000
+typedef struct _raw_interpreter_frame {
+  // tagged stack reference of the code object
+  uintptr_t f_executable;
+  struct _raw_interpreter_frame *previous;
+  uintptr_t f_funcobj;
+  PyObject *f_globals;
+  PyObject *f_builtins;
+  PyObject *f_locals;
+  PyFrameObject *frame_obj;
+  uint16_t *instr_ptr;
+  void *stackpointer;
+#ifdef Py_GIL_DISABLED
+  int32_t tlbc_index;
+#endif
+  uint16_t return_offset;
+  char owner;
+} raw_interpreter_frame;
+#elif PY_VERSION_HEX >= 0x030D0000
+typedef struct _raw_interpreter_frame {
+  uintptr_t f_executable;
+  struct _raw_interpreter_frame *previous;
+  PyObject *f_funcobj;
+  PyObject *f_globals;
+  PyObject *f_builtins;
+  PyObject *f_locals;
+  PyFrameObject *frame_obj;
+  uint16_t *instr_ptr;
+  int stacktop;
+  uint16_t return_offset;
+  char owner;
+} raw_interpreter_frame;
+#elif PY_VERSION_HEX >= 0x030C0000
+typedef struct _raw_interpreter_frame {
+  PyCodeObject *f_code;
+  struct _raw_interpreter_frame *previous;
+  PyObject *f_funcobj;
+  PyObject *f_globals;
+  PyObject *f_builtins;
+  PyObject *f_locals;
+  PyFrameObject *frame_obj;
+  uint16_t *prev_instr;
+  int stacktop;
+  uint16_t return_offset;
+  char owner;
+} raw_interpreter_frame;
+#else
+typedef struct _raw_interpreter_frame {
+  PyObject *f_func;
+  PyObject *f_globals;
+  PyObject *f_builtins;
+  PyObject *f_locals;
+  PyCodeObject *f_code;
+  PyFrameObject *frame_obj;
+  struct _raw_interpreter_frame *previous;
+  uint16_t *prev_instr;
+  int stacktop;
+  bool is_entry;
+  char owner;
+} raw_interpreter_frame;
+#endif
+
+// owners from FRAME_OWNED_BY_CSTACK (FRAME_OWNED_BY_INTERPRETER since 3.14)
+// on mark entry frames of the interpreter, which run no code
+#if PY_VERSION_HEX >= 0x030C0000
+#define RAW_FRAME_OWNED_BY_INTERPRETER 3
+#else
+#define RAW_FRAME_OWNED_BY_INTERPRETER 0x7f
+#endif
+
+static raw_interpreter_frame *current_interpreter_frame(PyThreadState *tstate) {
+#if PY_VERSION_HEX >= 0x030D0000
+  return (raw_interpreter_frame *)tstate->current_frame;
+#else
+  return tstate->cframe != NULL
+             ? (raw_interpreter_frame *)tstate->cframe->current_frame
+             : NULL;
+#endif
+}
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -24,6 +111,67 @@ PyObject *invoke_module_function(const char *module, const char *function,
   return NULL;
 }
 
+int capture_py_frames(PyThreadState *tstate, py_raw_frame *frames,
+                      int max_depth) {
+  int depth = 0;
+  if (tstate == NULL) {
+    return 0;
+  }
+#if PY_VERSION_HEX >= 0x030B0000
+  raw_interpreter_frame *frame = current_interpreter_frame(tstate);
+  for (; frame != NULL && depth < max_depth; frame = frame->previous) {
+    if (frame->owner >= RAW_FRAME_OWNED_BY_INTERPRETER) {
+      continue;
+    }
+#if PY_VERSION_HEX >= 0x030D0000
+    // low bits of a 3.14 stack reference are tags, objects are aligned
+    PyObject *code = (PyObject *)(frame->f_executable & ~(uintptr_t)7);
+    uint16_t *instr = frame->instr_ptr;
+#else
+    PyObject *code = (PyObject *)frame->f_code;
+    uint16_t *instr = frame->prev_instr;
+#endif
+    if (code == NULL || !PyCode_Check(code)) {
+      continue;
+    }
+    uint16_t *first = (uint16_t *)((PyCodeObject *)code)->co_code_adaptive;
+    Py_INCREF(code);
+    frames[depth].code = code;
+    frames[depth].offset = (int)(instr - first) * (int)sizeof(uint16_t);
+    depth++;
+  }
+#else
+  PyFrameObject *frame = tstate->frame;
+  for (; frame != NULL && depth < max_depth; frame = frame->f_back) {
+    PyObject *code = (PyObject *)frame->f_code;
+    Py_INCREF(code);
+    frames[depth].code = code;
+#if PY_VERSION_HEX >= 0x030A0000
+    // f_lasti counts code units since 3.10
+    frames[depth].offset = frame->f_lasti * (int)sizeof(uint16_t);
+#else
+    frames[depth].offset = frame->f_lasti;
+#endif
+    depth++;
+  }
+#endif
+  return depth;
+}
+
+int py_raw_frame_line(const py_raw_frame *frame) {
+  PyCodeObject *code = (PyCodeObject *)frame->code;
+  if (frame->offset < 0) {
+    return code->co_firstlineno;
+  }
+  return PyCode_Addr2Line(code, frame->offset);
+}
+
+void release_py_frames(py_raw_frame *frames, int depth) {
+  for (int i = 0; i < depth; i++) {
+    Py_CLEAR(frames[i].code);
+  }
+}
+
 #ifdef __cplusplus
 }
 #endif
@@ -9,6 +9,26 @@ extern "C" {
 
 PyObject *invoke_module_function(const char *module, const char *function,
                                  PyObject *args);
+
+// python frame of a thread, the code object is referenced
+typedef struct _py_raw_frame {
+  PyObject *code;
+  // byte offset of the instruction running in the frame, negative when the
+  // frame has not started yet
+  int offset;
+} py_raw_frame;
+
+// innermost max_depth python frames of tstate, read from its frame chain
+// without allocating or taking any lock. caller holds the gil, which may
+// already be detached from tstate, returns the number of frames
+int capture_py_frames(PyThreadState *tstate, py_raw_frame *frames,
+                      int max_depth);
+
+// source line of a captured frame, caller holds the gil
+int py_raw_frame_line(const py_raw_frame *frame);
+
+// release code objects of captured frames, caller holds the gil
+void release_py_frames(py_raw_frame *frames, int depth);
 #ifdef __cplusplus
 }
 #endif
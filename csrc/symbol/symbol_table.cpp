@@ -0,0 +1,79 @@
+#include "Python.h"
+#include "elf_symbol.h"
+#include <map>
+#include <sys/stat.h>
+#include <utility>
+
+// indexed files by device and inode, NULL for files that can not be indexed.
+// kept for the life of the process, only used with the gil held
+static std::map<std::pair<dev_t, ino_t>, elf_symbol_table *> tables;
+
+/**
+ * table of the file at path, indexed on first use. a binary replaced on disk
+ * is a new inode and indexed again, while /proc/<pid>/exe of a process still
+ * running the old one resolves to the old inode
+ */
+static elf_symbol_table *indexed_table(const char *path) {
+  struct stat st;
+  if (stat(path, &st) != 0) {
+    return NULL;
+  }
+  std::pair<dev_t, ino_t> key(st.st_dev, st.st_ino);
+  auto it = tables.find(key);
+  if (it != tables.end()) {
+    return it->second;
+  }
+  elf_symbol_table *table = elf_symbol_table_open(path);
+  tables[key] = table;
+  return table;
+}
+
+static PyObject *symbol_count(PyObject *self, PyObject *args) {
+  const char *path;
+  if (!PyArg_ParseTuple(args, "s", &path)) {
+    return NULL;
+  }
+  elf_symbol_table *table = indexed_table(path);
+  if (table == NULL) {
+    return Py_BuildValue("i", -1);
+  }
+  return PyLong_FromSize_t(elf_symbol_table_size(table));
+}
+
+static PyObject *lookup_symbol(PyObject *self, PyObject *args) {
+  const char *path;
+  const char *name;
+  if (!PyArg_ParseTuple(args, "ss", &path, &name)) {
+    return NULL;
+  }
+  elf_symbol_table *table = indexed_table(path);
+  unsigned long value =
+      table != NULL ? elf_symbol_table_lookup(table, name) : 0;
+  if (value == 0) {
+    Py_RETURN_NONE;
+  }
+  return PyLong_FromUnsignedLong(value);
+}
+
+static PyMethodDef symbol_table_module_methods[] = {
+    {"symbol_count", (PyCFunction)symbol_count, METH_VARARGS,
+     "number of symbols indexed from an ELF file, -1 when it can not be "
+     "indexed"},
+    {"lookup_symbol", (PyCFunction)lookup_symbol, METH_VARARGS,
+     "link time address of a symbol of an ELF file like nm prints it"},
+    {NULL, NULL, 0, NULL}};
+
+static struct PyModuleDef symbol_table_module = {
+    PyModuleDef_HEAD_INIT,
+    // name of module
+    "symbol_table_C",
+    // module documentation
+    NULL,
+    // size of per-interpreter state of the module, or -1 if the module keeps
+    // state in global variables
+    -1, symbol_table_module_methods};
+
+// will be called when python module first loaded
+PyMODINIT_FUNC PyInit_symbol_table_C(void) {
+  return PyModule_Create(&symbol_table_module);
+}
@@ -1,8 +1,12 @@
+#include "clock_util.h"
 #include <Python.h>
 #include <assert.h>
 #include <float.h>
 #include <frameobject.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <structmember.h>
 #include <sys/time.h>
 
@@ -10,12 +14,17 @@
 // Internal functions //
 ////////////////////////
 
-static long long NSEC_PER_SEC = 1e9;
+// frames record raw clock ticks, converted to wall time only when emitted
+static long long _get_time_ticks(clock_source clock) {
+  return (long long)clock_ticks(clock);
+}
+
+static long long _ticks_to_realtime_ns(clock_source clock, long long ticks) {
+  return (long long)clock_ticks_to_realtime_ns(clock, ticks);
+}
 
-static long long _get_time_ns(void) {
-  struct timespec ts;
-  clock_gettime(CLOCK_REALTIME, &ts);
-  return (long long)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+static long long _ticks_to_ns(clock_source clock, long long ticks) {
+  return (long long)clock_ticks_to_ns(clock, ticks);
 }
 
 static PyCodeObject *_code_from_frame(PyFrameObject *frame) {
@@ -28,156 +37,386 @@ static PyCodeObject *_code_from_frame(PyFrameObject *frame) {
 #endif
 }
 
-static PyObject *_get_frame_info(PyFrameObject *frame, Py_ssize_t start_ns,
-                                 Py_ssize_t cost_ns, Py_ssize_t pid,
-                                 PyObject *arg, int c_frame) {
-  if (c_frame) {
-    PyObject *qualname = PyObject_GetAttrString(arg, "__qualname__");
-    if (!qualname) {
-      qualname = PyObject_GetAttrString(arg, "__name__");
-    }
-    PyObject *result = PyUnicode_FromFormat("%U%c%s%c%i%c%lld%c%lld%c%lld",
-                                            qualname, 0, "<built-in>", 0, 0, 1,
-                                            start_ns, 1, cost_ns, 1, pid);
-    Py_XDECREF(qualname);
-    return result;
-  } else {
-    PyCodeObject *code = _code_from_frame(frame);
-    PyObject *result = PyUnicode_FromFormat(
-        "%U%c%U%c%i%c%lld%c%lld%c%lld", code->co_name, 0, code->co_filename, 0,
-        code->co_firstlineno, 1, start_ns, 1, cost_ns, 1, pid);
-    Py_XDECREF(code);
-    return result;
+// description of a frame: method_name\x00file_name\x00lineno
+static PyObject *_code_description(PyCodeObject *code) {
+  return PyUnicode_FromFormat("%U%c%U%c%i", code->co_name, 0,
+                              code->co_filename, 0, code->co_firstlineno);
+}
+
+static PyObject *_c_func_description(PyObject *func) {
+  PyObject *qualname = PyObject_GetAttrString(func, "__qualname__");
+  if (!qualname) {
+    PyErr_Clear();
+    qualname = PyObject_GetAttrString(func, "__name__");
+  }
+  if (!qualname) {
+    PyErr_Clear();
+    return PyUnicode_FromFormat("%s%c%s%c%i", "<unknown>", 0, "<built-in>", 0,
+                                0);
   }
+  PyObject *result =
+      PyUnicode_FromFormat("%U%c%s%c%i", qualname, 0, "<built-in>", 0, 0);
+  Py_DECREF(qualname);
+  return result;
 }
 
-static PyObject *_get_header(PyFrameObject *frame, int c_frame, PyObject *arg) {
-  if (c_frame) {
-    PyObject *qualname = PyObject_GetAttrString(arg, "__qualname__");
-    if (!qualname) {
-      qualname = PyObject_GetAttrString(arg, "__name__");
+static PyObject *_await_description(void) {
+  return PyUnicode_FromFormat("%s%c%c%i", "[await]", 0, 0, 0);
+}
+
+/////////////////////////////
+// Frame description table //
+/////////////////////////////
+
+// kept frame sent to the client, see TRACE_RECORD in trace_frame.py
+typedef struct {
+  int32_t desc;     // index in the description table, -1 for an empty slot
+  int32_t pid;      // offset of the parent frame, -1 for the root
+  int64_t start_ns; // wall clock
+  int64_t cost_ns;
+} TraceRecord;
+
+// frame emitted after its offset was flushed, see TRACE_LATE_RECORD
+typedef struct {
+  int32_t offset;
+  int32_t unused;
+  TraceRecord record;
+} TraceLateRecord;
+
+typedef struct {
+  const void *key;
+  const void *sub_key;
+  PyObject *owner;       // keeps the keys alive, NULL for static keys
+  PyObject *description; // method_name\x00file_name\x00lineno
+} FrameDesc;
+
+// frames of the same function share one description, found by open
+// addressing on (key, sub_key)
+typedef struct {
+  FrameDesc *entries;
+  Py_ssize_t size;
+  Py_ssize_t capacity;
+  Py_ssize_t *buckets; // 1-based entry index, 0 is an empty bucket
+  Py_ssize_t bucket_cap;
+} FrameDescTable;
+
+#define FRAME_DESC_INIT_BUCKETS 64
+
+static size_t desc_hash(const void *key, const void *sub_key) {
+  uint64_t h = (uint64_t)(uintptr_t)key * 0x9E3779B97F4A7C15ull ^
+               (uint64_t)(uintptr_t)sub_key * 0xC2B2AE3D27D4EB4Full;
+  return (size_t)(h ^ (h >> 29));
+}
+
+static Py_ssize_t desc_table_find(FrameDescTable *table, const void *key,
+                                  const void *sub_key) {
+  if (table->bucket_cap == 0) {
+    return -1;
+  }
+  size_t mask = table->bucket_cap - 1;
+  size_t pos = desc_hash(key, sub_key) & mask;
+  while (table->buckets[pos] != 0) {
+    FrameDesc *entry = &table->entries[table->buckets[pos] - 1];
+    if (entry->key == key && entry->sub_key == sub_key) {
+      return table->buckets[pos] - 1;
     }
-    PyObject *result =
-        PyUnicode_FromFormat("%U%c%s%c%i", qualname, 0, "<built-in>", 0, 0);
-    Py_XDECREF(qualname);
-    return result;
-  } else {
-    PyCodeObject *code = _code_from_frame(frame);
-    PyObject *result =
-        PyUnicode_FromFormat("%U%c%U%c%i", code->co_name, 0, code->co_filename,
-                             0, code->co_firstlineno);
-    Py_XDECREF(code);
-    return result;
+    pos = (pos + 1) & mask;
   }
+  return -1;
 }
 
-static PyObject *build_context_switch_frame(Py_ssize_t start_ns,
-                                            Py_ssize_t cost_ns,
-                                            Py_ssize_t pid) {
-  PyObject *result =
-      PyUnicode_FromFormat("%s%c%c%i%c%lld%c%lld%c%lld", "[await]", 0, 0, 0, 1,
-                           start_ns, 1, cost_ns, 1, pid);
-  return result;
+// rebuild buckets with twice the capacity, keeping the load factor below 1/2
+static int desc_table_rehash(FrameDescTable *table) {
+  Py_ssize_t bucket_cap = table->bucket_cap == 0 ? FRAME_DESC_INIT_BUCKETS
+                                                 : table->bucket_cap * 2;
+  Py_ssize_t *buckets =
+      (Py_ssize_t *)PyMem_Calloc(bucket_cap, sizeof(Py_ssize_t));
+  if (buckets == NULL) {
+    return -1;
+  }
+  Py_ssize_t i;
+  for (i = 0; i < table->size; i++) {
+    size_t pos = desc_hash(table->entries[i].key, table->entries[i].sub_key) &
+                 (bucket_cap - 1);
+    while (buckets[pos] != 0) {
+      pos = (pos + 1) & (bucket_cap - 1);
+    }
+    buckets[pos] = i + 1;
+  }
+  PyMem_Free(table->buckets);
+  table->buckets = buckets;
+  table->bucket_cap = bucket_cap;
+  return 0;
+}
+
+static int grow_buffer(void **buffer, Py_ssize_t *capacity, size_t item_size) {
+  Py_ssize_t new_capacity = *capacity == 0 ? 4 : *capacity * 2;
+  void *new_buffer = PyMem_Realloc(*buffer, item_size * new_capacity);
+  if (new_buffer == NULL) {
+    return -1;
+  }
+  *buffer = new_buffer;
+  *capacity = new_capacity;
+  return 0;
+}
+
+// description is stolen, return its index or -1 when it can not be added
+static Py_ssize_t desc_table_add(FrameDescTable *table, const void *key,
+                                 const void *sub_key, PyObject *owner,
+                                 PyObject *description) {
+  if (description == NULL) {
+    PyErr_Clear();
+    return -1;
+  }
+  if ((table->size + 1) * 2 > table->bucket_cap &&
+      desc_table_rehash(table) != 0) {
+    Py_DECREF(description);
+    return -1;
+  }
+  if (table->size == table->capacity &&
+      grow_buffer((void **)&table->entries, &table->capacity,
+                  sizeof(FrameDesc)) != 0) {
+    Py_DECREF(description);
+    return -1;
+  }
+  Py_ssize_t index = table->size++;
+  FrameDesc *entry = &table->entries[index];
+  entry->key = key;
+  entry->sub_key = sub_key;
+  Py_XINCREF(owner);
+  entry->owner = owner;
+  entry->description = description;
+
+  size_t mask = table->bucket_cap - 1;
+  size_t pos = desc_hash(key, sub_key) & mask;
+  while (table->buckets[pos] != 0) {
+    pos = (pos + 1) & mask;
+  }
+  table->buckets[pos] = index + 1;
+  return index;
+}
+
+static void desc_table_clear(FrameDescTable *table) {
+  Py_ssize_t i;
+  for (i = 0; i < table->size; i++) {
+    Py_XDECREF(table->entries[i].owner);
+    Py_DECREF(table->entries[i].description);
+  }
+  PyMem_Free(table->entries);
+  PyMem_Free(table->buckets);
+  memset(table, 0, sizeof(FrameDescTable));
+}
+
+//////////////////
+// TraceSession //
+//////////////////
+
+// descriptions shared by all traced calls of one trace command, the client
+// keeps the same table and only receives entries added since the last send
+typedef struct {
+  PyObject_HEAD FrameDescTable descs;
+  Py_ssize_t sent; // descriptions already taken for sending
+} TraceSession;
+
+static void TraceSession_Dealloc(TraceSession *self) {
+  desc_table_clear(&self->descs);
+  Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *TraceSession_New(PyTypeObject *type, PyObject *args,
+                                  PyObject *kwds) {
+  TraceSession *self = (TraceSession *)type->tp_alloc(type, 0);
+  if (self == NULL) {
+    return NULL;
+  }
+  memset(&self->descs, 0, sizeof(FrameDescTable));
+  self->sent = 0;
+  return (PyObject *)self;
 }
 
-static PyObject *build_last_async_frame(PyObject *frame_desp,
-                                        Py_ssize_t start_ns, Py_ssize_t cost_ns,
-                                        Py_ssize_t pid) {
-  PyObject *result = PyUnicode_FromFormat("%U%c%lld%c%lld%c%lld", frame_desp, 1,
-                                          start_ns, 1, cost_ns, 1, pid);
+// return (first id, descriptions) not taken before, the caller sends them
+// before any record referencing them
+static PyObject *TraceSession_TakeDescriptions(TraceSession *self,
+                                               PyObject *unused) {
+  Py_ssize_t base = self->sent;
+  PyObject *descriptions = PyList_New(self->descs.size - base);
+  if (descriptions == NULL) {
+    return NULL;
+  }
+  Py_ssize_t i;
+  for (i = base; i < self->descs.size; i++) {
+    PyObject *description = self->descs.entries[i].description;
+    Py_INCREF(description);
+    PyList_SET_ITEM(descriptions, i - base, description);
+  }
+  PyObject *result = Py_BuildValue("nN", base, descriptions);
+  if (result != NULL) {
+    self->sent = self->descs.size;
+  }
   return result;
 }
 
+// intern a description built on the python side, such as the thread frames
+// of followed executor work, return its id
+static PyObject *TraceSession_Intern(TraceSession *self,
+                                     PyObject *description) {
+  if (!PyUnicode_Check(description)) {
+    PyErr_SetString(PyExc_TypeError, "description must be a str");
+    return NULL;
+  }
+  Py_INCREF(description);
+  PyUnicode_InternInPlace(&description);
+  Py_ssize_t desc = desc_table_find(&self->descs, description, NULL);
+  if (desc < 0) {
+    Py_INCREF(description);
+    desc = desc_table_add(&self->descs, description, NULL, description,
+                          description);
+  }
+  Py_DECREF(description);
+  if (desc < 0) {
+    return PyErr_Occurred() ? NULL : PyErr_NoMemory();
+  }
+  return PyLong_FromSsize_t(desc);
+}
+
+static Py_ssize_t TraceSession_Len(TraceSession *self) {
+  return self->descs.size;
+}
+
+static PyMethodDef TraceSession_methods[] = {
+    {"take_descriptions", (PyCFunction)TraceSession_TakeDescriptions,
+     METH_NOARGS, "take (first id, descriptions) added since the last call"},
+    {"intern", (PyCFunction)TraceSession_Intern, METH_O,
+     "intern a description, return its id"},
+    {NULL} /* Sentinel */
+};
+
+static PySequenceMethods TraceSession_as_sequence = {
+    (lenfunc)TraceSession_Len, /* sq_length */
+};
+
+static PyTypeObject TraceSession_Type = {
+    PyVarObject_HEAD_INIT(NULL, 0) "pyflight.ext.TraceSession", /* tp_name */
+    sizeof(TraceSession),                    /* tp_basicsize */
+    0,                                       /* tp_itemsize */
+    (destructor)TraceSession_Dealloc,        /* tp_dealloc */
+    0,                                       /* tp_print */
+    0,                                       /* tp_getattr */
+    0,                                       /* tp_setattr */
+    0,                                       /* tp_reserved */
+    0,                                       /* tp_repr */
+    0,                                       /* tp_as_number */
+    &TraceSession_as_sequence,               /* tp_as_sequence */
+    0,                                       /* tp_as_mapping */
+    0,                                       /* tp_hash */
+    0,                                       /* tp_call */
+    0,                                       /* tp_str */
+    0,                                       /* tp_getattro */
+    0,                                       /* tp_setattro */
+    0,                                       /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                      /* tp_flags */
+    "frame descriptions of a trace command", /* tp_doc */
+    0,                                       /* tp_traverse */
+    0,                                       /* tp_clear */
+    0,                                       /* tp_richcompare */
+    0,                                       /* tp_weaklistoffset */
+    0,                                       /* tp_iter */
+    0,                                       /* tp_iternext */
+    TraceSession_methods,                    /* tp_methods */
+    0,                                       /* tp_members */
+    0,                                       /* tp_getset */
+    0,                                       /* tp_base */
+    0,                                       /* tp_dict */
+    0,                                       /* tp_descr_get */
+    0,                                       /* tp_descr_set */
+    0,                                       /* tp_dictoffset */
+    0,                                       /* tp_init */
+    PyType_GenericAlloc,                     /* tp_alloc */
+    TraceSession_New,                        /* tp_new */
+    PyObject_Del,                            /* tp_free */
+};
+
 ///////////////////
 // TraceProfiler //
 ///////////////////
-typedef struct {
-  PyObject_HEAD PyObject *prev; // LinkedList FrameNode
-  PyObject *succ;
-  Py_ssize_t start_ns;
+typedef struct FrameNode {
+  struct FrameNode *prev; // LinkedList FrameNode, next free node when released
+  // async frames entered below this one, owned by this node
+  struct FrameNode **succ;
+  Py_ssize_t succ_sz;
+  Py_ssize_t succ_cap;
+  long long start_ticks;
   Py_ssize_t offset; // target frameNode in sending frame offset
 
-  PyObject *frame_desp;
-  PyObject *frame_id;
-  PyObject *enter_timestamp;
+  // async frames only, described by code when emitted
+  PyCodeObject *code;
+  void *frame_id;
+  long long *enter_timestamp;
+  Py_ssize_t enter_sz;
+  Py_ssize_t enter_cap;
 } FrameNode;
 
+// nodes are carved from chunks and recycled through a free list, a chunk
+// lives until its profiler is deallocated
+#define FRAME_NODE_CHUNK_SIZE 256
+
+typedef struct FrameNodeChunk {
+  struct FrameNodeChunk *next;
+  FrameNode nodes[FRAME_NODE_CHUNK_SIZE];
+} FrameNodeChunk;
+
 typedef struct trace_profiler {
   PyObject_HEAD PyObject *target; // output message to client callable target
-  PyObject *on_sending_frame;     // frames that ready to be sent
+  TraceRecord *records;           // frames that ready to be sent
+  Py_ssize_t records_sz;          // records including empty slots
+  Py_ssize_t records_cap;         // allocated records
+  Py_ssize_t records_base;        // offset of records[0]
+  Py_ssize_t flush_records;       // flush threshold, 0 sends once at return
+  TraceLateRecord *late;          // open frames of flushed offsets
+  Py_ssize_t late_sz;
+  Py_ssize_t late_cap;
+  TraceSession *session;          // descriptions referenced by records
   PyObject *out_queue;            // sending queue
   FrameNode *top;                 // frame stack top
+  FrameNode *free_nodes;          // released nodes ready for reuse
+  FrameNodeChunk *chunks;         // all allocated nodes
+  int broken;                     // allocation failed, events are ignored
   Py_ssize_t sf_sz;               // sending frame size
   Py_ssize_t is_async;            // async function
-  long long interval;             // interval
+  long long interval;             // interval in clock ticks
+  clock_source clock;             // clock source of recorded ticks
   Py_ssize_t current_depth;       // current top depth
   Py_ssize_t depth_limit;         // depth limit
+  int monitored;                  // traced by sys.monitoring callbacks
 } TraceProfiler;
 
 static void TraceProfiler_Dealloc(TraceProfiler *self) {
-  if (!self->is_async) {
-    FrameNode *top_frame = (FrameNode *)self->top;
-    self->top = (FrameNode *)top_frame->prev;
-    Py_DECREF(top_frame);
+  // every node belongs to a chunk, free them regardless of the stack shape
+  FrameNodeChunk *chunk = self->chunks;
+  while (chunk != NULL) {
+    FrameNodeChunk *next = chunk->next;
+    int i;
+    for (i = 0; i < FRAME_NODE_CHUNK_SIZE; i++) {
+      Py_XDECREF(chunk->nodes[i].code);
+      PyMem_Free(chunk->nodes[i].succ);
+      PyMem_Free(chunk->nodes[i].enter_timestamp);
+    }
+    PyMem_Free(chunk);
+    chunk = next;
   }
-  Py_XDECREF(self->top);
+  self->chunks = NULL;
+  self->free_nodes = NULL;
   self->top = NULL;
-  Py_DECREF(self->on_sending_frame);
-  Py_DECREF(self->target);
-  Py_DECREF(self->out_queue);
-  Py_TYPE(self)->tp_free(self);
-}
-
-static void FrameNode_Dealloc(FrameNode *self) {
-  self->prev = NULL;
-  Py_XDECREF(self->succ);
-  Py_XDECREF(self->enter_timestamp);
-  Py_XDECREF(self->frame_id);
-  Py_XDECREF(self->frame_desp);
+  PyMem_Free(self->records);
+  self->records = NULL;
+  PyMem_Free(self->late);
+  self->late = NULL;
+  Py_XDECREF(self->session);
+  Py_XDECREF(self->target);
+  Py_XDECREF(self->out_queue);
   Py_TYPE(self)->tp_free(self);
 }
 
-static PyTypeObject FrameNode_Type = {
-    PyVarObject_HEAD_INIT(NULL, 0) "pyflight.ext.FrameNode", /* tp_name */
-    sizeof(FrameNode),                                       /* tp_basicsize */
-    0,                                                       /* tp_itemsize */
-    (destructor)FrameNode_Dealloc,                           /* tp_dealloc */
-    0,                                                       /* tp_print */
-    0,                                                       /* tp_getattr */
-    0,                                                       /* tp_setattr */
-    0,                                                       /* tp_reserved */
-    0,                                                       /* tp_repr */
-    0,                                                       /* tp_as_number */
-    0,                                        /* tp_as_sequence */
-    0,                                        /* tp_as_mapping */
-    0,                                        /* tp_hash */
-    0,                                        /* tp_call */
-    0,                                        /* tp_str */
-    0,                                        /* tp_getattro */
-    0,                                        /* tp_setattro */
-    0,                                        /* tp_as_buffer */
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /* tp_flags */
-    0,                                        /* tp_doc */
-    0,                                        /* tp_traverse */
-    0,                                        /* tp_clear */
-    0,                                        /* tp_richcompare */
-    0,                                        /* tp_weaklistoffset */
-    0,                                        /* tp_iter */
-    0,                                        /* tp_iternext */
-    0,                                        /* tp_methods */
-    0,                                        /* tp_members */
-    0,                                        /* tp_getset */
-    0,                                        /* tp_base */
-    0,                                        /* tp_dict */
-    0,                                        /* tp_descr_get */
-    0,                                        /* tp_descr_set */
-    0,                                        /* tp_dictoffset */
-    0,                                        /* tp_init */
-    PyType_GenericAlloc,                      /* tp_alloc */
-    PyType_GenericNew,                        /* tp_new */
-    PyObject_Del,                             /* tp_free */
-};
-
 static PyTypeObject TraceProfiler_Type = {
     PyVarObject_HEAD_INIT(NULL, 0) "pyflight.ext.TraceProfiler", /* tp_name */
     sizeof(TraceProfiler),                    /* tp_basicsize */
@@ -219,33 +458,207 @@ static PyTypeObject TraceProfiler_Type = {
     PyObject_Del,                             /* tp_free */
 };
 
-static FrameNode *pop_last_element(PyObject *list, Py_ssize_t size) {
+static FrameNode *FrameNode_New(TraceProfiler *self) {
+  if (self->free_nodes == NULL) {
+    FrameNodeChunk *chunk =
+        (FrameNodeChunk *)PyMem_Calloc(1, sizeof(FrameNodeChunk));
+    if (chunk == NULL) {
+      self->broken = 1;
+      return NULL;
+    }
+    chunk->next = self->chunks;
+    self->chunks = chunk;
+    int i;
+    for (i = FRAME_NODE_CHUNK_SIZE - 1; i >= 0; i--) {
+      chunk->nodes[i].prev = self->free_nodes;
+      self->free_nodes = &chunk->nodes[i];
+    }
+  }
+  FrameNode *node = self->free_nodes;
+  self->free_nodes = node->prev;
+  // succ and enter_timestamp buffers are kept for reuse
+  node->prev = NULL;
+  node->succ_sz = 0;
+  node->start_ticks = 0;
+  node->offset = 0;
+  node->code = NULL;
+  node->frame_id = NULL;
+  node->enter_sz = 0;
+  return node;
+}
 
-  PyObject *last_element = PyList_GetItem(list, size - 1);
-  Py_INCREF(last_element);
+// release node and the async frames it owns
+static void FrameNode_Release(TraceProfiler *self, FrameNode *node) {
+  if (node == NULL) {
+    return;
+  }
+  Py_ssize_t i;
+  for (i = 0; i < node->succ_sz; i++) {
+    FrameNode_Release(self, node->succ[i]);
+  }
+  node->succ_sz = 0;
+  node->enter_sz = 0;
+  Py_CLEAR(node->code);
+  node->frame_id = NULL;
+  node->prev = self->free_nodes;
+  self->free_nodes = node;
+}
+
+static int FrameNode_AppendSucc(TraceProfiler *self, FrameNode *node,
+                                FrameNode *child) {
+  if (node->succ_sz == node->succ_cap &&
+      grow_buffer((void **)&node->succ, &node->succ_cap,
+                  sizeof(FrameNode *)) != 0) {
+    self->broken = 1;
+    return -1;
+  }
+  node->succ[node->succ_sz++] = child;
+  return 0;
+}
 
-  if (PyList_SetSlice(list, size - 1, size, NULL) ==
-      -1) { // slice will decrease element ref cnt by 1
-    Py_DECREF(last_element);
+static int FrameNode_AppendTimestamp(TraceProfiler *self, FrameNode *node,
+                                     long long ticks) {
+  if (node->enter_sz == node->enter_cap &&
+      grow_buffer((void **)&node->enter_timestamp, &node->enter_cap,
+                  sizeof(long long)) != 0) {
+    self->broken = 1;
+    return -1;
+  }
+  node->enter_timestamp[node->enter_sz++] = ticks;
+  return 0;
+}
+
+// ownership of the child moves to the caller
+static FrameNode *pop_last_element(FrameNode *node) {
+  node->succ_sz -= 1;
+  return node->succ[node->succ_sz];
+}
+
+static Py_ssize_t TraceProfiler_CodeDesc(TraceProfiler *self,
+                                         PyCodeObject *code) {
+  Py_ssize_t desc = desc_table_find(&self->session->descs, code, NULL);
+  if (desc < 0) {
+    desc = desc_table_add(&self->session->descs, code, NULL, (PyObject *)code,
+                          _code_description(code));
+  }
+  return desc;
+}
+
+static Py_ssize_t TraceProfiler_CFuncDesc(TraceProfiler *self,
+                                          PyObject *func) {
+  const void *key = func;
+  const void *sub_key = NULL;
+  PyObject *owner = func;
+  if (PyCFunction_Check(func)) {
+    // bound builtin methods are created per call, share the description of
+    // their method definition on the same type
+    PyObject *m_self = PyCFunction_GET_SELF(func);
+    key = ((PyCFunctionObject *)func)->m_ml;
+    if (m_self != NULL) {
+      owner = PyType_Check(m_self) || PyModule_Check(m_self)
+                  ? m_self
+                  : (PyObject *)Py_TYPE(m_self);
+      sub_key = owner;
+    }
+  } else if (Py_TYPE(func) == &PyMethodDescr_Type) {
+    // unbound builtin methods called by sys.monitoring CALL events
+    key = ((PyMethodDescrObject *)func)->d_method;
+    owner = (PyObject *)PyDescr_TYPE(func);
+    sub_key = owner;
+  }
+  Py_ssize_t desc = desc_table_find(&self->session->descs, key, sub_key);
+  if (desc < 0) {
+    desc = desc_table_add(&self->session->descs, key, sub_key, owner,
+                          _c_func_description(func));
+  }
+  return desc;
+}
+
+static Py_ssize_t TraceProfiler_AwaitDesc(TraceProfiler *self) {
+  static const char await_key = 0;
+  Py_ssize_t desc = desc_table_find(&self->session->descs, &await_key, NULL);
+  if (desc < 0) {
+    desc = desc_table_add(&self->session->descs, &await_key, NULL, NULL,
+                          _await_description());
+  }
+  return desc;
+}
+
+static Py_ssize_t TraceProfiler_FrameDesc(TraceProfiler *self,
+                                          PyFrameObject *frame, PyObject *arg,
+                                          int c_frame) {
+  if (c_frame) {
+    return TraceProfiler_CFuncDesc(self, arg);
+  }
+  PyCodeObject *code = _code_from_frame(frame);
+  Py_ssize_t desc = TraceProfiler_CodeDesc(self, code);
+  Py_XDECREF(code);
+  return desc;
+}
+
+static void TraceProfiler_FlushTraceFrames(TraceProfiler *self, int final);
+
+// a frame still open when its offset was flushed, sent with the next chunk
+static TraceRecord *TraceProfiler_LateRecord(TraceProfiler *self,
+                                             Py_ssize_t offset) {
+  if (self->late_sz == self->late_cap &&
+      grow_buffer((void **)&self->late, &self->late_cap,
+                  sizeof(TraceLateRecord)) != 0) {
     return NULL;
   }
-  return (FrameNode *)last_element;
+  TraceLateRecord *late = &self->late[self->late_sz++];
+  late->offset = (int32_t)offset;
+  late->unused = 0;
+  return &late->record;
 }
 
-static FrameNode *FrameNode_New() {
-  FrameNode *node = PyObject_New(FrameNode, &FrameNode_Type);
-  node->prev = NULL;
-  node->succ = PyList_New(0);
-  node->frame_desp = NULL;
-  node->enter_timestamp = PyList_New(0);
-  node->frame_id = NULL;
-  return node;
+// keep a frame at offset of the sending frames, skipped offsets stay empty
+static void TraceProfiler_EmitFrame(TraceProfiler *self, Py_ssize_t offset,
+                                    Py_ssize_t desc, Py_ssize_t pid,
+                                    long long start_ticks,
+                                    long long cost_ticks) {
+  if (desc < 0) {
+    self->broken = 1;
+    return;
+  }
+  TraceRecord *record;
+  if (offset < self->records_base) {
+    record = TraceProfiler_LateRecord(self, offset);
+    if (record == NULL) {
+      self->broken = 1;
+      return;
+    }
+  } else {
+    Py_ssize_t index = offset - self->records_base;
+    while (index >= self->records_cap) {
+      if (grow_buffer((void **)&self->records, &self->records_cap,
+                      sizeof(TraceRecord)) != 0) {
+        self->broken = 1;
+        return;
+      }
+    }
+    while (self->records_sz <= index) {
+      self->records[self->records_sz++].desc = -1;
+    }
+    record = &self->records[index];
+  }
+  record->desc = (int32_t)desc;
+  record->pid = (int32_t)pid;
+  record->start_ns = _ticks_to_realtime_ns(self->clock, start_ticks);
+  record->cost_ns = _ticks_to_ns(self->clock, cost_ticks);
+  if (self->flush_records > 0 && self->records_sz >= self->flush_records) {
+    TraceProfiler_FlushTraceFrames(self, 0);
+  }
 }
 
-static void TraceProfiler_PushFrame(TraceProfiler *self, Py_ssize_t start_ns) {
-  FrameNode *node = FrameNode_New();
-  node->prev = (PyObject *)self->top;
-  node->start_ns = start_ns;
+static void TraceProfiler_PushFrame(TraceProfiler *self,
+                                    Py_ssize_t start_ticks) {
+  FrameNode *node = FrameNode_New(self);
+  if (node == NULL) {
+    return;
+  }
+  node->prev = self->top;
+  node->start_ticks = start_ticks;
   node->offset = self->sf_sz;
 
   self->sf_sz += 1;
@@ -253,10 +666,13 @@ static void TraceProfiler_PushFrame(TraceProfiler *self, Py_ssize_t start_ns) {
 }
 
 static void TraceProfiler_PushFrameWithDepth(TraceProfiler *self,
-                                             Py_ssize_t start_ns) {
-  FrameNode *node = FrameNode_New();
-  node->prev = (PyObject *)self->top;
-  node->start_ns = start_ns;
+                                             Py_ssize_t start_ticks) {
+  FrameNode *node = FrameNode_New(self);
+  if (node == NULL) {
+    return;
+  }
+  node->prev = self->top;
+  node->start_ticks = start_ticks;
   node->offset = self->sf_sz;
   self->sf_sz += 1;
   self->top = node;
@@ -264,261 +680,209 @@ static void TraceProfiler_PushFrameWithDepth(TraceProfiler *self,
 }
 
 static void TraceProfiler_InnerPushAsyncFrame(TraceProfiler *self,
-                                              Py_ssize_t start_ns,
-                                              PyObject *frame_desp,
-                                              PyObject *frame_id) {
-  FrameNode *node = FrameNode_New();
-  PyObject *temp_start_ns = PyLong_FromLong(start_ns);
-  PyList_Append(node->enter_timestamp, temp_start_ns);
-  Py_DECREF(temp_start_ns);
+                                              Py_ssize_t start_ticks,
+                                              PyCodeObject *code,
+                                              void *frame_id) {
+  FrameNode *node = FrameNode_New(self);
+  if (node == NULL) {
+    return;
+  }
+  if (FrameNode_AppendTimestamp(self, node, start_ticks) != 0 ||
+      FrameNode_AppendSucc(self, self->top, node) != 0) {
+    FrameNode_Release(self, node);
+    return;
+  }
   node->frame_id = frame_id;
-
-  PyList_Append(self->top->succ, (PyObject *)node);
-  node->prev = (PyObject *)self->top;
-  node->start_ns = start_ns;
+  node->prev = self->top;
+  node->start_ticks = start_ticks;
   node->offset = self->sf_sz;
 
   self->sf_sz += 1;
-  node->frame_desp = frame_desp;
+  Py_INCREF(code);
+  node->code = code;
   self->top = node;
-  Py_DECREF(node);
 }
 
 static void TraceProfiler_InnerPushAsyncFrameWithDepth(TraceProfiler *self,
-                                                       Py_ssize_t start_ns,
-                                                       PyObject *frame_desp,
-                                                       PyObject *frame_id) {
-  FrameNode *node = FrameNode_New();
-  PyObject *temp_start_ns = PyLong_FromLong(start_ns);
-  PyList_Append(node->enter_timestamp, temp_start_ns);
-  Py_DECREF(temp_start_ns);
+                                                       Py_ssize_t start_ticks,
+                                                       PyCodeObject *code,
+                                                       void *frame_id) {
+  FrameNode *node = FrameNode_New(self);
+  if (node == NULL) {
+    return;
+  }
+  if (FrameNode_AppendTimestamp(self, node, start_ticks) != 0 ||
+      FrameNode_AppendSucc(self, self->top, node) != 0) {
+    FrameNode_Release(self, node);
+    return;
+  }
   node->frame_id = frame_id;
-
-  PyList_Append(self->top->succ, (PyObject *)node);
-  node->prev = (PyObject *)self->top;
-  node->start_ns = start_ns;
+  node->prev = self->top;
+  node->start_ticks = start_ticks;
   node->offset = self->sf_sz;
 
   self->sf_sz += 1;
-  node->frame_desp = frame_desp;
+  Py_INCREF(code);
+  node->code = code;
   self->current_depth += 1;
   self->top = node;
-  Py_DECREF(node);
 }
 
 static void TraceProfiler_FinishUnclosedAsyncFrame(TraceProfiler *self) {
   FrameNode *current_top = self->top;
-  Py_ssize_t children_len = PyList_Size(current_top->succ);
-  while (children_len > 0) {
-    FrameNode *last_async_node =
-        pop_last_element(current_top->succ, children_len);
-    Py_ssize_t size = PyList_Size(last_async_node->enter_timestamp);
-    PyObject *last_element =
-        PyList_GetItem(last_async_node->enter_timestamp, size - 1);
-    long long last_leave_ns = PyLong_AsLongLong(last_element);
-
-    PyObject *first_element =
-        PyList_GetItem(last_async_node->enter_timestamp, 0);
-    long long last_async_start_ns = PyLong_AsLongLong(first_element);
-    long long cost_ns = last_leave_ns - last_async_start_ns;
-
-    if (cost_ns >= self->interval) {
+  while (current_top->succ_sz > 0) {
+    FrameNode *last_async_node = pop_last_element(current_top);
+    long long last_leave_ticks =
+        last_async_node->enter_timestamp[last_async_node->enter_sz - 1];
+    long long last_async_start_ticks = last_async_node->enter_timestamp[0];
+    long long cost_ticks = last_leave_ticks - last_async_start_ticks;
+
+    if (cost_ticks >= self->interval) {
       Py_ssize_t pid = current_top->offset;
-      PyObject *frame_desp = build_last_async_frame(
-          last_async_node->frame_desp, last_async_start_ns, cost_ns, pid);
-      Py_ssize_t real_sf_sz = PyList_Size(self->on_sending_frame);
-      long long distance = last_async_node->offset + 1 - real_sf_sz;
-      long long idx;
-      for (idx = 0; idx < distance; idx++) {
-        PyList_Append(self->on_sending_frame, Py_None);
-      }
-      PyList_SetItem(self->on_sending_frame, last_async_node->offset,
-                     frame_desp);
+      Py_ssize_t desc = TraceProfiler_CodeDesc(self, last_async_node->code);
+      TraceProfiler_EmitFrame(self, last_async_node->offset, desc, pid,
+                              last_async_start_ticks, cost_ticks);
       if (current_top != self->top) {
-        Py_DECREF(current_top);
+        FrameNode_Release(self, current_top);
       }
       current_top = last_async_node;
-      children_len = PyList_Size(current_top->succ);
     } else {
-      Py_DECREF(last_async_node);
+      FrameNode_Release(self, last_async_node);
       break;
     }
   }
   if (current_top != self->top) {
-    Py_DECREF(current_top);
+    FrameNode_Release(self, current_top);
   }
 }
 
 static void
 TraceProfiler_FinishUnclosedAsyncFrameWithDepth(TraceProfiler *self) {
   FrameNode *current_top = self->top;
-  Py_ssize_t children_len = PyList_Size(current_top->succ);
-  while (children_len > 0) {
-    FrameNode *last_async_node =
-        pop_last_element(current_top->succ, children_len);
-    Py_ssize_t size = PyList_Size(last_async_node->enter_timestamp);
-    PyObject *last_element =
-        PyList_GetItem(last_async_node->enter_timestamp, size - 1);
-    long long last_leave_ns = PyLong_AsLongLong(last_element);
-
-    PyObject *first_element =
-        PyList_GetItem(last_async_node->enter_timestamp, 0);
-    long long last_async_start_ns = PyLong_AsLongLong(first_element);
-    long long cost_ns = last_leave_ns - last_async_start_ns;
+  while (current_top->succ_sz > 0) {
+    FrameNode *last_async_node = pop_last_element(current_top);
+    long long last_leave_ticks =
+        last_async_node->enter_timestamp[last_async_node->enter_sz - 1];
+    long long last_async_start_ticks = last_async_node->enter_timestamp[0];
+    long long cost_ticks = last_leave_ticks - last_async_start_ticks;
 
     if (self->current_depth < self->depth_limit) {
       Py_ssize_t pid = current_top->offset;
-      PyObject *frame_desp = build_last_async_frame(
-          last_async_node->frame_desp, last_async_start_ns, cost_ns, pid);
-      Py_ssize_t real_sf_sz = PyList_Size(self->on_sending_frame);
-      long long distance = last_async_node->offset + 1 - real_sf_sz;
-      long long idx;
-      for (idx = 0; idx < distance; idx++) {
-        PyList_Append(self->on_sending_frame, Py_None);
-      }
-      PyList_SetItem(self->on_sending_frame, last_async_node->offset,
-                     frame_desp);
+      Py_ssize_t desc = TraceProfiler_CodeDesc(self, last_async_node->code);
+      TraceProfiler_EmitFrame(self, last_async_node->offset, desc, pid,
+                              last_async_start_ticks, cost_ticks);
       if (current_top != self->top) {
-        Py_DECREF(current_top);
+        FrameNode_Release(self, current_top);
       }
       current_top = last_async_node;
-      children_len = PyList_Size(current_top->succ);
     } else {
-      Py_DECREF(last_async_node);
+      FrameNode_Release(self, last_async_node);
       break;
     }
   }
   if (current_top != self->top) {
-    Py_DECREF(current_top);
+    FrameNode_Release(self, current_top);
   }
 }
 
 static void TraceProfiler_PushAsyncFrame(TraceProfiler *self,
-                                         Py_ssize_t start_ns, PyObject *f_desp,
-                                         int is_async_frame,
-                                         PyObject *frame_id) {
+                                         Py_ssize_t start_ticks,
+                                         PyCodeObject *code,
+                                         int is_async_frame, void *frame_id) {
   if (!is_async_frame) {
     if (self->top->offset == -1) {
       return;
     }
     TraceProfiler_FinishUnclosedAsyncFrame(self);
-    TraceProfiler_PushFrame(self, start_ns);
+    TraceProfiler_PushFrame(self, start_ticks);
   } else {
     if (self->top->offset == -1) {
-      Py_ssize_t children_len = PyList_Size(self->top->succ);
+      Py_ssize_t children_len = self->top->succ_sz;
       if (children_len > 0) {
-        FrameNode *last_element =
-            (FrameNode *)PyList_GetItem(self->top->succ, children_len - 1);
-        if (PyObject_RichCompareBool(last_element->frame_id, frame_id, Py_EQ) ==
-            1) {
+        FrameNode *last_element = self->top->succ[children_len - 1];
+        if (last_element->frame_id == frame_id) {
           self->top = last_element;
         } else {
           return;
         }
       } else {
-        TraceProfiler_InnerPushAsyncFrame(self, start_ns, f_desp, frame_id);
+        TraceProfiler_InnerPushAsyncFrame(self, start_ticks, code, frame_id);
         return;
       }
     }
-    if (PyObject_RichCompareBool(self->top->frame_id, frame_id, Py_EQ) == 1) {
-      Py_ssize_t succ_len = PyList_Size(self->top->succ);
-      if (succ_len == 0) {
-        Py_ssize_t e_size = PyList_Size(self->top->enter_timestamp);
-        PyObject *t_last_element =
-            PyList_GetItem(self->top->enter_timestamp, e_size - 1);
-        long long t_last_leave_ns = PyLong_AsLongLong(t_last_element);
-        long long cost_ns = start_ns - t_last_leave_ns;
+    if (self->top->frame_id == frame_id) {
+      if (self->top->succ_sz == 0) {
+        long long t_last_leave_ticks =
+            self->top->enter_timestamp[self->top->enter_sz - 1];
+        long long cost_ticks = start_ticks - t_last_leave_ticks;
 
-        if (cost_ns >= self->interval) {
+        if (cost_ticks >= self->interval) {
           Py_ssize_t pid = self->top->offset;
-          PyObject *frame_desp =
-              build_context_switch_frame(t_last_leave_ns, cost_ns, pid);
-          Py_ssize_t real_sf_sz = PyList_Size(self->on_sending_frame);
-          long long distance = self->sf_sz + 1 - real_sf_sz;
-          long long idx;
-          for (idx = 0; idx < distance; idx++) {
-            PyList_Append(self->on_sending_frame, Py_None);
-          }
-          PyList_SetItem(self->on_sending_frame, self->sf_sz, frame_desp);
+          Py_ssize_t desc = TraceProfiler_AwaitDesc(self);
+          TraceProfiler_EmitFrame(self, self->sf_sz, desc, pid,
+                                  t_last_leave_ticks, cost_ticks);
           self->sf_sz += 1;
-          Py_DECREF(pop_last_element(self->top->enter_timestamp, e_size));
+          self->top->enter_sz -= 1;
         }
       } else {
-        Py_ssize_t succ_size = PyList_Size(self->top->succ);
-        FrameNode *top_succ =
-            (FrameNode *)PyList_GetItem(self->top->succ, succ_size - 1);
-        self->top = top_succ;
+        self->top = self->top->succ[self->top->succ_sz - 1];
       }
     } else {
       TraceProfiler_FinishUnclosedAsyncFrame(self);
-      TraceProfiler_InnerPushAsyncFrame(self, start_ns, f_desp, frame_id);
+      TraceProfiler_InnerPushAsyncFrame(self, start_ticks, code, frame_id);
     }
   }
 }
 
 static void TraceProfiler_PushAsyncFrameWithDepth(TraceProfiler *self,
-                                                  Py_ssize_t start_ns,
-                                                  PyObject *f_desp,
+                                                  Py_ssize_t start_ticks,
+                                                  PyCodeObject *code,
                                                   int is_async_frame,
-                                                  PyObject *frame_id) {
+                                                  void *frame_id) {
   if (!is_async_frame) {
     if (self->top->offset == -1) {
       return;
     }
     TraceProfiler_FinishUnclosedAsyncFrameWithDepth(self);
-    TraceProfiler_PushFrameWithDepth(self, start_ns);
+    TraceProfiler_PushFrameWithDepth(self, start_ticks);
   } else {
     if (self->top->offset == -1) {
-      Py_ssize_t children_len = PyList_Size(self->top->succ);
+      Py_ssize_t children_len = self->top->succ_sz;
       if (children_len > 0) {
-        FrameNode *last_element =
-            (FrameNode *)PyList_GetItem(self->top->succ, children_len - 1);
-        if (PyObject_RichCompareBool(last_element->frame_id, frame_id, Py_EQ) ==
-            1) {
+        FrameNode *last_element = self->top->succ[children_len - 1];
+        if (last_element->frame_id == frame_id) {
           self->top = last_element;
           self->current_depth += 1;
         } else {
           return;
         }
       } else {
-        TraceProfiler_InnerPushAsyncFrameWithDepth(self, start_ns, f_desp,
+        TraceProfiler_InnerPushAsyncFrameWithDepth(self, start_ticks, code,
                                                    frame_id);
         return;
       }
     }
-    if (PyObject_RichCompareBool(self->top->frame_id, frame_id, Py_EQ) == 1) {
-      Py_ssize_t succ_len = PyList_Size(self->top->succ);
-      if (succ_len == 0) {
-        Py_ssize_t e_size = PyList_Size(self->top->enter_timestamp);
-        PyObject *t_last_element =
-            PyList_GetItem(self->top->enter_timestamp, e_size - 1);
-        long long t_last_leave_ns = PyLong_AsLongLong(t_last_element);
-        long long cost_ns = start_ns - t_last_leave_ns;
+    if (self->top->frame_id == frame_id) {
+      if (self->top->succ_sz == 0) {
+        long long t_last_leave_ticks =
+            self->top->enter_timestamp[self->top->enter_sz - 1];
+        long long cost_ticks = start_ticks - t_last_leave_ticks;
 
         if (self->current_depth < self->depth_limit) {
           Py_ssize_t pid = self->top->offset;
-          PyObject *frame_desp =
-              build_context_switch_frame(t_last_leave_ns, cost_ns, pid);
-          Py_ssize_t real_sf_sz = PyList_Size(self->on_sending_frame);
-          long long distance = self->sf_sz + 1 - real_sf_sz;
-          long long idx;
-          for (idx = 0; idx < distance; idx++) {
-            PyList_Append(self->on_sending_frame, Py_None);
-          }
-          PyList_SetItem(self->on_sending_frame, self->sf_sz, frame_desp);
+          Py_ssize_t desc = TraceProfiler_AwaitDesc(self);
+          TraceProfiler_EmitFrame(self, self->sf_sz, desc, pid,
+                                  t_last_leave_ticks, cost_ticks);
           self->sf_sz += 1;
-          Py_DECREF(pop_last_element(self->top->enter_timestamp, e_size));
+          self->top->enter_sz -= 1;
         }
       } else {
-        Py_ssize_t succ_size = PyList_Size(self->top->succ);
-        FrameNode *top_succ =
-            (FrameNode *)PyList_GetItem(self->top->succ, succ_size - 1);
-        self->top = top_succ;
+        self->top = self->top->succ[self->top->succ_sz - 1];
         self->current_depth += 1;
       }
     } else {
       TraceProfiler_FinishUnclosedAsyncFrameWithDepth(self);
-      TraceProfiler_InnerPushAsyncFrameWithDepth(self, start_ns, f_desp,
+      TraceProfiler_InnerPushAsyncFrameWithDepth(self, start_ticks, code,
                                                  frame_id);
     }
   }
@@ -554,10 +918,7 @@ static FrameNode *TraceProfiler_PopFrameAsync(TraceProfiler *self,
 
     return top_frame;
   } else {
-    PyObject *e_time_obj = PyLong_FromLong(end_time);
-    PyList_Append(self->top->enter_timestamp,
-                  e_time_obj); // PyList_Append Increment obj's reference
-    Py_DECREF(e_time_obj);
+    FrameNode_AppendTimestamp(self, self->top, end_time);
 
     self->top = (FrameNode *)self->top->prev;
     return NULL;
@@ -578,10 +939,7 @@ static FrameNode *TraceProfiler_PopFrameAsyncWithDepth(TraceProfiler *self,
     self->current_depth -= 1;
     return top_frame;
   } else {
-    PyObject *e_time_obj = PyLong_FromLong(end_time);
-    PyList_Append(self->top->enter_timestamp,
-                  e_time_obj); // PyList_Append Increment obj's reference
-    Py_DECREF(e_time_obj);
+    FrameNode_AppendTimestamp(self, self->top, end_time);
 
     self->current_depth -= 1;
     self->top = (FrameNode *)self->top->prev;
@@ -592,44 +950,30 @@ static FrameNode *TraceProfiler_PopFrameAsyncWithDepth(TraceProfiler *self,
 static void TraceProfiler_FulfillAsyncUnfinishedRequests(TraceProfiler *self) {
   while (self->top != NULL) {
     if (self->top->offset == -1) {
-      Py_ssize_t succ_len = PyList_Size(self->top->succ);
-      if (succ_len > 0) {
+      if (self->top->succ_sz > 0) {
         FrameNode *cur_top = self->top;
-        self->top = pop_last_element(self->top->succ, succ_len);
-        Py_DECREF(cur_top);
+        self->top = pop_last_element(self->top);
+        FrameNode_Release(self, cur_top);
       } else {
         return;
       }
     } else {
       FrameNode *last_async_node = self->top;
-      Py_ssize_t size = PyList_Size(last_async_node->enter_timestamp);
-      PyObject *last_element =
-          PyList_GetItem(last_async_node->enter_timestamp, size - 1);
-      long long last_leave_ns = PyLong_AsLongLong(last_element);
-
-      PyObject *first_element =
-          PyList_GetItem(last_async_node->enter_timestamp, 0);
-      long long last_async_start_ns = PyLong_AsLongLong(first_element);
-      long long cost_ns = last_leave_ns - last_async_start_ns;
-
-      if (cost_ns >= self->interval) {
-        FrameNode *prev_node = (FrameNode *)self->top->prev;
+      long long last_leave_ticks =
+          last_async_node->enter_timestamp[last_async_node->enter_sz - 1];
+      long long last_async_start_ticks = last_async_node->enter_timestamp[0];
+      long long cost_ticks = last_leave_ticks - last_async_start_ticks;
+
+      if (cost_ticks >= self->interval) {
+        FrameNode *prev_node = self->top->prev;
         Py_ssize_t pid = prev_node->offset;
-        PyObject *frame_desp = build_last_async_frame(
-            last_async_node->frame_desp, last_async_start_ns, cost_ns, pid);
-        Py_ssize_t real_sf_sz = PyList_Size(self->on_sending_frame);
-        long long distance = last_async_node->offset + 1 - real_sf_sz;
-        long long idx;
-        for (idx = 0; idx < distance; idx++) {
-          PyList_Append(self->on_sending_frame, Py_None);
-        }
-        PyList_SetItem(self->on_sending_frame, last_async_node->offset,
-                       frame_desp);
-        Py_ssize_t succ_len_2 = PyList_Size(self->top->succ);
-        if (succ_len_2 > 0) {
+        Py_ssize_t desc = TraceProfiler_CodeDesc(self, last_async_node->code);
+        TraceProfiler_EmitFrame(self, last_async_node->offset, desc, pid,
+                                last_async_start_ticks, cost_ticks);
+        if (self->top->succ_sz > 0) {
           FrameNode *cur_top_2 = self->top;
-          self->top = pop_last_element(self->top->succ, succ_len_2);
-          Py_DECREF(cur_top_2);
+          self->top = pop_last_element(self->top);
+          FrameNode_Release(self, cur_top_2);
         } else {
           return;
         }
@@ -644,46 +988,32 @@ static void
 TraceProfiler_FulfillAsyncUnfinishedRequestsWithDepth(TraceProfiler *self) {
   while (self->top != NULL) {
     if (self->top->offset == -1) {
-      Py_ssize_t succ_len = PyList_Size(self->top->succ);
-      if (succ_len > 0) {
+      if (self->top->succ_sz > 0) {
         FrameNode *cur_top = self->top;
-        self->top = pop_last_element(self->top->succ, succ_len);
+        self->top = pop_last_element(self->top);
         self->current_depth += 1;
-        Py_DECREF(cur_top);
+        FrameNode_Release(self, cur_top);
       } else {
         return;
       }
     } else {
       FrameNode *last_async_node = self->top;
-      Py_ssize_t size = PyList_Size(last_async_node->enter_timestamp);
-      PyObject *last_element =
-          PyList_GetItem(last_async_node->enter_timestamp, size - 1);
-      long long last_leave_ns = PyLong_AsLongLong(last_element);
-
-      PyObject *first_element =
-          PyList_GetItem(last_async_node->enter_timestamp, 0);
-      long long last_async_start_ns = PyLong_AsLongLong(first_element);
-      long long cost_ns = last_leave_ns - last_async_start_ns;
+      long long last_leave_ticks =
+          last_async_node->enter_timestamp[last_async_node->enter_sz - 1];
+      long long last_async_start_ticks = last_async_node->enter_timestamp[0];
+      long long cost_ticks = last_leave_ticks - last_async_start_ticks;
 
       if (self->current_depth <= self->depth_limit) {
-        FrameNode *prev_node = (FrameNode *)self->top->prev;
+        FrameNode *prev_node = self->top->prev;
         Py_ssize_t pid = prev_node->offset;
-        PyObject *frame_desp = build_last_async_frame(
-            last_async_node->frame_desp, last_async_start_ns, cost_ns, pid);
-        Py_ssize_t real_sf_sz = PyList_Size(self->on_sending_frame);
-        long long distance = last_async_node->offset + 1 - real_sf_sz;
-        long long idx;
-        for (idx = 0; idx < distance; idx++) {
-          PyList_Append(self->on_sending_frame, Py_None);
-        }
-        PyList_SetItem(self->on_sending_frame, last_async_node->offset,
-                       frame_desp);
-        Py_ssize_t succ_len_2 = PyList_Size(self->top->succ);
-        if (succ_len_2 > 0) {
+        Py_ssize_t desc = TraceProfiler_CodeDesc(self, last_async_node->code);
+        TraceProfiler_EmitFrame(self, last_async_node->offset, desc, pid,
+                                last_async_start_ticks, cost_ticks);
+        if (self->top->succ_sz > 0) {
           FrameNode *cur_top_2 = self->top;
-          self->top = pop_last_element(self->top->succ, succ_len_2);
+          self->top = pop_last_element(self->top);
           self->current_depth += 1;
-          Py_DECREF(cur_top_2);
+          FrameNode_Release(self, cur_top_2);
         } else {
           return;
         }
@@ -694,25 +1024,94 @@ TraceProfiler_FulfillAsyncUnfinishedRequestsWithDepth(TraceProfiler *self) {
   }
 }
 
-static TraceProfiler *TraceProfiler_New(long long interval, Py_ssize_t is_async,
-                                        Py_ssize_t depth_limit) {
+static TraceProfiler *TraceProfiler_New(clock_source clock,
+                                        long long interval, Py_ssize_t is_async,
+                                        Py_ssize_t depth_limit,
+                                        Py_ssize_t flush_records) {
   TraceProfiler *trace_profiler =
       PyObject_New(TraceProfiler, &TraceProfiler_Type);
   trace_profiler->target = NULL;
-  trace_profiler->interval = interval;
+  trace_profiler->clock = clock;
+  trace_profiler->interval = clock_ns_to_ticks(clock, interval);
   trace_profiler->is_async = is_async;
-  FrameNode *node = FrameNode_New();
-  node->offset = -1;
-  trace_profiler->top = (FrameNode *)node;
+  trace_profiler->free_nodes = NULL;
+  trace_profiler->chunks = NULL;
+  trace_profiler->broken = 0;
+  trace_profiler->monitored = 0;
+  // root node, its offset -1 marks the bottom of the stack
+  FrameNode *node = FrameNode_New(trace_profiler);
+  if (node != NULL) {
+    node->offset = -1;
+  }
+  trace_profiler->top = node;
   trace_profiler->sf_sz = 0;
   trace_profiler->current_depth = 0;
   trace_profiler->depth_limit = depth_limit;
 
-  trace_profiler->on_sending_frame = PyList_New(0);
+  trace_profiler->records = NULL;
+  trace_profiler->records_sz = 0;
+  trace_profiler->records_cap = 0;
+  trace_profiler->records_base = 0;
+  trace_profiler->flush_records = flush_records;
+  trace_profiler->late = NULL;
+  trace_profiler->late_sz = 0;
+  trace_profiler->late_cap = 0;
+  trace_profiler->session = NULL;
   trace_profiler->out_queue = NULL;
   return trace_profiler;
 }
 
+// send records kept since the last flush, frames still open keep their
+// offsets and follow as late records once they return. flushes during the
+// traced call run inside profile events, the error state is preserved
+static void TraceProfiler_FlushTraceFrames(TraceProfiler *self, int final) {
+  PyObject *err_type, *err_value, *err_tb;
+  PyErr_Fetch(&err_type, &err_value, &err_tb);
+
+  PyObject *records = PyBytes_FromStringAndSize(
+      (const char *)self->records, self->records_sz * sizeof(TraceRecord));
+  PyObject *late = PyBytes_FromStringAndSize(
+      (const char *)self->late, self->late_sz * sizeof(TraceLateRecord));
+  PyObject *base = PyLong_FromSsize_t(self->records_base);
+  PyObject *result = NULL;
+  if (records == NULL || late == NULL || base == NULL) {
+    PyErr_Clear();
+    goto done;
+  }
+
+#if PY_VERSION_HEX >= 0x03090000
+  // vectorcall implementation could be faster, is available in Python 3.9
+  PyObject *callargs[7] = {NULL,
+                           (PyObject *)self->out_queue,
+                           records,
+                           (PyObject *)self->session,
+                           base,
+                           late,
+                           final ? Py_True : Py_False};
+  result = PyObject_Vectorcall(self->target, callargs + 1,
+                               6 | PY_VECTORCALL_ARGUMENTS_OFFSET, NULL);
+#else
+  result = PyObject_CallFunctionObjArgs(
+      self->target, self->out_queue, records, self->session, base, late,
+      final ? Py_True : Py_False, NULL);
+#endif
+  if (result == NULL) {
+    // the traced function must not see errors of the output target
+    PyErr_WriteUnraisable(self->target);
+  }
+  // buffers are reused by the next chunk
+  self->records_base += self->records_sz;
+  self->records_sz = 0;
+  self->late_sz = 0;
+
+done:
+  Py_XDECREF(records);
+  Py_XDECREF(late);
+  Py_XDECREF(base);
+  Py_XDECREF(result);
+  PyErr_Restore(err_type, err_value, err_tb);
+}
+
 static void TraceProfiler_SendTraceFrames(TraceProfiler *self) {
   if (self->is_async) {
     if (self->depth_limit <= 0) {
@@ -721,18 +1120,7 @@ static void TraceProfiler_SendTraceFrames(TraceProfiler *self) {
       TraceProfiler_FulfillAsyncUnfinishedRequestsWithDepth(self);
     }
   }
-
-#if PY_VERSION_HEX >= 0x03090000
-  // vectorcall implementation could be faster, is available in Python 3.9
-  PyObject *callargs[3] = {NULL, (PyObject *)self->out_queue,
-                           (PyObject *)self->on_sending_frame};
-  PyObject *result = PyObject_Vectorcall(
-      self->target, callargs + 1, 2 | PY_VECTORCALL_ARGUMENTS_OFFSET, NULL);
-#else
-  PyObject *result = PyObject_CallFunctionObjArgs(self->target, self->out_queue,
-                                                  self->on_sending_frame, NULL);
-#endif
-  Py_XDECREF(result);
+  TraceProfiler_FlushTraceFrames(self, 1);
 }
 
 //////////////////////
@@ -746,8 +1134,11 @@ static int profile(PyObject *op, PyFrameObject *frame, int what,
                    PyObject *arg) {
   TraceProfiler *tp = (TraceProfiler *)op;
   PyObject *result;
+  if (tp->broken) {
+    return 0;
+  }
 
-  long long current_time = _get_time_ns();
+  long long current_time = _get_time_ticks(tp->clock);
   // what:        0         1           3        4           5             6
   // return:      call   exception    return    c_call    c_exception   c_return
   if (what == 0 || what == 4) {
@@ -756,24 +1147,17 @@ static int profile(PyObject *op, PyFrameObject *frame, int what,
   } else if (what == 3 || what == 6 || what == 5) {
     // return/c_exception/c_return
     FrameNode *node = TraceProfiler_PopFrame(tp);
-    long long cost_ns = current_time - node->start_ns;
-    if (cost_ns < tp->interval) {
+    long long cost_ticks = current_time - node->start_ticks;
+    if (cost_ticks < tp->interval) {
       tp->sf_sz -= 1;
     } else {
       int c_frame = (what == 3) ? 0 : 1;
       FrameNode *parent_node = (FrameNode *)tp->top;
-      PyObject *frame_desp = _get_frame_info(frame, node->start_ns, cost_ns,
-                                             parent_node->offset, arg, c_frame);
-
-      Py_ssize_t real_sf_sz = PyList_Size(tp->on_sending_frame);
-      long long distance = node->offset + 1 - real_sf_sz;
-      long long idx;
-      for (idx = 0; idx < distance; idx++) {
-        PyList_Append(tp->on_sending_frame, Py_None);
-      }
-      PyList_SetItem(tp->on_sending_frame, node->offset, frame_desp);
+      Py_ssize_t desc = TraceProfiler_FrameDesc(tp, frame, arg, c_frame);
+      TraceProfiler_EmitFrame(tp, node->offset, desc, parent_node->offset,
+                              node->start_ticks, cost_ticks);
     }
-    Py_DECREF(node);
+    FrameNode_Release(tp, node);
   }
   return 0;
 }
@@ -782,8 +1166,11 @@ static int profile_with_depth(PyObject *op, PyFrameObject *frame, int what,
                               PyObject *arg) {
   TraceProfiler *tp = (TraceProfiler *)op;
   PyObject *result;
+  if (tp->broken) {
+    return 0;
+  }
 
-  long long current_time = _get_time_ns();
+  long long current_time = _get_time_ticks(tp->clock);
   // what:        0         1           3        4           5             6
   // return:      call   exception    return    c_call    c_exception   c_return
   if (what == 0 || what == 4) {
@@ -792,24 +1179,17 @@ static int profile_with_depth(PyObject *op, PyFrameObject *frame, int what,
   } else if (what == 3 || what == 6 || what == 5) {
     // return/c_exception/c_return
     FrameNode *node = TraceProfiler_PopFrameWithDepth(tp);
-    long long cost_ns = current_time - node->start_ns;
+    long long cost_ticks = current_time - node->start_ticks;
     if (tp->current_depth >= tp->depth_limit) {
       tp->sf_sz -= 1;
     } else {
       int c_frame = (what == 3) ? 0 : 1;
       FrameNode *parent_node = (FrameNode *)tp->top;
-      PyObject *frame_desp = _get_frame_info(frame, node->start_ns, cost_ns,
-                                             parent_node->offset, arg, c_frame);
-
-      Py_ssize_t real_sf_sz = PyList_Size(tp->on_sending_frame);
-      long long distance = node->offset + 1 - real_sf_sz;
-      long long idx;
-      for (idx = 0; idx < distance; idx++) {
-        PyList_Append(tp->on_sending_frame, Py_None);
-      }
-      PyList_SetItem(tp->on_sending_frame, node->offset, frame_desp);
+      Py_ssize_t desc = TraceProfiler_FrameDesc(tp, frame, arg, c_frame);
+      TraceProfiler_EmitFrame(tp, node->offset, desc, parent_node->offset,
+                              node->start_ticks, cost_ticks);
     }
-    Py_DECREF(node);
+    FrameNode_Release(tp, node);
   }
   return 0;
 }
@@ -818,44 +1198,38 @@ static int async_profile(PyObject *op, PyFrameObject *frame, int what,
                          PyObject *arg) {
   TraceProfiler *tp = (TraceProfiler *)op;
   PyObject *result;
+  if (tp->broken) {
+    return 0;
+  }
 
-  long long current_time = _get_time_ns();
+  long long current_time = _get_time_ticks(tp->clock);
   // what:        0         1           3        4           5             6
   // return:      call   exception    return    c_call    c_exception   c_return
   PyCodeObject *code_obj = _code_from_frame(frame);
   int is_async_frame = (code_obj->co_flags & 0x80) > 0 && (what < 4);
-  Py_DECREF(code_obj);
   if (what == 0 || what == 4) {
     // call/c_call
-    int c_frame = (what == 4) ? 1 : 0;
-    TraceProfiler_PushAsyncFrame(
-        tp, current_time, _get_header(frame, c_frame, arg), is_async_frame,
-        PyLong_FromVoidPtr((void *)frame));
+    TraceProfiler_PushAsyncFrame(tp, current_time, code_obj, is_async_frame,
+                                 (void *)frame);
   } else if (what == 3 || what == 6 || what == 5) {
     // return/c_exception/c_return
     FrameNode *node =
         TraceProfiler_PopFrameAsync(tp, is_async_frame, current_time);
     if (!is_async_frame && node != NULL) {
-      long long cost_ns = current_time - node->start_ns;
-      if (cost_ns < tp->interval) {
+      long long cost_ticks = current_time - node->start_ticks;
+      if (cost_ticks < tp->interval) {
         tp->sf_sz -= 1;
       } else {
         int c_frame = (what == 3) ? 0 : 1;
         FrameNode *parent_node = (FrameNode *)tp->top;
-        PyObject *frame_desp = _get_frame_info(
-            frame, node->start_ns, cost_ns, parent_node->offset, arg, c_frame);
-
-        Py_ssize_t real_sf_sz = PyList_Size(tp->on_sending_frame);
-        long long distance = node->offset + 1 - real_sf_sz;
-        long long idx;
-        for (idx = 0; idx < distance; idx++) {
-          PyList_Append(tp->on_sending_frame, Py_None);
-        }
-        PyList_SetItem(tp->on_sending_frame, node->offset, frame_desp);
+        Py_ssize_t desc = TraceProfiler_FrameDesc(tp, frame, arg, c_frame);
+        TraceProfiler_EmitFrame(tp, node->offset, desc, parent_node->offset,
+                                node->start_ticks, cost_ticks);
       }
     }
-    Py_XDECREF(node);
+    FrameNode_Release(tp, node);
   }
+  Py_DECREF(code_obj);
   return 0;
 }
 
@@ -863,78 +1237,102 @@ static int async_profile_with_depth(PyObject *op, PyFrameObject *frame,
                                     int what, PyObject *arg) {
   TraceProfiler *tp = (TraceProfiler *)op;
   PyObject *result;
+  if (tp->broken) {
+    return 0;
+  }
 
-  long long current_time = _get_time_ns();
+  long long current_time = _get_time_ticks(tp->clock);
   // what:        0         1           3        4           5             6
   // return:      call   exception    return    c_call    c_exception   c_return
   PyCodeObject *code_obj = _code_from_frame(frame);
   int is_async_frame = (code_obj->co_flags & 0x80) > 0 && (what < 4);
-  Py_DECREF(code_obj);
   if (what == 0 || what == 4) {
     // call/c_call
-    int c_frame = (what == 4) ? 1 : 0;
-    TraceProfiler_PushAsyncFrameWithDepth(
-        tp, current_time, _get_header(frame, c_frame, arg), is_async_frame,
-        PyLong_FromVoidPtr((void *)frame));
+    TraceProfiler_PushAsyncFrameWithDepth(tp, current_time, code_obj,
+                                          is_async_frame, (void *)frame);
   } else if (what == 3 || what == 6 || what == 5) {
     // return/c_exception/c_return
     FrameNode *node =
         TraceProfiler_PopFrameAsyncWithDepth(tp, is_async_frame, current_time);
     if (!is_async_frame && node != NULL) {
-      long long cost_ns = current_time - node->start_ns;
+      long long cost_ticks = current_time - node->start_ticks;
       if (tp->current_depth >= tp->depth_limit) {
         tp->sf_sz -= 1;
       } else {
         int c_frame = (what == 3) ? 0 : 1;
         FrameNode *parent_node = (FrameNode *)tp->top;
-        PyObject *frame_desp = _get_frame_info(
-            frame, node->start_ns, cost_ns, parent_node->offset, arg, c_frame);
-
-        Py_ssize_t real_sf_sz = PyList_Size(tp->on_sending_frame);
-        long long distance = node->offset + 1 - real_sf_sz;
-        long long idx;
-        for (idx = 0; idx < distance; idx++) {
-          PyList_Append(tp->on_sending_frame, Py_None);
-        }
-        PyList_SetItem(tp->on_sending_frame, node->offset, frame_desp);
+        Py_ssize_t desc = TraceProfiler_FrameDesc(tp, frame, arg, c_frame);
+        TraceProfiler_EmitFrame(tp, node->offset, desc, parent_node->offset,
+                                node->start_ticks, cost_ticks);
       }
     }
-    Py_XDECREF(node);
+    FrameNode_Release(tp, node);
   }
+  Py_DECREF(code_obj);
   return 0;
 }
 
-static PyObject *set_trace_profile(PyObject *m, PyObject *args,
-                                   PyObject *kwds) {
-
+// profiler of a set_trace_profile/set_trace_monitoring call, not installed
+static TraceProfiler *TraceProfiler_FromArgs(PyObject *args) {
   TraceProfiler *profiler = NULL;
   PyObject *out_q;
   PyObject *target;
   long long interval = 0;
   Py_ssize_t depth_limit = 0;
   int async_func = 0;
+  int clock = CLOCK_SOURCE_MONOTONIC_RAW;
+  PyObject *session = Py_None;
+  Py_ssize_t flush_records = 0;
 
-  if (!PyArg_ParseTuple(args, "OOLpn", &target, &out_q, &interval, &async_func,
-                        &depth_limit)) {
+  if (!PyArg_ParseTuple(args, "OOLpn|iOn", &target, &out_q, &interval,
+                        &async_func, &depth_limit, &clock, &session,
+                        &flush_records)) {
     return NULL;
   }
   if (out_q == NULL) {
     return NULL;
   }
+  if (clock < 0 || clock >= CLOCK_SOURCE_COUNT) {
+    PyErr_Format(PyExc_ValueError, "invalid clock source %d", clock);
+    return NULL;
+  }
+  if (session == Py_None) {
+    // descriptions of a single traced call
+    session = TraceSession_New(&TraceSession_Type, NULL, NULL);
+    if (session == NULL) {
+      return NULL;
+    }
+  } else if (PyObject_TypeCheck(session, &TraceSession_Type)) {
+    Py_INCREF(session);
+  } else {
+    PyErr_SetString(PyExc_TypeError, "session must be a TraceSession");
+    return NULL;
+  }
 
-  profiler = TraceProfiler_New(interval, async_func, depth_limit);
+  profiler = TraceProfiler_New((clock_source)clock, interval, async_func,
+                               depth_limit, flush_records);
   Py_XINCREF(out_q);
   profiler->out_queue = out_q;
   Py_XINCREF(target);
   profiler->target = target;
-  if (async_func == 1) {
-    if (depth_limit <= 0) {
+  profiler->session = (TraceSession *)session;
+  return profiler;
+}
+
+static PyObject *set_trace_profile(PyObject *m, PyObject *args,
+                                   PyObject *kwds) {
+  TraceProfiler *profiler = TraceProfiler_FromArgs(args);
+  if (profiler == NULL) {
+    return NULL;
+  }
+  if (profiler->is_async) {
+    if (profiler->depth_limit <= 0) {
       PyEval_SetProfile(async_profile, (PyObject *)profiler);
     } else {
       PyEval_SetProfile(async_profile_with_depth, (PyObject *)profiler);
     }
   } else {
-    if (depth_limit <= 0) {
+    if (profiler->depth_limit <= 0) {
       PyEval_SetProfile(profile, (PyObject *)profiler);
     } else {
       PyEval_SetProfile(profile_with_depth, (PyObject *)profiler);
@@ -943,22 +1341,385 @@ static PyObject *set_trace_profile(PyObject *m, PyObject *args,
   return (PyObject *)profiler;
 }
 
+////////////////////////////
+// sys.monitoring backend //
+////////////////////////////
+
+// PEP 669 backend of sync traced calls on 3.12+. callbacks get the code
+// object or the callable instead of a materialized frame. the tool id is
+// held while trace points use it, events are enabled while traced calls
+// run. set_events is process wide, threads which are not traced return
+// right away. no code is ever DISABLEd: whether a call is recorded depends
+// on its own cost and depth, so any location may be recorded later and
+// both backends must build the same tree
+#if PY_VERSION_HEX >= 0x030C0000
+#define MONITOR_HAS_EVENTS 1
+
+static int monitor_tool_id = -1;
+static Py_ssize_t monitor_users = 0;  // trace points holding the tool id
+static Py_ssize_t monitor_active = 0; // traced calls with enabled events
+static long monitor_events = 0;
+static __thread TraceProfiler *monitor_profiler = NULL;
+
+static PyObject *monitor_call_method(const char *name, const char *format,
+                                     ...) {
+  PyObject *monitoring = PySys_GetObject("monitoring");
+  if (monitoring == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "sys.monitoring is not available");
+    return NULL;
+  }
+  PyObject *method = PyObject_GetAttrString(monitoring, name);
+  if (method == NULL) {
+    return NULL;
+  }
+  va_list va;
+  va_start(va, format);
+  PyObject *args = Py_VaBuildValue(format, va);
+  va_end(va);
+  PyObject *result = NULL;
+  if (args != NULL) {
+    result = PyObject_CallObject(method, args);
+    Py_DECREF(args);
+  }
+  Py_DECREF(method);
+  return result;
+}
+
+static int monitor_set_events(long events) {
+  PyObject *result =
+      monitor_call_method("set_events", "(il)", monitor_tool_id, events);
+  Py_XDECREF(result);
+  return result == NULL ? -1 : 0;
+}
+
+static void monitor_push(TraceProfiler *tp, const void *key) {
+  long long current_time = _get_time_ticks(tp->clock);
+  if (tp->depth_limit <= 0) {
+    TraceProfiler_PushFrame(tp, current_time);
+  } else {
+    TraceProfiler_PushFrameWithDepth(tp, current_time);
+  }
+  if (!tp->broken) {
+    tp->top->frame_id = (void *)key;
+  }
+}
+
+// pop the frame pushed for key, return it or NULL when key is not on top
+static FrameNode *monitor_pop(TraceProfiler *tp, const void *key,
+                              long long *cost_ticks, int *kept) {
+  if (tp->top->offset == -1 || tp->top->frame_id != key) {
+    return NULL;
+  }
+  long long current_time = _get_time_ticks(tp->clock);
+  FrameNode *node = tp->depth_limit <= 0 ? TraceProfiler_PopFrame(tp)
+                                         : TraceProfiler_PopFrameWithDepth(tp);
+  *cost_ticks = current_time - node->start_ticks;
+  *kept = tp->depth_limit <= 0 ? *cost_ticks >= tp->interval
+                               : tp->current_depth < tp->depth_limit;
+  if (!*kept) {
+    tp->sf_sz -= 1;
+  }
+  return node;
+}
+
+// PY_START, PY_RESUME: code, instruction offset
+static PyObject *monitor_py_start(PyObject *m, PyObject *const *args,
+                                  Py_ssize_t nargs) {
+  TraceProfiler *tp = monitor_profiler;
+  if (tp == NULL || tp->broken || nargs < 1) {
+    Py_RETURN_NONE;
+  }
+  monitor_push(tp, args[0]);
+  Py_RETURN_NONE;
+}
+
+// PY_THROW: code, instruction offset, exception. not a local event, it can
+// not be disabled
+static PyObject *monitor_py_throw(PyObject *m, PyObject *const *args,
+                                  Py_ssize_t nargs) {
+  TraceProfiler *tp = monitor_profiler;
+  if (tp == NULL || tp->broken || nargs < 1) {
+    Py_RETURN_NONE;
+  }
+  monitor_push(tp, args[0]);
+  Py_RETURN_NONE;
+}
+
+// PY_RETURN, PY_YIELD, PY_UNWIND: code, instruction offset, value
+static PyObject *monitor_py_return(PyObject *m, PyObject *const *args,
+                                   Py_ssize_t nargs) {
+  TraceProfiler *tp = monitor_profiler;
+  if (tp == NULL || tp->broken || nargs < 1) {
+    Py_RETURN_NONE;
+  }
+  long long cost_ticks;
+  int kept;
+  FrameNode *node = monitor_pop(tp, args[0], &cost_ticks, &kept);
+  if (node == NULL) {
+    // frames entered before tracing
+    Py_RETURN_NONE;
+  }
+  if (kept) {
+    Py_ssize_t desc = TraceProfiler_CodeDesc(tp, (PyCodeObject *)args[0]);
+    TraceProfiler_EmitFrame(tp, node->offset, desc, tp->top->offset,
+                            node->start_ticks, cost_ticks);
+  }
+  FrameNode_Release(tp, node);
+  Py_RETURN_NONE;
+}
+
+// callables reported as c_call by setprofile
+static int monitor_c_callable(PyObject *callable) {
+  return PyCFunction_Check(callable) ||
+         Py_IS_TYPE(callable, &PyMethodDescr_Type);
+}
+
+// CALL: code, instruction offset, callable, first argument
+static PyObject *monitor_call(PyObject *m, PyObject *const *args,
+                              Py_ssize_t nargs) {
+  TraceProfiler *tp = monitor_profiler;
+  if (tp == NULL || tp->broken || nargs < 3 ||
+      !monitor_c_callable(args[2])) {
+    Py_RETURN_NONE;
+  }
+  monitor_push(tp, args[2]);
+  Py_RETURN_NONE;
+}
+
+// C_RETURN, C_RAISE: code, instruction offset, callable, first argument
+static PyObject *monitor_c_return(PyObject *m, PyObject *const *args,
+                                  Py_ssize_t nargs) {
+  TraceProfiler *tp = monitor_profiler;
+  if (tp == NULL || tp->broken || nargs < 3) {
+    Py_RETURN_NONE;
+  }
+  long long cost_ticks;
+  int kept;
+  FrameNode *node = monitor_pop(tp, args[2], &cost_ticks, &kept);
+  if (node == NULL) {
+    Py_RETURN_NONE;
+  }
+  if (kept) {
+    Py_ssize_t desc = TraceProfiler_CFuncDesc(tp, args[2]);
+    TraceProfiler_EmitFrame(tp, node->offset, desc, tp->top->offset,
+                            node->start_ticks, cost_ticks);
+  }
+  FrameNode_Release(tp, node);
+  Py_RETURN_NONE;
+}
+
+typedef struct {
+  const char *event;
+  PyMethodDef callback;
+} MonitorCallback;
+
+static MonitorCallback monitor_callbacks[] = {
+    {"PY_START",
+     {"py_start", (PyCFunction)(void (*)(void))monitor_py_start, METH_FASTCALL,
+      NULL}},
+    {"PY_RESUME",
+     {"py_resume", (PyCFunction)(void (*)(void))monitor_py_start,
+      METH_FASTCALL, NULL}},
+    {"PY_THROW",
+     {"py_throw", (PyCFunction)(void (*)(void))monitor_py_throw, METH_FASTCALL,
+      NULL}},
+    {"PY_RETURN",
+     {"py_return", (PyCFunction)(void (*)(void))monitor_py_return,
+      METH_FASTCALL, NULL}},
+    {"PY_YIELD",
+     {"py_yield", (PyCFunction)(void (*)(void))monitor_py_return,
+      METH_FASTCALL, NULL}},
+    {"PY_UNWIND",
+     {"py_unwind", (PyCFunction)(void (*)(void))monitor_py_return,
+      METH_FASTCALL, NULL}},
+    {"CALL",
+     {"call", (PyCFunction)(void (*)(void))monitor_call, METH_FASTCALL, NULL}},
+    {"C_RETURN",
+     {"c_return", (PyCFunction)(void (*)(void))monitor_c_return, METH_FASTCALL,
+      NULL}},
+    {"C_RAISE",
+     {"c_raise", (PyCFunction)(void (*)(void))monitor_c_return, METH_FASTCALL,
+      NULL}},
+};
+
+#define MONITOR_CALLBACK_COUNT                                                 \
+  ((Py_ssize_t)(sizeof(monitor_callbacks) / sizeof(MonitorCallback)))
+
+static int monitor_register(int tool_id) {
+  PyObject *monitoring = PySys_GetObject("monitoring");
+  if (monitoring == NULL) {
+    PyErr_SetString(PyExc_RuntimeError, "sys.monitoring is not available");
+    return -1;
+  }
+  PyObject *events = PyObject_GetAttrString(monitoring, "events");
+  if (events == NULL) {
+    return -1;
+  }
+  long mask = 0;
+  Py_ssize_t i;
+  for (i = 0; i < MONITOR_CALLBACK_COUNT; i++) {
+    PyObject *event =
+        PyObject_GetAttrString(events, monitor_callbacks[i].event);
+    long event_bit = event == NULL ? -1 : PyLong_AsLong(event);
+    Py_XDECREF(event);
+    PyObject *callback =
+        event_bit < 0 ? NULL
+                      : PyCFunction_New(&monitor_callbacks[i].callback, NULL);
+    PyObject *result =
+        callback == NULL
+            ? NULL
+            : monitor_call_method("register_callback", "(ilO)", tool_id,
+                                  event_bit, callback);
+    Py_XDECREF(callback);
+    if (result == NULL) {
+      Py_DECREF(events);
+      return -1;
+    }
+    Py_DECREF(result);
+    mask |= event_bit;
+  }
+  Py_DECREF(events);
+  monitor_events = mask;
+  monitor_tool_id = tool_id;
+  return 0;
+}
+
+// give the tool id back once no trace point nor traced call uses it
+static void monitor_release_tool(void) {
+  if (monitor_tool_id < 0 || monitor_users > 0 || monitor_active > 0) {
+    return;
+  }
+  PyObject *result =
+      monitor_call_method("free_tool_id", "(i)", monitor_tool_id);
+  if (result == NULL) {
+    PyErr_WriteUnraisable(NULL);
+  }
+  Py_XDECREF(result);
+  monitor_tool_id = -1;
+}
+#else
+#define MONITOR_HAS_EVENTS 0
+#endif
+
+/**
+ * like set_trace_profile, but sync calls are traced by sys.monitoring when
+ * init_trace_monitoring acquired its tool id
+ */
+static PyObject *set_trace_monitoring(PyObject *m, PyObject *args,
+                                      PyObject *kwds) {
+#if MONITOR_HAS_EVENTS
+  if (monitor_tool_id >= 0) {
+    TraceProfiler *profiler = TraceProfiler_FromArgs(args);
+    if (profiler == NULL) {
+      return NULL;
+    }
+    if (!profiler->is_async) {
+      if (monitor_active == 0 && monitor_set_events(monitor_events) != 0) {
+        Py_DECREF(profiler);
+        return NULL;
+      }
+      monitor_active += 1;
+      profiler->monitored = 1;
+      // a nested traced call replaces the outer one like setprofile does
+      Py_XSETREF(monitor_profiler, (TraceProfiler *)Py_NewRef(profiler));
+      return (PyObject *)profiler;
+    }
+    Py_DECREF(profiler);
+  }
+#endif
+  return set_trace_profile(m, args, kwds);
+}
+
 static PyObject *remove_trace_profile(PyObject *m, PyObject *args,
                                       PyObject *kwds) {
-  PyEval_SetProfile(NULL, NULL);
   PyObject *profiler_obj;
 
   if (!PyArg_ParseTuple(args, "O", &profiler_obj)) {
+    PyEval_SetProfile(NULL, NULL);
     Py_RETURN_NONE;
   }
   if (profiler_obj == Py_None || profiler_obj == NULL) {
+    PyEval_SetProfile(NULL, NULL);
     Py_RETURN_NONE;
   }
   TraceProfiler *profiler = (TraceProfiler *)profiler_obj;
+#if MONITOR_HAS_EVENTS
+  if (profiler->monitored) {
+    profiler->monitored = 0;
+    if (monitor_profiler == profiler) {
+      Py_CLEAR(monitor_profiler);
+    }
+    monitor_active -= 1;
+    if (monitor_active == 0 && monitor_set_events(0) != 0) {
+      PyErr_WriteUnraisable(NULL);
+    }
+    monitor_release_tool();
+  } else {
+    PyEval_SetProfile(NULL, NULL);
+  }
+#else
+  PyEval_SetProfile(NULL, NULL);
+#endif
   TraceProfiler_SendTraceFrames(profiler);
   Py_RETURN_NONE;
 }
 
+/**
+ * acquire the sys.monitoring tool id for a trace point, return False when
+ * it is not available: before 3.12 or used by another profiler
+ */
+static PyObject *init_trace_monitoring(PyObject *m, PyObject *args) {
+#if MONITOR_HAS_EVENTS
+  if (monitor_tool_id < 0) {
+    PyObject *monitoring = PySys_GetObject("monitoring");
+    PyObject *tool = monitoring == NULL
+                         ? NULL
+                         : PyObject_GetAttrString(monitoring, "PROFILER_ID");
+    int tool_id = tool == NULL ? -1 : (int)PyLong_AsLong(tool);
+    Py_XDECREF(tool);
+    PyObject *result =
+        tool_id < 0 ? NULL
+                    : monitor_call_method("use_tool_id", "(is)", tool_id,
+                                          "pyflightprofiler");
+    if (result == NULL) {
+      PyErr_Clear();
+      Py_RETURN_FALSE;
+    }
+    Py_DECREF(result);
+    if (monitor_register(tool_id) != 0) {
+      PyErr_WriteUnraisable(NULL);
+      result = monitor_call_method("free_tool_id", "(i)", tool_id);
+      Py_XDECREF(result);
+      PyErr_Clear();
+      Py_RETURN_FALSE;
+    }
+  }
+  monitor_users += 1;
+  Py_RETURN_TRUE;
+#else
+  Py_RETURN_FALSE;
+#endif
+}
+
+// a trace point initialized by init_trace_monitoring is cleared
+static PyObject *release_trace_monitoring(PyObject *m, PyObject *args) {
+#if MONITOR_HAS_EVENTS
+  if (monitor_users > 0) {
+    monitor_users -= 1;
+    monitor_release_tool();
+  }
+#endif
+  Py_RETURN_NONE;
+}
+
+static PyObject *init_clock_source(PyObject *m, PyObject *args) {
+  const char *name = NULL;
+  if (!PyArg_ParseTuple(args, "|z", &name)) {
+    return NULL;
+  }
+  return PyLong_FromLong(clock_source_init(name));
+}
+
 ///////////////////////////
 // Module initialization //
 ///////////////////////////
@@ -968,6 +1729,15 @@ static PyMethodDef module_methods[] = {
      METH_VARARGS | METH_KEYWORDS, "set_trace_profile implementation."},
     {"remove_trace_profile", (PyCFunction)remove_trace_profile,
      METH_VARARGS | METH_KEYWORDS, "remove by setting sys.setprofile(None)"},
+    {"set_trace_monitoring", (PyCFunction)set_trace_monitoring,
+     METH_VARARGS | METH_KEYWORDS,
+     "set_trace_profile tracing sync calls by sys.monitoring when available"},
+    {"init_trace_monitoring", (PyCFunction)init_trace_monitoring, METH_NOARGS,
+     "acquire the sys.monitoring tool id, return whether it is available"},
+    {"release_trace_monitoring", (PyCFunction)release_trace_monitoring,
+     METH_NOARGS, "release the tool id acquired by init_trace_monitoring"},
+    {"init_clock_source", (PyCFunction)init_clock_source, METH_VARARGS,
+     "resolve and calibrate clock source by name, return its id"},
     {NULL} /* Sentinel */
 };
 
@@ -975,5 +1745,19 @@ PyMODINIT_FUNC PyInit_trace_profile_C(void) {
   static struct PyModuleDef moduledef = {
       PyModuleDef_HEAD_INIT, "trace_profile_C", "PyFlight trace supports.", -1,
       module_methods};
-  return PyModule_Create(&moduledef);
+  if (PyType_Ready(&TraceSession_Type) < 0) {
+    return NULL;
+  }
+  PyObject *m = PyModule_Create(&moduledef);
+  if (m == NULL) {
+    return NULL;
+  }
+  Py_INCREF(&TraceSession_Type);
+  if (PyModule_AddObject(m, "TraceSession", (PyObject *)&TraceSession_Type) <
+      0) {
+    Py_DECREF(&TraceSession_Type);
+    Py_DECREF(m);
+    return NULL;
+  }
+  return m;
 }
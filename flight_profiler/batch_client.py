@@ -0,0 +1,473 @@
+"""
+Batch attach: inject the agent into many processes at once, e.g. the workers
+of a gunicorn or uWSGI master, and fan one command out to all of them.
+
+perf writes one flamegraph merged over all processes, `gilstat stream` prints
+one report with rows per process, other commands run in every process
+concurrently and their outputs are printed per process.
+"""
+import json
+import os
+import subprocess
+import sys
+import threading
+import time
+from concurrent.futures import ThreadPoolExecutor
+from io import StringIO
+from typing import Any, Dict, Iterable, List, Optional
+
+from flight_profiler.client import (
+    ProfilerCli,
+    find_port_available,
+    locate_base_addr,
+    prefetch_agent_symbols,
+    remote_exec_agent,
+    run_linux_injector,
+)
+from flight_profiler.common.system_logger import logger
+from flight_profiler.communication.flight_client import FlightClient
+from flight_profiler.plugins.gilstat.cli_plugin_gilstat import GilStatCliPlugin
+from flight_profiler.plugins.gilstat.gilstat_parser import valid as gilstat_valid
+from flight_profiler.plugins.gilstat.gilstat_render import render_gil_batch_report
+from flight_profiler.plugins.gilstat.gilstat_stream import GilStreamReader
+from flight_profiler.plugins.perf.cli_plugin_perf import perf_request, write_flamegraph
+from flight_profiler.plugins.perf.perf_parser import PerfParams, global_perf_parser
+from flight_profiler.plugins.perf.perf_render import merge_collapsed
+from flight_profiler.utils.args_util import split_regex
+from flight_profiler.utils.cli_util import (
+    is_process_alive,
+    show_error_info,
+    show_normal_info,
+)
+from flight_profiler.utils.env_util import is_linux, is_mac, py_higher_than_314
+from flight_profiler.utils.render_util import COLOR_END, COLOR_RED, EXIT_CODE_HINTS
+from flight_profiler.utils.shell_util import get_py_bin_path, process_build_id
+
+# commands that only make sense against a single interactive target
+SINGLE_TARGET_COMMANDS = ("quit", "exit", "stop", "history", "console")
+
+
+class BatchTarget:
+
+    def __init__(self, pid: int):
+        self.pid = pid
+        self.port = -1
+        # why the target can't be used, None when attached
+        self.error: Optional[str] = None
+        # attached by an earlier run of the client
+        self.reused = False
+
+
+class ThreadOutput:
+    """
+    sys.stdout replacement sending the prints of threads which set a buffer to
+    it, so plugins running for several targets at once don't interleave
+    """
+
+    def __init__(self, stream):
+        self.stream = stream
+        self.local = threading.local()
+
+    def write(self, text: str) -> int:
+        buffer = getattr(self.local, "buffer", None)
+        return (buffer if buffer is not None else self.stream).write(text)
+
+    def flush(self) -> None:
+        if getattr(self.local, "buffer", None) is None:
+            self.stream.flush()
+
+    def __getattr__(self, name: str):
+        return getattr(self.stream, name)
+
+
+def descendant_pids(roots: Iterable[int], ps_output: Optional[str] = None) -> List[int]:
+    """
+    pids of all descendants of roots, roots excluded, parents before children.
+    ps_output is `ps -A -o pid=,ppid=` and read from ps when not given
+    """
+    if ps_output is None:
+        ps_output = subprocess.run(
+            ["ps", "-A", "-o", "pid=,ppid="], capture_output=True, text=True
+        ).stdout
+    children: Dict[int, List[int]] = {}
+    for line in ps_output.splitlines():
+        fields = line.split()
+        if len(fields) != 2 or not fields[0].isdigit() or not fields[1].isdigit():
+            continue
+        children.setdefault(int(fields[1]), []).append(int(fields[0]))
+    result: List[int] = []
+    seen = set(roots)
+    queue = list(roots)
+    while queue:
+        for child in sorted(children.get(queue.pop(0), [])):
+            if child not in seen:
+                seen.add(child)
+                result.append(child)
+                queue.append(child)
+    return result
+
+
+def is_python_process(pid: int) -> bool:
+    """
+    whether a python interpreter or libpython is mapped into pid, masters
+    usually fork helper processes which are not python, e.g. uWSGI spoolers
+    """
+    if not is_linux():
+        return True
+    try:
+        with open(f"/proc/{pid}/maps") as f:
+            for line in f:
+                fields = line.split()
+                if len(fields) < 6:
+                    continue
+                name = os.path.basename(fields[5])
+                if name.startswith("python") or name.startswith("libpython"):
+                    return True
+    except OSError:
+        return False
+    return False
+
+
+def query_server_pid(port: int) -> Optional[int]:
+    """
+    pid of the agent server listening on port, None when it isn't one
+    """
+    try:
+        client = FlightClient("localhost", port)
+    except:
+        return None
+    try:
+        server_resp: Dict[str, Any] = json.loads(
+            client.request({"target": "status", "is_plugin_calling": False})
+        )
+        if server_resp["app_type"] != "py_flight_profiler":
+            return None
+        return int(server_resp["pid"])
+    except:
+        # maybe the port is used by application
+        return None
+    finally:
+        client.close()
+
+
+def find_injected_ports(pids: Iterable[int], start_port: int, end_port: int) -> Dict[int, int]:
+    """
+    ports of the pids attached already, like check_server_injected for many pids
+    in one scan of the port range
+    """
+    wanted = set(pids)
+    found: Dict[int, int] = {}
+    for port in range(start_port, end_port):
+        if len(found) == len(wanted):
+            break
+        server_pid = query_server_pid(port)
+        if server_pid in wanted:
+            found[server_pid] = port
+    return found
+
+
+def inject_target(target: BatchTarget, debug: bool, agent_symbols: str = "") -> None:
+    current_directory = os.path.dirname(os.path.abspath(__file__))
+    server_pid = str(target.pid)
+    try:
+        base_addr = locate_base_addr(
+            current_directory, server_pid, "linux" if is_linux() else "mac"
+        )
+        if py_higher_than_314():
+            remote_exec_agent(target.port, server_pid, base_addr, agent_symbols)
+            return
+        exit_code = run_linux_injector(
+            target.port, server_pid, base_addr, debug, agent_symbols
+        )
+        if exit_code != 0:
+            target.error = (
+                EXIT_CODE_HINTS[exit_code]
+                if 0 <= exit_code < len(EXIT_CODE_HINTS)
+                else f"inject exit code {exit_code}"
+            )
+    except PermissionError as e:
+        target.error = f"higher permission required, {e}"
+    except ValueError as e:
+        target.error = str(e).strip()
+    except Exception as e:
+        logger.exception(f"inject {server_pid} failed")
+        target.error = f"{type(e).__name__}: {e}"
+
+
+def wait_target(target: BatchTarget, timeout: int) -> None:
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if query_server_pid(target.port) == target.pid:
+            return
+        if not is_process_alive(target.pid):
+            break
+        time.sleep(0.2)
+    # the injection is done, but the server has no chance to respond
+    target.error = EXIT_CODE_HINTS[16]
+
+
+def attach_targets(
+    pids: List[int],
+    start_port: int,
+    end_port: int,
+    parallel: int,
+    timeout: int,
+    debug: bool = False,
+) -> List[BatchTarget]:
+    """
+    inject the agent into pids, at most parallel of them are injected at once
+    since each injection stops its target for a moment
+    """
+    targets = [BatchTarget(pid) for pid in pids]
+    injected = find_injected_ports(pids, start_port, end_port)
+    used_ports = set(injected.values())
+    pending: List[BatchTarget] = []
+    for target in targets:
+        if target.pid in injected:
+            target.port = injected[target.pid]
+            target.reused = True
+            continue
+        port = find_port_available(start_port, end_port, used_ports)
+        if port < 0:
+            target.error = f"no available debug port between range: {start_port} {end_port}"
+            continue
+        used_ports.add(port)
+        target.port = port
+        pending.append(target)
+    if not pending:
+        return targets
+
+    # encoded agent symbols by target pid
+    agent_symbols: Dict[int, str] = {}
+    if is_linux():
+        # workers of one master share the interpreter, resolve its symbols once
+        by_build_id: Dict[Optional[bytes], str] = {}
+        for target in pending:
+            build_id = process_build_id(target.pid)
+            if build_id is None or build_id not in by_build_id:
+                by_build_id[build_id] = prefetch_agent_symbols(str(target.pid), debug)
+            agent_symbols[target.pid] = by_build_id[build_id]
+
+    with ThreadPoolExecutor(max(1, parallel)) as executor:
+        list(
+            executor.map(
+                lambda t: inject_target(t, debug, agent_symbols.get(t.pid, "")),
+                pending,
+            )
+        )
+    injected_targets = [t for t in pending if t.error is None]
+    if injected_targets:
+        with ThreadPoolExecutor(len(injected_targets)) as executor:
+            list(executor.map(lambda t: wait_target(t, timeout), injected_targets))
+    return targets
+
+
+def show_targets(targets: List[BatchTarget]) -> None:
+    print(f"{'pid':<10}{'port':<8}status")
+    for target in targets:
+        if target.error is not None:
+            status = f"{COLOR_RED}failed: {target.error}{COLOR_END}"
+        elif target.reused:
+            status = "attached already"
+        else:
+            status = "attached"
+        port = str(target.port) if target.port >= 0 else "-"
+        print(f"{target.pid:<10}{port:<8}{status}")
+
+
+def batch_perf(targets: List[BatchTarget], cmd: str) -> None:
+    """
+    sample all targets over the same window and write one flamegraph
+    """
+    try:
+        params: PerfParams = global_perf_parser.parse_perf_params(cmd)
+    except Exception as e:
+        show_error_info(f"Perf command parsed failed, {e}")
+        return
+    directory = os.path.dirname(params.filepath)
+    if not os.path.isdir(directory):
+        show_error_info(f"Directory {directory} does not exist.")
+        return
+
+    def request_all(sampling: List[BatchTarget], param: str) -> Dict[int, dict]:
+        with ThreadPoolExecutor(len(sampling)) as executor:
+            results = list(executor.map(lambda t: perf_request(t.port, param), sampling))
+        succeeded = {}
+        for target, result in zip(sampling, results):
+            if result is None:
+                continue
+            if "error" in result:
+                show_error_info(f"pid {target.pid}: {result['error']}")
+                continue
+            succeeded[target.pid] = result
+        return succeeded
+
+    started = request_all(targets, f"start {params.sample_rate} {params.mode}")
+    sampling = [t for t in targets if t.pid in started]
+    if not sampling:
+        return
+    try:
+        show_normal_info(f"Sampling {len(sampling)} processes, press Control-C to exit.")
+        deadline = time.time() + params.duration if params.duration > 0 else None
+        while deadline is None or time.time() < deadline:
+            if not any(is_process_alive(t.pid) for t in sampling):
+                break
+            time.sleep(0.1)
+    except KeyboardInterrupt:
+        pass
+    stopped = list(request_all(sampling, "stop").values())
+    samples = sum(result["samples"] for result in stopped)
+    stacks = merge_collapsed([result["stacks"] for result in stopped])
+    write_flamegraph(params, samples, stacks, f"{len(stopped)} pids")
+
+
+def batch_gilstat_stream(targets: List[BatchTarget], params: List[str]) -> None:
+    """
+    stream gil statistics of all targets, printing one report with the
+    latest statistics of every target once per interval
+    """
+    if len(params) > 6:
+        show_error_info("stream files are kept per process, the path is ignored in batch mode.")
+        params = params[:6]
+    gil_cmd = GilStatCliPlugin(None, None).build_gil_cmd(params, 1000)
+    interval = int(gil_cmd.split()[3]) / 1000
+    if len(params) <= 5:
+        gil_cmd = gil_cmd + " auto"
+    clients: List[FlightClient] = []
+    readers: Dict[int, GilStreamReader] = {}
+    paths: List[str] = []
+    try:
+        for target in targets:
+            try:
+                client = FlightClient(host="localhost", port=target.port)
+            except:
+                show_error_info(f"pid {target.pid}: target process exited!")
+                continue
+            clients.append(client)
+            # first message is the stream file, otherwise an error
+            line = next(client.request_stream({"target": "gilstat", "param": gil_cmd}), None)
+            stream_path = line.decode("utf-8") if line else None
+            if stream_path is None or not os.path.exists(stream_path):
+                show_error_info(f"pid {target.pid}: {stream_path or 'target process exited!'}")
+                continue
+            paths.append(stream_path)
+            readers[target.pid] = GilStreamReader(stream_path)
+        if not readers:
+            return
+        latest = {}
+        rendered_at = time.time()
+        updated = False
+        while True:
+            for pid, reader in readers.items():
+                for report in reader.read_reports():
+                    latest[pid] = report
+                    updated = True
+            if updated and time.time() - rendered_at >= interval:
+                show_normal_info(render_gil_batch_report(latest))
+                rendered_at = time.time()
+                updated = False
+            if all(r.closed or not is_process_alive(pid) for pid, r in readers.items()):
+                break
+            time.sleep(0.05)
+    except KeyboardInterrupt:
+        pass
+    finally:
+        for target in targets:
+            GilStatCliPlugin(target.port, target.pid).do_gil_off_action()
+        for reader in readers.values():
+            reader.close()
+        for path in paths:
+            try:
+                os.unlink(path)
+            except OSError:
+                pass
+        for client in clients:
+            client.close()
+
+
+def fan_out_command(targets: List[BatchTarget], cmd: str) -> None:
+    """
+    run cmd for all targets concurrently and print the output of each target
+    once it's done, CTRL+C interrupts all of them
+    """
+    output = ThreadOutput(sys.stdout)
+    clis: Dict[int, ProfilerCli] = {}
+
+    def run_one(target: BatchTarget) -> str:
+        output.local.buffer = StringIO()
+        cli = ProfilerCli(target.port, get_py_bin_path(target.pid))
+        cli.server_pid = target.pid
+        clis[target.pid] = cli
+        cli.do_action(cmd)
+        return output.local.buffer.getvalue()
+
+    sys.stdout = output
+    try:
+        with ThreadPoolExecutor(len(targets)) as executor:
+            futures = [executor.submit(run_one, target) for target in targets]
+            try:
+                results = [future.result() for future in futures]
+            except KeyboardInterrupt:
+                for cli in list(clis.values()):
+                    if cli.current_plugin is not None:
+                        cli.current_plugin.on_interrupted()
+                results = [future.result() for future in futures]
+    finally:
+        sys.stdout = output.stream
+    for target, result in zip(targets, results):
+        show_normal_info(f"pid {target.pid}:")
+        print(result, end="" if result.endswith("\n") else "\n")
+
+
+def run_batch_command(targets: List[BatchTarget], cmd: str) -> None:
+    parts = split_regex(cmd)
+    if not parts:
+        return
+    if parts[0] in SINGLE_TARGET_COMMANDS:
+        show_error_info(f"{parts[0]} is not supported when attaching several processes.")
+    elif parts[0] == "perf" and not any(p in ("-h", "--help") for p in parts):
+        batch_perf(targets, cmd[cmd.find("perf") + len("perf"):])
+    elif parts[0] == "gilstat" and len(parts) > 1 and parts[1] == "stream" and gilstat_valid(parts[1:]):
+        batch_gilstat_stream(targets, parts[1:])
+    else:
+        fan_out_command(targets, cmd)
+
+
+def run_batch(
+    pids: List[int],
+    children: bool,
+    parallel: int,
+    cmd: Optional[str],
+    start_port: int,
+    end_port: int,
+    timeout: int,
+    debug: bool = False,
+) -> None:
+    if not is_linux() and not (is_mac() and py_higher_than_314()):
+        show_error_info("attaching several processes needs linux, or CPython 3.14 on mac.")
+        exit(1)
+    if children:
+        # the client itself when it's started below the given pids
+        pids = [
+            pid
+            for pid in descendant_pids(pids)
+            if pid != os.getpid() and is_python_process(pid)
+        ]
+        if not pids:
+            show_error_info("no python child process found.")
+            exit(1)
+    # keep the order given, drop duplicates
+    pids = list(dict.fromkeys(pids))
+
+    targets = attach_targets(pids, start_port, end_port, parallel, timeout, debug)
+    show_targets(targets)
+    attached = [t for t in targets if t.error is None]
+    print(f"\nPyFlightProfiler: 🌟 {len(attached)} of {len(targets)} processes attached.")
+    if not attached:
+        exit(1)
+    if cmd is None:
+        show_normal_info(
+            "Use --cmd to run a command in all of them, or flight_profiler <pid> to enter one."
+        )
+        return
+    run_batch_command(attached, cmd)
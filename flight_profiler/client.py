@@ -13,7 +13,7 @@ import traceback
 from importlib.metadata import version
 from pathlib import Path
 from subprocess import PIPE, Popen
-from typing import Any, Dict
+from typing import Any, Collection, Dict
 
 from flight_profiler.common.global_store import (
     FORBIDDEN_COMMANDS_IN_PY314,
@@ -22,6 +22,7 @@ from flight_profiler.common.global_store import (
 )
 from flight_profiler.common.system_logger import logger
 from flight_profiler.communication.flight_client import FlightClient
+from flight_profiler.plugins.gilstat.gilstat_build import PAUSE_SYMBOLS
 from flight_profiler.plugins.help.help_agent import HELP_COMMANDS_NAMES
 from flight_profiler.utils.cli_util import (
     show_error_info,
@@ -38,7 +39,14 @@ from flight_profiler.utils.render_util import (
     build_colorful_banners,
     build_title_hints,
 )
-from flight_profiler.utils.shell_util import execute_shell, get_py_bin_path
+from flight_profiler.utils.shell_util import (
+    encode_agent_symbols,
+    execute_shell,
+    get_py_bin_path,
+    process_build_id,
+    resolve_symbol_address,
+)
+from flight_profiler.utils.symbol_cache import symbol_cache
 
 # Check readline availability, which may not be enabled in some python distribution.
 try:
@@ -232,12 +240,16 @@ def completer(text, state):
         return None
 
 
-def find_port_available(start_port: int, end_port: int) -> int:
+def find_port_available(
+    start_port: int, end_port: int, excluded: Collection[int] = ()
+) -> int:
     """
     find available port for client/server communicate in range[start_port, end_port]
-    returns -1 if not find
+    ports in excluded are already handed out, returns -1 if not find
     """
     for port in range(start_port, end_port + 1):
+        if port in excluded:
+            continue
         with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
             try:
                 s.bind(("127.0.0.1", port))
@@ -270,7 +282,11 @@ def check_directory_write_permission(directory: str) -> bool:
         return False
 
 
-def get_base_addr(current_directory: str, server_pid: str, platform: str) -> int:
+def locate_base_addr(current_directory: str, server_pid: str, platform: str) -> int:
+    """
+    base address of the python binary in the target process
+    raises ValueError if it can't be located
+    """
     base_addr_locate_shell_path = os.path.join(
         current_directory, f"shell/{platform}/py_bin_base_addr_locate.sh"
     )
@@ -278,29 +294,73 @@ def get_base_addr(current_directory: str, server_pid: str, platform: str) -> int
         base_addr_locate_shell_path, ["bash", base_addr_locate_shell_path, server_pid, str(sys.executable)]
     )
     if base_addr is None or len(base_addr) == 0:
-        show_error_info(
+        raise ValueError(
             f"[Error] can't locate python bin base addr, please make sure target python process and flight_profiler is in the same python environment."
         )
-        exit(1)
     try:
-        base_addr = int(base_addr, 16)
+        return int(base_addr, 16)
     except:
-        show_error_info(f"\n{base_addr}")
+        raise ValueError(f"\n{base_addr}")
+
+
+def get_base_addr(current_directory: str, server_pid: str, platform: str) -> int:
+    try:
+        return locate_base_addr(current_directory, server_pid, platform)
+    except ValueError as e:
+        show_error_info(str(e))
         exit(1)
-    return base_addr
 
 
-def do_inject_on_linux(free_port: int, server_pid: str, debug: bool = False) -> int:
+# processes injected at once when attaching several
+DEFAULT_BATCH_PARALLEL = 8
+
+
+# symbols the agent resolves inside the target
+AGENT_SYMBOLS = ("take_gil", "drop_gil", "_Py_DumpTracebackThreads") + PAUSE_SYMBOLS
+
+
+def prefetch_agent_symbols(server_pid: str, debug: bool = False) -> str:
     """
-    inject by ptrace under linux env
-    returns target port if inject successfully, otherwise exit abnormally
+    resolve the symbols of the agent before injecting, encoded to be handed
+    over with the inject params. they are cached by the build-id of the target
+    interpreter in the cache of the client user, so that later attaches to
+    processes of the same build skip symbol resolution
     """
-    current_directory = os.path.dirname(os.path.abspath(__file__))
-    base_addr = get_base_addr(current_directory, server_pid, "linux")
+    try:
+        addresses = {
+            symbol: resolve_symbol_address(symbol, int(server_pid)) or 0
+            for symbol in AGENT_SYMBOLS
+        }
+        if debug:
+            build_id = process_build_id(int(server_pid))
+            print(
+                f"[DEBUG] Symbols of build-id {build_id.hex() if build_id else None} "
+                f"cached in {symbol_cache().path}"
+            )
+        return encode_agent_symbols(addresses)
+    except Exception:
+        # the agent resolves them itself
+        logger.exception("prefetch agent symbols failed")
+        return ""
+
 
+def run_linux_injector(
+    free_port: int,
+    server_pid: str,
+    base_addr: int,
+    debug: bool = False,
+    agent_symbols: str = "",
+) -> int:
+    """
+    inject by ptrace under linux env, returns the exit code of the injector
+    agent_symbols is encoded by prefetch_agent_symbols
+    """
+    current_directory = os.path.dirname(os.path.abspath(__file__))
     code_inject_py: str = os.path.join(current_directory, "code_inject.py")
-    with open(os.path.join(current_directory, "lib/inject_params.data"), "w") as f:
-        f.write(f"{code_inject_py.strip()},{free_port},{base_addr}\n")
+    # read by the agent of this pid only, so that processes can be injected concurrently
+    params_path = os.path.join(current_directory, f"lib/inject_params_{server_pid}.data")
+    with open(params_path, "w") as f:
+        f.write(f"{code_inject_py.strip()},{free_port},{base_addr},{agent_symbols}\n")
 
     shell_path = os.path.join(current_directory, "lib/inject")
     # Add debug flag to the command if enabled
@@ -308,15 +368,33 @@ def do_inject_on_linux(free_port: int, server_pid: str, debug: bool = False) ->
     if debug:
         cmd_args.append("--debug")
 
-    ps = Popen(
-        cmd_args,
-        stdin=PIPE,
-        stdout=None,
-        stderr=None,
-        bufsize=1,
-        text=True,
+    try:
+        ps = Popen(
+            cmd_args,
+            stdin=PIPE,
+            stdout=None,
+            stderr=None,
+            bufsize=1,
+            text=True,
+        )
+        return ps.wait()
+    finally:
+        # the agent has read it once dlopen returned
+        os.remove(params_path)
+
+
+def do_inject_on_linux(
+    free_port: int, server_pid: str, debug: bool = False, agent_symbols: str = ""
+) -> int:
+    """
+    inject by ptrace under linux env
+    returns target port if inject successfully, otherwise exit abnormally
+    """
+    current_directory = os.path.dirname(os.path.abspath(__file__))
+    base_addr = get_base_addr(current_directory, server_pid, "linux")
+    exit_code = run_linux_injector(
+        free_port, server_pid, base_addr, debug, agent_symbols
     )
-    exit_code = ps.wait()
     verify_exit_code(exit_code, server_pid)
     return free_port
 
@@ -361,29 +439,41 @@ def do_inject_on_mac(free_port: int, server_pid: str, debug: bool = False) -> in
 
 
 
-def do_inject_with_sys_remote_exec(free_port: int, server_pid: str, debug: bool = False):
+def remote_exec_agent(
+    free_port: int, server_pid: str, nm_symbol_offset: int, agent_symbols: str = ""
+) -> None:
+    """
+    run the agent bootstrap code in the target by sys.remote_exec, raises what it raises
+    """
     current_directory = os.path.dirname(os.path.abspath(__file__))
     code_inject_py: str = os.path.join(current_directory, "code_inject.py")
     inject_code_file_path: str = os.path.join(current_directory, f"code_inject_{server_pid}_{int(time.time())}.py")
     shared_lib_suffix = "so" if is_linux() else "dylib"
     inject_agent_so_path: str = os.path.join(current_directory, "lib", f"flight_profiler_agent.{shared_lib_suffix}")
 
-    if is_linux():
-        nm_symbol_offset= get_base_addr(current_directory, server_pid, "linux")
-    else:
-        nm_symbol_offset = get_base_addr(current_directory, server_pid, "mac")
-
     with open(code_inject_py, 'r', encoding='utf-8') as f:
         content = f.read()
     modified_content = content.replace("${listen_port}", str(free_port))
     modified_content = modified_content.replace("${current_file_abspath}", inject_code_file_path)
     modified_content = modified_content.replace("${flight_profiler_agent_so_path}", inject_agent_so_path)
     modified_content = modified_content.replace("${nm_symbol_offset}", str(nm_symbol_offset))
+    modified_content = modified_content.replace("${agent_symbols}", agent_symbols)
     with open(inject_code_file_path, 'w', encoding='utf-8') as f:
         f.write(modified_content)
+    sys.remote_exec(int(server_pid), inject_code_file_path)
+
+
+def do_inject_with_sys_remote_exec(
+    free_port: int, server_pid: str, debug: bool = False, agent_symbols: str = ""
+):
+    current_directory = os.path.dirname(os.path.abspath(__file__))
+    if is_linux():
+        nm_symbol_offset= get_base_addr(current_directory, server_pid, "linux")
+    else:
+        nm_symbol_offset = get_base_addr(current_directory, server_pid, "mac")
 
     try:
-        sys.remote_exec(int(server_pid), inject_code_file_path)
+        remote_exec_agent(free_port, server_pid, nm_symbol_offset, agent_symbols)
     except PermissionError as e:
         show_error_info(f"\n[ERROR] Higher Permission required! This error id caused by {e}")
         show_normal_info(f"[{COLOR_GREEN}Solution{COLOR_END}{COLOR_WHITE_255}] Try run flight_profiler $pid as {COLOR_RED}root{COLOR_END}{COLOR_WHITE_255}!")
@@ -455,24 +545,53 @@ def show_pre_attach_info(server_pid: str, debug: bool = False):
 
 def run():
     parser = argparse.ArgumentParser(
-        usage="%(prog)s <pid> \n\ndescription: A realtime analysis tool used for profiling python program!  \n"
+        usage="%(prog)s <pid> [<pid> ...] [--children] [--parallel N] \n\n"
+              "description: A realtime analysis tool used for profiling python program!  \n"
               " "
     )
     parser.add_argument(
         "pid",
         type=int,
-        help="python process id to analyze."
+        nargs="+",
+        help="python process id to analyze, several pids attach all of them."
     )
     parser.add_argument("--cmd", required=False, type=str, help="One-time profile, primarily used for unit testing.")
     parser.add_argument("--debug", required=False, action="store_true", help="enable debug logging for attachment.")
+    parser.add_argument(
+        "--children",
+        required=False,
+        action="store_true",
+        help="attach the python child processes of the pids instead, e.g. gunicorn or uWSGI workers."
+    )
+    parser.add_argument(
+        "--parallel",
+        required=False,
+        type=int,
+        default=DEFAULT_BATCH_PARALLEL,
+        help=f"processes injected at once when attaching several, {DEFAULT_BATCH_PARALLEL} by default."
+    )
     try:
         args = parser.parse_args()
     except:
         exit(1)
-    server_pid = str(args.pid)
     inject_start_port = int(os.getenv("PYFLIGHT_INJECT_START_PORT", 16000))
     inject_end_port = int(os.getenv("PYFLIGHT_INJECT_END_PORT", 16500))
     inject_timeout = int(os.getenv("PYFLIGHT_INJECT_TIMEOUT", 5))
+    if len(args.pid) > 1 or args.children:
+        from flight_profiler.batch_client import run_batch
+
+        run_batch(
+            args.pid,
+            args.children,
+            args.parallel,
+            args.cmd,
+            inject_start_port,
+            inject_end_port,
+            inject_timeout,
+            args.debug,
+        )
+        exit(0)
+    server_pid = str(args.pid[0])
     show_pre_attach_info(server_pid, args.debug)
 
     connect_port: int = check_server_injected(
@@ -484,15 +603,20 @@ def run():
             print(
                 f"No available debug port between range: {inject_start_port} {inject_end_port}"
             )
+        agent_symbols = prefetch_agent_symbols(server_pid, args.debug) if is_linux() else ""
         if sys.version_info >= (3, 14):
             if not is_linux() and not is_mac():
                 print(f"flight profiler is not enabled on platform: {platform.system()}.")
                 exit(1)
             # sys.remote_exec is provided in CPython 3.14, we can just use it to inject agent code
-            connect_port = do_inject_with_sys_remote_exec(free_port, server_pid, args.debug)
+            connect_port = do_inject_with_sys_remote_exec(
+                free_port, server_pid, args.debug, agent_symbols
+            )
         else:
             if is_linux():
-                connect_port = do_inject_on_linux(free_port, server_pid, args.debug)
+                connect_port = do_inject_on_linux(
+                    free_port, server_pid, args.debug, agent_symbols
+                )
             elif is_mac():
                 connect_port = do_inject_on_mac(free_port, server_pid, args.debug)
             else:
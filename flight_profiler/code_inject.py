@@ -10,13 +10,19 @@ PYTHON_VERSION_314: bool = sys.version_info >= (3, 14)
 if PYTHON_VERSION_314:
     listen_port = "${listen_port}"
     current_file_abspath = "${current_file_abspath}"
+    agent_symbols = "${agent_symbols}"
 else:
     global_vars_dict = globals()
     listen_port = global_vars_dict["__profile_listen_port__"]
     current_file_abspath = os.path.abspath(__file__)
+    # not set by the lldb injection on macOS
+    agent_symbols = global_vars_dict.get("__profile_agent_symbols__", "")
 
 sys.path.append(os.path.dirname(current_file_abspath))
 from flight_profiler.server_flight_profiler import FlightProfilerServer
+from flight_profiler.utils.shell_util import set_agent_symbols
+
+set_agent_symbols(agent_symbols)
 
 
 def load_frida_gum():
@@ -46,6 +52,6 @@ def run_app():
     loop.run_until_complete(asyncio.wait(tasks))
 
 
-profile_thread = threading.Thread(target=run_app)
+profile_thread = threading.Thread(target=run_app, name="flight-profiler-server")
 profile_thread.start()
 logger.info("pyFlightProfiler: start code inject successfully")
@@ -0,0 +1,204 @@
+import argparse
+import heapq
+import random
+import threading
+import time
+from typing import Any, Callable, List, Optional
+
+
+class CallSampler:
+    """
+    decides which invocations of a spied method are recorded, before their
+    arguments are serialized:
+      sample_every: record one in sample_every calls at random
+      rate: record at most rate calls per second
+      slowest: record the slowest calls of every window_s seconds window,
+               emitted when the window ends
+    """
+
+    def __init__(
+        self, sample_every: int = 0, rate: int = 0, slowest: int = 0, window_s: float = 5
+    ):
+        self.sample_every = sample_every
+        self.rate = rate
+        self.slowest = slowest
+        self.window_s = window_s
+        # native wrapper skipping calls faster than the kept ones
+        self.native_wrapper: Optional[Any] = None
+        self.__second = 0
+        self.__taken = 0
+        self.__lock = threading.Lock()
+        # heap of (cost_ms, seq, emit) kept in the current window
+        self.__kept: List[tuple] = []
+        self.__seq = 0
+        self.__window_end = 0.0
+        self.__timer: Optional[threading.Timer] = None
+        self.__limit = 0
+        self.__on_limit: Optional[Callable[[], None]] = None
+        self.__emitted = 0
+        self.__closed = False
+
+    @staticmethod
+    def create(
+        sample_every: Optional[int],
+        rate: Optional[int],
+        slowest: Optional[int],
+        window_s: float,
+    ) -> Optional["CallSampler"]:
+        if not sample_every and not rate and not slowest:
+            return None
+        return CallSampler(sample_every or 0, rate or 0, slowest or 0, window_s)
+
+    def bind(self, limit: int, on_limit: Callable[[], None]) -> None:
+        """
+        slowest calls count to the command limit when they are emitted
+        """
+        self.__limit = limit
+        self.__on_limit = on_limit
+
+    def sample_call(self) -> bool:
+        """
+        called before the invocation, skipped calls do not count to the limit
+        """
+        if self.sample_every > 1 and random.randrange(self.sample_every) != 0:
+            return False
+        if self.rate > 0:
+            second = int(time.time())
+            if second != self.__second:
+                self.__second = second
+                self.__taken = 0
+            if self.__taken >= self.rate:
+                return False
+            self.__taken += 1
+        return True
+
+    def admits(self, cost_ms: float) -> bool:
+        """
+        whether an invocation may be kept, checked before serializing it
+        """
+        if not self.slowest:
+            return True
+        kept = self.__kept
+        return (
+            len(kept) < self.slowest
+            or cost_ms > kept[0][0]
+            or time.time() >= self.__window_end
+        )
+
+    def record(self, cost_ms: float, emit: Callable[[], None]) -> None:
+        """
+        emit an invocation now, or keep it until the window ends in slowest mode
+        """
+        if not self.slowest:
+            emit()
+            return
+        expired = []
+        with self.__lock:
+            if self.__closed:
+                return
+            now = time.time()
+            if now >= self.__window_end:
+                expired = self.__take_kept()
+                self.__window_end = now + self.window_s
+                self.__timer = threading.Timer(self.window_s, self.flush)
+                self.__timer.daemon = True
+                self.__timer.start()
+            self.__seq += 1
+            item = (cost_ms, self.__seq, emit)
+            if len(self.__kept) < self.slowest:
+                heapq.heappush(self.__kept, item)
+            elif cost_ms > self.__kept[0][0]:
+                heapq.heapreplace(self.__kept, item)
+            if len(self.__kept) >= self.slowest:
+                self.__set_cost_floor(self.__kept[0][0], self.__window_end)
+        self.__emit(expired)
+
+    def flush(self) -> None:
+        """
+        emit the calls kept in the current window
+        """
+        with self.__lock:
+            expired = self.__take_kept()
+        self.__emit(expired)
+
+    def close(self) -> None:
+        with self.__lock:
+            self.__closed = True
+            self.__take_kept()
+
+    def __take_kept(self) -> List[tuple]:
+        expired = self.__kept
+        self.__kept = []
+        if self.__timer is not None:
+            self.__timer.cancel()
+            self.__timer = None
+        self.__set_cost_floor(0, 0)
+        # emitted in call order
+        return sorted(expired, key=lambda item: item[1])
+
+    def __set_cost_floor(self, cost_ms: float, until_s: float) -> None:
+        if self.native_wrapper is not None:
+            self.native_wrapper.set_cost_floor(cost_ms, until_s)
+
+    def __emit(self, items: List[tuple]) -> None:
+        for _, _, emit in items:
+            if self.__closed or self.__emitted >= self.__limit:
+                return
+            emit()
+            self.__emitted += 1
+            if self.__emitted >= self.__limit and self.__on_limit is not None:
+                self.close()
+                self.__on_limit()
+
+
+def check_positive(value) -> int:
+    try:
+        i_value = int(value)
+    except:
+        raise argparse.ArgumentTypeError(f"{value} is not a integer.")
+    if i_value < 1:
+        raise argparse.ArgumentTypeError(f"{value} should be positive.")
+    return i_value
+
+
+def add_sampling_arguments(parser: argparse.ArgumentParser) -> None:
+    """
+    sampling options shared by watch and tt
+    """
+    parser.add_argument(
+        "--sample",
+        required=False,
+        type=check_positive,
+        default=None,
+        help="record one in n invocations at random",
+    )
+    parser.add_argument(
+        "--rate",
+        required=False,
+        type=check_positive,
+        default=None,
+        help="record at most n invocations per second",
+    )
+    parser.add_argument(
+        "--slowest",
+        required=False,
+        type=check_positive,
+        default=None,
+        help="record the slowest n invocations of every window",
+    )
+    parser.add_argument(
+        "--window",
+        required=False,
+        type=check_positive,
+        default=5,
+        help="window seconds of --slowest, default value 5",
+    )
+
+
+def create_sampler(args: argparse.Namespace) -> Optional[CallSampler]:
+    return CallSampler.create(
+        getattr(args, "sample"),
+        getattr(args, "rate"),
+        getattr(args, "slowest"),
+        getattr(args, "window"),
+    )
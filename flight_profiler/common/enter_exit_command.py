@@ -1,23 +1,39 @@
 import importlib
 import sys
-from typing import Optional
+from typing import Any, Callable, Optional
 
 from flight_profiler.common import aop_decorator
+from flight_profiler.common.call_sampler import CallSampler
+from flight_profiler.common.expression_resolver import FilterExprResolver
 from flight_profiler.common.system_logger import logger
 from flight_profiler.plugins.server_plugin import Message, ServerQueue
 
+try:
+    from flight_profiler.ext.aop_C import AopWrapper
+except ImportError:
+    AopWrapper = None
+
 
 class EnterExitCommand:
 
-    def __init__(self, limit: int):
+    def __init__(self, limit: int, sampler: Optional[CallSampler] = None):
         self.__count = 0
         self.__finished = 0
         self.limit = limit
+        self.sampler = sampler
+        # slowest calls are counted by the sampler when they are emitted
+        self.call_limit = limit
+        if sampler is not None:
+            sampler.bind(limit, self.finish)
+            if sampler.slowest:
+                self.call_limit = sys.maxsize
         self.out_q: Optional[ServerQueue] = None
         self.origin_code = None
         self.module_name = None
         self.method_name = None
         self.class_name = None
+        # native enter/exit wrapper called by the method trampoline
+        self.native_wrapper: Optional[Any] = None
 
     def enter(self) -> bool:
         """
@@ -37,7 +53,9 @@ class EnterExitCommand:
         if self_injected:
             return False
 
-        if self.__count < self.limit:
+        if self.__count < self.call_limit and (
+            self.sampler is None or self.sampler.sample_call()
+        ):
             self.__count += 1
             return True
         else:
@@ -49,13 +67,65 @@ class EnterExitCommand:
         """
         try:
             self.__finished += 1
-            if self.__finished >= self.limit:
-                self.recover_origin_code()
-                self.child_clear_action()
+            if self.__finished >= self.call_limit:
+                self.finish()
         except:
             logger.exception("error on exit")
 
+    def finish(self):
+        self.recover_origin_code()
+        self.child_clear_action()
+        self.release_native_wrapper()
+
+    def admits(self, cost_ms: float) -> bool:
+        """
+        whether a call passed the filter may be recorded, checked before
+        serializing it
+        """
+        return self.sampler is None or self.sampler.admits(cost_ms)
+
+    def record(self, cost_ms: float, emit: Callable[[], None]) -> None:
+        if self.sampler is None:
+            emit()
+        else:
+            self.sampler.record(cost_ms, emit)
+
+    def build_native_wrapper(
+        self, filter_resolver: FilterExprResolver, self_target: bool, **options
+    ) -> Optional[Any]:
+        """
+        native wrapper doing enter/exit, timing and filtering of sync methods,
+        the callbacks in options are only called for calls passed the filter,
+        None when the python wrapper is needed for nested methods
+        """
+        if AopWrapper is None or getattr(self, "nested_method", None) is not None:
+            return None
+        if self.sampler is not None:
+            options["sample_every"] = self.sampler.sample_every
+            options["rate"] = self.sampler.rate
+        self.native_wrapper = AopWrapper(
+            self.call_limit,
+            self.finish,
+            filter_resolver.native_filter(),
+            self_target,
+            **options,
+        )
+        if self.sampler is not None:
+            self.sampler.native_wrapper = self.native_wrapper
+        return self.native_wrapper
+
+    def release_native_wrapper(self) -> None:
+        """
+        drop the native wrapper once the method is restored, its callbacks are
+        bound methods of this command
+        """
+        self.native_wrapper = None
+        if self.sampler is not None:
+            self.sampler.native_wrapper = None
+
     def recover_origin_code(self):
+        if self.sampler is not None:
+            self.sampler.close()
         if self.origin_code is not None:
             try:
                 module = importlib.import_module(self.module_name)
@@ -1,5 +1,115 @@
+import ast
+import sys
 import uuid
-from typing import Any
+from typing import Any, Callable, Optional
+
+try:
+    from flight_profiler.ext.filter_C import evaluate as native_evaluate
+except ImportError:
+    native_evaluate = None
+
+# node kinds, roots, steps and compare ops of filter programs, same values as
+# in csrc/filter/filter_expr.c
+NODE_CONST = 0
+NODE_PATH = 1
+NODE_COMPARE = 2
+NODE_AND = 3
+NODE_OR = 4
+NODE_NOT = 5
+
+FILTER_ROOTS = {"target": 0, "return_obj": 1, "cost": 2, "args": 3, "kwargs": 4}
+
+STEP_ATTR = 0
+STEP_ITEM = 1
+
+COMPARE_OPS = {
+    ast.Lt: 0,
+    ast.LtE: 1,
+    ast.Eq: 2,
+    ast.NotEq: 3,
+    ast.Gt: 4,
+    ast.GtE: 5,
+    ast.In: 6,
+    ast.NotIn: 7,
+    ast.Is: 8,
+    ast.IsNot: 9,
+}
+
+
+class UnsupportedFilter(Exception):
+    pass
+
+
+def _const_value(node: ast.AST) -> Any:
+    if isinstance(node, ast.Constant):
+        return node.value
+    if isinstance(node, ast.UnaryOp) and isinstance(node.op, ast.USub):
+        value = _const_value(node.operand)
+        if type(value) in (int, float):
+            return -value
+    if isinstance(node, ast.Tuple):
+        return tuple(_const_value(elt) for elt in node.elts)
+    if isinstance(node, ast.List):
+        return [_const_value(elt) for elt in node.elts]
+    raise UnsupportedFilter()
+
+
+def _compile_value(node: ast.AST) -> tuple:
+    """
+    names of filter arguments followed by attributes or constant subscripts
+    """
+    steps = []
+    while True:
+        if isinstance(node, ast.Attribute):
+            steps.append((STEP_ATTR, node.attr))
+            node = node.value
+        elif isinstance(node, ast.Subscript):
+            key = node.slice
+            # python 3.8 wraps subscripts in ast.Index
+            if sys.version_info < (3, 9) and isinstance(key, ast.Index):
+                key = key.value
+            steps.append((STEP_ITEM, _const_value(key)))
+            node = node.value
+        else:
+            break
+    if isinstance(node, ast.Name) and node.id in FILTER_ROOTS:
+        return NODE_PATH, FILTER_ROOTS[node.id], tuple(reversed(steps))
+    if steps:
+        raise UnsupportedFilter()
+    return NODE_CONST, _const_value(node)
+
+
+def _compile_test(node: ast.AST) -> tuple:
+    if isinstance(node, ast.BoolOp):
+        kind = NODE_AND if isinstance(node.op, ast.And) else NODE_OR
+        return kind, tuple(_compile_test(value) for value in node.values)
+    if isinstance(node, ast.UnaryOp) and isinstance(node.op, ast.Not):
+        return NODE_NOT, _compile_test(node.operand)
+    if isinstance(node, ast.Compare):
+        operands = [node.left] + node.comparators
+        # a chained comparison evaluates its middle operands once, only allow
+        # ones without attribute access
+        for middle in operands[1:-1]:
+            if not isinstance(middle, (ast.Constant, ast.Name)):
+                raise UnsupportedFilter()
+        values = [_compile_value(operand) for operand in operands]
+        tests = tuple(
+            (NODE_COMPARE, COMPARE_OPS[type(op)], values[i], values[i + 1])
+            for i, op in enumerate(node.ops)
+        )
+        return tests[0] if len(tests) == 1 else (NODE_AND, tests)
+    return _compile_value(node)
+
+
+def compile_filter_program(expr: str) -> Optional[tuple]:
+    """
+    compile predicates like `cost > 10 and args[0].name == 'a'` into a program
+    evaluated by filter_C without a python frame, None for other expressions
+    """
+    try:
+        return _compile_test(ast.parse(expr.strip(), mode="eval").body)
+    except (SyntaxError, UnsupportedFilter, KeyError):
+        return None
 
 
 class ExpressionResolver:
@@ -28,6 +138,25 @@ class ExpressionResolver:
         pass
 
 
+class CompiledExpression:
+    """
+    expression function compiled on first use and kept for the command,
+    compile errors are raised by every call like the expression errors
+    """
+
+    def __init__(self, func_name: str, code: str):
+        self.__func_name = func_name
+        self.__code = code
+        self.__func: Optional[Callable] = None
+
+    def get(self) -> Callable:
+        if self.__func is None:
+            namespace = {}
+            exec(compile(self.__code, "<expression>", "exec"), globals(), namespace)
+            self.__func = namespace[self.__func_name]
+        return self.__func
+
+
 class MethodInvocationExprResolver(ExpressionResolver):
 
     def __init__(self, expr: str):
@@ -39,11 +168,10 @@ class MethodInvocationExprResolver(ExpressionResolver):
         uid = str(uuid.uuid4())
         self.__func_name = f"expr_func_{uid.replace('-', '_')}"
         self.__code = f"def {self.__func_name}(target, return_obj, *args, **kwargs): return {self.__expr}"
+        self.__compiled = CompiledExpression(self.__func_name, self.__code)
 
     def eval(self, target_obj: Any, return_obj: Any, *args, **kwargs) -> Any:
-        namespace = {}
-        exec(self.__code, globals(), namespace)
-        return namespace[self.__func_name](target_obj, return_obj, *args, **kwargs)
+        return self.__compiled.get()(target_obj, return_obj, *args, **kwargs)
 
 
 class InstanceExprResolver(ExpressionResolver):
@@ -57,11 +185,10 @@ class InstanceExprResolver(ExpressionResolver):
         uid = str(uuid.uuid4())
         self.__func_name = f"expr_func_{uid.replace('-', '_')}"
         self.__code = f"def {self.__func_name}(target): return {self.__expr}"
+        self.__compiled = CompiledExpression(self.__func_name, self.__code)
 
     def eval_target(self, target_obj: Any) -> Any:
-        namespace = {}
-        exec(self.__code, globals(), namespace)
-        return namespace[self.__func_name](target_obj)
+        return self.__compiled.get()(target_obj)
 
 
 class InstanceListExprResolver(ExpressionResolver):
@@ -75,11 +202,10 @@ class InstanceListExprResolver(ExpressionResolver):
         uid = str(uuid.uuid4())
         self.__func_name = f"expr_func_{uid.replace('-', '_')}"
         self.__code = f"def {self.__func_name}(instances): return {self.__expr}"
+        self.__compiled = CompiledExpression(self.__func_name, self.__code)
 
     def eval_target(self, target_obj: Any) -> Any:
-        namespace = {}
-        exec(self.__code, globals(), namespace)
-        return namespace[self.__func_name](target_obj)
+        return self.__compiled.get()(target_obj)
 
 
 class FilterExprResolver(ExpressionResolver):
@@ -93,17 +219,32 @@ class FilterExprResolver(ExpressionResolver):
         uid = str(uuid.uuid4())
         self.__func_name = f"expr_func_{uid.replace('-', '_')}"
         self.__code = f"def {self.__func_name}(target, return_obj, cost, *args, **kwargs): return {self.__expr}"
+        self.__compiled = CompiledExpression(self.__func_name, self.__code)
+        self.__program: Optional[tuple] = None
+        if self.__expr is not None and native_evaluate is not None:
+            self.__program = compile_filter_program(self.__expr)
 
     def eval_filter(
         self, target_obj: Any, return_obj: Any, cost: float, *args, **kwargs
     ) -> False:
 
         if self.__expr is not None:
-            namespace = {}
-            exec(self.__code, globals(), namespace)
-            ok = namespace[self.__func_name](
-                target_obj, return_obj, cost, *args, **kwargs
-            )
+            if self.__program is not None:
+                return native_evaluate(
+                    self.__program, target_obj, return_obj, cost, args, kwargs
+                )
+            ok = self.__compiled.get()(target_obj, return_obj, cost, *args, **kwargs)
             if not ok:
                 return False
         return True
+
+    def native_filter(self) -> Any:
+        """
+        filter for aop_C.AopWrapper: the filter program, eval_filter for other
+        expressions or None without filter
+        """
+        if self.__expr is None:
+            return None
+        if self.__program is not None:
+            return self.__program
+        return self.eval_filter
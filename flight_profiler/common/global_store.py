@@ -1,9 +1,7 @@
 GLOBAL_INJECT_SERVER_PID = -1
 GLOBAL_HISTORY_FILE_PATH = ""
 
-FORBIDDEN_COMMANDS_IN_PY314 = {
-    "perf"
-}
+FORBIDDEN_COMMANDS_IN_PY314 = set()
 
 def set_history_file_path(path: str):
     """
@@ -0,0 +1,18 @@
+from typing import Any, Callable, Optional
+
+class AopWrapper:
+    count: int
+    finished: int
+    def __init__(
+        self,
+        limit: int,
+        on_finish: Callable[[], Any],
+        filter: Any = None,
+        self_target: bool = False,
+        keep_self: bool = False,
+        filter_before: bool = False,
+        on_call: Optional[Callable[..., Any]] = None,
+        on_return: Optional[Callable[..., Any]] = None,
+        on_error: Optional[Callable[..., Any]] = None,
+    ) -> None: ...
+    def __call__(self, func: Callable[..., Any], *args: Any, **kwargs: Any) -> Any: ...
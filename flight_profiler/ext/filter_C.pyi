@@ -0,0 +1,10 @@
+from typing import Any, Dict, Tuple
+
+def evaluate(
+    program: Tuple[Any, ...],
+    target: Any,
+    return_obj: Any,
+    cost: Any,
+    args: Tuple[Any, ...],
+    kwargs: Dict[str, Any],
+) -> bool: ...
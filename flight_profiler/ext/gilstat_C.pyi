@@ -1,13 +1,44 @@
+from types import CodeType
+from typing import List, Tuple
+
 from flight_profiler.plugins.server_plugin import ServerQueue
 
 def init_gil_interceptor(
-    out_q: ServerQueue,
+    out_q: ServerQueue | None,
     take_gil_addr: int,
     drop_gil_addr: int,
     take_threshold: int,
     hold_threshold: int,
-    stat_interval: int,
-    max_stat_threads: int
-) -> None: ...
+    stat_interval_ms: int,
+    max_stat_threads: int,
+    clock: str | None = None,
+    stream_path: str | None = None,
+    timeline_events: int = 0,
+    hold_frames: int = 0,
+    pause_addrs: Tuple[int, int, int, int] = (0, 0, 0, 0)
+) -> None:
+    """
+    take_gil_addr and drop_gil_addr are 0 on free-threaded builds running
+    without the gil, pause_addrs are the nm addresses of
+    _PyCriticalSection_BeginSlow, _PyCriticalSection2_BeginSlow,
+    _PyEval_StopTheWorld and _PyEval_StartTheWorld, 0 is not hooked
+    """
+    ...
 
 def deinit_gil_interceptor() -> None: ...
+
+def dump_gil_timeline() -> List[Tuple[int, int, str, int, bytes]]:
+    """
+    (thread_id, native_thread_id, thread_name, lost_cycles, cycles) of every
+    thread seen by a recording gilstat, cycles are packed "=4Q" realtime
+    nanoseconds of take start, take end, drop start and drop end
+    """
+    ...
+
+def dump_gil_hold_samples() -> Tuple[int, List[Tuple[int, int, Tuple[Tuple[CodeType, int], ...]]]]:
+    """
+    (dropped samples, [(thread_id, hold_ns, ((code, line), ...)), ...]) of
+    the gil holds longer than the hold threshold since the last call, frames
+    are innermost first
+    """
+    ...
@@ -0,0 +1,5 @@
+def start_sampler(rate: int, mode: int = 0) -> int: ...
+
+def stop_sampler() -> int: ...
+
+def dump_sampler(fd: int) -> int: ...
@@ -0,0 +1,14 @@
+from typing import Optional
+
+def symbol_count(path: str) -> int:
+    """
+    number of symbols indexed from .symtab, .gnu_debugdata and .dynsym of
+    the ELF file at path, -1 when it can not be indexed
+    """
+    ...
+
+def lookup_symbol(path: str, name: str) -> Optional[int]:
+    """
+    link time address of the symbol like nm prints it, None when not found
+    """
+    ...
@@ -1,13 +1,39 @@
-from typing import Any, Callable, List, Optional
+from typing import Any, Callable, List, Optional, Tuple
 
 from flight_profiler.plugins.server_plugin import ServerQueue
 from flight_profiler.plugins.trace.trace_profiler import TraceProfiler
 
+class TraceSession:
+    """
+    frame descriptions interned across traced calls of a trace command
+    """
+    def __len__(self) -> int: ...
+    def take_descriptions(self) -> Tuple[int, List[str]]: ...
+    def intern(self, description: str) -> int: ...
+
 def set_trace_profile(
-    target: Callable[[ServerQueue, List[Any]], Any] | None,
+    target: Callable[[ServerQueue, bytes, TraceSession, int, bytes, bool], Any]
+    | None,
+    out_q: ServerQueue,
+    interval: int,
+    async_func: bool,
+    depth: int,
+    clock: int = 0,
+    session: Optional[TraceSession] = None,
+    flush_records: int = 0
+) -> TraceProfiler: ...
+def set_trace_monitoring(
+    target: Callable[[ServerQueue, bytes, TraceSession, int, bytes, bool], Any]
+    | None,
     out_q: ServerQueue,
     interval: int,
     async_func: bool,
-    depth: int
+    depth: int,
+    clock: int = 0,
+    session: Optional[TraceSession] = None,
+    flush_records: int = 0
 ) -> TraceProfiler: ...
 def remove_trace_profile(profiler: Optional[TraceProfiler]) -> None: ...
+def init_trace_monitoring() -> bool: ...
+def release_trace_monitoring() -> None: ...
+def init_clock_source(name: Optional[str] = None) -> int: ...
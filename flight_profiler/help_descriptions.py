@@ -112,16 +112,42 @@ GETGLOBAL_COMMAND_DESCRIPTION = CommandDescription(
 )
 
 GILSTAT_COMMAND_DESCRIPTION = CommandDescription(
-    usage=["gilstat on [gil_take] [gil_hold] [interval] [max_threads]", "gilstat off"],
+    usage=[
+        "gilstat on [gil_take] [gil_hold] [interval] [max_threads] [clock]",
+        "gilstat stream [gil_take] [gil_hold] [interval_ms] [max_threads] [clock] [file]",
+        "gilstat record [seconds] [file] [max_threads] [clock]",
+        "gilstat hogs [seconds] [gil_hold] [frames] [file]",
+        "gilstat off",
+    ],
     summary="Collect python global interpreter lock statistics, including gil holding,taking,dropping time....",
-    examples=["gilstat on", "gilstat on 5 5 10 100", "gilstat off"],
+    examples=[
+        "gilstat on",
+        "gilstat on 5 5 10 100",
+        "gilstat on 5 5 10 100 tsc",
+        "gilstat stream 5 5 200",
+        "gilstat stream 5 5 200 500 auto /tmp/gil.bin",
+        "gilstat record 10",
+        "gilstat record 10 /tmp/gil.pftrace",
+        "gilstat hogs 30 10",
+        "gilstat hogs 30 10 16 /tmp/gil_hogs.svg",
+        "gilstat off",
+    ],
     wiki="https://github.com/alibaba/PyFlightProfiler/blob/main/docs/WIKI.md",
     options=[
-        ("on/off", "enable/disable gil statistics display."),
+        ("on/off", "enable/disable gil statistics display, grouped by interpreter when subinterpreters own their gil, "
+                   "critical section and stop the world pauses on free-threaded builds."),
+        ("stream", "enable gil statistics exported as binary records through a mapped file, no gil is taken to report."),
+        ("record", "record every gil take/hold/drop of #{seconds} seconds(default 5) as a timeline viewable in ui.perfetto.dev or chrome://tracing."),
+        ("hogs", "sample python call sites holding gil longer than #{gil_hold}ms for #{seconds} seconds(default 10), show top call sites and write a flamegraph weighted by hold time."),
+        ("<frames>", "innermost python frames kept per long gil hold, default is 16, at most 32."),
         ("<gil_take>", "print warning if gil take more than #{gil_take}ms."),
         ("<gil_hold>", "print warning if gil hold more than #{gil_hold}ms."),
-        ("<interval>", "statistics display intervals."),
+        ("<interval>", "statistics display intervals in seconds."),
+        ("<interval_ms>", "statistics export intervals in milliseconds, at least 100ms."),
         ("<max_threads>", "display at most #{max_threads} threads."),
+        ("<clock>", "timing clock source: auto/raw/coarse/tsc, default is auto."),
+        ("<file>", "keep binary records in #{file} for other tools instead of displaying them. for record, the timeline file, "
+                   ".pftrace/.perfetto-trace/.pb for perfetto protobuf, chrome trace json otherwise. for hogs, the svg flamegraph."),
     ],
 )
 
@@ -186,18 +212,29 @@ MODULE_COMMAND_DESCRIPTION = CommandDescription(
 )
 
 PERF_COMMAND_DESCRIPTION = CommandDescription(
-    usage=["perf [pid] [-f <value>] [-r <value>] [-d <value>]"],
-    summary="Dump stack trace information to flamegraph.",
-    examples=["perf", "perf -f application.svg"],
+    usage=[
+        "perf [-f <value>] [-r <value>] [-d <value>] [--format <value>] [--mode <value>]"
+    ],
+    summary="Sample python stacks of current process and dump them to flamegraph.",
+    examples=[
+        "perf",
+        "perf -f application.svg",
+        "perf -d 30 --format speedscope -f profile.json",
+        "perf -d 30 --mode cpu",
+    ],
     wiki="https://github.com/alibaba/PyFlightProfiler/blob/main/docs/WIKI.md",
     options=[
-        (
-            "<pid>",
-            "perf target process id, default analyze current injected process and support analyze other process in the same container.",
-        ),
         ("-f, --filepath", "redirect flamegraph to filepath."),
         ("-r, --rate", "sample rate per second, default is 100."),
         ("-d, --duration", "sample duration in seconds, default is unlimited."),
+        (
+            "--format",
+            "svg (default), collapsed (one stack per line, for flamegraph.pl) or speedscope (json for speedscope.app).",
+        ),
+        (
+            "--mode",
+            "wall (default) samples every thread per tick, cpu weights stacks by thread time and writes one flamegraph per state: cpu, gil wait and syscall.",
+        ),
     ],
 )
 
@@ -235,7 +272,7 @@ else:
 
 TRACE_COMMAND_DESCRIPTION = CommandDescription(
     usage=[
-        "trace module [class] method [-i <value>] [-nm <value>] [-et <value>] [-d <value>] [-n <value>] [-f <value>]"
+        "trace module [class] method [-i <value>] [-nm <value>] [-et <value>] [-d <value>] [-n <value>] [-f <value>] [--clock <value>] [--flush <value>] [--follow]"
     ],
     summary="Trace the execution time of specified method invocation.",
     examples=[
@@ -243,6 +280,7 @@ TRACE_COMMAND_DESCRIPTION = CommandDescription(
         "trace __main__ func --interval 1",
         "trace __main__ func -et 30 -i 1",
         "trace __main__ classA func",
+        "trace __main__ func --follow",
     ],
     wiki="https://github.com/alibaba/PyFlightProfiler/blob/main/docs/WIKI.md",
     options=[
@@ -272,6 +310,17 @@ TRACE_COMMAND_DESCRIPTION = CommandDescription(
             " (target, *args, **kwargs), eg: args[0]=='hello'.",
         ),
         ("-n, --limits <value>", "threshold of trace method times, default is 10."),
+        ("--clock <value>", "timing clock source: auto/raw/coarse/tsc, default is auto."),
+        (
+            "--flush <value>",
+            "stream the frames of a long traced call every ${value} frames, 0 sends them when the call returns, "
+            "default is 65536.",
+        ),
+        (
+            "--follow",
+            "also trace work the traced call submits to ThreadPoolExecutor or loop.run_in_executor, "
+            "shown under [thread] frames of the worker threads.",
+        ),
     ],
     option_offset=35,
 )
@@ -279,7 +328,8 @@ TRACE_COMMAND_DESCRIPTION = CommandDescription(
 TIME_TUNNEL_COMMAND_DESCRIPTION = CommandDescription(
     usage=[
         "tt [-t module [class] method] [-n <value>] [-l] [-i <value>] [-d <value>] [-nm <value>] [-da] [-x <value>] [-p] [-f <value>] [-r] [-v]"
-        " [-m <value>]"
+        " [-m <value>] [--sample <value>] [--rate <value>] [--slowest <value> [--window <value>]]"
+        " [--budget <value>] [--spill <value>]"
     ],
     summary="Time tunnel, records contexts of method invocation at different times in execution history.",
     examples=[
@@ -291,6 +341,7 @@ TIME_TUNNEL_COMMAND_DESCRIPTION = CommandDescription(
         "tt -i 1000 -p",
         "tt -t __main__ func -f \"return_obj['success']==True and cost>10\"",
         "tt -t __main__ func -f args[0][\"query\"]=='hello'",
+        "tt -t __main__ func --slowest 3 --window 10",
     ],
     wiki="https://github.com/alibaba/PyFlightProfiler/blob/main/docs/WIKI.md",
     options=[
@@ -326,6 +377,21 @@ TIME_TUNNEL_COMMAND_DESCRIPTION = CommandDescription(
             "-m, --method <value>",
             "specify method locator, default format is module.class.method, fill in None if method belongs to module.",
         ),
+        ("--sample <value>", "record one in value invocations at random."),
+        ("--rate <value>", "record at most value invocations per second."),
+        (
+            "--slowest <value>",
+            "record the slowest value invocations of every window, displayed when the window ends.",
+        ),
+        ("--window <value>", "window seconds of --slowest, default value 5."),
+        (
+            "--budget <value>",
+            "memory budget of recorded invocations in MB, least recently used ones are evicted, default value 64.",
+        ),
+        (
+            "--spill <value>",
+            "spill evicted invocations to a ring file of value MB instead of dropping them, 0 disables.",
+        ),
     ],
     option_offset=35,
 )
@@ -405,6 +471,7 @@ VMTOOL_COMMAND_DESCRIPTION = CommandDescription(
 WATCH_COMMAND_DESCRIPTION = CommandDescription(
     usage=[
         "watch module [class] method [--expr <value>] [-nm <value] [-e] [-r] [-v] [-n <value>] [-x <value>] [-f <value>]"
+        " [--sample <value>] [--rate <value>] [--slowest <value> [--window <value>]]"
     ],
     summary="Display the input/output args, return object and cost time of method invocation.",
     examples=[
@@ -413,6 +480,7 @@ WATCH_COMMAND_DESCRIPTION = CommandDescription(
         "watch __main__ func -f return_obj['success']==True",
         "watch __main__ func --expr return_obj,args -f cost>10",
         "watch __main__ classA func",
+        "watch __main__ func --rate 5",
     ],
     wiki="https://github.com/alibaba/PyFlightProfiler/blob/main/docs/WIKI.md",
     options=[
@@ -447,6 +515,13 @@ WATCH_COMMAND_DESCRIPTION = CommandDescription(
             "filter method params&args&return_obj&cost&target, expressions according to --expr"
             "eg: args[0]=='hello'.",
         ),
+        ("--sample <value>", "display one in value invocations at random."),
+        ("--rate <value>", "display at most value invocations per second."),
+        (
+            "--slowest <value>",
+            "display the slowest value invocations of every window when the window ends.",
+        ),
+        ("--window <value>", "window seconds of --slowest, default value 5."),
     ],
     option_offset=35,
 )
@@ -1,8 +1,19 @@
+import os
+import time
+
+from flight_profiler.communication.flight_client import FlightClient
 from flight_profiler.help_descriptions import GILSTAT_COMMAND_DESCRIPTION
 from flight_profiler.plugins.cli_plugin import BaseCliPlugin
 from flight_profiler.plugins.gilstat.gilstat_parser import valid
+from flight_profiler.plugins.gilstat.gilstat_render import render_gil_stream_report
+from flight_profiler.plugins.gilstat.gilstat_stream import GilStreamReader
 from flight_profiler.utils.args_util import split_regex
-from flight_profiler.utils.cli_util import common_plugin_execute_routine
+from flight_profiler.utils.cli_util import (
+    common_plugin_execute_routine,
+    is_process_alive,
+    show_error_info,
+    show_normal_info,
+)
 
 
 class GilStatCliPlugin(BaseCliPlugin):
@@ -12,7 +23,7 @@ class GilStatCliPlugin(BaseCliPlugin):
     def get_help(self):
         return GILSTAT_COMMAND_DESCRIPTION.help_hint()
 
-    def do_gil_on_action(self, cmd: str, params: list):
+    def build_gil_cmd(self, params: list, default_interval: int) -> str:
         gil_cmd = params[0]
         if len(params) > 1:
             gil_cmd = gil_cmd + " " + str(int(params[1]))
@@ -25,12 +36,99 @@ class GilStatCliPlugin(BaseCliPlugin):
         if len(params) > 3:
             gil_cmd = gil_cmd + " " + str(int(params[3]))
         else:
-            gil_cmd = gil_cmd + " 5"
+            gil_cmd = gil_cmd + " " + str(default_interval)
         if len(params) > 4:
             gil_cmd = gil_cmd + " " + str(int(params[4]))
         else:
             gil_cmd = gil_cmd + " 500"
+        if len(params) > 5:
+            gil_cmd = gil_cmd + " " + params[5]
+        return gil_cmd
+
+    def do_gil_on_action(self, cmd: str, params: list):
+        common_plugin_execute_routine(
+            cmd="gilstat",
+            param=self.build_gil_cmd(params, 5),
+            port=self.port,
+            raw_text=True
+        )
+
+    def do_gil_stream_action(self, params: list):
+        gil_cmd = self.build_gil_cmd(params, 1000)
+        if len(params) <= 5:
+            gil_cmd = gil_cmd + " auto"
+        user_path = params[6] if len(params) > 6 else None
+        if user_path is not None:
+            gil_cmd = gil_cmd + " " + os.path.abspath(user_path)
+        body = {"target": "gilstat", "param": gil_cmd}
+        try:
+            client = FlightClient(host="localhost", port=self.port)
+        except:
+            show_error_info("Target process exited!")
+            return
+        try:
+            responses = client.request_stream(body)
+            # first message is the stream file, otherwise an error
+            line = next(responses, None)
+            stream_path = line.decode("utf-8") if line else None
+            if stream_path is None or not os.path.exists(stream_path):
+                if stream_path is not None:
+                    show_error_info(stream_path)
+                return
+            if user_path is not None:
+                show_normal_info(
+                    f"gil statistics are streamed to {stream_path}, read them with "
+                    f"`python -m flight_profiler.plugins.gilstat.gilstat_stream {stream_path}`"
+                )
+                # block until gilstat off like `gilstat on`
+                for _ in responses:
+                    pass
+                return
+            self.render_stream(stream_path)
+        finally:
+            client.close()
 
+    def render_stream(self, stream_path: str):
+        try:
+            reader = GilStreamReader(stream_path)
+        except Exception as e:
+            show_error_info(f"open gil statistics stream failed: {e}")
+            return
+        try:
+            while True:
+                # reports published before close are still rendered
+                closed = reader.closed
+                for report in reader.read_reports():
+                    show_normal_info(render_gil_stream_report(report))
+                if closed or not is_process_alive(self.server_pid):
+                    break
+                time.sleep(0.05)
+        finally:
+            reader.close()
+            try:
+                os.unlink(stream_path)
+            except OSError:
+                pass
+
+    def do_gil_record_action(self, params: list):
+        gil_cmd = "record " + (params[1] if len(params) > 1 else "5")
+        if len(params) > 2:
+            gil_cmd = gil_cmd + " " + os.path.abspath(params[2])
+        if len(params) > 3:
+            gil_cmd = gil_cmd + " " + str(int(params[3])) + " " + " ".join(params[4:])
+        common_plugin_execute_routine(
+            cmd="gilstat",
+            param=gil_cmd.strip(),
+            port=self.port,
+            raw_text=True
+        )
+
+    def do_gil_hogs_action(self, params: list):
+        gil_cmd = "hogs " + (params[1] if len(params) > 1 else "10")
+        gil_cmd = gil_cmd + " " + (str(int(params[2])) if len(params) > 2 else "5")
+        gil_cmd = gil_cmd + " " + (str(int(params[3])) if len(params) > 3 else "16")
+        if len(params) > 4:
+            gil_cmd = gil_cmd + " " + os.path.abspath(params[4])
         common_plugin_execute_routine(
             cmd="gilstat",
             param=gil_cmd,
@@ -53,6 +151,12 @@ class GilStatCliPlugin(BaseCliPlugin):
             return
         if params[0] == "on":
             self.do_gil_on_action(cmd, params)
+        elif params[0] == "stream":
+            self.do_gil_stream_action(params)
+        elif params[0] == "record":
+            self.do_gil_record_action(params)
+        elif params[0] == "hogs":
+            self.do_gil_hogs_action(params)
         elif params[0] == "off":
             self.do_gil_off_action()
 
@@ -0,0 +1,74 @@
+"""
+Interpreter build seen by gilstat. Default builds are measured through
+take_gil/drop_gil, one gil per interpreter since 3.12. Free-threaded builds
+(3.13t and later) running without the gil have no gil to contend for, their
+threads wait in the slow path of critical sections and in stop the world
+pauses instead.
+"""
+import sys
+import sysconfig
+from typing import Callable, Optional, Tuple
+
+# order expected by init_gil_interceptor
+PAUSE_SYMBOLS = (
+    "_PyCriticalSection_BeginSlow",
+    "_PyCriticalSection2_BeginSlow",
+    "_PyEval_StopTheWorld",
+    "_PyEval_StartTheWorld",
+)
+
+
+def is_free_threaded_build() -> bool:
+    return bool(sysconfig.get_config_var("Py_GIL_DISABLED"))
+
+
+def is_gil_enabled() -> bool:
+    """
+    false only for free-threaded builds running without the gil, it comes
+    back when an extension not supporting free threading is imported
+    """
+    gil_enabled = getattr(sys, "_is_gil_enabled", None)
+    return gil_enabled is None or gil_enabled()
+
+
+def describe_build(free_threaded: bool, gil_enabled: bool) -> str:
+    if not free_threaded:
+        if sys.version_info >= (3, 12):
+            return "default build, one gil per interpreter"
+        return "default build, one gil shared by all interpreters"
+    if gil_enabled:
+        return "free-threaded build with the gil enabled"
+    return "free-threaded build without the gil"
+
+
+class GilSymbols:
+    """
+    nm addresses to hook, 0 when a function is not hooked
+    """
+
+    def __init__(self, take_gil: int, drop_gil: int, pauses: Tuple[int, ...]):
+        self.take_gil = take_gil
+        self.drop_gil = drop_gil
+        self.pauses = pauses
+
+    def has_gil(self) -> bool:
+        return self.take_gil != 0 and self.drop_gil != 0
+
+
+def resolve_gil_symbols(
+    resolve: Callable[[str], Optional[int]],
+    free_threaded: bool,
+    gil_enabled: bool,
+) -> GilSymbols:
+    """
+    take_gil/drop_gil are skipped while the gil is disabled, pauses are only
+    hooked on free-threaded builds where they are not no-ops
+    """
+    take_gil = drop_gil = 0
+    if gil_enabled:
+        take_gil = resolve("take_gil") or 0
+        drop_gil = resolve("drop_gil") or 0
+    pauses = (0,) * len(PAUSE_SYMBOLS)
+    if free_threaded:
+        pauses = tuple(resolve(symbol) or 0 for symbol in PAUSE_SYMBOLS)
+    return GilSymbols(take_gil, drop_gil, pauses)
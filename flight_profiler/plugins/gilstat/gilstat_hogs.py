@@ -0,0 +1,114 @@
+"""
+Aggregation of the hold samples taken by `gilstat hogs`: python frames of
+threads captured when they start dropping a gil held longer than the hold
+threshold, ranked by call site and rendered as a flamegraph weighted by hold
+time.
+"""
+import os
+import sys
+import threading
+from typing import Dict, List, Tuple
+
+from flight_profiler.plugins.perf.perf_render import render_svg
+
+# call sites shown in the table
+DEFAULT_TOP_SITES = 20
+
+
+def format_code_frame(code, line: int) -> str:
+    """
+    `name (file:line)` like the frames of perf
+    """
+    name = code.co_qualname if sys.version_info >= (3, 11) else code.co_name
+    return f"{name} ({code.co_filename}:{line})"
+
+
+class GilCallSite:
+
+    def __init__(self, name: str):
+        self.name = name
+        self.count = 0
+        self.hold_total_ns = 0
+        self.hold_max_ns = 0
+        self.threads: Dict[str, int] = {}
+
+    def add(self, thread_name: str, hold_ns: int) -> None:
+        self.count += 1
+        self.hold_total_ns += hold_ns
+        self.hold_max_ns = max(self.hold_max_ns, hold_ns)
+        self.threads[thread_name] = self.threads.get(thread_name, 0) + hold_ns
+
+
+class GilHogs:
+    """
+    hold samples aggregated by call site, the innermost python frame, and by
+    stack
+    """
+
+    def __init__(self):
+        self.samples = 0
+        self.dropped = 0
+        self.hold_total_ns = 0
+        self.sites: Dict[str, GilCallSite] = {}
+        # frames outermost first -> micro seconds held
+        self.stacks: Dict[Tuple[str, ...], int] = {}
+
+    def add(self, dropped: int, samples: List[Tuple[int, int, tuple]]) -> None:
+        """
+        add the result of dump_gil_hold_samples, threads are named while they
+        are alive
+        """
+        self.dropped += dropped
+        thread_names = {t.ident: t.name for t in threading.enumerate()}
+        for thread_id, hold_ns, frames in samples:
+            if not frames:
+                continue
+            thread_name = thread_names.get(thread_id, f"{thread_id:x}")
+            names = [format_code_frame(code, line) for code, line in frames]
+            site = self.sites.get(names[0])
+            if site is None:
+                site = self.sites[names[0]] = GilCallSite(names[0])
+            site.add(thread_name, hold_ns)
+            stack = tuple(reversed(names))
+            self.stacks[stack] = self.stacks.get(stack, 0) + hold_ns // 1000
+            self.samples += 1
+            self.hold_total_ns += hold_ns
+
+    def top_sites(self, top: int = DEFAULT_TOP_SITES) -> List[GilCallSite]:
+        return sorted(
+            self.sites.values(), key=lambda s: s.hold_total_ns, reverse=True
+        )[:top]
+
+    def render_table(self, top: int = DEFAULT_TOP_SITES) -> str:
+        lines = [
+            f"top gil hogs by call site, {self.samples} long holds, "
+            f"{self.hold_total_ns / 1000000:.1f}ms held in total:",
+            f"{'hold_all(ms)':<14}{'percent':<10}{'count':<10}{'holdavg(ms)':<14}"
+            f"{'holdmax(ms)':<14}{'thread_name':<24}call_site",
+        ]
+        for site in self.top_sites(top):
+            # thread holding the gil longest at this site
+            thread_name = max(site.threads.items(), key=lambda t: t[1])[0]
+            if len(site.threads) > 1:
+                thread_name = f"{thread_name} +{len(site.threads) - 1}"
+            lines.append(
+                f"{site.hold_total_ns / 1000000:<14.1f}"
+                f"{site.hold_total_ns * 100 / self.hold_total_ns:<10.1f}"
+                f"{site.count:<10}{site.hold_total_ns / site.count / 1000000:<14.2f}"
+                f"{site.hold_max_ns / 1000000:<14.2f}{thread_name:<24}{site.name}"
+            )
+        if len(self.sites) > top:
+            lines.append(f"{len(self.sites) - top} call sites more in the flamegraph")
+        if self.dropped > 0:
+            lines.append(f"{self.dropped} long holds dropped, sampling fell behind")
+        return os.linesep.join(lines)
+
+    def collapsed(self) -> List[Tuple[List[str], int]]:
+        return [(list(stack), us) for stack, us in self.stacks.items() if us > 0]
+
+    def render_svg(self, pid: int) -> str:
+        title = (
+            f"gil hogs pid {pid}, {self.samples} long holds, "
+            f"{self.hold_total_ns // 1000} us held"
+        )
+        return render_svg(self.collapsed(), title, "us")
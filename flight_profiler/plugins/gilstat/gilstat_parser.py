@@ -1,5 +1,14 @@
+CLOCK_SOURCES = ("auto", "raw", "coarse", "tsc")
+
 
 def valid(params):
-    if len(params) < 1 or ((params[0] != "on" and params[0] != "off")):
+    if len(params) < 1 or params[0] not in ("on", "off", "stream", "record", "hogs"):
+        return False
+    if params[0] == "record":
+        # record [seconds] [file] [max_threads] [clock]
+        if len(params) > 4 and params[4] not in CLOCK_SOURCES:
+            return False
+        return True
+    if len(params) > 5 and params[5] not in CLOCK_SOURCES:
         return False
     return True
@@ -0,0 +1,155 @@
+from typing import Dict, List
+
+from flight_profiler.plugins.gilstat.gilstat_stream import (
+    GilPercentiles,
+    GilStreamReport,
+)
+from flight_profiler.utils.time_util import time_ns_to_formatted_string
+
+
+def _percentile_row(
+    time_str: str, thread_id: str, name: str, event: str, p: GilPercentiles
+) -> str:
+    return (
+        f"{time_str:<26}{thread_id:<18}{name:<24}{event:<12}{p.count:<12}"
+        f"{p.p50:<14}{p.p90:<14}{p.p99:<14}{p.p999:<14}{p.max:<14}"
+    )
+
+
+def render_gil_stream_report(report: GilStreamReport) -> str:
+    """
+    render one binary report like the text reports of `gilstat on`
+    """
+    time_str = time_ns_to_formatted_string(report.time_ns)
+    lines: List[str] = []
+
+    if len(report.warnings) > 0 or report.dropped_warnings > 0:
+        lines.append("")
+        lines.append("gil warning report:")
+        lines.append(
+            f"{'time':<26}{'thread_id':<18}{'thread_name':<24}{'event':<12}"
+            f"{'cost(ns)':<18}{'threshold(ns)':<18}{'start(ns)':<30}{'end(ns)':<30}"
+        )
+        for w in report.warnings:
+            lines.append(
+                f"{time_ns_to_formatted_string(w.start_ns):<26}{w.thread_id:<18x}"
+                f"{w.thread_name:<24}{w.event:<12}{w.cost_ns:<18}{w.threshold_ns:<18}"
+                f"{w.start_ns:<30}{w.end_ns:<30}"
+            )
+        if report.dropped_warnings > 0:
+            lines.append(
+                f"{report.dropped_warnings} warnings dropped since last report"
+            )
+
+    if len(report.threads) > 0:
+        lines.append("")
+        lines.append("gil statistics report:")
+        lines.append(
+            f"{'time':<26}{'thread_id':<18}{'thread_name':<24}{'takecnt':<12}"
+            f"{'hold_all(ns)':<18}{'holdavg(ns)':<12}{'take_all(ns)':<18}"
+            f"{'takeavg(ns)':<12}{'dropcnt':<12}{'drop_all(ns)':<18}{'dropavg(ns)':<12}"
+        )
+        for t in report.threads:
+            lines.append(
+                f"{time_str:<26}{t.thread_id:<18x}{t.thread_name:<24}{t.take_count:<12}"
+                f"{t.hold_total_ns:<18}{t.hold_total_ns // t.take_count:<12}"
+                f"{t.take_total_ns:<18}{t.take_total_ns // t.take_count:<12}"
+                f"{t.drop_count:<12}{t.drop_total_ns:<18}"
+                f"{t.drop_total_ns // t.drop_count:<12}"
+            )
+        if report.untracked_threads > 0:
+            lines.append(
+                f"{report.untracked_threads} threads not tracked, all thread slots are in use"
+            )
+
+    if report.process is not None and report.process.take.count > 0:
+        lines.append("")
+        lines.append("gil percentile report:")
+        lines.append(
+            f"{'time':<26}{'thread_id':<18}{'thread_name':<24}{'event':<12}{'count':<12}"
+            f"{'p50(ns)':<14}{'p90(ns)':<14}{'p99(ns)':<14}{'p999(ns)':<14}{'max(ns)':<14}"
+        )
+        rows = [(f"{t.thread_id:x}", t.thread_name, t) for t in report.threads]
+        rows.append(("all", "process", report.process))
+        for thread_id, name, stat in rows:
+            lines.append(_percentile_row(time_str, thread_id, name, "take_gil", stat.take))
+            lines.append(_percentile_row(time_str, thread_id, name, "hold_gil", stat.hold))
+            lines.append(_percentile_row(time_str, thread_id, name, "drop_gil", stat.drop))
+
+    if report.dropped_reports > 0:
+        lines.append(
+            f"{report.dropped_reports} reports dropped in total because the reader fell behind"
+        )
+    return "\n".join(lines)
+
+
+def _worst(stats: List[GilPercentiles]) -> GilPercentiles:
+    return GilPercentiles(
+        sum(p.count for p in stats),
+        max(p.p50 for p in stats),
+        max(p.p90 for p in stats),
+        max(p.p99 for p in stats),
+        max(p.p999 for p in stats),
+        max(p.max for p in stats),
+    )
+
+
+def render_gil_batch_report(reports: Dict[int, GilStreamReport]) -> str:
+    """
+    latest stream report of every attached process, one row per pid and
+    event. Percentiles can not be merged exactly, the all rows show the worst
+    process
+    """
+    lines: List[str] = [
+        "",
+        "gil batch report:",
+        f"{'pid':<10}{'threads':<10}{'warnings':<10}{'event':<12}{'count':<12}"
+        f"{'total(ns)':<18}{'p50(ns)':<14}{'p90(ns)':<14}{'p99(ns)':<14}"
+        f"{'p999(ns)':<14}{'max(ns)':<14}",
+    ]
+    events = ("take_gil", "hold_gil", "drop_gil")
+    merged: Dict[str, List[GilPercentiles]] = {event: [] for event in events}
+    totals = {event: 0 for event in events}
+    threads = warnings = 0
+    for pid in sorted(reports):
+        report = reports[pid]
+        if report.process is None:
+            continue
+        pid_totals = {
+            "take_gil": sum(t.take_total_ns for t in report.threads),
+            "hold_gil": sum(t.hold_total_ns for t in report.threads),
+            "drop_gil": sum(t.drop_total_ns for t in report.threads),
+        }
+        stats = (report.process.take, report.process.hold, report.process.drop)
+        for event, stat in zip(events, stats):
+            lines.append(
+                _batch_row(
+                    str(pid),
+                    len(report.threads),
+                    len(report.warnings),
+                    event,
+                    pid_totals[event],
+                    stat,
+                )
+            )
+            merged[event].append(stat)
+            totals[event] += pid_totals[event]
+        threads += len(report.threads)
+        warnings += len(report.warnings)
+    if len(merged["take_gil"]) > 1:
+        for event in events:
+            lines.append(
+                _batch_row(
+                    "all", threads, warnings, event, totals[event], _worst(merged[event])
+                )
+            )
+    return "\n".join(lines)
+
+
+def _batch_row(
+    pid: str, threads: int, warnings: int, event: str, total: int, p: GilPercentiles
+) -> str:
+    return (
+        f"{pid:<10}{threads:<10}{warnings:<10}{event:<12}{p.count:<12}{total:<18}"
+        f"{p.p50:<14}{p.p90:<14}{p.p99:<14}{p.p999:<14}{p.max:<14}"
+    )
@@ -0,0 +1,233 @@
+"""
+Reader of the binary gil statistics stream, see csrc/gil_stat_stream.h for the layout.
+
+Can also be used standalone to dump a stream as json lines:
+    python -m flight_profiler.plugins.gilstat.gilstat_stream <file>
+"""
+import json
+import mmap
+import os
+import struct
+import sys
+import time
+from typing import List, Optional
+
+GIL_STREAM_MAGIC = b"FPGILST\0"
+GIL_STREAM_VERSION = 1
+
+GIL_STREAM_REPORT = 1
+GIL_STREAM_THREAD = 2
+GIL_STREAM_PROCESS = 3
+GIL_STREAM_WARNING = 4
+
+# host byte order, no padding
+HEADER = struct.Struct("=8sIIQQQQII")
+READ_POS_OFFSET = 32
+RECORD_HEADER = struct.Struct("=HHI")
+PERCENTILES = struct.Struct("=6Q")
+REPORT = struct.Struct("=3Q")
+THREAD = struct.Struct("=Q32s5Q")
+WARNING = struct.Struct("=Q32sII4Q")
+
+
+class GilPercentiles:
+
+    def __init__(self, count: int, p50: int, p90: int, p99: int, p999: int, max: int):
+        self.count = count
+        self.p50 = p50
+        self.p90 = p90
+        self.p99 = p99
+        self.p999 = p999
+        self.max = max
+
+    @staticmethod
+    def unpack(buf: bytes, offset: int) -> "GilPercentiles":
+        return GilPercentiles(*PERCENTILES.unpack_from(buf, offset))
+
+
+class GilThreadStat:
+
+    def __init__(self, buf: bytes):
+        (
+            self.thread_id,
+            name,
+            self.take_count,
+            self.take_total_ns,
+            self.hold_total_ns,
+            self.drop_count,
+            self.drop_total_ns,
+        ) = THREAD.unpack_from(buf, 0)
+        self.thread_name = _decode_name(name)
+        offset = THREAD.size
+        self.take = GilPercentiles.unpack(buf, offset)
+        self.hold = GilPercentiles.unpack(buf, offset + PERCENTILES.size)
+        self.drop = GilPercentiles.unpack(buf, offset + PERCENTILES.size * 2)
+
+
+class GilProcessStat:
+
+    def __init__(self, buf: bytes):
+        self.take = GilPercentiles.unpack(buf, 0)
+        self.hold = GilPercentiles.unpack(buf, PERCENTILES.size)
+        self.drop = GilPercentiles.unpack(buf, PERCENTILES.size * 2)
+
+
+class GilWarning:
+
+    def __init__(self, buf: bytes):
+        (
+            self.thread_id,
+            name,
+            self.type,
+            _,
+            self.cost_ns,
+            self.threshold_ns,
+            self.start_ns,
+            self.end_ns,
+        ) = WARNING.unpack_from(buf, 0)
+        self.thread_name = _decode_name(name)
+
+    @property
+    def event(self) -> str:
+        return "take_gil" if self.type == 0 else "hold_gil"
+
+
+class GilStreamReport:
+
+    def __init__(self, time_ns: int, untracked_threads: int, dropped_warnings: int):
+        self.time_ns = time_ns
+        self.untracked_threads = untracked_threads
+        self.dropped_warnings = dropped_warnings
+        self.threads: List[GilThreadStat] = []
+        self.process: Optional[GilProcessStat] = None
+        self.warnings: List[GilWarning] = []
+        # reports dropped by the agent so far because the reader fell behind
+        self.dropped_reports = 0
+
+    def to_dict(self) -> dict:
+        return {
+            "time_ns": self.time_ns,
+            "untracked_threads": self.untracked_threads,
+            "dropped_warnings": self.dropped_warnings,
+            "dropped_reports": self.dropped_reports,
+            "threads": [_to_dict(t) for t in self.threads],
+            "process": _to_dict(self.process) if self.process is not None else None,
+            "warnings": [_to_dict(w) for w in self.warnings],
+        }
+
+
+def _decode_name(name: bytes) -> str:
+    return name.split(b"\0", 1)[0].decode("utf-8", errors="replace")
+
+
+def _to_dict(obj) -> dict:
+    return {
+        k: _to_dict(v) if isinstance(v, GilPercentiles) else v
+        for k, v in vars(obj).items()
+    }
+
+
+class GilStreamReader:
+    """
+    single reader of a gil statistics stream, consumed records are released to the writer
+    """
+
+    def __init__(self, path: str):
+        self.path = path
+        self.fd = os.open(path, os.O_RDWR)
+        try:
+            self.map = mmap.mmap(self.fd, 0, mmap.MAP_SHARED, mmap.PROT_READ | mmap.PROT_WRITE)
+        except:
+            os.close(self.fd)
+            raise
+        (
+            magic,
+            version,
+            self.header_size,
+            self.capacity,
+            _,
+            _,
+            _,
+            self.writer_pid,
+            _,
+        ) = HEADER.unpack_from(self.map, 0)
+        if magic != GIL_STREAM_MAGIC or version != GIL_STREAM_VERSION:
+            self.close()
+            raise ValueError(f"{path} is not a gil statistics stream")
+
+    def _header(self):
+        return HEADER.unpack_from(self.map, 0)
+
+    @property
+    def closed(self) -> bool:
+        return self._header()[8] != 0
+
+    def _read(self, pos: int, size: int) -> bytes:
+        offset = pos % self.capacity
+        start = self.header_size + offset
+        if offset + size <= self.capacity:
+            return self.map[start:start + size]
+        first = self.capacity - offset
+        return self.map[start:start + first] + self.map[
+            self.header_size:self.header_size + size - first
+        ]
+
+    def read_reports(self) -> List[GilStreamReport]:
+        """
+        decode all published reports, return an empty list when nothing is new
+        """
+        header = self._header()
+        write_pos, read_pos, dropped_reports = header[4], header[5], header[6]
+        reports: List[GilStreamReport] = []
+        pos = read_pos
+        while pos < write_pos:
+            record_type, _, size = RECORD_HEADER.unpack(self._read(pos, RECORD_HEADER.size))
+            if size < RECORD_HEADER.size:
+                raise ValueError(f"corrupted gil statistics record at {pos}")
+            body = self._read(pos + RECORD_HEADER.size, size - RECORD_HEADER.size)
+            pos += size
+            if record_type == GIL_STREAM_REPORT:
+                report = GilStreamReport(*REPORT.unpack_from(body, 0))
+                report.dropped_reports = dropped_reports
+                reports.append(report)
+            elif len(reports) == 0:
+                continue
+            elif record_type == GIL_STREAM_THREAD:
+                reports[-1].threads.append(GilThreadStat(body))
+            elif record_type == GIL_STREAM_PROCESS:
+                reports[-1].process = GilProcessStat(body)
+            elif record_type == GIL_STREAM_WARNING:
+                reports[-1].warnings.append(GilWarning(body))
+        if pos != read_pos:
+            # hand the space back to the writer
+            struct.pack_into("=Q", self.map, READ_POS_OFFSET, pos)
+        return reports
+
+    def close(self) -> None:
+        if self.map is not None:
+            self.map.close()
+            self.map = None
+        os.close(self.fd)
+
+
+def main(argv: List[str]) -> None:
+    if len(argv) != 2:
+        print(f"usage: {argv[0]} <file>")
+        sys.exit(1)
+    reader = GilStreamReader(argv[1])
+    try:
+        while True:
+            # closed is checked first, reports published before it are still read
+            closed = reader.closed
+            for report in reader.read_reports():
+                print(json.dumps(report.to_dict()))
+            sys.stdout.flush()
+            if closed:
+                break
+            time.sleep(0.05)
+    finally:
+        reader.close()
+
+
+if __name__ == "__main__":
+    main(sys.argv)
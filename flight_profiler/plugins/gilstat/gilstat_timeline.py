@@ -0,0 +1,300 @@
+"""
+Export of the gil cycles recorded by `gilstat record` as a Chrome trace event
+json (chrome://tracing, ui.perfetto.dev) or a Perfetto protobuf trace.
+
+Every thread gets a track of take_gil / hold_gil / drop_gil slices, the
+"GIL holder" track shows which thread held the gil over time.
+"""
+import json
+import os
+import struct
+import threading
+import time
+from typing import Any, Dict, List, Optional, Tuple
+
+# realtime nanoseconds of take start, take end, drop start and drop end
+TIMELINE_EVENT = struct.Struct("=4Q")
+
+PERFETTO_SUFFIXES = (".pftrace", ".perfetto-trace", ".pb")
+
+# pseudo thread of the gil holder track
+HOLDER_TID = 0
+HOLDER_TRACK_NAME = "GIL holder"
+
+
+class GilThreadTimeline:
+
+    def __init__(
+        self, thread_id: int, native_thread_id: int, name: str, lost: int, cycles: bytes
+    ):
+        self.thread_id = thread_id
+        # tid shown by trace viewers, pthread id when the native one is unknown
+        self.tid = native_thread_id if native_thread_id > 0 else thread_id
+        self.name = name
+        self.lost = lost
+        self.cycles: List[Tuple[int, int, int, int]] = list(
+            TIMELINE_EVENT.iter_unpack(cycles)
+        )
+
+    @staticmethod
+    def from_dump(dump: List[Tuple[int, int, str, int, bytes]]) -> List["GilThreadTimeline"]:
+        """
+        timelines of dump_gil_timeline, python thread names win over the
+        native ones
+        """
+        python_names = {t.ident: t.name for t in threading.enumerate()}
+        timelines = []
+        for thread_id, native_thread_id, name, lost, cycles in dump:
+            timeline = GilThreadTimeline(thread_id, native_thread_id, name, lost, cycles)
+            timeline.name = python_names.get(thread_id, name)
+            if timeline.cycles or timeline.lost:
+                timelines.append(timeline)
+        return timelines
+
+
+def holder_slices(timelines: List[GilThreadTimeline]) -> List[Tuple[int, int, str]]:
+    """
+    (start_ns, end_ns, thread name) of gil holds in time order, a hold is
+    clipped at the next one since its drop end is only seen by the dropper
+    """
+    holds = []
+    for timeline in timelines:
+        for _, take_end, _, drop_end in timeline.cycles:
+            holds.append((take_end, drop_end, f"{timeline.name} ({timeline.tid})"))
+    holds.sort()
+    slices = []
+    for i, (start, end, name) in enumerate(holds):
+        if i + 1 < len(holds):
+            end = min(end, holds[i + 1][0])
+        if end > start:
+            slices.append((start, end, name))
+    return slices
+
+
+def cycle_slices(cycle: Tuple[int, int, int, int]) -> List[Tuple[str, int, int]]:
+    """
+    (name, start_ns, end_ns) of one gil cycle, drop_gil nests in hold_gil
+    """
+    take_start, take_end, drop_start, drop_end = cycle
+    return [
+        ("take_gil", take_start, take_end),
+        ("hold_gil", take_end, drop_end),
+        ("drop_gil", drop_start, drop_end),
+    ]
+
+
+def to_chrome_trace(timelines: List[GilThreadTimeline], pid: int) -> Dict[str, Any]:
+    events: List[Dict[str, Any]] = [
+        {"name": "process_name", "ph": "M", "pid": pid, "tid": HOLDER_TID,
+         "args": {"name": f"python {pid}"}},
+        {"name": "thread_name", "ph": "M", "pid": pid, "tid": HOLDER_TID,
+         "args": {"name": HOLDER_TRACK_NAME}},
+    ]
+    for timeline in timelines:
+        events.append(
+            {"name": "thread_name", "ph": "M", "pid": pid, "tid": timeline.tid,
+             "args": {"name": timeline.name}}
+        )
+        for cycle in timeline.cycles:
+            for name, start, end in cycle_slices(cycle):
+                events.append(
+                    {"name": name, "cat": "gil", "ph": "X", "pid": pid,
+                     "tid": timeline.tid, "ts": start / 1000, "dur": (end - start) / 1000}
+                )
+    for start, end, name in holder_slices(timelines):
+        events.append(
+            {"name": name, "cat": "gil", "ph": "X", "pid": pid, "tid": HOLDER_TID,
+             "ts": start / 1000, "dur": (end - start) / 1000}
+        )
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def _varint(value: int) -> bytes:
+    # negative values are encoded as 64 bit two's complement
+    value &= (1 << 64) - 1
+    out = bytearray()
+    while True:
+        byte = value & 0x7F
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def _field_varint(field: int, value: int) -> bytes:
+    return _varint(field << 3) + _varint(value)
+
+
+def _field_bytes(field: int, value: bytes) -> bytes:
+    return _varint((field << 3) | 2) + _varint(len(value)) + value
+
+
+def _field_str(field: int, value: str) -> bytes:
+    return _field_bytes(field, value.encode("utf-8"))
+
+
+# protobuf field numbers of perfetto/trace/*.proto used below
+TRACE_PACKET = 1
+PACKET_TIMESTAMP = 8
+PACKET_TRACK_EVENT = 11
+PACKET_SEQUENCE_ID = 10
+PACKET_SEQUENCE_FLAGS = 13
+PACKET_TRACK_DESCRIPTOR = 60
+SEQ_INCREMENTAL_STATE_CLEARED = 1
+SEQ_NEEDS_INCREMENTAL_STATE = 2
+TRACK_UUID = 1
+TRACK_NAME = 2
+TRACK_PROCESS = 3
+TRACK_THREAD = 4
+TRACK_PARENT_UUID = 5
+EVENT_CATEGORIES = 22
+EVENT_NAME = 23
+EVENT_TYPE = 9
+EVENT_TRACK_UUID = 11
+EVENT_SLICE_BEGIN = 1
+EVENT_SLICE_END = 2
+
+SEQUENCE_ID = 1
+
+
+class PerfettoWriter:
+    """
+    minimal encoder of the Perfetto trace protobuf, track descriptors followed
+    by track events on one packet sequence
+    """
+
+    def __init__(self):
+        self.packets: List[bytes] = []
+
+    def packet(self, payload: bytes, timestamp: Optional[int] = None) -> None:
+        flags = SEQ_INCREMENTAL_STATE_CLEARED if not self.packets else SEQ_NEEDS_INCREMENTAL_STATE
+        body = _field_varint(PACKET_SEQUENCE_ID, SEQUENCE_ID)
+        body += _field_varint(PACKET_SEQUENCE_FLAGS, flags)
+        if timestamp is not None:
+            body += _field_varint(PACKET_TIMESTAMP, timestamp)
+        self.packets.append(_field_bytes(TRACE_PACKET, body + payload))
+
+    def process_track(self, uuid: int, pid: int, name: str) -> None:
+        process = _field_varint(1, pid) + _field_str(6, name)
+        self.packet(
+            _field_bytes(
+                PACKET_TRACK_DESCRIPTOR,
+                _field_varint(TRACK_UUID, uuid) + _field_bytes(TRACK_PROCESS, process),
+            )
+        )
+
+    def thread_track(self, uuid: int, parent_uuid: int, pid: int, tid: int, name: str) -> None:
+        thread = _field_varint(1, pid) + _field_varint(2, tid) + _field_str(5, name)
+        self.packet(
+            _field_bytes(
+                PACKET_TRACK_DESCRIPTOR,
+                _field_varint(TRACK_UUID, uuid)
+                + _field_varint(TRACK_PARENT_UUID, parent_uuid)
+                + _field_bytes(TRACK_THREAD, thread),
+            )
+        )
+
+    def named_track(self, uuid: int, parent_uuid: int, name: str) -> None:
+        self.packet(
+            _field_bytes(
+                PACKET_TRACK_DESCRIPTOR,
+                _field_varint(TRACK_UUID, uuid)
+                + _field_str(TRACK_NAME, name)
+                + _field_varint(TRACK_PARENT_UUID, parent_uuid),
+            )
+        )
+
+    def slice(self, uuid: int, name: str, start: int, end: int) -> None:
+        self.begin(uuid, name, start)
+        self.end(uuid, end)
+
+    def begin(self, uuid: int, name: str, timestamp: int) -> None:
+        self.packet(
+            _field_bytes(
+                PACKET_TRACK_EVENT,
+                _field_varint(EVENT_TYPE, EVENT_SLICE_BEGIN)
+                + _field_varint(EVENT_TRACK_UUID, uuid)
+                + _field_str(EVENT_CATEGORIES, "gil")
+                + _field_str(EVENT_NAME, name),
+            ),
+            timestamp,
+        )
+
+    def end(self, uuid: int, timestamp: int) -> None:
+        self.packet(
+            _field_bytes(
+                PACKET_TRACK_EVENT,
+                _field_varint(EVENT_TYPE, EVENT_SLICE_END)
+                + _field_varint(EVENT_TRACK_UUID, uuid),
+            ),
+            timestamp,
+        )
+
+    def to_bytes(self) -> bytes:
+        return b"".join(self.packets)
+
+
+def boottime_offset_ns() -> int:
+    """
+    added to realtime nanoseconds to get the boottime ones perfetto expects
+    """
+    clock = getattr(time, "CLOCK_BOOTTIME", time.CLOCK_MONOTONIC)
+    return time.clock_gettime_ns(clock) - time.time_ns()
+
+
+def to_perfetto_trace(
+    timelines: List[GilThreadTimeline], pid: int, offset_ns: int = 0
+) -> bytes:
+    writer = PerfettoWriter()
+    process_uuid = pid << 32
+    holder_uuid = process_uuid + 1
+    writer.process_track(process_uuid, pid, f"python {pid}")
+    writer.named_track(holder_uuid, process_uuid, HOLDER_TRACK_NAME)
+    for i, timeline in enumerate(timelines):
+        writer.thread_track(process_uuid + 2 + i, process_uuid, pid, timeline.tid, timeline.name)
+    # slices of one track are emitted in time order
+    for i, timeline in enumerate(timelines):
+        uuid = process_uuid + 2 + i
+        for take_start, take_end, drop_start, drop_end in timeline.cycles:
+            writer.slice(uuid, "take_gil", take_start + offset_ns, take_end + offset_ns)
+            writer.begin(uuid, "hold_gil", take_end + offset_ns)
+            writer.slice(uuid, "drop_gil", drop_start + offset_ns, drop_end + offset_ns)
+            writer.end(uuid, drop_end + offset_ns)
+    for start, end, name in holder_slices(timelines):
+        writer.slice(holder_uuid, name, start + offset_ns, end + offset_ns)
+    return writer.to_bytes()
+
+
+def is_perfetto_path(path: str) -> bool:
+    return path.endswith(PERFETTO_SUFFIXES)
+
+
+def write_timeline(path: str, timelines: List[GilThreadTimeline], pid: int) -> None:
+    """
+    perfetto protobuf for .pftrace/.perfetto-trace/.pb files, chrome trace
+    event json otherwise
+    """
+    if is_perfetto_path(path):
+        data = to_perfetto_trace(timelines, pid, boottime_offset_ns())
+        with open(path, "wb") as f:
+            f.write(data)
+    else:
+        with open(path, "w") as f:
+            json.dump(to_chrome_trace(timelines, pid), f)
+
+
+def summarize_timeline(path: str, timelines: List[GilThreadTimeline], seconds: float) -> str:
+    cycles = sum(len(t.cycles) for t in timelines)
+    lost = sum(t.lost for t in timelines)
+    hold_ns = sum(d - t for timeline in timelines for _, t, _, d in timeline.cycles)
+    lines = [
+        f"gil timeline of {seconds:g}s written to {path}",
+        f"threads: {len(timelines)}, cycles: {cycles}, lost cycles: {lost}, "
+        f"gil held: {hold_ns / 1000000:.1f}ms",
+        "open it in https://ui.perfetto.dev or chrome://tracing",
+    ]
+    if lost:
+        lines.append("oldest cycles of busy threads were overwritten, record a shorter window")
+    return os.linesep.join(lines)
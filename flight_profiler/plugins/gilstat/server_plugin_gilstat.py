@@ -1,21 +1,91 @@
+import asyncio
 import os
+import tempfile
+import time
 import traceback
 
-from flight_profiler.ext.gilstat_C import deinit_gil_interceptor, init_gil_interceptor
+from flight_profiler.ext.gilstat_C import (
+    deinit_gil_interceptor,
+    dump_gil_hold_samples,
+    dump_gil_timeline,
+    init_gil_interceptor,
+)
 from flight_profiler.help_descriptions import GILSTAT_COMMAND_DESCRIPTION
+from flight_profiler.plugins.gilstat.gilstat_build import (
+    GilSymbols,
+    describe_build,
+    is_free_threaded_build,
+    is_gil_enabled,
+    resolve_gil_symbols,
+)
+from flight_profiler.plugins.gilstat.gilstat_hogs import GilHogs
 from flight_profiler.plugins.gilstat.gilstat_parser import valid
+from flight_profiler.plugins.gilstat.gilstat_timeline import (
+    GilThreadTimeline,
+    summarize_timeline,
+    write_timeline,
+)
 from flight_profiler.plugins.server_plugin import Message, ServerPlugin, ServerQueue
 from flight_profiler.utils.args_util import split_regex
-from flight_profiler.utils.shell_util import resolve_symbol_address
+from flight_profiler.utils.shell_util import resolve_agent_symbol_address
+
+
+# gil cycles kept per thread while recording a timeline
+GIL_TIMELINE_EVENTS = 1 << 16
+MAX_RECORD_SECONDS = 300
+# hold samples are buffered in a ring of 1024 until drained
+HOLD_SAMPLE_DRAIN_INTERVAL = 0.1
+# actions measuring gil cycles only
+GIL_CYCLE_ACTIONS = ("stream", "record", "hogs")
+
+
+def default_stream_path() -> str:
+    return os.path.join(
+        tempfile.gettempdir(), f"flight_profiler_gilstat_{os.getpid()}.bin"
+    )
+
+
+def default_timeline_path() -> str:
+    return os.path.join(
+        tempfile.gettempdir(), f"flight_profiler_gil_{os.getpid()}.json"
+    )
+
+
+def default_hogs_path() -> str:
+    return os.path.join(
+        tempfile.gettempdir(), f"flight_profiler_gil_hogs_{os.getpid()}.svg"
+    )
 
 
 class GilStatServerPlugin(ServerPlugin):
     def __init__(self, cmd: str, out_q: ServerQueue):
         super().__init__(cmd, out_q)
 
-    def enable_gil_stat(self, params):
-        take_gil_addr = resolve_symbol_address("take_gil", os.getpid())
-        drop_gil_addr = resolve_symbol_address("drop_gil", os.getpid())
+    def gil_symbols(self) -> GilSymbols:
+        return resolve_gil_symbols(
+            resolve_agent_symbol_address,
+            is_free_threaded_build(),
+            is_gil_enabled(),
+        )
+
+    async def require_gil(self, action: str) -> bool:
+        """
+        a free-threaded build running without the gil makes no gil cycles
+        """
+        if is_gil_enabled():
+            return True
+        await self.out_q.output_msg(
+            Message(
+                True,
+                f"gilstat {action} needs the gil, this is a "
+                f"{describe_build(is_free_threaded_build(), False)}, "
+                "gilstat on reports its free-threading pauses",
+            )
+        )
+        return False
+
+    def enable_gil_stat(self, params, stream_path=None):
+        symbols = self.gil_symbols()
         if len(params) > 1:
             take_threshold = int(params[1])
         else:
@@ -28,23 +98,118 @@ class GilStatServerPlugin(ServerPlugin):
             stat_interval = int(params[3])
         else:
             stat_interval = 5
+        # interval is in milliseconds when streaming
+        stat_interval_ms = stat_interval if stream_path is not None else stat_interval * 1000
         if len(params) > 4:
             max_stat_threads = int(params[4])
         else:
             max_stat_threads = 500
+        if len(params) > 5:
+            clock = params[5]
+        else:
+            clock = "auto"
         return init_gil_interceptor(
             self.out_q,
-            take_gil_addr,
-            drop_gil_addr,
+            symbols.take_gil,
+            symbols.drop_gil,
             take_threshold,
             hold_threshold,
-            stat_interval,
+            stat_interval_ms,
             max_stat_threads,
+            clock,
+            stream_path,
+            0,
+            0,
+            # pauses are only reported as text
+            symbols.pauses if stream_path is None else (0, 0, 0, 0),
         )
 
     def disable_gil_stat(self):
         return deinit_gil_interceptor()
 
+    async def record_gil_timeline(self, params):
+        seconds = float(params[1]) if len(params) > 1 else 5
+        seconds = min(max(seconds, 0.1), MAX_RECORD_SECONDS)
+        path = params[2] if len(params) > 2 else default_timeline_path()
+        max_threads = int(params[3]) if len(params) > 3 else 100
+        clock = params[4] if len(params) > 4 else "auto"
+        symbols = self.gil_symbols()
+        # thresholds and interval high enough that nothing is reported
+        ret = init_gil_interceptor(
+            None,
+            symbols.take_gil,
+            symbols.drop_gil,
+            3600000,
+            3600000,
+            3600000,
+            max_threads,
+            clock,
+            None,
+            GIL_TIMELINE_EVENTS,
+        )
+        if ret != 0:
+            await self.out_q.output_msg(
+                Message(True, "gilstat record failed, turn gilstat off first")
+            )
+            return
+        try:
+            await asyncio.sleep(seconds)
+            timelines = GilThreadTimeline.from_dump(dump_gil_timeline())
+        finally:
+            self.disable_gil_stat()
+        write_timeline(path, timelines, os.getpid())
+        await self.out_q.output_msg(
+            Message(True, summarize_timeline(path, timelines, seconds))
+        )
+
+    async def sample_gil_hogs(self, params):
+        seconds = float(params[1]) if len(params) > 1 else 10
+        seconds = min(max(seconds, 0.1), MAX_RECORD_SECONDS)
+        hold_threshold = int(params[2]) if len(params) > 2 else 5
+        hold_frames = int(params[3]) if len(params) > 3 else 16
+        path = params[4] if len(params) > 4 else default_hogs_path()
+        symbols = self.gil_symbols()
+        ret = init_gil_interceptor(
+            None,
+            symbols.take_gil,
+            symbols.drop_gil,
+            3600000,
+            hold_threshold,
+            3600000,
+            500,
+            "auto",
+            None,
+            0,
+            hold_frames,
+        )
+        if ret != 0:
+            await self.out_q.output_msg(
+                Message(True, "gilstat hogs failed, turn gilstat off first")
+            )
+            return
+        hogs = GilHogs()
+        try:
+            deadline = time.monotonic() + seconds
+            while time.monotonic() < deadline:
+                await asyncio.sleep(
+                    min(HOLD_SAMPLE_DRAIN_INTERVAL, deadline - time.monotonic())
+                )
+                hogs.add(*dump_gil_hold_samples())
+        finally:
+            self.disable_gil_stat()
+        if hogs.samples == 0:
+            await self.out_q.output_msg(
+                Message(True, f"no gil held longer than {hold_threshold}ms in {seconds:g}s")
+            )
+            return
+        result = hogs.render_table()
+        svg = hogs.render_svg(os.getpid())
+        if svg:
+            with open(path, "w") as f:
+                f.write(svg)
+            result += f"{os.linesep}flamegraph weighted by hold time written to {path}"
+        await self.out_q.output_msg(Message(True, result))
+
     async def do_action(self, param):
         params = split_regex(param)
         if not valid(params):
@@ -59,6 +224,19 @@ class GilStatServerPlugin(ServerPlugin):
                 else:
                     # will not return end message, server request will block
                     pass
+            elif params[0] in GIL_CYCLE_ACTIONS and not await self.require_gil(params[0]):
+                return
+            elif params[0] == "stream":
+                stream_path = params[6] if len(params) > 6 else default_stream_path()
+                if self.enable_gil_stat(params, stream_path) != 0:
+                    await self.out_q.output_msg(Message(True, "gilstat enable failed"))
+                else:
+                    # client reads reports from the stream file until gilstat off
+                    await self.out_q.output_msg(Message(False, stream_path))
+            elif params[0] == "record":
+                await self.record_gil_timeline(params)
+            elif params[0] == "hogs":
+                await self.sample_gil_hogs(params)
             elif params[0] == "off":
                 if self.disable_gil_stat() != 0:
                     await self.out_q.output_msg(Message(True, "gilstat disable failed"))
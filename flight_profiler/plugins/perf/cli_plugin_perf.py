@@ -1,63 +1,127 @@
 import argparse
-import signal
-import subprocess
+import os
+import pickle
+import time
+from typing import Optional
 
+from flight_profiler.communication.flight_client import FlightClient
 from flight_profiler.help_descriptions import PERF_COMMAND_DESCRIPTION
 from flight_profiler.plugins.cli_plugin import BaseCliPlugin
 from flight_profiler.plugins.perf.perf_parser import PerfParams, global_perf_parser
-from flight_profiler.utils.cli_util import show_error_info, show_normal_info
-from flight_profiler.utils.env_util import is_linux
+from flight_profiler.plugins.perf.perf_render import (
+    parse_collapsed,
+    render_speedscope,
+    render_svg,
+    split_states,
+)
+from flight_profiler.utils.cli_util import (
+    is_process_alive,
+    show_error_info,
+    show_normal_info,
+)
 from flight_profiler.utils.render_util import COLOR_GREEN
 
 
+def perf_request(port: int, param: str) -> Optional[dict]:
+    try:
+        client = FlightClient(host="localhost", port=port)
+    except:
+        show_error_info("Target process exited!")
+        return None
+    try:
+        for line in client.request_stream({"target": "perf", "param": param}):
+            if line:
+                return pickle.loads(line)
+    finally:
+        client.close()
+    show_error_info("Target process exited!")
+    return None
+
+
+def write_flamegraph(params: PerfParams, samples: int, stacks: str, subject: str):
+    """
+    write collapsed stacks in the format of params, subject names the sampled
+    processes in titles
+    """
+    if samples == 0:
+        show_error_info("No python stack sampled.")
+        return
+    if params.format == "collapsed":
+        # cpu mode stacks keep their state frames in one file
+        _write_file(params.filepath, stacks)
+    elif params.mode == "wall":
+        title = f"perf {subject}, {samples} samples"
+        _write_file(params.filepath, _render(params, parse_collapsed(stacks), title))
+    else:
+        # one flamegraph per state, weights are micro seconds
+        for state, state_stacks in split_states(parse_collapsed(stacks)).items():
+            total = sum(count for _, count in state_stacks)
+            title = f"perf {subject}, {state} time {total} us"
+            _write_file(
+                params.state_filepath(state),
+                _render(params, state_stacks, title),
+            )
+
+
+def _render(params: PerfParams, stacks, title: str) -> str:
+    if params.format == "svg":
+        return render_svg(
+            stacks, title, "us" if params.mode == "cpu" else "samples"
+        )
+    return render_speedscope(
+        stacks, title, "microseconds" if params.mode == "cpu" else "none"
+    )
+
+
+def _write_file(filepath: str, content: str):
+    with open(filepath, "w") as f:
+        f.write(content)
+    show_normal_info(
+        f" Flamegraph data has been successfully written to {COLOR_GREEN}{filepath}!"
+    )
+
+
 class PerfCliPlugin(BaseCliPlugin):
     def __init__(self, port, server_pid):
         super().__init__(port, server_pid)
-        self.local_process = None
 
     def get_help(self):
         return PERF_COMMAND_DESCRIPTION.help_hint()
 
-    def __dump_to_flamegraph(self, params: PerfParams, cmd: str):
+    def __request(self, param: str) -> Optional[dict]:
+        return perf_request(self.port, param)
+
+    def __wait(self, params: PerfParams) -> None:
+        deadline = time.time() + params.duration if params.duration > 0 else None
+        while deadline is None or time.time() < deadline:
+            if not is_process_alive(self.server_pid):
+                return
+            time.sleep(0.1)
+
+    def __dump_to_flamegraph(self, params: PerfParams):
         """
-        dump stack trace info to flamegraph based on py-spy from benfred
-        see: https://github.com/benfred/py-spy
+        sample python stacks inside the target process by the agent sampler
         """
-        command = [
-            "py-spy",
-            "record",
-            "--pid",
-            str(params.pid),
-            "--output",
-            params.filepath,
-            "--rate",
-            str(params.sample_rate),
-        ]
-        if params.duration > 0:
-            command.extend(["--duration", str(params.duration)])
-
-        if not is_linux():
-            # OSX need root privilege to do py-spy
-            command.insert(0, "sudo")
-
-        process = subprocess.Popen(
-            command, stdout=subprocess.PIPE, stderr=subprocess.PIPE
-        )
+        result = self.__request(f"start {params.sample_rate} {params.mode}")
+        if result is None:
+            return
+        if "error" in result:
+            show_error_info(result["error"])
+            return
         try:
             show_normal_info(f"Press Control-C to exit.")
-            self.__capture_process(process, params)
+            self.__wait(params)
         except KeyboardInterrupt:
-            process.send_signal(signal.SIGINT)
-            self.__capture_process(process, params)
-
-    def __capture_process(self, process: subprocess.Popen, params: PerfParams) -> None:
-        stdout, stderr = process.communicate()
-        if process.returncode == 0:
-            show_normal_info(
-                f" Flamegraph data has been successfully written to {COLOR_GREEN}{params.filepath}!"
-            )
-        else:
-            show_error_info(stderr.decode())
+            pass
+        result = self.__request("stop")
+        if result is None:
+            return
+        if "error" in result:
+            show_error_info(result["error"])
+            return
+        write_flamegraph(
+            params, result["samples"], result["stacks"], f"pid {self.server_pid}"
+        )
 
     def do_action(self, cmd):
         try:
@@ -71,7 +135,15 @@ class PerfCliPlugin(BaseCliPlugin):
         except:
             show_normal_info(self.get_help())
             return
-        self.__dump_to_flamegraph(perf_param, cmd)
+        directory = os.path.dirname(perf_param.filepath)
+        if not os.path.isdir(directory):
+            show_error_info(f"Directory {directory} does not exist.")
+            return
+        self.__dump_to_flamegraph(perf_param)
+
+    # stop sampling when CTRL+C interrupts the client outside of waiting
+    def on_interrupted(self):
+        self.__request("stop")
 
 
 def get_instance(port: str, server_pid: int):
@@ -3,29 +3,55 @@ import os
 from argparse import RawTextHelpFormatter
 from typing import Optional
 
-from flight_profiler.common.global_store import get_inject_server_pid
 from flight_profiler.help_descriptions import PERF_COMMAND_DESCRIPTION
 from flight_profiler.utils.args_util import rewrite_args
 
+PERF_FORMATS = ["svg", "collapsed", "speedscope"]
+
+# wall: one sample per thread and tick, cpu: thread time split by state
+PERF_MODES = ["wall", "cpu"]
+
+DEFAULT_PERF_FILES = {
+    "svg": "flamegraph.svg",
+    "collapsed": "flamegraph.txt",
+    "speedscope": "flamegraph.speedscope.json",
+}
+
 
 class PerfParams:
 
     def __init__(
-        self, pid: int, filepath: Optional[str], duration: int, sample_rate: int
+        self,
+        filepath: Optional[str],
+        duration: int,
+        sample_rate: int,
+        format: str,
+        mode: str = "wall",
     ):
-        self.pid = pid
         self.filepath = filepath
         self.duration = duration
         self.sample_rate = sample_rate
+        self.format = format
+        self.mode = mode
 
         if self.filepath is None:
-            cwd_path: str = os.getcwd()
-            if cwd_path.endswith("/"):
-                self.filepath = cwd_path + "flamegraph.svg"
-            else:
-                self.filepath = cwd_path + "/flamegraph.svg"
+            self.filepath = os.path.join(os.getcwd(), DEFAULT_PERF_FILES[self.format])
         self.filepath = os.path.abspath(os.path.expanduser(self.filepath))
 
+    def state_filepath(self, state: str) -> str:
+        """
+        flamegraph.svg -> flamegraph.cpu.svg
+        """
+        root, ext = os.path.splitext(self.filepath)
+        return f"{root}.{state}{ext}"
+
+
+def positive_rate(value: str) -> int:
+    rate = int(value)
+    if rate <= 0 or rate > 10000:
+        raise argparse.ArgumentTypeError(f"rate should be in [1, 10000], got {value}")
+    return rate
+
 
 class PerfParser(argparse.ArgumentParser):
 
@@ -37,17 +63,11 @@ class PerfParser(argparse.ArgumentParser):
         )
         if hasattr(self, "exit_on_error"):
             self.exit_on_error = False
-        self.add_argument(
-            "--pid",
-            required=False,
-            help="target process pid.",
-            default=get_inject_server_pid(),
-        )
         self.add_argument(
             "-r",
             "--rate",
             required=False,
-            type=int,
+            type=positive_rate,
             help="sample rate per second.",
             default=100,
         )
@@ -66,19 +86,34 @@ class PerfParser(argparse.ArgumentParser):
             help="dump stack trace flamegraph to filepath.",
             default=None,
         )
+        self.add_argument(
+            "--format",
+            required=False,
+            choices=PERF_FORMATS,
+            help="output format, default is svg.",
+            default="svg",
+        )
+        self.add_argument(
+            "--mode",
+            required=False,
+            choices=PERF_MODES,
+            help="wall samples, or cpu time split into cpu/gil/syscall, default is wall.",
+            default="wall",
+        )
 
     def error(self, message):
         raise Exception(message)
 
     def parse_perf_params(self, arg_string: str) -> PerfParams:
 
-        new_args = rewrite_args(arg_string, unspec_names=["pid"], omit_column=None)
+        new_args = rewrite_args(arg_string, unspec_names=[], omit_column=None)
         args = self.parse_args(args=new_args)
         return PerfParams(
-            pid=getattr(args, "pid"),
             filepath=getattr(args, "filepath"),
             duration=getattr(args, "duration"),
             sample_rate=getattr(args, "rate"),
+            format=getattr(args, "format"),
+            mode=getattr(args, "mode"),
         )
 
 
@@ -0,0 +1,205 @@
+"""
+Render collapsed stacks dumped by the agent sampler, one stack per line:
+    outermost;...;innermost count
+In cpu mode every stack starts with its state frame and counts are micro seconds.
+"""
+import json
+import re
+import zlib
+from typing import Dict, List, Tuple
+from xml.sax.saxutils import escape
+
+FRAME_PATTERN = re.compile(r"^(.*) \((.*):(\d+)\)$")
+
+# root frames of cpu mode stacks, same order as _sample_state in py_sampler.h
+STATE_FRAMES = {"[cpu]": "cpu", "[gil]": "gil", "[syscall]": "syscall"}
+
+SVG_WIDTH = 1200
+SVG_FRAME_HEIGHT = 16
+SVG_PADDING = 10
+SVG_FONT_WIDTH = 7
+# frames narrower than it are not drawn
+SVG_MIN_WIDTH = 0.1
+
+
+def parse_collapsed(text: str) -> List[Tuple[List[str], int]]:
+    stacks: List[Tuple[List[str], int]] = []
+    for line in text.splitlines():
+        stack, sep, count = line.rpartition(" ")
+        if not sep or not count.isdigit():
+            continue
+        stacks.append((stack.split(";"), int(count)))
+    return stacks
+
+
+def merge_collapsed(texts: List[str]) -> str:
+    """
+    sum the counts of the same stack over the collapsed stacks of many
+    processes
+    """
+    counts: Dict[str, int] = {}
+    for text in texts:
+        for line in text.splitlines():
+            stack, sep, count = line.rpartition(" ")
+            if not sep or not count.isdigit():
+                continue
+            counts[stack] = counts.get(stack, 0) + int(count)
+    return "".join(f"{stack} {count}\n" for stack, count in counts.items())
+
+
+def split_states(
+    stacks: List[Tuple[List[str], int]]
+) -> Dict[str, List[Tuple[List[str], int]]]:
+    """
+    group cpu mode stacks by state and strip the state frame, states without
+    stacks are left out
+    """
+    states: Dict[str, List[Tuple[List[str], int]]] = {}
+    for stack, count in stacks:
+        state = STATE_FRAMES.get(stack[0])
+        if state is None or len(stack) == 1:
+            continue
+        states.setdefault(state, []).append((stack[1:], count))
+    return states
+
+
+def split_frame(frame: str) -> Tuple[str, str, int]:
+    """
+    split `name (file:line)` into its parts, synthetic frames have no location
+    """
+    matched = FRAME_PATTERN.match(frame)
+    if matched is None:
+        return frame, "", 0
+    return matched.group(1), matched.group(2), int(matched.group(3))
+
+
+def render_speedscope(
+    stacks: List[Tuple[List[str], int]], name: str, unit: str = "none"
+) -> str:
+    """
+    speedscope sampled profile, see https://www.speedscope.app/file-format-schema.json
+    """
+    frame_ids: Dict[str, int] = {}
+    frames = []
+    samples = []
+    weights = []
+    for stack, count in stacks:
+        sample = []
+        for frame in stack:
+            frame_id = frame_ids.get(frame)
+            if frame_id is None:
+                frame_id = len(frames)
+                frame_ids[frame] = frame_id
+                func, file, line = split_frame(frame)
+                info = {"name": func}
+                if file:
+                    info["file"] = file
+                    info["line"] = line
+                frames.append(info)
+            sample.append(frame_id)
+        samples.append(sample)
+        weights.append(count)
+    total = sum(weights)
+    return json.dumps(
+        {
+            "$schema": "https://www.speedscope.app/file-format-schema.json",
+            "shared": {"frames": frames},
+            "profiles": [
+                {
+                    "type": "sampled",
+                    "name": name,
+                    "unit": unit,
+                    "startValue": 0,
+                    "endValue": total,
+                    "samples": samples,
+                    "weights": weights,
+                }
+            ],
+            "name": name,
+            "activeProfileIndex": 0,
+            "exporter": "flight_profiler",
+        }
+    )
+
+
+class FlameNode:
+
+    def __init__(self, name: str):
+        self.name = name
+        self.count = 0
+        self.children: Dict[str, "FlameNode"] = {}
+
+
+def _build_tree(stacks: List[Tuple[List[str], int]]) -> FlameNode:
+    root = FlameNode("all")
+    for stack, count in stacks:
+        root.count += count
+        node = root
+        for frame in stack:
+            child = node.children.get(frame)
+            if child is None:
+                child = FlameNode(frame)
+                node.children[frame] = child
+            child.count += count
+            node = child
+    return root
+
+
+def _frame_color(name: str) -> str:
+    # stable warm colors like flamegraph.pl, same frame same color
+    h = zlib.crc32(name.encode("utf-8"))
+    return f"rgb({205 + h % 50},{(h >> 8) % 230},{(h >> 16) % 55})"
+
+
+def render_svg(
+    stacks: List[Tuple[List[str], int]], title: str, unit: str = "samples"
+) -> str:
+    """
+    icicle flame graph with the outermost frame at the bottom, frames of the
+    same parent are sorted by name
+    """
+    root = _build_tree(stacks)
+    if root.count == 0:
+        return ""
+    scale = (SVG_WIDTH - 2 * SVG_PADDING) / root.count
+
+    rects: List[Tuple[FlameNode, float, int]] = []
+    max_depth = 0
+    pending = [(root, float(SVG_PADDING), 0)]
+    while pending:
+        node, x, depth = pending.pop()
+        rects.append((node, x, depth))
+        max_depth = max(max_depth, depth)
+        for name in sorted(node.children):
+            child = node.children[name]
+            if child.count * scale >= SVG_MIN_WIDTH:
+                pending.append((child, x, depth + 1))
+            x += child.count * scale
+
+    height = (max_depth + 1) * SVG_FRAME_HEIGHT + SVG_PADDING * 4
+    lines = [
+        '<?xml version="1.0" standalone="no"?>',
+        f'<svg version="1.1" width="{SVG_WIDTH}" height="{height}" '
+        f'xmlns="http://www.w3.org/2000/svg" font-family="Verdana" font-size="12">',
+        f'<rect x="0" y="0" width="{SVG_WIDTH}" height="{height}" fill="#f8f8f8"/>',
+        f'<text x="{SVG_WIDTH // 2}" y="{SVG_PADDING * 2}" text-anchor="middle" '
+        f'font-size="15">{escape(title)}</text>',
+    ]
+    for node, x, depth in rects:
+        width = node.count * scale
+        y = height - SVG_PADDING - (depth + 1) * SVG_FRAME_HEIGHT
+        percent = node.count * 100.0 / root.count
+        tip = escape(f"{node.name} ({node.count} {unit}, {percent:.2f}%)")
+        lines.append(
+            f'<g><title>{tip}</title><rect x="{x:.1f}" y="{y}" width="{width:.1f}" '
+            f'height="{SVG_FRAME_HEIGHT - 1}" fill="{_frame_color(node.name)}" rx="2"/>'
+        )
+        chars = int(width / SVG_FONT_WIDTH)
+        if chars >= 3:
+            label = node.name if len(node.name) <= chars else node.name[: chars - 2] + ".."
+            lines.append(
+                f'<text x="{x + 3:.1f}" y="{y + SVG_FRAME_HEIGHT - 4}">{escape(label)}</text>'
+            )
+        lines.append("</g>")
+    lines.append("</svg>")
+    return "\n".join(lines)
@@ -0,0 +1,59 @@
+import os
+import pickle
+import tempfile
+import traceback
+
+from flight_profiler.ext.perf_C import dump_sampler, start_sampler, stop_sampler
+from flight_profiler.plugins.server_plugin import Message, ServerPlugin, ServerQueue
+from flight_profiler.utils.args_util import split_regex
+
+# values of _sample_mode in py_sampler.h
+SAMPLE_MODES = {"wall": 0, "cpu": 1}
+
+
+class PerfServerPlugin(ServerPlugin):
+    """
+    perf start <rate> [wall|cpu]: start sampling python stacks in the agent
+    perf stop: stop sampling and return collapsed stacks
+    """
+
+    def __init__(self, cmd: str, out_q: ServerQueue):
+        super().__init__(cmd, out_q)
+
+    def dump_stacks(self) -> dict:
+        tmp_fd, tmp_file_path = tempfile.mkstemp()
+        try:
+            samples = dump_sampler(tmp_fd)
+            if samples < 0:
+                return {"error": "perf dump samples failed"}
+            with open(tmp_file_path, "r") as f:
+                return {"samples": samples, "stacks": f.read()}
+        finally:
+            os.close(tmp_fd)
+            os.unlink(tmp_file_path)
+
+    async def do_action(self, param):
+        params = split_regex(param)
+        try:
+            if params[0] == "start":
+                mode = SAMPLE_MODES[params[2]] if len(params) > 2 else 0
+                if start_sampler(int(params[1]), mode) != 0:
+                    result = {"error": "perf start failed, sampler may be already running"}
+                else:
+                    result = {}
+            elif params[0] == "stop":
+                if stop_sampler() != 0:
+                    result = {"error": "perf stop failed"}
+                else:
+                    result = self.dump_stacks()
+            else:
+                result = {"error": f"unknown perf action {params[0]}"}
+            await self.out_q.output_msg(Message(True, pickle.dumps(result)))
+        except:
+            await self.out_q.output_msg(
+                Message(True, pickle.dumps({"error": traceback.format_exc()}))
+            )
+
+
+def get_instance(cmd: str, out_q: ServerQueue):
+    return PerfServerPlugin(cmd, out_q)
@@ -1,4 +1,3 @@
-import os
 import tempfile
 import threading
 import traceback
@@ -6,7 +5,7 @@ import traceback
 from flight_profiler.ext.stack_C import dump_all_threads_stack
 from flight_profiler.plugins.server_plugin import Message, ServerPlugin, ServerQueue
 from flight_profiler.utils.args_util import split_regex
-from flight_profiler.utils.shell_util import resolve_symbol_address
+from flight_profiler.utils.shell_util import resolve_agent_symbol_address
 
 
 class StackServerPlugin(ServerPlugin):
@@ -51,7 +50,7 @@ class StackServerPlugin(ServerPlugin):
     async def do_action(self, param):
         tmp_fd, tmp_file_path = tempfile.mkstemp()
         try:
-            addr = resolve_symbol_address("_Py_DumpTracebackThreads", os.getpid())
+            addr = resolve_agent_symbol_address("_Py_DumpTracebackThreads")
             if addr is None:
                 await self.out_q.output_msg(
                     Message(True, "symbol _Py_DumpTracebackThreads not found")
@@ -1,15 +1,17 @@
 import argparse
 import pickle
 import sys
-from typing import Union
+from typing import List, Union
 
 from flight_profiler.communication.flight_client import FlightClient
 from flight_profiler.help_descriptions import TRACE_COMMAND_DESCRIPTION
 from flight_profiler.plugins.cli_plugin import BaseCliPlugin
 from flight_profiler.plugins.trace.trace_agent import TracePoint
 from flight_profiler.plugins.trace.trace_frame import (
+    TraceFrameChunks,
     WrapTraceFrame,
-    deserialize_string_frames,
+    decode_trace_frames,
+    is_trace_frames,
 )
 from flight_profiler.plugins.trace.trace_parser import TraceArgumentParser
 from flight_profiler.plugins.trace.trace_render import TraceRender
@@ -47,13 +49,29 @@ class TraceCliPlugin(BaseCliPlugin):
             raise
         try:
             first_chunk = True
+            # descriptions interned by the agent for this trace command
+            descriptions: List[str] = []
+            chunks = TraceFrameChunks()
             for content in client.request_stream(body):
                 sys.stdout.flush()
                 if first_chunk:
                     global_filepath_operator.set_sys_path(pickle.loads(content))
                     first_chunk = False
                 else:
-                    wrap: Union[WrapTraceFrame, str] = pickle.loads(content)
+                    if is_trace_frames(content):
+                        chunk: WrapTraceFrame = decode_trace_frames(
+                            content, descriptions
+                        )
+                        wrap: Union[WrapTraceFrame, str] = chunks.merge(chunk)
+                        if wrap is None:
+                            # long traced call, the tree is shown when it returns
+                            show_normal_info(
+                                f"Tracing thread {chunk.thread_name}, "
+                                f"{chunks.received(chunk.thread_id)} frames received."
+                            )
+                            continue
+                    else:
+                        wrap = pickle.loads(content)
                     if type(wrap) == str:
                         # error
                         show_error_info(wrap)
@@ -68,7 +86,6 @@ class TraceCliPlugin(BaseCliPlugin):
                             f"Trace method cost is below {trace_point.interval}ms, skip display."
                         )
                         continue
-                    wrap = deserialize_string_frames(wrap)
                     if (
                         wrap.frames[0].cost_ns
                         < trace_point.entrance_time * 1_000_000
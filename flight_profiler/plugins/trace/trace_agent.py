@@ -4,6 +4,7 @@ import importlib
 import inspect
 import pickle
 import sys
+import threading
 import traceback
 import types
 from types import CodeType
@@ -14,9 +15,22 @@ from flight_profiler.common.code_wrapper_entity import CodeWrapperResult
 from flight_profiler.common.enter_exit_command import EnterExitCommand
 from flight_profiler.common.expression_resolver import FilterExprResolver
 from flight_profiler.common.system_logger import logger
-from flight_profiler.ext.trace_profile_C import remove_trace_profile, set_trace_profile
+from flight_profiler.ext.trace_profile_C import (
+    TraceSession,
+    init_clock_source,
+    init_trace_monitoring,
+    release_trace_monitoring,
+    remove_trace_profile,
+    set_trace_monitoring,
+)
 from flight_profiler.plugins.server_plugin import Message, ServerQueue
-from flight_profiler.plugins.trace.trace_frame import WrapTraceFrame
+from flight_profiler.plugins.trace.trace_follow import (
+    TraceFollowGroup,
+    install_follow_submit,
+    release_follow_output,
+    uninstall_follow_submit,
+)
+from flight_profiler.plugins.trace.trace_frame import encode_trace_frames
 from flight_profiler.utils.render_util import (
     COLOR_END,
     COLOR_ORANGE,
@@ -24,6 +38,9 @@ from flight_profiler.utils.render_util import (
     build_long_spy_command_hint,
 )
 
+# records kept by a traced call before they are flushed, 24 bytes each
+DEFAULT_FLUSH_FRAMES = 65536
+
 # from flight_profiler.plugins.trace.trace_profiler import (
 #     remove_trace_profile,
 #     set_trace_profile,
@@ -45,7 +62,10 @@ class TracePoint(EnterExitCommand):
         out_q: ServerQueue = None,
         nested_method: str = None,
         need_wrap_nested_inplace: bool = False,
-        nested_code_obj: CodeType = None
+        nested_code_obj: CodeType = None,
+        clock: str = "auto",
+        flush_frames: int = DEFAULT_FLUSH_FRAMES,
+        follow_executors: bool = False,
     ):
         super().__init__(limit=limits)
         self.module_name = module_name
@@ -62,27 +82,108 @@ class TracePoint(EnterExitCommand):
         self.nested_method = nested_method
         self.need_wrap_nested_inplace = need_wrap_nested_inplace
         self.nested_code_obj = nested_code_obj
+        self.clock = clock
+        self.clock_source: int = 0
+        # frames of a traced call are streamed in chunks of flush_frames
+        self.flush_frames = flush_frames
+        # sync calls are traced by sys.monitoring while the point holds its tool
+        self.monitoring = False
+        # trace work submitted to thread pool executors by traced calls
+        self.follow_executors = follow_executors
+        self.follow_installed = False
+        # frame descriptions interned across traced calls, created by set_point
+        self.session: Optional[TraceSession] = None
 
 
     def child_clear_action(self):
+        self.release_monitoring()
+        self.release_follow()
         global_trace_agent.clear_auto_close(self.unique_key())
 
+    def release_monitoring(self):
+        if self.monitoring:
+            self.monitoring = False
+            release_trace_monitoring()
+
+    def release_follow(self):
+        if self.follow_installed:
+            self.follow_installed = False
+            uninstall_follow_submit()
+
+    def trace_output(self, func_args: List[Union[Callable, Any]]) -> Callable:
+        """
+        target of the profiler of a traced call, the profiler must be set by
+        the wrapper itself as sync profilers expect balanced frames. when it
+        can't be set, release_follow_output must be called with the target
+        """
+        if not self.follow_installed:
+            return func_args[1]
+        return TraceFollowGroup(self, func_args).output
 
-def c_bind_output_trace_frames(out_q: ServerQueue, sending_frames: List[str]) -> None:
+
+# traced threads share the session of their point, taking new descriptions and
+# queueing them must not interleave, or records may arrive before descriptions
+trace_output_lock = threading.Lock()
+
+
+def c_bind_output_trace_frames(
+    out_q: ServerQueue,
+    records: bytes,
+    session: TraceSession,
+    base: int = 0,
+    late: bytes = b"",
+    final: bool = True,
+) -> None:
     """
-    response trace frames to client side
+    response trace frames to client side, packed records are sent without pickling
+    together with descriptions the client has not received yet. long traced
+    calls send several chunks, the last one is final
     """
-    out_q.output_msg_nowait(
-        Message(
-            False, msg=pickle.dumps(WrapTraceFrame(sending_frames))
+    with trace_output_lock:
+        first_desc, descriptions = session.take_descriptions()
+        out_q.output_msg_nowait(
+            Message(
+                False,
+                msg=encode_trace_frames(
+                    records, first_desc, descriptions, base, late, final
+                ),
+            )
         )
-    )
+
+
+def traced_call(func_args: List[Union[Callable, Any]], func, args, kwargs) -> Any:
+    """
+    native wrapper callback for calls passed the filter, traces the call
+    """
+    trace_point: TracePoint = func_args[2]
+    out_q: ServerQueue = trace_point.out_q
+    target = args[0] if func_args[5] and args else None
+    filter: FilterExprResolver = func_args[4]
+    trace_profiler = None
+    output = None
+    try:
+        if filter.eval_filter(target, None, 0, *args, **kwargs):
+            output = trace_point.trace_output(func_args)
+            trace_profiler = func_args[0](
+                output, out_q, func_args[3], False,
+                trace_point.depth, trace_point.clock_source, trace_point.session,
+                trace_point.flush_frames
+            )
+    except:
+        release_follow_output(output)
+        msg = traceback.format_exc()
+        out_q.output_msg_nowait(Message(False, msg=msg + "\n"))
+    try:
+        return func(*args, **kwargs)
+    finally:
+        func_args[6](trace_profiler)
 
 
 def generate_trace_wrapper(func_args: List[Union[Callable, Any]]) -> Callable:
     """
     func_args: [set_trace_profile, output_frames_function, trace_point,
                 interval_ns, watch_filter, is_class_method, remove_trace_function]
+
     """
 
     def trace_decorator(func):
@@ -121,9 +222,16 @@ def generate_trace_wrapper(func_args: List[Union[Callable, Any]]) -> Callable:
                         else:
                             target_func = func
                         if can_pass:
-                            trace_profiler = func_args[0](
-                                func_args[1], out_q, func_args[3], True, trace_point.depth
-                            )
+                            output = trace_point.trace_output(func_args)
+                            try:
+                                trace_profiler = func_args[0](
+                                    output, out_q, func_args[3], True,
+                                    trace_point.depth, trace_point.clock_source, trace_point.session,
+                                    trace_point.flush_frames
+                                )
+                            except:
+                                release_follow_output(output)
+                                raise
                         return await target_func(*args, **kwargs)
                     except:
                         raise
@@ -134,6 +242,25 @@ def generate_trace_wrapper(func_args: List[Union[Callable, Any]]) -> Callable:
                     return await func(*args, **kwargs)
 
             return async_wrapper
+        elif func_args[2].build_native_wrapper(
+            func_args[4],
+            func_args[5],
+            # trace filters see the target in args as well
+            keep_self=True,
+            filter_before=True,
+            on_call=functools.partial(traced_call, func_args),
+        ):
+
+            # enter/exit and filtering are done by aop_C
+            @functools.wraps(func)
+            def wrapper(*args, **kwargs):
+                native_wrapper = func_args[2].native_wrapper
+                if native_wrapper is None:
+                    # released while the method is being restored
+                    return func(*args, **kwargs)
+                return native_wrapper(func, *args, **kwargs)
+
+            return wrapper
         else:
 
             @functools.wraps(func)
@@ -168,9 +295,16 @@ def generate_trace_wrapper(func_args: List[Union[Callable, Any]]) -> Callable:
                         else:
                             target_func = func
                         if can_pass:
-                            trace_profiler = func_args[0](
-                                func_args[1], out_q, func_args[3], False, trace_point.depth
-                            )
+                            output = trace_point.trace_output(func_args)
+                            try:
+                                trace_profiler = func_args[0](
+                                    output, out_q, func_args[3], False,
+                                    trace_point.depth, trace_point.clock_source, trace_point.session,
+                                    trace_point.flush_frames
+                                )
+                            except:
+                                release_follow_output(output)
+                                raise
                         return target_func(*args, **kwargs)
                     except:
                         raise
@@ -198,6 +332,8 @@ class TraceAgent:
         old_point = self.aop_points.get(key, None)
         if old_point is not None:
             self.clear_point(old_point)
+        point.clock_source = init_clock_source(point.clock)
+        point.session = TraceSession()
 
         point.out_q.output_msg_nowait(
             Message(is_end=False, msg=pickle.dumps(sys.path))
@@ -223,7 +359,7 @@ class TraceAgent:
             point.method_name,
             generate_trace_wrapper,
             [
-                set_trace_profile,
+                set_trace_monitoring,
                 c_bind_output_trace_frames,
                 point,
                 int(point.interval * 1000000),
@@ -248,6 +384,10 @@ class TraceAgent:
                 point.need_wrap_nested_inplace = True
                 point.nested_code_obj = wrapper_result.value.nested_code_obj
             point.origin_code = wrapper_result.value
+            point.monitoring = init_trace_monitoring()
+            if point.follow_executors:
+                install_follow_submit()
+                point.follow_installed = True
             point.out_q.output_msg_nowait(
                 Message(
                     False,
@@ -273,6 +413,9 @@ class TraceAgent:
             )
             return None
         self.aop_points.pop(point.unique_key())
+        old_point.release_monitoring()
+        old_point.release_follow()
+        old_point.release_native_wrapper()
 
         if old_point.origin_code is not None:
             module = importlib.import_module(old_point.module_name)
@@ -0,0 +1,200 @@
+import concurrent.futures
+import contextvars
+import functools
+import threading
+import time
+from typing import Any, Callable, List, Optional, Tuple
+
+from flight_profiler.common.system_logger import logger
+from flight_profiler.plugins.trace.trace_frame import TRACE_RECORD
+
+# method name of the frame a followed task is shown under, the file name of
+# its description is the worker thread name
+THREAD_FRAME_METHOD = "[thread]"
+
+# follow group of the traced call running in the current thread or asyncio task
+trace_follow_group: contextvars.ContextVar = contextvars.ContextVar(
+    "flight_profiler_trace_follow", default=None
+)
+
+
+class TraceFollowGroup:
+    """
+    work submitted to a ThreadPoolExecutor by one traced call, loop.run_in_executor
+    included. every task is traced in its worker thread, tasks done before the
+    call returns are merged into its final message under a [thread] frame of
+    the root, the others are sent as traces of their worker thread
+    """
+
+    def __init__(self, trace_point: Any, func_args: List[Any]):
+        self.trace_point = trace_point
+        self.set_function: Callable = func_args[0]
+        self.output_function: Callable = func_args[1]
+        self.interval: int = func_args[3]
+        self.remove_function: Callable = func_args[6]
+        # (worker thread name, submit_ns, end_ns, records) of finished tasks
+        self.tasks: List[Tuple[str, int, int, bytes]] = []
+        self.closed = False
+        self.lock = threading.Lock()
+        self.token = trace_follow_group.set(self)
+
+    def release(self) -> None:
+        if self.token is None:
+            return
+        try:
+            trace_follow_group.reset(self.token)
+        except ValueError:
+            # released from another context
+            trace_follow_group.set(None)
+        self.token = None
+
+    def output(
+        self,
+        out_q: Any,
+        records: bytes,
+        session: Any,
+        base: int = 0,
+        late: bytes = b"",
+        final: bool = True,
+    ) -> None:
+        """
+        target of the traced call profiler, appends the finished tasks to its
+        final message
+        """
+        if final:
+            with self.lock:
+                self.closed = True
+                tasks, self.tasks = self.tasks, []
+            self.release()
+            if tasks:
+                records = records + self.merge_tasks(
+                    tasks, session, base + len(records) // TRACE_RECORD.size
+                )
+        self.output_function(out_q, records, session, base, late, final)
+
+    def merge_tasks(
+        self, tasks: List[Tuple[str, int, int, bytes]], session: Any, offset: int
+    ) -> bytes:
+        """
+        records of the tasks rebased after offset, each one below a thread
+        frame spanning from its submission to its end
+        """
+        merged = []
+        for thread_name, submit_ns, end_ns, records in tasks:
+            if end_ns - submit_ns < self.interval:
+                continue
+            merged.append(
+                TRACE_RECORD.pack(
+                    session.intern(f"{THREAD_FRAME_METHOD}\x00{thread_name}\x000"),
+                    0,
+                    submit_ns,
+                    end_ns - submit_ns,
+                )
+            )
+            for desc, pid, start_ns, cost_ns in TRACE_RECORD.iter_unpack(records):
+                merged.append(
+                    TRACE_RECORD.pack(
+                        desc, offset if pid < 0 else pid + offset + 1, start_ns, cost_ns
+                    )
+                )
+            offset += 1 + len(records) // TRACE_RECORD.size
+        return b"".join(merged)
+
+    def collect(
+        self,
+        submit_ns: int,
+        out_q: Any,
+        records: bytes,
+        session: Any,
+        base: int = 0,
+        late: bytes = b"",
+        final: bool = True,
+    ) -> None:
+        """
+        target of the task profilers, tasks are not streamed
+        """
+        end_ns = time.time_ns()
+        with self.lock:
+            if not self.closed:
+                self.tasks.append(
+                    (threading.current_thread().name, submit_ns, end_ns, records)
+                )
+                return
+        self.output_function(out_q, records, session, base, late, final)
+
+    def wrap(self, fn: Callable) -> Callable:
+        submit_ns = time.time_ns()
+        point = self.trace_point
+
+        @functools.wraps(fn)
+        def followed_task(*args, **kwargs):
+            # work submitted by the task is followed as well
+            token = trace_follow_group.set(self)
+            profiler = None
+            try:
+                profiler = self.set_function(
+                    functools.partial(self.collect, submit_ns), point.out_q,
+                    self.interval, False, point.depth, point.clock_source,
+                    point.session, 0
+                )
+            except Exception as e:
+                logger.warning(f"trace executor task failed: {e}")
+            try:
+                return fn(*args, **kwargs)
+            finally:
+                self.remove_function(profiler)
+                trace_follow_group.reset(token)
+
+        return followed_task
+
+
+def release_follow_output(output: Optional[Callable]) -> None:
+    """
+    release the group of a profiler target when the profiler of the traced
+    call could not be set, its final output that releases the group never runs
+    """
+    group = getattr(output, "__self__", None)
+    if isinstance(group, TraceFollowGroup):
+        group.release()
+
+
+# ThreadPoolExecutor.submit before follow_submit was installed
+origin_submit: Optional[Callable] = None
+follow_users = 0
+follow_lock = threading.Lock()
+
+
+def follow_submit(*args, **kwargs):
+    """
+    ThreadPoolExecutor.submit of processes tracing with --follow, only calls
+    made in a traced call are followed
+    """
+    group: Optional[TraceFollowGroup] = trace_follow_group.get()
+    if group is not None and not group.closed and len(args) > 1:
+        executor = args[0]
+        # interpreter pools pickle their tasks
+        interpreter_pool = getattr(concurrent.futures, "InterpreterPoolExecutor", None)
+        if interpreter_pool is None or not isinstance(executor, interpreter_pool):
+            args = (executor, group.wrap(args[1])) + args[2:]
+    return origin_submit(*args, **kwargs)
+
+
+def install_follow_submit() -> None:
+    global origin_submit, follow_users
+    with follow_lock:
+        follow_users += 1
+        if follow_users == 1:
+            origin_submit = concurrent.futures.ThreadPoolExecutor.submit
+            concurrent.futures.ThreadPoolExecutor.submit = functools.wraps(
+                origin_submit
+            )(follow_submit)
+
+
+def uninstall_follow_submit() -> None:
+    global origin_submit, follow_users
+    with follow_lock:
+        if follow_users == 0:
+            return
+        follow_users -= 1
+        if follow_users == 0:
+            concurrent.futures.ThreadPoolExecutor.submit = origin_submit
@@ -1,5 +1,25 @@
+import struct
 import threading
-from typing import Any, Dict, List, Union
+from typing import Any, Dict, List, Optional, Tuple, Union
+
+# binary trace frames message, native byte order as client and agent share a host:
+#   header | thread name | new descriptions joined by \x01 | records | late records
+# descriptions are interned per trace command, a message only carries the ones
+# added since the previous message, starting at id first description.
+# long traced calls are streamed in several messages, records of a message
+# start at offset base, frames still open when their offset was sent follow
+# later as late records. the last message of a call is flagged final
+TRACE_FRAMES_MAGIC = b"FPTF"
+TRACE_FRAMES_VERSION = 2
+# magic, version, daemon flag, final flag, thread id, thread name size,
+# first description, descriptions size, base offset, record count, late count
+TRACE_FRAMES_HEADER = struct.Struct("=4sBBBQIIIIII")
+# description id, parent offset, start_ns, cost_ns, TraceRecord in trace_profile.c
+TRACE_RECORD = struct.Struct("=iiqq")
+# offset, padding, TraceRecord, TraceLateRecord in trace_profile.c
+TRACE_LATE_RECORD = struct.Struct("=i4xiiqq")
+# daemon flag of threads not known to threading
+UNKNOWN_DAEMON = 255
 
 
 class TraceFrame:
@@ -20,11 +40,28 @@ class WrapTraceFrame:
     server sent frame list, contains frame level infos
     """
 
-    def __init__(self, frames: List[Union[str, TraceFrame]]):
+    def __init__(
+        self,
+        frames: List[Optional[Union[str, TraceFrame]]],
+        thread_id: Optional[int] = None,
+        thread_name: Optional[str] = None,
+        is_daemon: Optional[bool] = None,
+    ):
+        """
+        thread infos default to the current thread
+        """
         self.frames = frames
+        self.thread_id = thread_id
+        self.thread_name = thread_name
+        self.is_daemon = is_daemon
+        # offset of frames[0] and frames sent before their offset, streamed
+        # messages are merged by TraceFrameChunks
+        self.base = 0
+        self.late: List[Tuple[int, TraceFrame]] = []
+        self.final = True
+        if thread_id is not None:
+            return
         self.thread_id = threading.get_ident()
-        self.thread_name = None
-        self.is_daemon = None
         for thread in threading.enumerate():
             if thread.ident == self.thread_id:
                 self.thread_name = thread.name
@@ -47,6 +84,8 @@ class FlattenTreeTraceFrame:
         self.cost_ns = cost_ns
         self.c_frame = self.filename == "<built-in>"
         self.await_frame = self.method_name == "[await]"
+        # executor work followed into a worker thread, filename is the thread
+        self.thread_frame = self.method_name == "[thread]"
         self.sub_frames: List[FlattenTreeTraceFrame] = []
 
     def append_child(self, frame) -> None:
@@ -87,3 +126,193 @@ def deserialize_string_frames(wrap: WrapTraceFrame) -> WrapTraceFrame:
         deserialized_frames.append(t)
     wrap.frames = deserialized_frames
     return wrap
+
+
+def encode_trace_frames(
+    records: bytes,
+    first_desc: int,
+    descriptions: List[str],
+    base: int = 0,
+    late: bytes = b"",
+    final: bool = True,
+) -> bytes:
+    """
+    wrap records and new descriptions produced by the C profiler with the infos
+    of the current thread, records are sent as is
+    """
+    wrap = WrapTraceFrame([])
+    name = (wrap.thread_name or "").encode("utf-8")
+    desc = "\x01".join(descriptions).encode("utf-8")
+    daemon = UNKNOWN_DAEMON if wrap.is_daemon is None else int(wrap.is_daemon)
+    header = TRACE_FRAMES_HEADER.pack(
+        TRACE_FRAMES_MAGIC,
+        TRACE_FRAMES_VERSION,
+        daemon,
+        int(final),
+        wrap.thread_id,
+        len(name),
+        first_desc,
+        len(desc),
+        base,
+        len(records) // TRACE_RECORD.size,
+        len(late) // TRACE_LATE_RECORD.size,
+    )
+    return b"".join((header, name, desc, records, late))
+
+
+def is_trace_frames(payload: bytes) -> bool:
+    return payload[: len(TRACE_FRAMES_MAGIC)] == TRACE_FRAMES_MAGIC
+
+
+def decode_trace_frames(
+    payload: bytes, descriptions: Optional[List[str]] = None
+) -> WrapTraceFrame:
+    """
+    inverse of encode_trace_frames, empty record slots become None like in
+    deserialize_string_frames
+    :param descriptions: descriptions of the trace command received so far,
+        extended by the ones carried by payload
+    """
+    if descriptions is None:
+        descriptions = []
+    view = memoryview(payload)
+    (
+        _,
+        version,
+        daemon,
+        final,
+        thread_id,
+        name_size,
+        first_desc,
+        desc_size,
+        base,
+        count,
+        late_count,
+    ) = TRACE_FRAMES_HEADER.unpack_from(view)
+    if version != TRACE_FRAMES_VERSION:
+        raise ValueError(f"unsupported trace frames version {version}")
+    pos = TRACE_FRAMES_HEADER.size
+    thread_name = str(view[pos : pos + name_size], "utf-8")
+    pos += name_size
+    if desc_size > 0:
+        del descriptions[first_desc:]
+        descriptions.extend(str(view[pos : pos + desc_size], "utf-8").split("\x01"))
+    pos += desc_size
+    frames: List[Optional[TraceFrame]] = []
+    for desc, pid, start_ns, cost_ns in TRACE_RECORD.iter_unpack(
+        view[pos : pos + count * TRACE_RECORD.size]
+    ):
+        if desc < 0:
+            frames.append(None)
+            continue
+        frame = TraceFrame(descriptions[desc], start_ns)
+        frame.cost_ns = cost_ns
+        frame.pid = pid
+        frames.append(frame)
+    pos += count * TRACE_RECORD.size
+    wrap = WrapTraceFrame(
+        frames,
+        thread_id=thread_id,
+        thread_name=thread_name if name_size > 0 else None,
+        is_daemon=None if daemon == UNKNOWN_DAEMON else bool(daemon),
+    )
+    wrap.base = base
+    wrap.final = bool(final)
+    for offset, desc, pid, start_ns, cost_ns in TRACE_LATE_RECORD.iter_unpack(
+        view[pos : pos + late_count * TRACE_LATE_RECORD.size]
+    ):
+        frame = TraceFrame(descriptions[desc], start_ns)
+        frame.cost_ns = cost_ns
+        frame.pid = pid
+        wrap.late.append((offset, frame))
+    return wrap
+
+
+class TraceFrameChunks:
+    """
+    merges the messages of traced calls streamed in chunks, a thread runs one
+    traced call at a time
+    """
+
+    def __init__(self):
+        self.pending: Dict[int, WrapTraceFrame] = {}
+
+    def merge(self, wrap: WrapTraceFrame) -> Optional[WrapTraceFrame]:
+        """
+        return the frames of the traced call once its final message is merged
+        """
+        call = self.pending.pop(wrap.thread_id, None)
+        if call is None:
+            if wrap.base != 0:
+                # earlier chunks were lost, the tree can not be rebuilt
+                return None
+            call = wrap
+        else:
+            frames = call.frames
+            if len(frames) < wrap.base:
+                frames.extend([None] * (wrap.base - len(frames)))
+            del frames[wrap.base :]
+            frames.extend(wrap.frames)
+            call.late.extend(wrap.late)
+            call.final = wrap.final
+        if not call.final:
+            self.pending[wrap.thread_id] = call
+            return None
+        for offset, frame in call.late:
+            if offset < len(call.frames):
+                call.frames[offset] = frame
+        call.late = []
+        return call
+
+    def received(self, thread_id: int) -> int:
+        call = self.pending.get(thread_id)
+        return 0 if call is None else len(call.frames)
+
+
+class StringTraceSession:
+    """
+    python counterpart of trace_profile_C.TraceSession, interns descriptions of
+    the python TraceProfiler
+    """
+
+    def __init__(self):
+        self.descriptions: List[str] = []
+        self.desc_ids: Dict[str, int] = {}
+        self.sent = 0
+
+    def __len__(self) -> int:
+        return len(self.descriptions)
+
+    def intern(self, description: str) -> int:
+        desc = self.desc_ids.get(description)
+        if desc is None:
+            desc = len(self.descriptions)
+            self.desc_ids[description] = desc
+            self.descriptions.append(description)
+        return desc
+
+    def take_descriptions(self) -> Tuple[int, List[str]]:
+        first_desc = self.sent
+        self.sent = len(self.descriptions)
+        return first_desc, self.descriptions[first_desc:]
+
+
+def pack_string_frames(
+    frames: List[Optional[str]], session: StringTraceSession
+) -> bytes:
+    """
+    convert frames of the string format into records, descriptions are interned
+    in session
+    """
+    records = []
+    for frame in frames:
+        if frame is None:
+            records.append(TRACE_RECORD.pack(-1, 0, 0, 0))
+            continue
+        parts = frame.split("\x01")
+        records.append(
+            TRACE_RECORD.pack(
+                session.intern(parts[0]), int(parts[3]), int(parts[1]), int(parts[2])
+            )
+        )
+    return b"".join(records)
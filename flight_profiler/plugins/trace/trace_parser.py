@@ -2,7 +2,7 @@ import argparse
 from argparse import RawTextHelpFormatter
 
 from flight_profiler.help_descriptions import TRACE_COMMAND_DESCRIPTION
-from flight_profiler.plugins.trace.trace_agent import TracePoint
+from flight_profiler.plugins.trace.trace_agent import DEFAULT_FLUSH_FRAMES, TracePoint
 from flight_profiler.utils.args_util import rewrite_args
 
 
@@ -23,6 +23,15 @@ def check_depth(value):
     except:
         raise argparse.ArgumentTypeError(f"{value} is not a integer above 1 or -1")
 
+def check_flush_frames(value):
+    try:
+        i_value = int(value)
+    except:
+        raise argparse.ArgumentTypeError(f"{value} is not a integer.")
+    if i_value < 0:
+        raise argparse.ArgumentTypeError(f"{value} should not be negative.")
+    return i_value
+
 
 class TraceArgumentParser(argparse.ArgumentParser):
 
@@ -77,6 +86,28 @@ class TraceArgumentParser(argparse.ArgumentParser):
             default=None,
             help="filter expression",
         )
+        self.add_argument(
+            "--clock",
+            required=False,
+            choices=["auto", "raw", "coarse", "tsc"],
+            default="auto",
+            help="timing clock source",
+        )
+        self.add_argument(
+            "--flush",
+            type=check_flush_frames,
+            required=False,
+            help="stream frames of a traced call every #flush frames, 0 sends them when the call returns, "
+            f"default value {DEFAULT_FLUSH_FRAMES}",
+            default=DEFAULT_FLUSH_FRAMES,
+        )
+        self.add_argument(
+            "--follow",
+            action="store_true",
+            required=False,
+            help="also trace work the traced call submits to ThreadPoolExecutor or loop.run_in_executor",
+            default=False,
+        )
 
     def error(self, message):
         raise Exception(message)
@@ -96,5 +127,8 @@ class TraceArgumentParser(argparse.ArgumentParser):
             entrance_time=getattr(args, "entrance_time"),
             limits=getattr(args, "limits"),
             filter_expr=getattr(args, "filter_expr"),
+            clock=getattr(args, "clock"),
+            flush_frames=getattr(args, "flush"),
+            follow_executors=getattr(args, "follow"),
         )
         return point
@@ -5,9 +5,13 @@ Python version of TraceProfiler, used only for debugging.
 import sys
 import time
 from types import FrameType
-from typing import Any, Callable, List
+from typing import Any, Callable, List, Optional
 
 from flight_profiler.plugins.server_plugin import ServerQueue
+from flight_profiler.plugins.trace.trace_frame import (
+    StringTraceSession,
+    pack_string_frames,
+)
 
 
 class FrameNode:
@@ -33,9 +37,11 @@ class TraceProfiler:
         out_q: ServerQueue,
         interval: int,
         is_async: bool = False,
-        depth_limit: int = -1
+        depth_limit: int = -1,
+        session: Optional[StringTraceSession] = None
     ):
         self.target = target
+        self.session = session if session is not None else StringTraceSession()
         self.on_sending_frame = []
         self.sf_sz = 0
         self.current_depth = 0
@@ -618,19 +624,37 @@ class TraceProfiler:
 
     def send_trace_frames(self):
         if not self.is_async:
-            self.target(self.out_q, self.on_sending_frame)
+            self.target(
+                self.out_q,
+                pack_string_frames(self.on_sending_frame, self.session),
+                self.session,
+            )
         else:
             if self.depth_limit == -1:
                 self.fulfill_async_unfinished_requests()
             else:
                 self.fulfill_async_unfinished_requests_with_depth()
-            self.target(self.out_q, self.on_sending_frame)
+            self.target(
+                self.out_q,
+                pack_string_frames(self.on_sending_frame, self.session),
+                self.session,
+            )
 
 
 def set_trace_profile(
-    target, out_q: ServerQueue, interval, async_func, depth: int
+    target,
+    out_q: ServerQueue,
+    interval,
+    async_func,
+    depth: int,
+    clock: int = 0,
+    session: Optional[StringTraceSession] = None,
+    flush_records: int = 0,
 ) -> TraceProfiler:
-    profiler = TraceProfiler(target, out_q, interval, is_async=async_func, depth_limit=depth)
+    # frames are always sent when the traced call returns
+    profiler = TraceProfiler(
+        target, out_q, interval, is_async=async_func, depth_limit=depth, session=session
+    )
     if async_func:
         if depth > 0:
             sys.setprofile(profiler.profile_async_func_with_depth)
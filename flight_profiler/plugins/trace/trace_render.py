@@ -120,6 +120,18 @@ class TraceRender(SkipStrategy):
                 f"{COLOR_AWAIT}{frame.method_name}{COLOR_END}    "
                 f"{COLOR_FAINT}{frame.filename}{COLOR_END}\n"
             )
+        elif frame.thread_frame:
+            # time from the submission of the task to its start in the worker
+            queued = (
+                f"    queued {(frame.sub_frames[0].start_ns - frame.start_ns) / 1000000}ms"
+                if frame.sub_frames
+                else ""
+            )
+            show_msg = show_msg + (
+                f"[{time_color}{frame.cost_ns / 1000000}ms{COLOR_END}]  "
+                f"{COLOR_AWAIT}{frame.method_name}{COLOR_END} {frame.filename}"
+                f"{COLOR_FAINT}{queued}{COLOR_END}\n"
+            )
         elif frame.c_frame:
             show_msg = show_msg + (
                 f"[{time_color}{frame.cost_ns / 1000000}ms{COLOR_END}]  "
@@ -76,6 +76,23 @@ def generate_time_tunnel_wrapper(tt_cmd: TimeTunnelCmd):
                     return await func(*args, **kwargs)
 
             return async_wrapper
+        elif tt_cmd.build_native_wrapper(
+            tt_cmd.tt_filter,
+            tt_cmd.class_name is not None,
+            on_return=tt_cmd.record_return,
+            on_error=tt_cmd.record_error,
+        ):
+
+            # enter/exit, timing and filtering are done by aop_C
+            @functools.wraps(func)
+            def wrapper(*args, **kwargs):
+                native_wrapper = tt_cmd.native_wrapper
+                if native_wrapper is None:
+                    # released while the method is being restored
+                    return func(*args, **kwargs)
+                return native_wrapper(func, *args, **kwargs)
+
+            return wrapper
         else:
 
             @functools.wraps(func)
@@ -143,6 +160,7 @@ class TimeTunnelAgent:
                 self.clear_tt_point(tt_cmd)
 
             tt_cmd.global_instance = global_tt_agent
+            global_time_tunnel_recorder.configure_store(tt_cmd)
             try:
                 module = importlib.import_module(tt_cmd.module_name)
             except Exception as e:
@@ -234,6 +252,8 @@ class TimeTunnelAgent:
 
         origin_tt_cmd = self.aop_points.pop(cmd.unique_key())
         if origin_tt_cmd is not None:
+            if origin_tt_cmd.sampler is not None:
+                origin_tt_cmd.sampler.close()
             if origin_tt_cmd.origin_code is not None:
                 module = importlib.import_module(origin_tt_cmd.module_name)
                 aop_decorator.clear_func_wrapper(
@@ -243,6 +263,7 @@ class TimeTunnelAgent:
                     origin_tt_cmd.origin_code,
                 )
             origin_tt_cmd.out_q.output_msg_nowait(Message(is_end=True, msg=""))
+            origin_tt_cmd.release_native_wrapper()
 
     def off_action(self, tt_cmd: TimeTunnelCmd):
         """
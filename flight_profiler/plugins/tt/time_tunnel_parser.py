@@ -1,6 +1,11 @@
 import argparse
 from argparse import RawTextHelpFormatter
 
+from flight_profiler.common.call_sampler import (
+    add_sampling_arguments,
+    check_positive,
+    create_sampler,
+)
 from flight_profiler.help_descriptions import TIME_TUNNEL_COMMAND_DESCRIPTION
 from flight_profiler.plugins.tt.time_tunnel_recorder import TimeTunnelCmd
 from flight_profiler.utils.args_util import rewrite_args
@@ -123,6 +128,21 @@ class TimeTunnelArgumentParser(argparse.ArgumentParser):
             default=None,
             help="method filter expression",
         )
+        add_sampling_arguments(self)
+        self.add_argument(
+            "--budget",
+            required=False,
+            default=None,
+            type=check_positive,
+            help="memory budget of invocation records in MB, default value 64.",
+        )
+        self.add_argument(
+            "--spill",
+            required=False,
+            default=None,
+            type=int,
+            help="spill records over budget to a ring file of value MB, 0 disables.",
+        )
 
     def error(self, message):
         raise Exception(message)
@@ -150,5 +170,8 @@ class TimeTunnelArgumentParser(argparse.ArgumentParser):
             filter_expr=getattr(args, "filter"),
             method_filter=getattr(args, "method"),
             nested_method=getattr(args, "nested_method"),
+            sampler=create_sampler(args),
+            budget_mb=getattr(args, "budget"),
+            spill_mb=getattr(args, "spill"),
         )
         return cmd
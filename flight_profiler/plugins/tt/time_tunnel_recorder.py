@@ -1,4 +1,5 @@
 import asyncio
+import functools
 import importlib
 import pickle
 import time
@@ -6,16 +7,18 @@ import traceback
 from argparse import ArgumentTypeError
 from concurrent.futures import ThreadPoolExecutor
 from types import CodeType
-from typing import Any, Dict, List, Optional, Union
+from typing import Any, Dict, List, Optional, Tuple, Union
 
 from flight_profiler.common.aop_decorator import (
     find_class_function,
     find_module_function,
 )
+from flight_profiler.common.call_sampler import CallSampler
 from flight_profiler.common.dumps import encode_obj_to_transfer
 from flight_profiler.common.enter_exit_command import EnterExitCommand
 from flight_profiler.common.expression_resolver import FilterExprResolver
 from flight_profiler.plugins.server_plugin import Message, ServerQueue
+from flight_profiler.plugins.tt.time_tunnel_store import TimeTunnelStore
 from flight_profiler.utils.args_util import split_regex
 
 
@@ -38,9 +41,15 @@ class TimeTunnelCmd(EnterExitCommand):
         verbose: bool = False,
         nested_method: str = None,
         need_wrap_nested_inplace: bool = False,
-        nested_code_obj: CodeType = None
+        nested_code_obj: CodeType = None,
+        sampler: Optional[CallSampler] = None,
+        budget_mb: Optional[int] = None,
+        spill_mb: Optional[int] = None,
     ):
-        super().__init__(limit=limits)
+        super().__init__(limit=limits, sampler=sampler)
+        # record store settings, kept as they are when not specified
+        self.budget_mb = budget_mb
+        self.spill_mb = spill_mb
         self.time_tunnel = time_tunnel
         self.limits = limits
         self.show_list = show_list
@@ -96,6 +105,17 @@ class TimeTunnelCmd(EnterExitCommand):
         return_obj: Any,
         *args: List[Any],
         **kwargs: Dict[str, Any],
+    ) -> None:
+        self.__dump_invocation(start_timestamp, cost_ms, return_obj, args, kwargs, False)
+
+    def __dump_invocation(
+        self,
+        start_timestamp: int,
+        cost_ms: float,
+        return_obj: Any,
+        args: Tuple[Any, ...],
+        kwargs: Dict[str, Any],
+        filter_passed: bool,
     ) -> None:
         target_obj = None
         if self.class_name is not None and self.nested_method is None:
@@ -103,30 +123,26 @@ class TimeTunnelCmd(EnterExitCommand):
             target_obj = args[0]
         else:
             filter_args = args
-        if self.tt_filter.eval_filter(
-            target_obj, return_obj, cost_ms, *filter_args, **kwargs
-        ):
-            index = global_tt_indexer.get_index()
-            record: FullInvocationRecord = global_time_tunnel_recorder.records(
-                index,
-                start_timestamp,
+        if (
+            filter_passed
+            or self.tt_filter.eval_filter(
+                target_obj, return_obj, cost_ms, *filter_args, **kwargs
+            )
+        ) and self.admits(cost_ms):
+            self.record(
                 cost_ms,
-                True,
-                False,
-                self.module_name,
-                self.class_name,
-                self.method_name,
-                args,
-                kwargs,
-                return_obj,
-                None,
+                functools.partial(
+                    self.__save_invocation,
+                    start_timestamp,
+                    cost_ms,
+                    True,
+                    False,
+                    args,
+                    kwargs,
+                    return_obj,
+                    None,
+                ),
             )
-            if self.out_q is not None:
-                self.out_q.output_msg_nowait(
-                    Message(
-                        False, msg=pickle.dumps(record.base_record)
-                    )
-                )
 
     def dump_error(
         self,
@@ -135,6 +151,17 @@ class TimeTunnelCmd(EnterExitCommand):
         exp_obj: Any,
         *args: List[Any],
         **kwargs: Dict[str, Any],
+    ) -> None:
+        self.__dump_error(start_timestamp, cost_ms, exp_obj, args, kwargs, False)
+
+    def __dump_error(
+        self,
+        start_timestamp: int,
+        cost_ms: float,
+        exp_obj: Any,
+        args: Tuple[Any, ...],
+        kwargs: Dict[str, Any],
+        filter_passed: bool,
     ) -> None:
         target_obj = None
         if self.class_name is not None and self.nested_method is None:
@@ -142,30 +169,82 @@ class TimeTunnelCmd(EnterExitCommand):
             target_obj = args[0]
         else:
             filter_args = args
-        if self.tt_filter.eval_filter(
-            target_obj, None, cost_ms, *filter_args, **kwargs
-        ):
-            index = global_tt_indexer.get_index()
-            record: FullInvocationRecord = global_time_tunnel_recorder.records(
-                index,
-                start_timestamp,
+        if (
+            filter_passed
+            or self.tt_filter.eval_filter(
+                target_obj, None, cost_ms, *filter_args, **kwargs
+            )
+        ) and self.admits(cost_ms):
+            self.record(
                 cost_ms,
-                False,
-                True,
-                self.module_name,
-                self.class_name,
-                self.method_name,
-                args,
-                kwargs,
-                None,
-                exp_obj,
+                functools.partial(
+                    self.__save_invocation,
+                    start_timestamp,
+                    cost_ms,
+                    False,
+                    True,
+                    args,
+                    kwargs,
+                    None,
+                    exp_obj,
+                ),
             )
-            if self.out_q is not None:
-                self.out_q.output_msg_nowait(
-                    Message(
-                        False, msg=pickle.dumps(record.base_record)
-                    )
+
+    def __save_invocation(
+        self,
+        start_timestamp: int,
+        cost_ms: float,
+        is_ret: bool,
+        is_exp: bool,
+        args: Any,
+        kwargs: Dict[str, Any],
+        return_obj: Any,
+        exp_obj: Any,
+    ) -> None:
+        index = global_tt_indexer.get_index()
+        record: FullInvocationRecord = global_time_tunnel_recorder.records(
+            index,
+            start_timestamp,
+            cost_ms,
+            is_ret,
+            is_exp,
+            self.module_name,
+            self.class_name,
+            self.method_name,
+            args,
+            kwargs,
+            return_obj,
+            exp_obj,
+        )
+        if self.out_q is not None:
+            self.out_q.output_msg_nowait(
+                Message(
+                    False, msg=pickle.dumps(record.base_record)
                 )
+            )
+
+    def record_return(self, start_timestamp, cost_ms, return_obj, args, kwargs, filter_failed):
+        """
+        native wrapper callback for calls passed the filter, the filter is only
+        evaluated again to log the error when it raised
+        """
+        try:
+            self.__dump_invocation(
+                start_timestamp, cost_ms, return_obj, args, kwargs, not filter_failed
+            )
+        except:
+            logger.error(traceback.format_exc())
+
+    def record_error(self, start_timestamp, cost_ms, error, args, kwargs, filter_failed):
+        try:
+            msg = "".join(
+                traceback.format_exception(type(error), error, error.__traceback__)
+            )
+            self.__dump_error(
+                start_timestamp, cost_ms, msg, args, kwargs, not filter_failed
+            )
+        except:
+            logger.error(traceback.format_exc())
 
     def child_clear_action(self):
         if self.global_instance is not None:
@@ -263,7 +342,7 @@ global_replay_executor = TimeTuneReplayExecutor()
 class TimeTunnelRecorder:
 
     def __init__(self):
-        self.invocation_records: Dict[int, FullInvocationRecord] = {}
+        self.invocation_records: TimeTunnelStore = TimeTunnelStore()
 
     def records(
         self,
@@ -296,17 +375,24 @@ class TimeTunnelRecorder:
             return_obj,
             exp_obj,
         )
-        self.invocation_records[index] = full_record
+        self.invocation_records.put(index, full_record)
         return full_record
 
     def show_list_records(self, cmd: TimeTunnelCmd) -> None:
         base_records = []
-        for r in self.invocation_records.values():
-            filter_args = r.args
-            method_names = f"{r.base_record.module_name}.{r.base_record.class_name}.{r.base_record.method_name}"
+        for index, base_record in self.invocation_records.base_records():
+            method_names = f"{base_record.module_name}.{base_record.class_name}.{base_record.method_name}"
             if cmd.method_filter is not None and cmd.method_filter != method_names:
                 continue
+            if cmd.filter_expr is None:
+                base_records.append(base_record)
+                continue
 
+            # spilled records are loaded for the filter only
+            r = self.invocation_records.get(index, touch=False)
+            if r is None:
+                continue
+            filter_args = r.args
             target_obj = None
             if r.base_record.class_name is not None:
                 filter_args = r.args[1:]
@@ -319,13 +405,16 @@ class TimeTunnelRecorder:
                 *filter_args,
                 **r.kwargs,
             ):
-                base_records.append(r.base_record)
+                base_records.append(base_record)
         cmd.out_q.output_msg_nowait(
             Message(True, msg=pickle.dumps(base_records))
         )
 
     def show_indexed_record(self, cmd: TimeTunnelCmd) -> None:
-        if cmd.index not in self.invocation_records:
+        full_record: Optional[FullInvocationRecord] = self.invocation_records.get(
+            cmd.index
+        )
+        if full_record is None:
             cmd.out_q.output_msg_nowait(
                 Message(
                     True,
@@ -333,7 +422,6 @@ class TimeTunnelRecorder:
                 )
             )
             return
-        full_record: FullInvocationRecord = self.invocation_records[cmd.index]
         self.__send_full_record_directly(full_record, cmd.out_q, cmd.expand_level,
                                          raw_output=cmd.raw_output, verbose=cmd.verbose)
 
@@ -368,7 +456,9 @@ class TimeTunnelRecorder:
             full_record.args = origin_args
 
     def replay_time_fragment(self, cmd: TimeTunnelCmd) -> None:
-        if cmd.index not in self.invocation_records:
+        # spilled records are replayed with unpickled copies of their args
+        record: Optional[FullInvocationRecord] = self.invocation_records.get(cmd.index)
+        if record is None:
             cmd.out_q.output_msg_nowait(
                 Message(
                     True,
@@ -377,7 +467,6 @@ class TimeTunnelRecorder:
             )
             return
 
-        record: FullInvocationRecord = self.invocation_records[cmd.index]
         cls_name: str = record.base_record.class_name
         module_name = record.base_record.module_name
         method_name = record.base_record.method_name
@@ -445,10 +534,13 @@ class TimeTunnelRecorder:
             self.__send_full_record_directly(new_record, cmd.out_q, cmd.expand_level, cmd.raw_output, cmd.verbose)
 
     def delete_specified_record(self, id) -> bool:
-        if id in self.invocation_records:
-            self.invocation_records.pop(id)
-            return True
-        return False
+        return self.invocation_records.pop(id)
+
+    def configure_store(self, cmd: TimeTunnelCmd) -> None:
+        self.invocation_records.configure(
+            None if cmd.budget_mb is None else cmd.budget_mb << 20,
+            None if cmd.spill_mb is None else cmd.spill_mb << 20,
+        )
 
     def delete_all_records(self):
         self.invocation_records.clear()
@@ -0,0 +1,237 @@
+import bisect
+import mmap
+import os
+import pickle
+import sys
+import tempfile
+import threading
+from collections import OrderedDict
+from typing import Any, Dict, Iterable, List, Optional, Tuple
+
+from flight_profiler.common.system_logger import logger
+
+DEFAULT_BUDGET_MB = 64
+
+# objects visited when estimating the size of a record
+MAX_SIZED_OBJECTS = 1000
+
+
+def estimate_size(obj: Any, max_depth: int = 4) -> int:
+    """
+    approximate bytes referenced by obj, containers and instance dicts are
+    walked up to max_depth, shared objects are counted once
+    """
+    seen = set()
+    total = 0
+    stack = [(obj, 0)]
+    while stack and len(seen) < MAX_SIZED_OBJECTS:
+        o, depth = stack.pop()
+        if id(o) in seen:
+            continue
+        seen.add(id(o))
+        try:
+            total += sys.getsizeof(o)
+        except:
+            continue
+        if depth >= max_depth:
+            continue
+        if isinstance(o, (str, bytes, bytearray, int, float, bool)):
+            continue
+        if isinstance(o, dict):
+            for k, v in o.items():
+                stack.append((k, depth + 1))
+                stack.append((v, depth + 1))
+        elif isinstance(o, (list, tuple, set, frozenset)):
+            for v in o:
+                stack.append((v, depth + 1))
+        elif hasattr(o, "__dict__"):
+            stack.append((o.__dict__, depth + 1))
+    return total
+
+
+class SpillFile:
+    """
+    ring of pickled records in an mmap'd unlinked temp file, records are
+    overwritten oldest first when the ring wraps
+    """
+
+    def __init__(self, capacity: int):
+        self.capacity = capacity
+        fd, path = tempfile.mkstemp(prefix="flight_profiler_tt_")
+        try:
+            os.unlink(path)
+            os.ftruncate(fd, capacity)
+            self.__mm = mmap.mmap(fd, capacity)
+        finally:
+            os.close(fd)
+        self.__pos = 0
+        # index -> (offset, length)
+        self.__entries: Dict[int, Tuple[int, int]] = {}
+        # offsets of the entries in ascending order, and the index at each
+        self.__offsets: List[int] = []
+        self.__at: Dict[int, int] = {}
+
+    def write(self, index: int, data: bytes) -> Iterable[int]:
+        """
+        append data, returns the indexes overwritten by it
+        """
+        self.remove(index)
+        if len(data) > self.capacity:
+            return [index]
+        if self.__pos + len(data) > self.capacity:
+            self.__pos = 0
+        start, end = self.__pos, self.__pos + len(data)
+        # entries don't overlap each other, so the ones intersecting the new
+        # range are adjacent by offset. after a wrap they are not the oldest
+        # ones, the tail left unused by the last lap keeps older entries
+        first = bisect.bisect_right(self.__offsets, start) - 1
+        if first < 0 or sum(self.__entries[self.__at[self.__offsets[first]]]) <= start:
+            first += 1
+        last = bisect.bisect_left(self.__offsets, end, first)
+        overwritten = [self.__at.pop(offset) for offset in self.__offsets[first:last]]
+        del self.__offsets[first:last]
+        for old_index in overwritten:
+            del self.__entries[old_index]
+        self.__mm[start:end] = data
+        self.__entries[index] = (start, len(data))
+        self.__offsets.insert(first, start)
+        self.__at[start] = index
+        self.__pos = end
+        return overwritten
+
+    def read(self, index: int) -> Optional[bytes]:
+        entry = self.__entries.get(index)
+        if entry is None:
+            return None
+        offset, length = entry
+        return self.__mm[offset : offset + length]
+
+    def remove(self, index: int) -> None:
+        entry = self.__entries.pop(index, None)
+        if entry is None:
+            return
+        del self.__offsets[bisect.bisect_left(self.__offsets, entry[0])]
+        del self.__at[entry[0]]
+
+    def __contains__(self, index: int) -> bool:
+        return index in self.__entries
+
+    def close(self) -> None:
+        self.__entries.clear()
+        self.__offsets.clear()
+        self.__at.clear()
+        self.__mm.close()
+
+
+class TimeTunnelStore:
+    """
+    invocation records of tt by index, records referenced in memory are kept
+    within budget_bytes, least recently used ones are spilled to a ring file
+    of spill_bytes or dropped. base records stay in memory for tt -l
+    """
+
+    def __init__(self, budget_bytes: int = DEFAULT_BUDGET_MB << 20, spill_bytes: int = 0):
+        self.budget_bytes = budget_bytes
+        self.spill_bytes = spill_bytes
+        self.memory_bytes = 0
+        self.__lock = threading.RLock()
+        # every record kept, in index order
+        self.__base: Dict[int, Any] = {}
+        # index -> (full record, estimated size) in least recently used order
+        self.__memory: "OrderedDict[int, Tuple[Any, int]]" = OrderedDict()
+        self.__spill: Optional[SpillFile] = None
+
+    def configure(self, budget_bytes: Optional[int], spill_bytes: Optional[int]) -> None:
+        with self.__lock:
+            if budget_bytes is not None:
+                self.budget_bytes = budget_bytes
+            if spill_bytes is not None and spill_bytes != self.spill_bytes:
+                self.spill_bytes = spill_bytes
+                if self.__spill is not None:
+                    # spilled records are lost with their file
+                    for index in list(self.__base):
+                        if index in self.__spill:
+                            self.__base.pop(index)
+                    self.__spill.close()
+                    self.__spill = None
+            self.__evict()
+
+    def put(self, index: int, record: Any) -> None:
+        size = estimate_size(
+            (record.args, record.kwargs, record.return_obj, record.exp_obj)
+        )
+        with self.__lock:
+            self.pop(index)
+            self.__base[index] = record.base_record
+            self.__memory[index] = (record, size)
+            self.memory_bytes += size
+            self.__evict()
+
+    def get(self, index: int, touch: bool = True) -> Optional[Any]:
+        """
+        spilled records are returned as unpickled copies
+        """
+        with self.__lock:
+            entry = self.__memory.get(index)
+            if entry is not None:
+                if touch:
+                    self.__memory.move_to_end(index)
+                return entry[0]
+            data = self.__spill.read(index) if self.__spill is not None else None
+        if data is None:
+            return None
+        return pickle.loads(data)
+
+    def base_records(self) -> Iterable[Tuple[int, Any]]:
+        with self.__lock:
+            return list(self.__base.items())
+
+    def is_spilled(self, index: int) -> bool:
+        return index in self.__base and index not in self.__memory
+
+    def pop(self, index: int) -> bool:
+        with self.__lock:
+            if self.__base.pop(index, None) is None:
+                return False
+            entry = self.__memory.pop(index, None)
+            if entry is not None:
+                self.memory_bytes -= entry[1]
+            if self.__spill is not None:
+                self.__spill.remove(index)
+            return True
+
+    def clear(self) -> None:
+        with self.__lock:
+            self.__base.clear()
+            self.__memory.clear()
+            self.memory_bytes = 0
+            if self.__spill is not None:
+                self.__spill.close()
+                self.__spill = None
+
+    def __contains__(self, index: int) -> bool:
+        return index in self.__base
+
+    def __len__(self) -> int:
+        return len(self.__base)
+
+    def __evict(self) -> None:
+        while self.memory_bytes > self.budget_bytes and self.__memory:
+            index, (record, size) = self.__memory.popitem(last=False)
+            self.memory_bytes -= size
+            if not self.__spill_record(index, record):
+                self.__base.pop(index, None)
+
+    def __spill_record(self, index: int, record: Any) -> bool:
+        if self.spill_bytes <= 0:
+            return False
+        try:
+            data = pickle.dumps(record)
+        except Exception as e:
+            logger.warning(f"tt record {index} is not picklable, dropped: {e}")
+            return False
+        if self.__spill is None:
+            self.__spill = SpillFile(self.spill_bytes)
+        for overwritten in self.__spill.write(index, data):
+            self.__base.pop(overwritten, None)
+        return index in self.__spill
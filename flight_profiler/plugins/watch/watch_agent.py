@@ -10,6 +10,7 @@ import types
 from types import CodeType
 
 from flight_profiler.common import aop_decorator
+from flight_profiler.common.call_sampler import CallSampler
 from flight_profiler.common.code_wrapper_entity import CodeWrapperResult
 from flight_profiler.common.enter_exit_command import EnterExitCommand
 from flight_profiler.common.expression_resolver import FilterExprResolver
@@ -41,9 +42,10 @@ class WatchSetting(EnterExitCommand):
         max_count: int = 10,
         out_q: ServerQueue = None,
         need_wrap_nested_inplace: bool = False,
-        nested_code_obj: CodeType = None
+        nested_code_obj: CodeType = None,
+        sampler: CallSampler = None,
     ):
-        super().__init__(limit=max_count)
+        super().__init__(limit=max_count, sampler=sampler)
         self.module_name = module_name
         self.class_name = class_name
         self.method_name = method_name
@@ -99,21 +101,72 @@ class WatchSetting(EnterExitCommand):
         del state["watch_filter"]
         del state["out_q"]
         del state["origin_code"]
+        del state["native_wrapper"]
+        del state["sampler"]
         return str(json.dumps(state))
 
+    def split_target(self, args):
+        # filter class method self
+        if self.class_name is not None and self.nested_method is None:
+            return args[0], args[1:]
+        return None, args
+
+    def record_return(self, start_ms, time_cost, return_obj, args, kwargs, filter_failed):
+        """
+        native wrapper callback for calls passed the filter, the filter is only
+        evaluated again to report the error when it raised
+        """
+        target_obj, new_args = self.split_target(args)
+        try:
+            self.__dump_result(
+                start_ms, target_obj, time_cost, return_obj, new_args, kwargs,
+                not filter_failed,
+            )
+        except:
+            logger.error(traceback.format_exc())
+
+    def record_error(self, start_ms, time_cost, error, args, kwargs, filter_failed):
+        target_obj, new_args = self.split_target(args)
+        try:
+            msg = "".join(
+                traceback.format_exception(type(error), error, error.__traceback__)
+            )
+            self.__dump_error(
+                start_ms, target_obj, time_cost, msg, new_args, kwargs,
+                not filter_failed,
+            )
+        except:
+            logger.error(traceback.format_exc())
+
     def dump_result(self, start_ms, target_obj, time_cost, return_obj, *args, **kwargs):
+        self.__dump_result(
+            start_ms, target_obj, time_cost, return_obj, args, kwargs, False
+        )
+
+    def dump_error(self, start_ms, target_obj, time_cost, err_text, *args, **kwargs):
+        self.__dump_error(start_ms, target_obj, time_cost, err_text, args, kwargs, False)
+
+    def __dump_result(
+        self, start_ms, target_obj, time_cost, return_obj, args, kwargs, filter_passed
+    ):
         # filter params or return obj
         try:
-            if self.watch_filter.eval_filter(
-                target_obj, return_obj, time_cost, *args, **kwargs
-            ):
+            if (
+                filter_passed
+                or self.watch_filter.eval_filter(
+                    target_obj, return_obj, time_cost, *args, **kwargs
+                )
+            ) and self.admits(time_cost):
                 # dump watch params/return obj to json
                 json_str = self.watch_displayer.dump(
                     start_ms, target_obj, time_cost, return_obj, *args, **kwargs
                 )
                 if self.out_q is not None:
-                    self.out_q.output_msg_nowait(
-                        Message(False, json_str)
+                    self.record(
+                        time_cost,
+                        functools.partial(
+                            self.out_q.output_msg_nowait, Message(False, json_str)
+                        ),
                     )
         except:
             if self.out_q is not None:
@@ -132,19 +185,27 @@ class WatchSetting(EnterExitCommand):
                     )
                 )
 
-    def dump_error(self, start_ms, target_obj, time_cost, err_text, *args, **kwargs):
+    def __dump_error(
+        self, start_ms, target_obj, time_cost, err_text, args, kwargs, filter_passed
+    ):
         # filter params or return obj
         try:
-            if self.watch_filter.eval_filter(
-                target_obj, None, time_cost, *args, **kwargs
-            ):
+            if (
+                filter_passed
+                or self.watch_filter.eval_filter(
+                    target_obj, None, time_cost, *args, **kwargs
+                )
+            ) and self.admits(time_cost):
                 # dump watch params/return obj to json
                 json_str = self.watch_displayer.dump_error(
                     start_ms, target_obj, time_cost, err_text, *args, **kwargs
                 )
                 if self.out_q is not None:
-                    self.out_q.output_msg_nowait(
-                        Message(False, json_str)
+                    self.record(
+                        time_cost,
+                        functools.partial(
+                            self.out_q.output_msg_nowait, Message(False, json_str)
+                        ),
                     )
         except:
             if self.out_q is not None:
@@ -227,6 +288,24 @@ def wrapper_generator(watch_setting: WatchSetting):
                 else:
                     return await func(*args, **kwargs)
 
+        elif watch_setting.build_native_wrapper(
+            watch_setting.watch_filter,
+            watch_setting.class_name is not None,
+            on_return=(
+                None if watch_setting.record_on_exception else watch_setting.record_return
+            ),
+            on_error=watch_setting.record_error,
+        ):
+
+            # enter/exit, timing and filtering are done by aop_C
+            @functools.wraps(func)
+            def wrapped(*args, **kwargs):
+                native_wrapper = watch_setting.native_wrapper
+                if native_wrapper is None:
+                    # released while the method is being restored
+                    return func(*args, **kwargs)
+                return native_wrapper(func, *args, **kwargs)
+
         else:
 
             @functools.wraps(func)
@@ -368,6 +447,8 @@ class WatchAgent(object):
             )
             return None
         self.aop_points.pop(old_setting.unique_key())
+        if old_setting.sampler is not None:
+            old_setting.sampler.close()
         if old_setting.origin_code is not None:
             module = old_setting.import_module()
             aop_decorator.clear_func_wrapper(
@@ -377,6 +458,7 @@ class WatchAgent(object):
                 old_setting.origin_code,
             )
             old_setting.out_q.output_msg_nowait(Message(True, None))
+            old_setting.release_native_wrapper()
         else:
             logger.warning(
                 f"old watch setting {old_setting.unique_key()} exists, but no origin function is stored"
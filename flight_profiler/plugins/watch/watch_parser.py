@@ -1,6 +1,10 @@
 import argparse
 from argparse import RawTextHelpFormatter
 
+from flight_profiler.common.call_sampler import (
+    add_sampling_arguments,
+    create_sampler,
+)
 from flight_profiler.help_descriptions import WATCH_COMMAND_DESCRIPTION
 from flight_profiler.plugins.watch import watch_agent
 from flight_profiler.utils.args_util import rewrite_args
@@ -75,6 +79,7 @@ class WatchArgumentParser(argparse.ArgumentParser):
             default=10,
             help="max display count",
         )
+        add_sampling_arguments(self)
 
     def error(self, message):
         raise Exception(message)
@@ -96,5 +101,6 @@ class WatchArgumentParser(argparse.ArgumentParser):
             expand_level=getattr(args, "expand"),
             verbose=getattr(args, "verbose"),
             max_count=getattr(args, "limits"),
+            sampler=create_sampler(args),
         )
         return watch_setting
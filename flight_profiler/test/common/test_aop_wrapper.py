@@ -0,0 +1,123 @@
+import gc
+import unittest
+import weakref
+
+from flight_profiler.common.expression_resolver import FilterExprResolver
+from flight_profiler.ext.aop_C import AopWrapper
+
+
+class Target:
+
+    def __init__(self, x: int):
+        self.x = x
+
+    def add(self, y: int, z: int = 0) -> int:
+        return self.x + y + z
+
+
+def fail(message: str):
+    raise ValueError(message)
+
+
+class AopWrapperTest(unittest.TestCase):
+
+    def setUp(self):
+        self.records = []
+        self.filter_failed = []
+        self.finished = 0
+
+    def on_record(self, start_ms, cost_ms, value, args, kwargs, filter_failed):
+        self.records.append((value, args, kwargs))
+        self.filter_failed.append(filter_failed)
+
+    def on_finish(self):
+        self.finished += 1
+
+    def test_limit(self):
+        wrapper = AopWrapper(2, self.on_finish, on_return=self.on_record)
+        target = Target(1)
+        for i in range(3):
+            self.assertEqual(1 + i, wrapper(Target.add, target, i))
+        self.assertEqual(
+            [(1, (target, 0), {}), (2, (target, 1), {})], self.records
+        )
+        self.assertEqual(1, self.finished)
+        self.assertEqual(2, wrapper.count)
+        self.assertEqual(2, wrapper.finished)
+
+    def test_filter(self):
+        for expr in ["args[0] > 1 and target.x == 1", "len(args) == 1 and not kwargs"]:
+            self.records.clear()
+            wrapper = AopWrapper(
+                10,
+                self.on_finish,
+                FilterExprResolver(expr).native_filter(),
+                True,
+                on_return=self.on_record,
+            )
+            target = Target(1)
+            wrapper(Target.add, target, 1, z=3)
+            wrapper(Target.add, target, 2)
+            self.assertEqual([(3, (target, 2), {})], self.records, expr)
+            self.assertEqual(2, wrapper.finished)
+
+    def test_collected(self):
+        class Command:
+            def __init__(self):
+                self.wrapper = AopWrapper(
+                    1, self.on_finish, lambda *args: True, on_return=self.on_return
+                )
+
+            def on_return(self, *args):
+                pass
+
+            def on_finish(self):
+                pass
+
+        command = Command()
+        ref = weakref.ref(command)
+        # the wrapper holding bound methods of its command is a cycle
+        del command
+        gc.collect()
+        self.assertIsNone(ref())
+
+    def test_error(self):
+        wrapper = AopWrapper(
+            10,
+            self.on_finish,
+            FilterExprResolver("args[0] == 'a' or args[1]").native_filter(),
+            on_error=self.on_record,
+        )
+        with self.assertRaises(ValueError):
+            wrapper(fail, "a")
+        # filter errors are reported by the callbacks
+        with self.assertRaises(ValueError):
+            wrapper(fail, "b")
+        self.assertEqual(2, len(self.records))
+        # args[1] raises for "b", the callback evaluates the filter again
+        self.assertEqual([False, True], self.filter_failed)
+        error, args, kwargs = self.records[0]
+        self.assertEqual("a", str(error))
+        self.assertEqual(("a",), args)
+
+    def test_filter_before(self):
+        calls = []
+
+        def on_call(func, args, kwargs):
+            calls.append(args)
+            return func(*args, **kwargs)
+
+        target = Target(1)
+        wrapper = AopWrapper(
+            2,
+            self.on_finish,
+            FilterExprResolver("target.x == 1 and args[0] is target").native_filter(),
+            True,
+            keep_self=True,
+            filter_before=True,
+            on_call=on_call,
+        )
+        self.assertEqual(3, wrapper(Target.add, Target(2), 1))
+        self.assertEqual(2, wrapper(Target.add, target, 1))
+        self.assertEqual([(target, 1)], calls)
+        self.assertEqual(1, self.finished)
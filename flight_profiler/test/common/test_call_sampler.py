@@ -0,0 +1,77 @@
+import time
+import unittest
+
+from flight_profiler.common.call_sampler import CallSampler
+from flight_profiler.ext.aop_C import AopWrapper
+
+
+class CallSamplerTest(unittest.TestCase):
+
+    def setUp(self):
+        self.emitted = []
+        self.finished = 0
+
+    def emit(self, value):
+        return lambda: self.emitted.append(value)
+
+    def on_limit(self):
+        self.finished += 1
+
+    def test_create(self):
+        self.assertIsNone(CallSampler.create(None, None, None, 5))
+        sampler = CallSampler.create(10, None, None, 5)
+        self.assertEqual(10, sampler.sample_every)
+        self.assertEqual(0, sampler.slowest)
+
+    def test_rate(self):
+        sampler = CallSampler(rate=2)
+        sampled = [sampler.sample_call() for _ in range(5)]
+        self.assertEqual(2, sum(sampled))
+        # not slowest mode, records are emitted at once
+        sampler.bind(10, self.on_limit)
+        sampler.record(1, self.emit(1))
+        self.assertEqual([1], self.emitted)
+
+    def test_sample_every(self):
+        sampler = CallSampler(sample_every=4)
+        sampled = sum(sampler.sample_call() for _ in range(4000))
+        self.assertTrue(500 < sampled < 1500, sampled)
+
+    def test_slowest(self):
+        sampler = CallSampler(slowest=2, window_s=60)
+        sampler.bind(3, self.on_limit)
+        for cost in [1, 5, 3, 4]:
+            if sampler.admits(cost):
+                sampler.record(cost, self.emit(cost))
+        self.assertFalse(sampler.admits(2))
+        self.assertTrue(sampler.admits(6))
+        self.assertEqual([], self.emitted)
+        sampler.flush()
+        # emitted in call order
+        self.assertEqual([5, 4], self.emitted)
+        sampler.record(7, self.emit(7))
+        sampler.record(8, self.emit(8))
+        sampler.flush()
+        self.assertEqual([5, 4, 7], self.emitted)
+        self.assertEqual(1, self.finished)
+
+    def test_native_wrapper(self):
+        records = []
+
+        def on_return(start_ms, cost_ms, value, args, kwargs, filter_failed):
+            records.append(value)
+
+        wrapper = AopWrapper(100, self.on_limit, rate=2, on_return=on_return)
+        for i in range(5):
+            self.assertEqual(i, wrapper(abs, i))
+        self.assertEqual(2, len(records))
+        # calls skipped by sampling do not count to the limit
+        self.assertEqual(2, wrapper.count)
+
+        records.clear()
+        wrapper = AopWrapper(100, self.on_limit, on_return=on_return)
+        wrapper.set_cost_floor(1000, time.time() + 60)
+        wrapper(abs, 1)
+        wrapper.set_cost_floor(1000, time.time() - 1)
+        wrapper(abs, 2)
+        self.assertEqual([2], records)
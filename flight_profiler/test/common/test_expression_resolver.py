@@ -0,0 +1,82 @@
+import unittest
+
+from flight_profiler.common.expression_resolver import (
+    FilterExprResolver,
+    MethodInvocationExprResolver,
+    compile_filter_program,
+)
+
+
+class Request:
+
+    def __init__(self, path: str, size: int):
+        self.path = path
+        self.size = size
+        self.headers = {"user": "admin"}
+
+
+class ExpressionResolverTest(unittest.TestCase):
+
+    def test_compile_filter_program(self):
+        self.assertIsNotNone(compile_filter_program("cost > 10"))
+        self.assertIsNotNone(
+            compile_filter_program("args[0].path == '/a' and not kwargs['x']")
+        )
+        self.assertIsNotNone(compile_filter_program("0 < cost <= 5.5"))
+        self.assertIsNotNone(compile_filter_program("return_obj is None"))
+        self.assertIsNotNone(compile_filter_program("args[-1] in (1, 2, -3)"))
+        # calls, globals and computed subscripts run in python
+        self.assertIsNone(compile_filter_program("len(args) > 1"))
+        self.assertIsNone(compile_filter_program("args[cost] == 1"))
+        self.assertIsNone(compile_filter_program("cost * 2 > 1"))
+        self.assertIsNone(compile_filter_program("0 < args[0].size < 5"))
+        self.assertIsNone(compile_filter_program("cost >"))
+
+    def test_native_filter_matches_python(self):
+        request = Request("/a", 3)
+        exprs = [
+            "cost > 10",
+            "0 < cost <= 20",
+            "args[0].path == '/a' and args[1] >= 2",
+            "args[0].headers['user'] != 'admin' or kwargs['flag']",
+            "not kwargs['flag']",
+            "args[1] in [1, 2, 3]",
+            "args[1] not in (1, 2)",
+            "return_obj is None",
+            "target is not None and target.size > -1",
+            "kwargs['flag']",
+        ]
+        for expr in exprs:
+            self.assertIsNotNone(compile_filter_program(expr), expr)
+            native = FilterExprResolver(expr)
+            python = FilterExprResolver(f"({expr}) and True")
+            for target, return_obj, cost, flag in [
+                (request, None, 15, True),
+                (None, 1, 5, False),
+            ]:
+                self.assertEqual(
+                    python.eval_filter(
+                        target, return_obj, cost, request, 2, flag=flag
+                    ),
+                    native.eval_filter(
+                        target, return_obj, cost, request, 2, flag=flag
+                    ),
+                    expr,
+                )
+
+    def test_filter_errors(self):
+        resolver = FilterExprResolver("args[0].missing > 1")
+        with self.assertRaises(AttributeError):
+            resolver.eval_filter(None, None, 0, Request("/a", 1))
+        with self.assertRaises(IndexError):
+            resolver.eval_filter(None, None, 0)
+        self.assertTrue(FilterExprResolver(None).eval_filter(None, None, 0))
+        resolver = FilterExprResolver("len(args) >")
+        for _ in range(2):
+            with self.assertRaises(SyntaxError):
+                resolver.eval_filter(None, None, 0)
+
+    def test_method_invocation_expr(self):
+        resolver = MethodInvocationExprResolver("(args[0].path, return_obj)")
+        self.assertEqual(("/a", 1), resolver.eval(None, 1, Request("/a", 1)))
+        self.assertEqual(("/b", 2), resolver.eval(None, 2, Request("/b", 1)))
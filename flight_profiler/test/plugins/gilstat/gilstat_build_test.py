@@ -0,0 +1,41 @@
+import unittest
+
+from flight_profiler.plugins.gilstat.gilstat_build import (
+    PAUSE_SYMBOLS,
+    describe_build,
+    resolve_gil_symbols,
+)
+
+ADDRESSES = {
+    "take_gil": 0x100,
+    "drop_gil": 0x200,
+    "_PyCriticalSection_BeginSlow": 0x300,
+    "_PyEval_StopTheWorld": 0x400,
+    "_PyEval_StartTheWorld": 0x500,
+}
+
+
+class GilBuildTest(unittest.TestCase):
+
+    def test_default_build(self):
+        symbols = resolve_gil_symbols(ADDRESSES.get, False, True)
+        self.assertTrue(symbols.has_gil())
+        self.assertEqual((0x100, 0x200), (symbols.take_gil, symbols.drop_gil))
+        # pause functions of default builds are no-ops
+        self.assertEqual((0,) * len(PAUSE_SYMBOLS), symbols.pauses)
+
+    def test_free_threaded_build(self):
+        symbols = resolve_gil_symbols(ADDRESSES.get, True, False)
+        self.assertFalse(symbols.has_gil())
+        # missing symbols are not hooked
+        self.assertEqual((0x300, 0, 0x400, 0x500), symbols.pauses)
+        symbols = resolve_gil_symbols(ADDRESSES.get, True, True)
+        self.assertTrue(symbols.has_gil())
+        self.assertEqual((0x300, 0, 0x400, 0x500), symbols.pauses)
+        self.assertEqual(
+            "free-threaded build without the gil", describe_build(True, False)
+        )
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,65 @@
+import threading
+import unittest
+
+from flight_profiler.plugins.gilstat.gilstat_hogs import GilHogs, format_code_frame
+
+MS = 1000000
+
+
+def leaf():
+    return 1
+
+
+def caller():
+    return leaf()
+
+
+class GilHogsTest(unittest.TestCase):
+
+    def samples(self):
+        ident = threading.get_ident()
+        leaf_code, caller_code = leaf.__code__, caller.__code__
+        return [
+            (ident, 10 * MS, ((leaf_code, 10), (caller_code, 14))),
+            (ident, 30 * MS, ((leaf_code, 10), (caller_code, 14))),
+            (0xABC, 20 * MS, ((caller_code, 14),)),
+            # thread without python frames
+            (ident, 50 * MS, ()),
+        ]
+
+    def test_top_sites(self):
+        hogs = GilHogs()
+        hogs.add(2, self.samples())
+        self.assertEqual(3, hogs.samples)
+        self.assertEqual(2, hogs.dropped)
+        self.assertEqual(60 * MS, hogs.hold_total_ns)
+        top = hogs.top_sites()
+        self.assertEqual(
+            [format_code_frame(leaf.__code__, 10), format_code_frame(caller.__code__, 14)],
+            [site.name for site in top],
+        )
+        self.assertEqual((2, 40 * MS, 30 * MS), (top[0].count, top[0].hold_total_ns, top[0].hold_max_ns))
+        self.assertEqual({threading.current_thread().name: 40 * MS}, top[0].threads)
+        # threads not alive are shown by id
+        self.assertEqual({"abc": 20 * MS}, top[1].threads)
+        table = hogs.render_table(top=1)
+        self.assertIn("leaf (", table)
+        self.assertIn("66.7", table)
+        self.assertIn("1 call sites more", table)
+        self.assertIn("2 long holds dropped", table)
+
+    def test_flamegraph(self):
+        hogs = GilHogs()
+        hogs.add(0, self.samples())
+        stacks = dict((tuple(stack), us) for stack, us in hogs.collapsed())
+        caller_frame = format_code_frame(caller.__code__, 14)
+        leaf_frame = format_code_frame(leaf.__code__, 10)
+        # outermost first, weighted by micro seconds held
+        self.assertEqual({(caller_frame, leaf_frame): 40000, (caller_frame,): 20000}, stacks)
+        svg = hogs.render_svg(1)
+        self.assertTrue(svg.startswith("<?xml") or svg.startswith("<svg"))
+        self.assertIn("gil hogs pid 1", svg)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -62,8 +62,38 @@ class GilStatPluginTest(unittest.TestCase):
         finally:
             integration.stop()
 
+    def test_gil_hogs(self):
+        # frames are taken from the tstate argument of drop_gil, whose index
+        # differs between versions, so this runs on every supported version
+        current_directory = os.path.dirname(os.path.abspath(__file__))
+        file = os.path.join(current_directory, "gilstat_server_script.py")
+        integration = ProfileIntegration()
+        integration.start(file, 20)
+        try:
+            integration.execute_profile_cmd("gilstat hogs 5 1")
+            process = integration.client_process
+            report = ""
+            start = time.time()
+            while time.time() - start < 20:
+                output = process.stdout.readline()
+                print(output)
+                if output:
+                    report += str(output)
+                    if report.find("gilstat_server_script.py") >= 0:
+                        break
+                else:
+                    break
+
+            self.assertIn("top gil hogs by call site", report)
+            self.assertIn("gilstat_server_script.py", report)
+        except:
+            raise
+        finally:
+            integration.stop()
+
 
 if __name__ == "__main__":
     test = GilStatPluginTest()
     test.test_gil_stat()
     test.test_gil_warning()
+    test.test_gil_hogs()
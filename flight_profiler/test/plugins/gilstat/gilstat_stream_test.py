@@ -0,0 +1,183 @@
+import os
+import struct
+import tempfile
+import unittest
+
+from flight_profiler.plugins.gilstat.gilstat_render import (
+    render_gil_batch_report,
+    render_gil_stream_report,
+)
+from flight_profiler.plugins.gilstat.gilstat_stream import (
+    GIL_STREAM_MAGIC,
+    GIL_STREAM_PROCESS,
+    GIL_STREAM_REPORT,
+    GIL_STREAM_THREAD,
+    GIL_STREAM_VERSION,
+    GIL_STREAM_WARNING,
+    HEADER,
+    PERCENTILES,
+    RECORD_HEADER,
+    REPORT,
+    THREAD,
+    WARNING,
+    GilStreamReader,
+)
+
+HEADER_SIZE = 4096
+CAPACITY = 1024
+
+
+class StreamWriter:
+    """
+    python twin of csrc/gil_stat_stream.cpp, enough to feed the reader
+    """
+
+    def __init__(self, path: str):
+        self.path = path
+        self.write_pos = 0
+        self.dropped_reports = 0
+        self.closed = 0
+        with open(path, "wb") as f:
+            f.write(b"\0" * (HEADER_SIZE + CAPACITY))
+        self._write_header(read_pos=0)
+
+    def _write_header(self, read_pos: int):
+        with open(self.path, "r+b") as f:
+            f.write(
+                HEADER.pack(
+                    GIL_STREAM_MAGIC,
+                    GIL_STREAM_VERSION,
+                    HEADER_SIZE,
+                    CAPACITY,
+                    self.write_pos,
+                    read_pos,
+                    self.dropped_reports,
+                    os.getpid(),
+                    self.closed,
+                )
+            )
+
+    def _read_pos(self) -> int:
+        with open(self.path, "rb") as f:
+            return HEADER.unpack(f.read(HEADER.size))[5]
+
+    def commit(self, records):
+        data = b"".join(
+            RECORD_HEADER.pack(t, 0, RECORD_HEADER.size + len(body)) + body
+            for t, body in records
+        )
+        read_pos = self._read_pos()
+        with open(self.path, "r+b") as f:
+            for i, byte in enumerate(data):
+                f.seek(HEADER_SIZE + (self.write_pos + i) % CAPACITY)
+                f.write(bytes([byte]))
+        self.write_pos += len(data)
+        self._write_header(read_pos)
+
+    def close(self):
+        self.closed = 1
+        self._write_header(self._read_pos())
+
+
+def percentiles(count, base):
+    return PERCENTILES.pack(count, base, base * 2, base * 3, base * 4, base * 5)
+
+
+def report_records(time_ns, thread_id):
+    thread = THREAD.pack(thread_id, b"worker", 10, 1000, 500, 10, 50) + b"".join(
+        percentiles(10, b) for b in (100, 50, 5)
+    )
+    process = b"".join(percentiles(10, b) for b in (100, 50, 5))
+    warning = WARNING.pack(thread_id, b"worker", 1, 0, 7000, 5000, time_ns, time_ns + 7000)
+    return [
+        (GIL_STREAM_REPORT, REPORT.pack(time_ns, 0, 3)),
+        (GIL_STREAM_THREAD, thread),
+        (GIL_STREAM_PROCESS, process),
+        (GIL_STREAM_WARNING, warning),
+    ]
+
+
+class GilStatStreamTest(unittest.TestCase):
+
+    def setUp(self):
+        fd, self.path = tempfile.mkstemp()
+        os.close(fd)
+
+    def tearDown(self):
+        os.unlink(self.path)
+
+    def test_read_reports(self):
+        writer = StreamWriter(self.path)
+        reader = GilStreamReader(self.path)
+        try:
+            self.assertEqual([], reader.read_reports())
+            writer.commit(report_records(1_700_000_000_000_000_000, 0x7F01))
+            reports = reader.read_reports()
+            self.assertEqual(1, len(reports))
+            report = reports[0]
+            self.assertEqual(3, report.dropped_warnings)
+            self.assertEqual(1, len(report.threads))
+            thread = report.threads[0]
+            self.assertEqual(0x7F01, thread.thread_id)
+            self.assertEqual("worker", thread.thread_name)
+            self.assertEqual(300, thread.take.p99)
+            self.assertEqual(250, report.process.hold.max)
+            self.assertEqual("hold_gil", report.warnings[0].event)
+            self.assertEqual(7000, report.warnings[0].cost_ns)
+
+            text = render_gil_stream_report(report)
+            self.assertIn("gil warning report:", text)
+            self.assertIn("gil percentile report:", text)
+            self.assertIn("3 warnings dropped since last report", text)
+            self.assertFalse(reader.closed)
+        finally:
+            reader.close()
+
+    def test_read_wrapped_reports(self):
+        writer = StreamWriter(self.path)
+        reader = GilStreamReader(self.path)
+        try:
+            # each report is a few hundred bytes, the ring wraps after a few of them
+            for i in range(10):
+                writer.commit(report_records(1_700_000_000_000_000_000 + i, i + 1))
+                reports = reader.read_reports()
+                self.assertEqual(1, len(reports))
+                self.assertEqual(i + 1, reports[0].threads[0].thread_id)
+                self.assertEqual(i + 1, reports[0].warnings[0].thread_id)
+            self.assertGreater(writer.write_pos, CAPACITY)
+            writer.close()
+            self.assertTrue(reader.closed)
+            self.assertEqual([], reader.read_reports())
+        finally:
+            reader.close()
+
+    def test_render_batch_report(self):
+        writer = StreamWriter(self.path)
+        reader = GilStreamReader(self.path)
+        try:
+            writer.commit(report_records(1_700_000_000_000_000_000, 1))
+            first = reader.read_reports()[0]
+            writer.commit(report_records(1_700_000_000_000_000_001, 2))
+            second = reader.read_reports()[0]
+        finally:
+            reader.close()
+        second.process.take.p99 = 900
+        text = render_gil_batch_report({202: second, 101: first})
+        rows = [line.split() for line in text.splitlines()[3:]]
+        # rows of each pid sorted by pid, then the merged rows
+        self.assertEqual(
+            ["101"] * 3 + ["202"] * 3 + ["all"] * 3, [row[0] for row in rows]
+        )
+        take = rows[6]
+        self.assertEqual("take_gil", take[3])
+        self.assertEqual("2", take[1])
+        # counts add up, percentiles are those of the worst process
+        self.assertEqual("20", take[4])
+        self.assertEqual("900", take[8])
+        self.assertNotIn("all", render_gil_batch_report({101: first}))
+
+    def test_reject_unknown_file(self):
+        with open(self.path, "wb") as f:
+            f.write(b"\0" * HEADER_SIZE)
+        with self.assertRaises(ValueError):
+            GilStreamReader(self.path)
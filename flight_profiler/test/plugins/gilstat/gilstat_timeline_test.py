@@ -0,0 +1,141 @@
+import json
+import os
+import tempfile
+import unittest
+
+from flight_profiler.plugins.gilstat.gilstat_timeline import (
+    HOLDER_TID,
+    TIMELINE_EVENT,
+    GilThreadTimeline,
+    holder_slices,
+    to_chrome_trace,
+    to_perfetto_trace,
+    write_timeline,
+)
+
+MS = 1000000
+
+
+def make_timelines():
+    # main takes at 0 waits 1ms, holds until 5ms, worker waits from 2ms to 5ms
+    main = TIMELINE_EVENT.pack(0, 1 * MS, 4 * MS, 5 * MS)
+    worker = TIMELINE_EVENT.pack(2 * MS, 5 * MS, 7 * MS, 8 * MS)
+    return GilThreadTimeline.from_dump(
+        [
+            (11, 101, "main", 0, main),
+            (22, 0, "worker", 3, worker),
+            (33, 303, "idle", 0, b""),
+        ]
+    )
+
+
+def read_varint(buf, pos):
+    value, shift = 0, 0
+    while True:
+        byte = buf[pos]
+        pos += 1
+        value |= (byte & 0x7F) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def decode(buf):
+    """
+    {field: [values]} of one protobuf message, length delimited fields are bytes
+    """
+    fields = {}
+    pos = 0
+    while pos < len(buf):
+        key, pos = read_varint(buf, pos)
+        if key & 7 == 0:
+            value, pos = read_varint(buf, pos)
+        else:
+            size, pos = read_varint(buf, pos)
+            value, pos = buf[pos : pos + size], pos + size
+        fields.setdefault(key >> 3, []).append(value)
+    return fields
+
+
+class GilTimelineTest(unittest.TestCase):
+
+    def test_from_dump(self):
+        timelines = make_timelines()
+        # threads without cycles are left out
+        self.assertEqual(["main", "worker"], [t.name for t in timelines])
+        self.assertEqual(101, timelines[0].tid)
+        # pthread id when the native one is unknown
+        self.assertEqual(22, timelines[1].tid)
+        self.assertEqual(3, timelines[1].lost)
+        self.assertEqual([(2 * MS, 5 * MS, 7 * MS, 8 * MS)], timelines[1].cycles)
+
+    def test_holder_slices(self):
+        slices = holder_slices(make_timelines())
+        self.assertEqual(
+            [(1 * MS, 5 * MS, "main (101)"), (5 * MS, 8 * MS, "worker (22)")], slices
+        )
+
+    def test_chrome_trace(self):
+        trace = to_chrome_trace(make_timelines(), 7)
+        events = trace["traceEvents"]
+        names = {
+            e["tid"]: e["args"]["name"] for e in events if e["name"] == "thread_name"
+        }
+        self.assertEqual({HOLDER_TID: "GIL holder", 101: "main", 22: "worker"}, names)
+        worker = [
+            (e["name"], e["ts"], e["dur"])
+            for e in events
+            if e["ph"] == "X" and e["tid"] == 22
+        ]
+        self.assertEqual(
+            [("take_gil", 2000, 3000), ("hold_gil", 5000, 3000), ("drop_gil", 7000, 1000)],
+            worker,
+        )
+        holder = [e["name"] for e in events if e["ph"] == "X" and e["tid"] == HOLDER_TID]
+        self.assertEqual(["main (101)", "worker (22)"], holder)
+
+    def test_perfetto_trace(self):
+        packets = [
+            decode(p) for p in decode(to_perfetto_trace(make_timelines(), 7, 100))[1]
+        ]
+        self.assertEqual([1], packets[0][13])
+        self.assertTrue(all(p[13] == [2] for p in packets[1:]))
+        self.assertTrue(all(p[10] == [1] for p in packets))
+        tracks = [decode(p[60][0]) for p in packets if 60 in p]
+        threads = [decode(t[4][0]) for t in tracks if 4 in t]
+        self.assertEqual([101, 22], [t[2][0] for t in threads])
+        self.assertEqual([b"main", b"worker"], [t[5][0] for t in threads])
+        worker_uuid = [t[1][0] for t in tracks if 4 in t][1]
+        worker = []
+        for p in packets:
+            if 11 not in p:
+                continue
+            event = decode(p[11][0])
+            if event[11] == [worker_uuid]:
+                worker.append((event[9][0], event.get(23, [b""])[0], p[8][0]))
+        self.assertEqual(
+            [
+                (1, b"take_gil", 2 * MS + 100),
+                (2, b"", 5 * MS + 100),
+                (1, b"hold_gil", 5 * MS + 100),
+                (1, b"drop_gil", 7 * MS + 100),
+                (2, b"", 8 * MS + 100),
+                (2, b"", 8 * MS + 100),
+            ],
+            worker,
+        )
+
+    def test_write_timeline(self):
+        with tempfile.TemporaryDirectory() as tmp:
+            json_path = os.path.join(tmp, "gil.json")
+            write_timeline(json_path, make_timelines(), 7)
+            with open(json_path) as f:
+                self.assertIn("traceEvents", json.load(f))
+            pb_path = os.path.join(tmp, "gil.pftrace")
+            write_timeline(pb_path, make_timelines(), 7)
+            with open(pb_path, "rb") as f:
+                self.assertTrue(decode(f.read())[1])
+
+
+if __name__ == "__main__":
+    unittest.main()
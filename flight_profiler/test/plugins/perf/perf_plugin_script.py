@@ -1,4 +1,5 @@
 import math
+import threading
 import time
 
 
@@ -6,6 +7,16 @@ def process_func():
     time.sleep(1)
 
 
+def deep_busy(depth):
+    # deeper than the frames the sampler keeps, the outer ones are <truncated>
+    if depth > 0:
+        return deep_busy(depth - 1)
+    while True:
+        math.sqrt(time.time())
+
+
+threading.Thread(target=deep_busy, args=(200,), daemon=True).start()
+
 print("plugin unit test script started\n", flush=True)
 
 while True:
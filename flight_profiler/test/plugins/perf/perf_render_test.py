@@ -0,0 +1,97 @@
+import json
+import unittest
+import xml.dom.minidom
+
+from flight_profiler.plugins.perf.perf_parser import PerfParser
+from flight_profiler.plugins.perf.perf_render import (
+    merge_collapsed,
+    parse_collapsed,
+    render_speedscope,
+    render_svg,
+    split_frame,
+    split_states,
+)
+
+COLLAPSED = (
+    "<module> (app.py:10);handle (app.py:5);compute (lib.py:3) 30\n"
+    "<module> (app.py:10);handle (app.py:6) 10\n"
+    "<truncated>;recurse (app.py:20) 2\n"
+)
+
+
+class PerfRenderTest(unittest.TestCase):
+
+    def test_parse_collapsed(self):
+        stacks = parse_collapsed(COLLAPSED + "malformed line\n")
+        self.assertEqual(3, len(stacks))
+        self.assertEqual(
+            ["<module> (app.py:10)", "handle (app.py:5)", "compute (lib.py:3)"],
+            stacks[0][0],
+        )
+        self.assertEqual(30, stacks[0][1])
+        self.assertEqual(("compute", "lib.py", 3), split_frame("compute (lib.py:3)"))
+        self.assertEqual(("<truncated>", "", 0), split_frame("<truncated>"))
+
+    def test_render_speedscope(self):
+        profile = json.loads(render_speedscope(parse_collapsed(COLLAPSED), "test"))
+        frames = profile["shared"]["frames"]
+        sampled = profile["profiles"][0]
+        self.assertEqual("sampled", sampled["type"])
+        self.assertEqual([30, 10, 2], sampled["weights"])
+        self.assertEqual(42, sampled["endValue"])
+        self.assertEqual(
+            ["<module>", "handle", "compute"],
+            [frames[i]["name"] for i in sampled["samples"][0]],
+        )
+        # frames are shared between samples
+        self.assertEqual(sampled["samples"][0][:1], sampled["samples"][1][:1])
+        self.assertNotIn("file", frames[sampled["samples"][2][0]])
+
+    def test_render_svg(self):
+        svg = render_svg(parse_collapsed(COLLAPSED), "test <svg>")
+        xml.dom.minidom.parseString(svg)
+        self.assertIn("handle (app.py:5) (30 samples, 71.43%)", svg)
+        self.assertIn("all (42 samples, 100.00%)", svg)
+        self.assertEqual("", render_svg([], "empty"))
+
+    def test_split_states(self):
+        stacks = parse_collapsed(
+            "[cpu];<module> (app.py:10);compute (lib.py:3) 1500\n"
+            "[gil];<module> (app.py:10);handle (app.py:5) 700\n"
+            "[cpu];<module> (app.py:10) 20\n"
+            "[syscall] 5\n"
+        )
+        states = split_states(stacks)
+        self.assertEqual(["cpu", "gil"], sorted(states))
+        self.assertEqual(
+            (["<module> (app.py:10)", "compute (lib.py:3)"], 1500), states["cpu"][0]
+        )
+        self.assertEqual(1520, sum(count for _, count in states["cpu"]))
+        svg = render_svg(states["gil"], "gil", "us")
+        self.assertIn("handle (app.py:5) (700 us, 100.00%)", svg)
+        self.assertEqual({}, split_states(parse_collapsed(COLLAPSED)))
+
+    def test_merge_collapsed(self):
+        merged = parse_collapsed(
+            merge_collapsed(
+                [COLLAPSED, "<module> (app.py:10);handle (app.py:6) 5\n", ""]
+            )
+        )
+        self.assertEqual(3, len(merged))
+        self.assertEqual(
+            (["<module> (app.py:10)", "handle (app.py:6)"], 15), merged[1]
+        )
+        self.assertEqual(47, sum(count for _, count in merged))
+
+    def test_parse_perf_params(self):
+        parser = PerfParser()
+        params = parser.parse_perf_params("-r 200 -d 5 --format speedscope")
+        self.assertEqual(200, params.sample_rate)
+        self.assertEqual(5, params.duration)
+        self.assertTrue(params.filepath.endswith("flamegraph.speedscope.json"))
+        self.assertEqual("wall", params.mode)
+        params = parser.parse_perf_params("--mode cpu -f /tmp/out.svg")
+        self.assertEqual("cpu", params.mode)
+        self.assertEqual("/tmp/out.gil.svg", params.state_filepath("gil"))
+        with self.assertRaises(Exception):
+            parser.parse_perf_params("-r 0")
@@ -1,5 +1,4 @@
 import os
-import sys
 import time
 import unittest
 
@@ -7,7 +6,6 @@ from flight_profiler.test.plugins.profile_integration import ProfileIntegration
 from flight_profiler.utils.env_util import is_linux
 
 
-@unittest.skipIf(sys.version_info >= (3, 14), "Perf not supported in Python 3.14+")
 class PerfPluginTest(unittest.TestCase):
 
 
@@ -45,6 +43,34 @@ class PerfPluginTest(unittest.TestCase):
         finally:
             integration.stop()
 
+    def test_perf_cpu_deep_stack(self):
+        if not is_linux():
+            return
+        current_directory = os.path.dirname(os.path.abspath(__file__))
+        file = os.path.join(current_directory, "perf_plugin_script.py")
+        filepath = os.path.join(current_directory, "deep.collapsed")
+        integration = ProfileIntegration()
+        integration.start(file, 15)
+        try:
+            integration.execute_profile_cmd(
+                f"perf -d 3 --mode cpu --format collapsed -f {filepath}"
+            )
+            process = integration.client_process
+            start = time.time()
+            while time.time() - start < 15:
+                output = process.stdout.readline()
+                if not output or "Flamegraph data has been successfully" in output:
+                    break
+            with open(filepath) as f:
+                lines = [line for line in f.read().splitlines() if "<truncated>" in line]
+            self.assertTrue(len(lines) > 0)
+            # state node, <truncated> and the innermost 128 frames
+            self.assertEqual(130, len(lines[0].rsplit(" ", 1)[0].split(";")))
+        finally:
+            if os.path.exists(filepath):
+                os.remove(filepath)
+            integration.stop()
+
 
 if __name__ == "__main__":
     test = PerfPluginTest()
@@ -1,15 +1,32 @@
 import asyncio
-import pickle
+import sys
+import time
 import unittest
 from asyncio import Queue
-
+from concurrent.futures import ThreadPoolExecutor
+
+from flight_profiler.ext.trace_profile_C import (
+    TraceSession,
+    init_clock_source,
+    init_trace_monitoring,
+    release_trace_monitoring,
+    remove_trace_profile,
+    set_trace_monitoring,
+    set_trace_profile,
+)
 from flight_profiler.plugins.server_plugin import Message, ServerQueue
 from flight_profiler.plugins.trace.trace_agent import global_trace_agent
+from flight_profiler.plugins.trace.trace_follow import trace_follow_group
 from flight_profiler.plugins.trace.trace_frame import (
+    FlattenTreeTraceFrame,
+    TraceFrameChunks,
     WrapTraceFrame,
-    deserialize_string_frames,
+    build_frame_stack,
+    decode_trace_frames,
+    encode_trace_frames,
 )
 from flight_profiler.plugins.trace.trace_parser import TracePoint
+from flight_profiler.plugins.trace.trace_render import TraceRender
 
 
 class A:
@@ -24,6 +41,72 @@ def test_func():
     print("hello")
 
 
+def test_long_func():
+    for i in range(10):
+        test_func()
+
+
+def raise_func():
+    raise ValueError("hello")
+
+
+def test_mixed_func():
+    for i in range(3):
+        [].append(i)
+        sorted([2, 1], key=len if i < 0 else abs)
+    try:
+        raise_func()
+    except ValueError:
+        pass
+    return sum(i for i in range(3))
+
+
+def fan_out_func(executor):
+    futures = [executor.submit(test_long_func) for _ in range(2)]
+    return [future.result() for future in futures]
+
+
+def slow_leaf(seconds):
+    if seconds > 0:
+        time.sleep(seconds)
+
+
+def slow_branch(seconds):
+    slow_leaf(seconds)
+
+
+def fast_then_slow_func():
+    # far more fast calls than any per code heuristic would sample before
+    # the one call over the interval
+    for _ in range(1200):
+        slow_branch(0)
+    slow_branch(0.002)
+
+
+def trace_frame_names(
+    set_function, depth: int, func=test_mixed_func, interval_ns: int = 0
+) -> list:
+    messages = []
+
+    def target(out_q, records, session, base=0, late=b"", final=True):
+        messages.append(
+            encode_trace_frames(records, *session.take_descriptions(), base, late, final)
+        )
+
+    profiler = set_function(target, None, interval_ns, False, depth, 0, TraceSession(), 0)
+    func()
+    remove_trace_profile(profiler)
+    wrap = decode_trace_frames(messages[0])
+
+    def names(frame: FlattenTreeTraceFrame, level: int = 0) -> list:
+        result = [(level, frame.method_name)]
+        for sub_frame in frame.sub_frames:
+            result.extend(names(sub_frame, level + 1))
+        return result
+
+    return names(build_frame_stack(wrap.frames))
+
+
 async def async_test_func():
     print("hello")
 
@@ -60,9 +143,7 @@ class TraceAgentTest(unittest.TestCase):
         self.assertIsNotNone(result)
         self.assertIsNotNone(sys_path)
 
-        wrap: WrapTraceFrame = pickle.loads(result.msg)
-        # print(wrap)
-        wrap = deserialize_string_frames(wrap)
+        wrap: WrapTraceFrame = decode_trace_frames(result.msg)
 
         self.assertTrue("test_func" in wrap.frames[0].description)
         self.assertTrue("print" in wrap.frames[1].description)
@@ -75,6 +156,201 @@ class TraceAgentTest(unittest.TestCase):
         global_trace_agent.clear_point(point)
         self.assertTrue(point.unique_key() not in global_trace_agent.aop_points)
 
+    def test_trace_session_descriptions(self):
+        out_q = Queue(maxsize=200)
+        try:
+            loop = asyncio.get_event_loop()
+        except:
+            loop = asyncio.new_event_loop()
+            asyncio.set_event_loop(loop)
+        point = TracePoint(
+            module_name="flight_profiler.test.plugins.trace.trace_agent_test",
+            class_name=None,
+            method_name="test_func",
+            interval=0,
+            out_q=ServerQueue(out_q, loop),
+            limits=10,
+            entrance_time=0,
+            depth=-1
+        )
+        global_trace_agent.set_point(point)
+        test_func()
+        test_func()
+
+        async def get_msg():
+            sys_path: Message = await out_q.get()
+            hello_title = await out_q.get()
+            return await out_q.get(), await out_q.get()
+
+        first, second = loop.run_until_complete(get_msg())
+        # the second call only references descriptions sent with the first one
+        descriptions = []
+        decode_trace_frames(first.msg, descriptions)
+        self.assertEqual(len(point.session), len(descriptions))
+        wrap: WrapTraceFrame = decode_trace_frames(second.msg, descriptions)
+        self.assertEqual(len(point.session), len(descriptions))
+        self.assertLess(len(second.msg), len(first.msg))
+        self.assertTrue("test_func" in wrap.frames[0].description)
+        self.assertTrue("print" in wrap.frames[1].description)
+
+        global_trace_agent.clear_point(point)
+
+    def test_trace_streamed_frames(self):
+        out_q = Queue(maxsize=200)
+        try:
+            loop = asyncio.get_event_loop()
+        except:
+            loop = asyncio.new_event_loop()
+            asyncio.set_event_loop(loop)
+        point = TracePoint(
+            module_name="flight_profiler.test.plugins.trace.trace_agent_test",
+            class_name=None,
+            method_name="test_long_func",
+            interval=0,
+            out_q=ServerQueue(out_q, loop),
+            limits=10,
+            entrance_time=0,
+            depth=-1,
+            flush_frames=4,
+        )
+        global_trace_agent.set_point(point)
+        test_long_func()
+
+        async def get_msgs():
+            sys_path: Message = await out_q.get()
+            hello_title = await out_q.get()
+            msgs = []
+            while out_q.qsize() > 0:
+                msgs.append(await out_q.get())
+            return msgs
+
+        msgs = loop.run_until_complete(get_msgs())
+        self.assertGreater(len(msgs), 1)
+        descriptions = []
+        chunks = TraceFrameChunks()
+        wraps = [chunks.merge(decode_trace_frames(m.msg, descriptions)) for m in msgs]
+        self.assertTrue(all(wrap is None for wrap in wraps[:-1]))
+        wrap: WrapTraceFrame = wraps[-1]
+        # frames still open when a chunk was sent are filled by late records
+        self.assertTrue(all(f is not None for f in wrap.frames))
+        self.assertTrue("test_long_func" in wrap.frames[0].description)
+        self.assertEqual(-1, wrap.frames[0].pid)
+        self.assertEqual(
+            10, len([f for f in wrap.frames if "test_func" in f.description])
+        )
+        self.assertTrue(all(f.pid == 0 for f in wrap.frames if "test_func" in f.description))
+
+        global_trace_agent.clear_point(point)
+
+    def test_trace_follow_executors(self):
+        out_q = Queue(maxsize=200)
+        try:
+            loop = asyncio.get_event_loop()
+        except:
+            loop = asyncio.new_event_loop()
+            asyncio.set_event_loop(loop)
+        point = TracePoint(
+            module_name="flight_profiler.test.plugins.trace.trace_agent_test",
+            class_name=None,
+            method_name="fan_out_func",
+            interval=0,
+            out_q=ServerQueue(out_q, loop),
+            limits=10,
+            entrance_time=0,
+            depth=-1,
+            follow_executors=True,
+        )
+        global_trace_agent.set_point(point)
+        with ThreadPoolExecutor(max_workers=2, thread_name_prefix="follow") as executor:
+            fan_out_func(executor)
+            # submissions outside traced calls are not followed
+            executor.submit(test_long_func).result()
+
+        async def get_msgs():
+            sys_path: Message = await out_q.get()
+            hello_title = await out_q.get()
+            msgs = []
+            while out_q.qsize() > 0:
+                msgs.append(await out_q.get())
+            return msgs
+
+        msgs = loop.run_until_complete(get_msgs())
+        global_trace_agent.clear_point(point)
+        self.assertEqual(1, len(msgs))
+        wrap: WrapTraceFrame = decode_trace_frames(msgs[0].msg)
+        root: FlattenTreeTraceFrame = build_frame_stack(wrap.frames)
+        threads = [f for f in root.sub_frames if f.thread_frame]
+        self.assertEqual(2, len(threads))
+        for thread in threads:
+            self.assertTrue(thread.filename.startswith("follow"))
+            self.assertEqual(["test_long_func"], [f.method_name for f in thread.sub_frames])
+            self.assertEqual(10, len(thread.sub_frames[0].sub_frames))
+            self.assertGreaterEqual(thread.sub_frames[0].start_ns, thread.start_ns)
+        self.assertTrue("[thread]" in TraceRender(root.cost_ns).display(wrap))
+
+    def test_trace_follow_released_on_failure(self):
+        out_q = Queue(maxsize=200)
+        try:
+            loop = asyncio.get_event_loop()
+        except:
+            loop = asyncio.new_event_loop()
+            asyncio.set_event_loop(loop)
+        point = TracePoint(
+            module_name="flight_profiler.test.plugins.trace.trace_agent_test",
+            class_name=None,
+            method_name="fan_out_func",
+            interval=0,
+            out_q=ServerQueue(out_q, loop),
+            limits=10,
+            entrance_time=0,
+            depth=-1,
+            follow_executors=True,
+        )
+        global_trace_agent.set_point(point)
+        # the profiler can't be set with an invalid session
+        session, point.session = point.session, object()
+        try:
+            with ThreadPoolExecutor(max_workers=1) as executor:
+                fan_out_func(executor)
+                # later submissions of this thread are not caught by the group
+                self.assertIsNone(trace_follow_group.get())
+        finally:
+            point.session = session
+            global_trace_agent.clear_point(point)
+
+    def test_trace_monitoring_backend(self):
+        available = init_trace_monitoring()
+        self.assertEqual(sys.version_info >= (3, 12), available)
+        try:
+            for depth in (-1, 2):
+                expected = trace_frame_names(set_trace_profile, depth)
+                self.assertEqual(expected, trace_frame_names(set_trace_monitoring, depth))
+            self.assertEqual((0, "test_mixed_func"), expected[0])
+            self.assertIn((1, "raise_func"), expected)
+            # a code that returned fast many times is still recorded when slow
+            self.assertEqual(0, init_clock_source("raw"))
+            for _ in range(2):
+                expected = trace_frame_names(
+                    set_trace_profile, -1, fast_then_slow_func, 1000000
+                )
+                self.assertEqual(
+                    [
+                        (0, "fast_then_slow_func"),
+                        (1, "slow_branch"),
+                        (2, "slow_leaf"),
+                        (3, "sleep"),
+                    ],
+                    expected,
+                )
+                self.assertEqual(
+                    expected,
+                    trace_frame_names(
+                        set_trace_monitoring, -1, fast_then_slow_func, 1000000
+                    ),
+                )
+        finally:
+            release_trace_monitoring()
+
     def test_trace_async_module_func(self):
         out_q = Queue(maxsize=200)
         try:
@@ -104,8 +380,7 @@ class TraceAgentTest(unittest.TestCase):
         self.assertIsNotNone(result)
         self.assertIsNotNone(sys_path)
 
-        wrap: WrapTraceFrame = pickle.loads(result.msg)
-        wrap = deserialize_string_frames(wrap)
+        wrap: WrapTraceFrame = decode_trace_frames(result.msg)
 
         self.assertTrue("async_test_func" in wrap.frames[0].description)
         self.assertTrue("print" in wrap.frames[1].description)
@@ -147,8 +422,7 @@ class TraceAgentTest(unittest.TestCase):
         self.assertIsNotNone(result)
         self.assertIsNotNone(sys_path)
 
-        wrap: WrapTraceFrame = pickle.loads(result.msg)
-        wrap = deserialize_string_frames(wrap)
+        wrap: WrapTraceFrame = decode_trace_frames(result.msg)
 
         self.assertTrue("test_func" in wrap.frames[0].description)
         self.assertTrue("print" in wrap.frames[1].description)
@@ -190,8 +464,7 @@ class TraceAgentTest(unittest.TestCase):
         self.assertIsNotNone(result)
         self.assertIsNotNone(sys_path)
 
-        wrap: WrapTraceFrame = pickle.loads(result.msg)
-        wrap = deserialize_string_frames(wrap)
+        wrap: WrapTraceFrame = decode_trace_frames(result.msg)
 
         self.assertTrue("async_test_func" in wrap.frames[0].description)
         self.assertTrue("print" in wrap.frames[1].description)
@@ -1,11 +1,19 @@
 import unittest
 
 from flight_profiler.plugins.trace.trace_frame import (
+    TRACE_FRAMES_HEADER,
+    TRACE_LATE_RECORD,
+    TRACE_RECORD,
     FlattenTreeTraceFrame,
+    StringTraceSession,
     TraceFrame,
+    TraceFrameChunks,
     WrapTraceFrame,
     build_frame_stack,
+    decode_trace_frames,
     deserialize_string_frames,
+    encode_trace_frames,
+    pack_string_frames,
 )
 from flight_profiler.test.plugins.trace import SENDING_FRAMES
 
@@ -22,6 +30,94 @@ class TraceFrameTest(unittest.TestCase):
         self.assertEqual(3, len(wrap_frame.frames))
         self.assertEqual(type(wrap_frame.frames[0]), type(raw_trace_frame))
 
+    def test_encode_trace_frames(self):
+        session = StringTraceSession()
+        records = pack_string_frames(SENDING_FRAMES + [None], session)
+        self.assertEqual(3, len(session))
+        wrap_frame = decode_trace_frames(
+            encode_trace_frames(records, *session.take_descriptions())
+        )
+        expected = deserialize_string_frames(WrapTraceFrame(SENDING_FRAMES))
+
+        self.assertEqual(expected.thread_id, wrap_frame.thread_id)
+        self.assertEqual(expected.thread_name, wrap_frame.thread_name)
+        self.assertEqual(expected.is_daemon, wrap_frame.is_daemon)
+        self.assertEqual(4, len(wrap_frame.frames))
+        self.assertIsNone(wrap_frame.frames[3])
+        for frame, expected_frame in zip(wrap_frame.frames, expected.frames):
+            self.assertEqual(expected_frame.description, frame.description)
+            self.assertEqual(expected_frame.start_ns, frame.start_ns)
+            self.assertEqual(expected_frame.cost_ns, frame.cost_ns)
+            self.assertEqual(expected_frame.pid, frame.pid)
+
+    def test_session_descriptions(self):
+        session = StringTraceSession()
+        received = []
+        first = encode_trace_frames(
+            pack_string_frames(SENDING_FRAMES, session), *session.take_descriptions()
+        )
+        decode_trace_frames(first, received)
+        self.assertEqual(3, len(received))
+
+        # known descriptions are not sent again
+        second = encode_trace_frames(
+            pack_string_frames(SENDING_FRAMES[1:], session),
+            *session.take_descriptions(),
+        )
+        header = TRACE_FRAMES_HEADER.unpack_from(second)
+        # first description, descriptions size, record count
+        self.assertEqual((3, 0, 2), (header[6], header[7], header[9]))
+        wrap_frame = decode_trace_frames(second, received)
+        self.assertEqual(3, len(received))
+        self.assertTrue(wrap_frame.frames[1].description.startswith("print"))
+
+        extra = "extra\x00main.py\x001\x011\x011\x010"
+        third = encode_trace_frames(
+            pack_string_frames([extra], session), *session.take_descriptions()
+        )
+        wrap_frame = decode_trace_frames(third, received)
+        self.assertEqual(4, len(received))
+        self.assertEqual("extra\x00main.py\x001", wrap_frame.frames[0].description)
+
+    def test_merge_trace_frame_chunks(self):
+        session = StringTraceSession()
+        records = pack_string_frames(SENDING_FRAMES, session)
+        size = TRACE_RECORD.size
+        first_desc, descriptions = session.take_descriptions()
+        # the traced call and its child are still open after the first chunk,
+        # they are sent as late records
+        empty = TRACE_RECORD.pack(-1, 0, 0, 0)
+        first = encode_trace_frames(
+            empty * 2 + records[2 * size :], first_desc, descriptions, final=False
+        )
+        late = b"".join(
+            TRACE_LATE_RECORD.pack(offset, *TRACE_RECORD.unpack_from(records, offset * size))
+            for offset in (1, 0)
+        )
+        second = encode_trace_frames(b"", len(descriptions), [], 3, late, True)
+
+        received = []
+        chunks = TraceFrameChunks()
+        wrap = decode_trace_frames(first, received)
+        self.assertFalse(wrap.final)
+        self.assertIsNone(chunks.merge(wrap))
+        self.assertEqual(3, chunks.received(wrap.thread_id))
+
+        wrap = decode_trace_frames(second, received)
+        self.assertEqual(3, wrap.base)
+        self.assertEqual(2, len(wrap.late))
+        merged = chunks.merge(wrap)
+        self.assertEqual(0, chunks.received(wrap.thread_id))
+        expected = deserialize_string_frames(WrapTraceFrame(SENDING_FRAMES))
+        self.assertEqual(3, len(merged.frames))
+        for frame, expected_frame in zip(merged.frames, expected.frames):
+            self.assertEqual(expected_frame.description, frame.description)
+            self.assertEqual(expected_frame.cost_ns, frame.cost_ns)
+            self.assertEqual(expected_frame.pid, frame.pid)
+
+        # chunks of a call whose first messages were missed are dropped
+        self.assertIsNone(TraceFrameChunks().merge(wrap))
+
     def test_build_frame_stack(self):
 
         wrap_frame: WrapTraceFrame = deserialize_string_frames(
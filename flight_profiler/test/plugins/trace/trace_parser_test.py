@@ -42,3 +42,40 @@ class TraceParserTest(unittest.TestCase):
         self.assertEqual("test_func", params.method_name)
         self.assertEqual("A", params.class_name)
         self.assertEqual(10, params.interval)
+
+    def test_parse_trace_clock(self):
+        parser = TraceArgumentParser()
+
+        params = parser.parse_trace_point("__main__ test_func")
+        self.assertEqual("auto", params.clock)
+
+        params = parser.parse_trace_point("__main__ A test_func --clock tsc")
+        self.assertEqual("A", params.class_name)
+        self.assertEqual("tsc", params.clock)
+
+        with self.assertRaises(Exception):
+            parser.parse_trace_point("__main__ test_func --clock wall")
+
+    def test_parse_trace_flush(self):
+        parser = TraceArgumentParser()
+
+        params = parser.parse_trace_point("__main__ test_func")
+        self.assertEqual(65536, params.flush_frames)
+
+        params = parser.parse_trace_point("__main__ A test_func --flush 0")
+        self.assertEqual("A", params.class_name)
+        self.assertEqual(0, params.flush_frames)
+
+        with self.assertRaises(Exception):
+            parser.parse_trace_point("__main__ test_func --flush -1")
+
+    def test_parse_trace_follow(self):
+        parser = TraceArgumentParser()
+
+        params = parser.parse_trace_point("__main__ test_func")
+        self.assertFalse(params.follow_executors)
+
+        params = parser.parse_trace_point("__main__ A test_func --follow -i 1")
+        self.assertEqual("A", params.class_name)
+        self.assertTrue(params.follow_executors)
+        self.assertEqual(1, params.interval)
@@ -2,6 +2,7 @@ import asyncio
 import pickle
 import unittest
 from asyncio import Queue
+from unittest import mock
 
 from flight_profiler.plugins.server_plugin import ServerQueue
 from flight_profiler.plugins.tt.time_tunnel_agent import global_tt_agent
@@ -123,6 +124,39 @@ class TimeTunnelAgentTest(unittest.TestCase):
         self.assertIsNotNone(result)
         self.assertTrue("Index 1000 is deleted successfully" in result.msg)
 
+    def test_time_tunnel_filter_evaluated_once(self):
+        global_tt_indexer.refresh()
+        out_q = Queue(maxsize=200)
+        try:
+            loop = asyncio.get_event_loop()
+        except:
+            loop = asyncio.new_event_loop()
+            asyncio.set_event_loop(loop)
+        tt_cmd = TimeTunnelArgumentParser().parse_time_tunnel_cmd(
+            "-t flight_profiler.test.plugins.tt.time_tunnel_agent_test func "
+            "-f \"return_obj is None\""
+        )
+        tt_cmd.out_q = ServerQueue(out_q, loop)
+        global_tt_agent.on_action(tt_cmd)
+        try:
+            # the native wrapper evaluated the filter already
+            with mock.patch.object(
+                tt_cmd.tt_filter, "eval_filter", side_effect=AssertionError
+            ) as eval_filter:
+                func()
+            self.assertEqual(0, eval_filter.call_count)
+
+            async def get_msg_with_title():
+                await out_q.get()
+                return await out_q.get()
+
+            result = loop.run_until_complete(get_msg_with_title())
+            record: BaseInvocationRecord = pickle.loads(result.msg)
+            self.assertEqual("func", record.method_name)
+            self.assertTrue(record.is_ret)
+        finally:
+            global_tt_agent.clear_tt_point(tt_cmd)
+
     def test_time_tunnel_class_method(self):
         global_tt_indexer.refresh()
         out_q = Queue(maxsize=200)
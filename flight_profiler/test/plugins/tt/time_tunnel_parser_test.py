@@ -48,3 +48,15 @@ class TimeTunnelParserTest(unittest.TestCase):
         cmd: TimeTunnelCmd = self.parser.parse_time_tunnel_cmd(list_src)
         self.assertTrue(cmd.show_list)
         self.assertEqual("__main__.A.hello", cmd.method_filter)
+
+        sample_src = "-t __main__ A func --slowest 5 -n 10"
+        cmd: TimeTunnelCmd = self.parser.parse_time_tunnel_cmd(sample_src)
+        self.assertEqual("func", cmd.method_name)
+        self.assertEqual(5, cmd.sampler.slowest)
+        self.assertEqual(5, cmd.sampler.window_s)
+        self.assertIsNone(cmd.budget_mb)
+
+        store_src = "-t __main__ func --budget 16 --spill 256"
+        cmd: TimeTunnelCmd = self.parser.parse_time_tunnel_cmd(store_src)
+        self.assertEqual(16, cmd.budget_mb)
+        self.assertEqual(256, cmd.spill_mb)
@@ -0,0 +1,95 @@
+import threading
+import unittest
+
+from flight_profiler.plugins.tt.time_tunnel_recorder import (
+    BaseInvocationRecord,
+    FullInvocationRecord,
+)
+from flight_profiler.plugins.tt.time_tunnel_store import (
+    SpillFile,
+    TimeTunnelStore,
+    estimate_size,
+)
+
+
+def make_record(index: int, payload) -> FullInvocationRecord:
+    return FullInvocationRecord(
+        BaseInvocationRecord(index, 0, 1.0, True, False, "m", None, "func"),
+        [payload],
+        {},
+        None,
+        None,
+    )
+
+
+class TimeTunnelStoreTest(unittest.TestCase):
+
+    def test_estimate_size(self):
+        small = estimate_size([1])
+        self.assertGreater(estimate_size(["x" * 100000]), small + 100000)
+        payload = "y" * 1000
+        self.assertLess(estimate_size([payload, payload]), 2 * len(payload))
+
+    def test_evict_without_spill(self):
+        store = TimeTunnelStore(budget_bytes=50000)
+        for i in range(10):
+            store.put(i, make_record(i, "x" * 10000))
+        self.assertLessEqual(store.memory_bytes, 50000)
+        self.assertNotIn(0, store)
+        self.assertIn(9, store)
+        self.assertEqual([i for i, _ in store.base_records()], list(range(6, 10)))
+        # recently used records are evicted last
+        store.get(6)
+        store.put(10, make_record(10, "x" * 10000))
+        self.assertIn(6, store)
+        self.assertNotIn(7, store)
+
+    def test_spill(self):
+        store = TimeTunnelStore(budget_bytes=50000, spill_bytes=1 << 20)
+        for i in range(10):
+            store.put(i, make_record(i, str(i) * 10000))
+        self.assertEqual(10, len(store))
+        self.assertTrue(store.is_spilled(0))
+        record = store.get(0)
+        self.assertEqual(0, record.base_record.index)
+        self.assertEqual("0" * 10000, record.args[0])
+        self.assertTrue(store.pop(0))
+        self.assertIsNone(store.get(0))
+        # records not picklable are dropped when evicted
+        store.put(10, make_record(10, threading.Lock()))
+        for i in range(11, 20):
+            store.put(i, make_record(i, "x" * 10000))
+        self.assertNotIn(10, store)
+        store.clear()
+        self.assertEqual(0, len(store))
+
+    def test_spill_ring(self):
+        spill = SpillFile(100)
+        self.assertEqual([], spill.write(1, b"a" * 40))
+        self.assertEqual([], spill.write(2, b"b" * 40))
+        self.assertEqual([1], spill.write(3, b"c" * 30))
+        self.assertEqual([2], spill.write(4, b"d" * 30))
+        self.assertEqual([], spill.write(5, b"e" * 30))
+        self.assertEqual(b"c" * 30, spill.read(3))
+        self.assertIsNone(spill.read(1))
+        self.assertEqual([6], spill.write(6, b"f" * 101))
+        spill.close()
+
+    def test_spill_ring_wrap_past_tail(self):
+        spill = SpillFile(30)
+        for index, data in enumerate((b"A" * 10, b"B" * 10, b"C" * 8, b"D" * 10, b"E" * 10)):
+            spill.write(index, data)
+        self.assertEqual(b"E" * 10, spill.read(4))
+        # wraps before the tail entry C, which is older than D and E but kept
+        self.assertEqual([3, 4], spill.write(5, b"F" * 15))
+        self.assertIsNone(spill.read(3))
+        self.assertIsNone(spill.read(4))
+        self.assertEqual(b"C" * 8, spill.read(2))
+        self.assertEqual(b"F" * 15, spill.read(5))
+        # C is overwritten once the ring reaches it again
+        self.assertEqual([2], spill.write(6, b"G" * 10))
+        self.assertEqual(b"G" * 10, spill.read(6))
+        spill.remove(5)
+        self.assertEqual([6], spill.write(7, b"H" * 17))
+        self.assertEqual(b"H" * 17, spill.read(7))
+        spill.close()
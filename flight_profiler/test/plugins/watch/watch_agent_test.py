@@ -1,6 +1,9 @@
 import asyncio
+import gc
 import pickle
 import unittest
+import weakref
+from unittest import mock
 from asyncio import Queue
 
 from flight_profiler.plugins.server_plugin import ServerQueue
@@ -41,6 +44,8 @@ class WatchAgentTest(unittest.TestCase):
         )
         watch_setting.out_q = ServerQueue(out_q, loop)
         global_watch_agent.add_watch(watch_setting)
+        # sync methods are wrapped natively
+        self.assertIsNotNone(watch_setting.native_wrapper)
         test_func()
 
         async def get_msg():
@@ -64,6 +69,58 @@ class WatchAgentTest(unittest.TestCase):
             not in global_watch_agent.aop_points
         )
 
+    def test_watch_setting_released(self):
+        out_q = Queue(maxsize=200)
+        try:
+            loop = asyncio.get_event_loop()
+        except:
+            loop = asyncio.new_event_loop()
+            asyncio.set_event_loop(loop)
+        watch_setting = WatchArgumentParser().parse_watch_setting(
+            "flight_profiler.test.plugins.watch.watch_agent_test test_func --expr return_obj"
+        )
+        watch_setting.out_q = ServerQueue(out_q, loop)
+        global_watch_agent.add_watch(watch_setting)
+        test_func()
+        global_watch_agent.clear_watch(watch_setting)
+        self.assertIsNone(watch_setting.native_wrapper)
+        ref = weakref.ref(watch_setting)
+        del watch_setting
+        gc.collect()
+        self.assertIsNone(ref())
+
+    def test_watch_filter_evaluated_once(self):
+        out_q = Queue(maxsize=200)
+        try:
+            loop = asyncio.get_event_loop()
+        except:
+            loop = asyncio.new_event_loop()
+            asyncio.set_event_loop(loop)
+        watch_setting = WatchArgumentParser().parse_watch_setting(
+            "flight_profiler.test.plugins.watch.watch_agent_test test_func "
+            "--expr return_obj -f \"return_obj == 'hello'\""
+        )
+        watch_setting.out_q = ServerQueue(out_q, loop)
+        global_watch_agent.add_watch(watch_setting)
+        try:
+            # the native wrapper evaluated the filter already
+            with mock.patch.object(
+                watch_setting.watch_filter, "eval_filter", side_effect=AssertionError
+            ) as eval_filter:
+                test_func()
+            self.assertEqual(0, eval_filter.call_count)
+
+            async def get_msg():
+                await out_q.get()
+                return await out_q.get()
+
+            result = loop.run_until_complete(get_msg())
+            watch_result: WatchResult = pickle.loads(result.msg)
+            self.assertIsNone(watch_result.filter_fail_info)
+            self.assertEqual("\"hello\"", watch_result.value)
+        finally:
+            global_watch_agent.clear_watch(watch_setting)
+
     def test_watch_module_async_func(self):
         out_q = Queue(maxsize=200)
         watch_setting = WatchArgumentParser().parse_watch_setting(
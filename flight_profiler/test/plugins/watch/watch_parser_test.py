@@ -36,3 +36,22 @@ class WatchParserTest(unittest.TestCase):
         self.assertEqual("args[0]['query']=='hello'", params.filter_expr)
         self.assertEqual(3 + 2, params.watch_displayer.expand_level)
         self.assertTrue(params.record_on_exception)
+
+    def test_parse_sampling_args(self):
+        parser = WatchArgumentParser()
+        params = parser.parse_watch_setting("__main__ test_func")
+        self.assertIsNone(params.sampler)
+
+        params = parser.parse_watch_setting(
+            "__main__ test_func --sample 10 --rate 5 -n 20"
+        )
+        self.assertEqual(10, params.sampler.sample_every)
+        self.assertEqual(5, params.sampler.rate)
+        self.assertEqual(20, params.call_limit)
+
+        params = parser.parse_watch_setting("__main__ A func --slowest 3 --window 10")
+        self.assertEqual("A", params.class_name)
+        self.assertEqual(3, params.sampler.slowest)
+        self.assertEqual(10, params.sampler.window_s)
+        with self.assertRaises(Exception):
+            parser.parse_watch_setting("__main__ test_func --rate 0")
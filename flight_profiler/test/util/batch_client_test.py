@@ -0,0 +1,74 @@
+import io
+import os
+import socket
+import sys
+import threading
+import unittest
+
+from flight_profiler.batch_client import (
+    ThreadOutput,
+    descendant_pids,
+    is_python_process,
+)
+from flight_profiler.client import find_port_available
+
+# gunicorn master 100 with two workers, one of them forked a helper
+PS_OUTPUT = """
+    1     0
+  100     1
+  101   100
+  102   100
+  103   102
+  200     1
+"""
+
+
+class BatchClientTest(unittest.TestCase):
+
+    def test_descendant_pids(self):
+        self.assertEqual([101, 102, 103], descendant_pids([100], PS_OUTPUT))
+        self.assertEqual([103], descendant_pids([102], PS_OUTPUT))
+        self.assertEqual([], descendant_pids([200], PS_OUTPUT))
+        # a root below another root is not its own descendant
+        self.assertEqual([101, 103], descendant_pids([100, 102], PS_OUTPUT))
+        self.assertEqual(
+            [os.getpid()], descendant_pids([os.getppid()], f"{os.getpid()} {os.getppid()}")
+        )
+
+    @unittest.skipIf(not sys.platform.startswith("linux"), "reads /proc maps")
+    def test_is_python_process(self):
+        self.assertTrue(is_python_process(os.getpid()))
+        self.assertFalse(is_python_process(1 << 30))
+
+    def test_find_port_available(self):
+        with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+            s.bind(("127.0.0.1", 0))
+            port = s.getsockname()[1]
+            self.assertEqual(-1, find_port_available(port, port))
+        self.assertEqual(port, find_port_available(port, port))
+        self.assertEqual(-1, find_port_available(port, port, {port}))
+
+    def test_thread_output(self):
+        stream = io.StringIO()
+        output = ThreadOutput(stream)
+        results = {}
+
+        def worker(name):
+            output.local.buffer = io.StringIO()
+            for i in range(100):
+                output.write(f"{name} {i}\n")
+            results[name] = output.local.buffer.getvalue()
+
+        threads = [threading.Thread(target=worker, args=(n,)) for n in ("a", "b")]
+        for t in threads:
+            t.start()
+        output.write("main\n")
+        for t in threads:
+            t.join()
+        self.assertEqual("main\n", stream.getvalue())
+        self.assertEqual("".join(f"a {i}\n" for i in range(100)), results["a"])
+        self.assertEqual("".join(f"b {i}\n" for i in range(100)), results["b"])
+
+
+if __name__ == "__main__":
+    unittest.main()
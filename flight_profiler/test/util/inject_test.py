@@ -0,0 +1,118 @@
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import tempfile
+import unittest
+from subprocess import PIPE, Popen
+
+INJECT_SRC_DIR = os.path.join(
+    os.path.dirname(os.path.abspath(__file__)), "../../../csrc/inject"
+)
+
+# exit code of inject when PTRACE_ATTACH is refused
+ATTACH_FAILED = 1
+
+SLEEPING_TARGET = """
+import time
+print("target started", flush=True)
+while True:
+    time.sleep(0.001)
+    print("alive", flush=True)
+"""
+
+# busy in python code with a profiling timer firing while it is stopped
+BUSY_TARGET = """
+import signal, time
+ticks = [0]
+signal.signal(signal.SIGPROF, lambda s, f: ticks.__setitem__(0, ticks[0] + 1))
+signal.setitimer(signal.ITIMER_PROF, 0.0005, 0.0005)
+print("target started", flush=True)
+last = time.time()
+while True:
+    if time.time() - last > 0.01:
+        print("alive", ticks[0], flush=True)
+        last = time.time()
+"""
+
+
+@unittest.skipIf(
+    not sys.platform.startswith("linux")
+    or platform.machine() not in ("x86_64", "aarch64")
+    or shutil.which("g++") is None
+    or not os.path.isdir(INJECT_SRC_DIR),
+    "ptrace injection is built from source for x86_64 and aarch64 linux",
+)
+class InjectTest(unittest.TestCase):
+    """
+    injects a library whose constructor does nothing through the injector
+    built from source, natively on x86_64 and arm64 runners
+    """
+
+    @classmethod
+    def setUpClass(cls):
+        cls.build_dir = tempfile.mkdtemp()
+        sources = [
+            os.path.join(INJECT_SRC_DIR, name)
+            for name in (
+                "ProcessTracer.cpp",
+                "ProcessUtils.cpp",
+                "LibraryInjector.cpp",
+                "inject.cpp",
+            )
+        ]
+        cls.inject_path = os.path.join(cls.build_dir, "inject")
+        subprocess.run(
+            ["g++", "-std=c++11", "-I" + INJECT_SRC_DIR, "-o", cls.inject_path]
+            + sources
+            + ["-ldl"],
+            check=True,
+        )
+        # inject loads the agent next to itself
+        cls.library_path = os.path.join(cls.build_dir, "flight_profiler_agent.so")
+        library_source = os.path.join(cls.build_dir, "agent.c")
+        with open(library_source, "w") as f:
+            f.write("__attribute__((constructor)) static void loaded(void) {}\n")
+        subprocess.run(
+            ["g++", "-x", "c", "-shared", "-fPIC", "-o", cls.library_path, library_source],
+            check=True,
+        )
+
+    @classmethod
+    def tearDownClass(cls):
+        shutil.rmtree(cls.build_dir)
+
+    def inject(self, script: str):
+        target = Popen([sys.executable, "-c", script], stdout=PIPE, text=True)
+        try:
+            self.assertEqual("target started", target.stdout.readline().strip())
+            result = subprocess.run(
+                [self.inject_path, str(target.pid), "--debug"],
+                capture_output=True,
+                text=True,
+                timeout=10,
+            )
+            if result.returncode == ATTACH_FAILED:
+                self.skipTest("ptrace attach is not permitted")
+            self.assertEqual(0, result.returncode, result.stdout + result.stderr)
+            self.assertIn("target stopped for", result.stdout)
+            with open(f"/proc/{target.pid}/maps") as f:
+                self.assertIn(self.library_path, f.read())
+            # the target keeps running after the injection
+            for _ in range(3):
+                self.assertTrue(target.stdout.readline().startswith("alive"))
+            self.assertIsNone(target.poll())
+        finally:
+            target.kill()
+            target.wait()
+
+    def test_inject_sleeping_target(self):
+        self.inject(SLEEPING_TARGET)
+
+    def test_inject_busy_target(self):
+        self.inject(BUSY_TARGET)
+
+
+if __name__ == "__main__":
+    unittest.main()
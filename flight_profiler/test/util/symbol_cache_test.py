@@ -0,0 +1,98 @@
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import unittest
+from unittest import mock
+
+from flight_profiler.utils.shell_util import (
+    encode_agent_symbols,
+    resolve_agent_symbol_address,
+    set_agent_symbols,
+)
+from flight_profiler.utils.symbol_cache import (
+    MAGIC,
+    RECORD,
+    SymbolCache,
+    read_build_id,
+)
+
+BUILD_ID = bytes.fromhex("0123456789abcdef0123456789abcdef01234567")
+OTHER_BUILD_ID = bytes.fromhex("fedcba9876543210fedcba9876543210fedcba98")
+
+
+class SymbolCacheTest(unittest.TestCase):
+
+    def setUp(self):
+        self.tmp = tempfile.mkdtemp()
+        self.path = os.path.join(self.tmp, "cache", "symbols.bin")
+
+    def tearDown(self):
+        shutil.rmtree(self.tmp)
+
+    def test_store_and_lookup(self):
+        writer = SymbolCache(self.path)
+        self.assertIsNone(writer.lookup(BUILD_ID, "take_gil"))
+        writer.store(BUILD_ID, "take_gil", 0x2AE9F0)
+        # missing symbols are cached as 0
+        writer.store(BUILD_ID, "_PyEval_StopTheWorld", 0)
+        writer.store(OTHER_BUILD_ID, "take_gil", 0x1000)
+        self.assertEqual(len(MAGIC) + 3 * RECORD.size, os.path.getsize(self.path))
+
+        reader = SymbolCache(self.path)
+        self.assertEqual(0x2AE9F0, reader.lookup(BUILD_ID, "take_gil"))
+        self.assertEqual(0, reader.lookup(BUILD_ID, "_PyEval_StopTheWorld"))
+        self.assertEqual(0x1000, reader.lookup(OTHER_BUILD_ID, "take_gil"))
+        self.assertIsNone(reader.lookup(BUILD_ID, "drop_gil"))
+        # records appended by other processes are picked up
+        writer.store(BUILD_ID, "drop_gil", 0x2AE130)
+        self.assertEqual(0x2AE130, reader.lookup(BUILD_ID, "drop_gil"))
+
+    def test_reset(self):
+        with open(os.path.join(self.tmp, "symbols.bin"), "wb") as f:
+            f.write(b"not a symbol cache")
+        cache = SymbolCache(os.path.join(self.tmp, "symbols.bin"))
+        self.assertIsNone(cache.lookup(BUILD_ID, "take_gil"))
+        cache.store(BUILD_ID, "take_gil", 0x10)
+        self.assertEqual(0x10, SymbolCache(cache.path).lookup(BUILD_ID, "take_gil"))
+
+    def test_agent_symbols(self):
+        set_agent_symbols(
+            encode_agent_symbols({"take_gil": 0x2AE9F0, "_PyEval_StopTheWorld": 0})
+        )
+        try:
+            # the agent never touches the cache of the user running it
+            with mock.patch(
+                "flight_profiler.utils.shell_util.symbol_cache",
+                side_effect=AssertionError("cache used by the agent"),
+            ):
+                self.assertEqual(0x2AE9F0, resolve_agent_symbol_address("take_gil"))
+                self.assertIsNone(resolve_agent_symbol_address("_PyEval_StopTheWorld"))
+                if sys.platform.startswith("linux"):
+                    self.assertIsNone(resolve_agent_symbol_address("no_such_symbol"))
+            # a malformed list is ignored
+            set_agent_symbols("take_gil=zz")
+            self.assertEqual(0x2AE9F0, resolve_agent_symbol_address("take_gil"))
+        finally:
+            set_agent_symbols("")
+
+    @unittest.skipIf(
+        not sys.platform.startswith("linux") or shutil.which("readelf") is None,
+        "readelf is not installed",
+    )
+    def test_read_build_id(self):
+        path = os.path.realpath(sys.executable)
+        output = subprocess.run(
+            ["readelf", "-n", path], capture_output=True, text=True
+        ).stdout
+        expected = None
+        for line in output.splitlines():
+            if "Build ID:" in line:
+                expected = bytes.fromhex(line.split("Build ID:")[1].strip())
+        self.assertEqual(expected, read_build_id(path))
+        self.assertIsNone(read_build_id(__file__))
+
+
+if __name__ == "__main__":
+    unittest.main()
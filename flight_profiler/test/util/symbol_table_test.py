@@ -0,0 +1,95 @@
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import unittest
+
+try:
+    import flight_profiler.ext.symbol_table_C as symbol_table_C
+except ImportError:
+    symbol_table_C = None
+
+
+def nm_symbols(path):
+    """
+    first address nm prints for every defined symbol
+    """
+    output = subprocess.run(["nm", path], capture_output=True, text=True).stdout
+    symbols = {}
+    for line in output.splitlines():
+        parts = line.split()
+        if len(parts) == 3 and parts[1] not in "Uw" and int(parts[0], 16) != 0:
+            symbols.setdefault(parts[2], int(parts[0], 16))
+    return symbols
+
+
+@unittest.skipIf(
+    symbol_table_C is None or not sys.platform.startswith("linux"),
+    "elf symbol reader is only built for linux",
+)
+class SymbolTableTest(unittest.TestCase):
+
+    @unittest.skipIf(shutil.which("nm") is None, "nm is not installed")
+    def test_same_as_nm(self):
+        path = symbol_table_C.__file__
+        expected = nm_symbols(path)
+        self.assertIn("PyInit_symbol_table_C", expected)
+        self.assertEqual(len(expected), symbol_table_C.symbol_count(path))
+        for name, address in expected.items():
+            self.assertEqual(address, symbol_table_C.lookup_symbol(path, name), name)
+
+    @unittest.skipIf(
+        shutil.which("cc") is None or shutil.which("nm") is None,
+        "cc or nm is not installed",
+    )
+    def test_clone_suffix(self):
+        # the split off .cold piece is defined first so it would be indexed
+        # before the lto clone
+        source = (
+            'void a(void) __asm__("take_gil.cold");\n'
+            "void a(void) {}\n"
+            'void b(void) __asm__("take_gil.lto_priv.0");\n'
+            "void b(void) {}\n"
+            'void c(void) __asm__("drop_gil.part.0");\n'
+            "void c(void) {}\n"
+            'void d(void) __asm__("drop_gil.cold");\n'
+            "void d(void) {}\n"
+            'void e(void) __asm__("eval.isra.0.constprop.1");\n'
+            "void e(void) {}\n"
+        )
+        with tempfile.TemporaryDirectory() as tmp:
+            with open(os.path.join(tmp, "clones.c"), "w") as f:
+                f.write(source)
+            path = os.path.join(tmp, "libclones.so")
+            subprocess.run(
+                ["cc", "-shared", "-fPIC", "-o", path, f.name], check=True
+            )
+            expected = nm_symbols(path)
+            self.assertEqual(
+                expected["take_gil.lto_priv.0"],
+                symbol_table_C.lookup_symbol(path, "take_gil"),
+            )
+            self.assertIsNone(symbol_table_C.lookup_symbol(path, "drop_gil"))
+            self.assertEqual(
+                expected["eval.isra.0.constprop.1"],
+                symbol_table_C.lookup_symbol(path, "eval"),
+            )
+            self.assertEqual(
+                expected["take_gil.cold"],
+                symbol_table_C.lookup_symbol(path, "take_gil.cold"),
+            )
+
+    def test_not_found(self):
+        path = symbol_table_C.__file__
+        self.assertIsNone(symbol_table_C.lookup_symbol(path, "no_such_symbol"))
+        with tempfile.NamedTemporaryFile() as f:
+            f.write(b"not an elf file")
+            f.flush()
+            self.assertEqual(-1, symbol_table_C.symbol_count(f.name))
+            self.assertIsNone(symbol_table_C.lookup_symbol(f.name, "main"))
+        self.assertEqual(-1, symbol_table_C.symbol_count("/no/such/file"))
+
+
+if __name__ == "__main__":
+    unittest.main()
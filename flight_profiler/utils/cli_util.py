@@ -1,3 +1,4 @@
+import os
 import pickle
 import sys
 from typing import Union
@@ -33,6 +34,22 @@ def show_normal_info(msg: str) -> None:
     """
     print(f"{COLOR_WHITE_255}{msg}{COLOR_END}")
 
+def is_process_alive(pid: Union[int, str]) -> bool:
+    """
+    Check whether the process still exists.
+
+    Args:
+        pid (Union[int, str]): Process id
+    """
+    try:
+        os.kill(int(pid), 0)
+    except PermissionError:
+        return True
+    except (OSError, ValueError, TypeError):
+        return False
+    return True
+
+
 def verify_exit_code(exit_code: int, pid: Union[int, str]) -> None:
     """
     Verify the exit code and display appropriate error messages.
@@ -1,7 +1,19 @@
 import os
 import subprocess
+import sys
 from subprocess import CalledProcessError
-from typing import List, Optional, Union
+from typing import Dict, List, Optional, Union
+
+from flight_profiler.utils.symbol_cache import read_build_id, symbol_cache
+
+try:
+    from flight_profiler.ext.symbol_table_C import lookup_symbol, symbol_count
+except ImportError:
+    lookup_symbol = symbol_count = None
+
+
+# link time addresses the client resolved for the agent, 0 for not found
+agent_symbols: Dict[str, int] = {}
 
 
 def execute_process(cmds: List[str]):
@@ -79,9 +91,117 @@ def complete_full_path(filepath: str, default_suffix: str) -> str:
         else:
             return f"{cwd_path}/{default_suffix}"
 
+def indexed_bin_path(pid: int) -> Optional[str]:
+    """
+    Path of the process binary when the native ELF reader can index it.
+
+    Args:
+        pid (int): Process ID
+
+    Returns:
+        Optional[str]: /proc/<pid>/exe, or None when nm has to be used
+    """
+    if symbol_count is None or not sys.platform.startswith("linux"):
+        return None
+    # the link resolves to the running binary even if it was replaced on disk
+    bin_path = f"/proc/{pid}/exe"
+    return bin_path if symbol_count(bin_path) > 0 else None
+
+
+def process_build_id(pid: int) -> Optional[bytes]:
+    """
+    GNU build-id of the process binary, None when it has none or on macOS.
+
+    Args:
+        pid (int): Process ID
+
+    Returns:
+        Optional[bytes]: build-id bytes
+    """
+    if not sys.platform.startswith("linux"):
+        return None
+    return read_build_id(f"/proc/{pid}/exe")
+
+
 def resolve_symbol_address(symbol: str, pid: int) -> Optional[int]:
     """
-    Resolve symbol address for the given symbol and process ID.
+    Resolve symbol address for the given symbol and process ID. Addresses
+    are cached on disk by the build-id of the process binary, so processes
+    running the same interpreter build resolve every symbol once.
+
+    Args:
+        symbol (str): Symbol to resolve
+        pid (int): Process ID
+
+    Returns:
+        Optional[int]: Symbol address as printed by nm or None if not found
+    """
+    build_id = process_build_id(pid)
+    if build_id is not None:
+        cached = symbol_cache().lookup(build_id, symbol)
+        if cached is not None:
+            return cached or None
+    bin_path = indexed_bin_path(pid)
+    if bin_path is not None:
+        address = lookup_symbol(bin_path, symbol)
+        # the index is complete, so a missing symbol is cached as well
+        if build_id is not None:
+            symbol_cache().store(build_id, symbol, address or 0)
+        return address
+    address = resolve_symbol_address_by_nm(symbol, pid)
+    if build_id is not None and address is not None:
+        symbol_cache().store(build_id, symbol, address)
+    return address
+
+
+def encode_agent_symbols(addresses: Dict[str, int]) -> str:
+    """
+    addresses as name=hex;... to hand over with the inject params
+    """
+    return ";".join(f"{name}={address:x}" for name, address in addresses.items())
+
+
+def set_agent_symbols(encoded: str) -> None:
+    """
+    keep the addresses encoded by encode_agent_symbols, a malformed list is
+    ignored and the agent resolves every symbol itself
+    """
+    try:
+        addresses = {}
+        for item in filter(None, encoded.split(";")):
+            name, address = item.split("=")
+            addresses[name] = int(address, 16)
+    except ValueError:
+        return
+    agent_symbols.clear()
+    agent_symbols.update(addresses)
+
+
+def resolve_agent_symbol_address(symbol: str) -> Optional[int]:
+    """
+    Resolve symbol address inside the agent. The client hands over the
+    addresses it resolved, others are resolved without the on-disk cache,
+    which belongs to the user running the client and not to the target.
+
+    Args:
+        symbol (str): Symbol to resolve
+
+    Returns:
+        Optional[int]: Symbol address as printed by nm or None if not found
+    """
+    if symbol in agent_symbols:
+        return agent_symbols[symbol] or None
+    pid = os.getpid()
+    bin_path = indexed_bin_path(pid)
+    if bin_path is not None:
+        return lookup_symbol(bin_path, symbol)
+    return resolve_symbol_address_by_nm(symbol, pid)
+
+
+def resolve_symbol_address_by_nm(symbol: str, pid: int) -> Optional[int]:
+    """
+    Resolve symbol address by nm over the process binary, for binaries the
+    ELF reader can not index, e.g. on macOS.
 
     Args:
         symbol (str): Symbol to resolve
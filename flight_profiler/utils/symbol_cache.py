@@ -0,0 +1,186 @@
+"""
+On-disk cache of symbol addresses keyed by the GNU build-id of the binary, so
+that processes running the same interpreter build skip symbol resolution.
+
+The file holds fixed size records after a magic header. It is mmap-ed and
+scanned without parsing, and new records are appended with one write, so
+concurrent attaches never corrupt it.
+"""
+import mmap
+import os
+import struct
+from typing import Dict, Optional, Tuple
+
+MAGIC = b"FPSYM001"
+# build-id length, build-id, symbol name, nm address with 0 for not found
+RECORD = struct.Struct("=B32s63sQ")
+# the file is reset when it grows beyond this
+MAX_RECORDS = 4096
+
+PT_NOTE = 4
+NT_GNU_BUILD_ID = 3
+
+
+def default_cache_path() -> str:
+    cache_home = os.environ.get("XDG_CACHE_HOME") or os.path.join(
+        os.path.expanduser("~"), ".cache"
+    )
+    return os.path.join(cache_home, "pyFlightProfiler", "symbols.bin")
+
+
+def read_build_id(path: str) -> Optional[bytes]:
+    """
+    GNU build-id note of an ELF file, found through its program headers
+    without reading the rest of the file. None when there is none
+    """
+    try:
+        with open(path, "rb") as f:
+            ident = f.read(16)
+            if len(ident) < 16 or ident[:4] != b"\x7fELF":
+                return None
+            is_64 = ident[4] == 2
+            endian = "<" if ident[5] == 1 else ">"
+            if is_64:
+                header = struct.Struct(endian + "HHIQQQIHHHHHH")
+                phdr = struct.Struct(endian + "IIQQQQQQ")
+            else:
+                header = struct.Struct(endian + "HHIIIIIHHHHHH")
+                phdr = struct.Struct(endian + "IIIIIIII")
+            fields = header.unpack(f.read(header.size))
+            phoff, phentsize, phnum = fields[4], fields[8], fields[9]
+            if phentsize < phdr.size:
+                return None
+            f.seek(phoff)
+            table = f.read(phentsize * phnum)
+            for i in range(phnum):
+                entry = phdr.unpack_from(table, i * phentsize)
+                if entry[0] != PT_NOTE:
+                    continue
+                # p_offset and p_filesz
+                offset, size = (entry[2], entry[5]) if is_64 else (entry[1], entry[4])
+                f.seek(offset)
+                build_id = find_build_id(f.read(size), endian)
+                if build_id is not None:
+                    return build_id
+    except (OSError, struct.error):
+        return None
+    return None
+
+
+def find_build_id(notes: bytes, endian: str) -> Optional[bytes]:
+    note = struct.Struct(endian + "III")
+    pos = 0
+    while pos + note.size <= len(notes):
+        name_size, desc_size, note_type = note.unpack_from(notes, pos)
+        name_pos = pos + note.size
+        desc_pos = name_pos + (name_size + 3) // 4 * 4
+        if note_type == NT_GNU_BUILD_ID and notes[name_pos : name_pos + name_size] == b"GNU\0":
+            return notes[desc_pos : desc_pos + desc_size]
+        pos = desc_pos + (desc_size + 3) // 4 * 4
+    return None
+
+
+class SymbolCache:
+
+    def __init__(self, path: Optional[str] = None):
+        self.path = path or default_cache_path()
+        self.records: Dict[Tuple[bytes, str], int] = {}
+        # inode and bytes of the file already loaded into records
+        self.loaded_inode = 0
+        self.loaded_size = 0
+        self.valid = True
+
+    def load(self) -> None:
+        """
+        read records appended since the last load, other processes may have
+        added some
+        """
+        try:
+            st = os.stat(self.path)
+        except OSError:
+            return
+        size = st.st_size
+        if st.st_ino != self.loaded_inode:
+            # replaced by the reset of another process
+            self.records.clear()
+            self.loaded_inode = st.st_ino
+            self.loaded_size = 0
+        if size == self.loaded_size:
+            return
+        with open(self.path, "rb") as f, mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ) as m:
+            if m[: len(MAGIC)] != MAGIC:
+                self.valid = False
+                return
+            self.valid = True
+            start = max(self.loaded_size, len(MAGIC))
+            # a record being appended right now is left for the next load
+            count = (size - start) // RECORD.size
+            for length, build_id, name, address in RECORD.iter_unpack(
+                m[start : start + count * RECORD.size]
+            ):
+                key = (build_id[:length], name.rstrip(b"\0").decode("utf-8", "replace"))
+                self.records[key] = address
+            self.loaded_size = start + count * RECORD.size
+
+    def lookup(self, build_id: bytes, name: str) -> Optional[int]:
+        """
+        cached address, 0 when the symbol is known to be missing, None when
+        it is not cached
+        """
+        key = (build_id, name)
+        if key not in self.records:
+            self.load()
+        return self.records.get(key)
+
+    def store(self, build_id: bytes, name: str, address: int) -> None:
+        encoded = name.encode("utf-8")
+        if len(build_id) > 32 or len(encoded) > 63:
+            return
+        self.records[(build_id, name)] = address
+        record = RECORD.pack(len(build_id), build_id, encoded, address)
+        try:
+            os.makedirs(os.path.dirname(self.path), exist_ok=True)
+            if not self.valid or len(self.records) > MAX_RECORDS:
+                self.reset(build_id)
+                return
+            try:
+                fd = os.open(self.path, os.O_WRONLY | os.O_CREAT | os.O_EXCL, 0o644)
+                os.write(fd, MAGIC)
+                os.close(fd)
+            except FileExistsError:
+                pass
+            fd = os.open(self.path, os.O_WRONLY | os.O_APPEND)
+            try:
+                os.write(fd, record)
+            finally:
+                os.close(fd)
+        except OSError:
+            # the cache is best effort, e.g. read only home directories
+            pass
+
+    def reset(self, build_id: bytes) -> None:
+        """
+        rewrite the file with the records of build_id only
+        """
+        kept = {k: v for k, v in self.records.items() if k[0] == build_id}
+        data = MAGIC + b"".join(
+            RECORD.pack(len(b), b, n.encode("utf-8"), a) for (b, n), a in kept.items()
+        )
+        tmp_path = f"{self.path}.{os.getpid()}"
+        with open(tmp_path, "wb") as f:
+            f.write(data)
+        os.replace(tmp_path, self.path)
+        self.records = kept
+        self.loaded_inode = os.stat(self.path).st_ino
+        self.loaded_size = len(data)
+        self.valid = True
+
+
+_symbol_cache: Optional[SymbolCache] = None
+
+
+def symbol_cache() -> SymbolCache:
+    global _symbol_cache
+    if _symbol_cache is None:
+        _symbol_cache = SymbolCache()
+    return _symbol_cache